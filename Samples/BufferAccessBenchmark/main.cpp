@@ -0,0 +1,312 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <array>
+#include <map>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "Core/Buffer.h"
+#include "Core/PipelineBarriers.h"
+
+// Compares PipelineBarriers' interval based buffer access tracking against the map based tracker it replaced, which keyed every access by the
+// buffer, offset and range and walked the following entries of the buffer to find overlaps.  Each recording makes a number of accesses to
+// sub-ranges of one large buffer, following one of the patterns below, and the trackers are cleared between recordings as command buffers are.
+
+using namespace vez;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const VkDeviceSize s_bufferSize = 64 * 1024 * 1024;
+static const uint32_t s_recordingCount = 20;
+
+struct Access
+{
+    VkDeviceSize offset;
+    VkDeviceSize range;
+    VkAccessFlags accessMask;
+};
+
+// Map based tracker, as PipelineBarriers::BufferAccess was implemented before buffer accesses were tracked as intervals.
+class MapBufferTracker
+{
+public:
+    typedef std::array<uint64_t, 3> BufferAccessKey;
+
+    void BufferAccess(uint64_t streamPos, Buffer* pBuffer, VkDeviceSize offset, VkDeviceSize range, VkAccessFlags accessMask, VkPipelineStageFlags stageMask)
+    {
+        // Insert new entry into buffer accesses map.
+        PipelineBarriers::BufferAccessInfo bufferAccessInfo = {};
+        bufferAccessInfo.streamPos = streamPos;
+        bufferAccessInfo.accessMask = accessMask;
+        bufferAccessInfo.stageMask = stageMask;
+        bufferAccessInfo.offset = offset;
+        bufferAccessInfo.range = range;
+
+        auto insertKey = BufferAccessKey{ reinterpret_cast<uint64_t>(pBuffer), offset, range };
+        auto result = m_bufferAccesses.emplace(insertKey, bufferAccessInfo);
+
+        // If entry successfully inserted (i.e. key did not exist) then combine with previous entries.
+        if (std::get<1>(result) == true)
+        {
+            // Iterate over previous and proceeding entries that overlap new access.
+            // The original decremented past the first entry of the map, which is guarded against here.
+            auto finalKey = insertKey;
+            auto iter = std::get<0>(result);
+            if (iter != m_bufferAccesses.begin())
+                --iter;
+
+            bool combinedEntries = false;
+            bool insertPipelineBarrier = false;
+            VkAccessFlags oldAccessMask = 0;
+            VkPipelineStageFlags oldStageMask = 0;
+            while (iter != m_bufferAccesses.end() && iter->first[0] == insertKey[0])
+            {
+                // Skip entry that was just inserted.
+                if (iter->first == insertKey)
+                {
+                    ++iter;
+                    continue;
+                }
+
+                // Check to see if previous access overlaps with new access.
+                auto min = std::min(finalKey[1], iter->first[1]);
+                auto max = std::max(finalKey[1] + finalKey[2], iter->first[1] + iter->first[2]);
+                if (max - min < finalKey[2] + iter->first[2])
+                {
+                    // Check to see if new access requires a pipeline barrier.
+                    if (RequiresPipelineBarrier(iter->second.accessMask, accessMask))
+                    {
+                        // Set flags, merge accesses and delete old access entry.
+                        insertPipelineBarrier = true;
+                        oldAccessMask |= iter->second.accessMask;
+                        oldStageMask |= iter->second.stageMask;
+                        iter = m_bufferAccesses.erase(iter);
+                    }
+                    else
+                    {
+                        // Combine old entry with new entry.
+                        auto newOffset = std::min(finalKey[1], iter->first[1]);
+                        auto newSize = std::max(finalKey[1] + finalKey[2], iter->first[1] + iter->first[2]) - newOffset;
+                        finalKey[1] = newOffset;
+                        finalKey[2] = newSize;
+                        accessMask |= iter->second.accessMask;
+                        stageMask |= iter->second.stageMask;
+                        iter = m_bufferAccesses.erase(iter);
+                        combinedEntries = true;
+                    }
+                }
+                // Else move to next entry.
+                else
+                {
+                    ++iter;
+                }
+            }
+
+            // If entries were combined with new one, remove new entry and reinsert it with new key.
+            if (combinedEntries)
+            {
+                m_bufferAccesses.erase(insertKey);
+
+                bufferAccessInfo.accessMask = accessMask;
+                bufferAccessInfo.stageMask = stageMask;
+                m_bufferAccesses.emplace(finalKey, bufferAccessInfo);
+            }
+
+            // Add pipeline barrier if required.
+            if (insertPipelineBarrier)
+            {
+                AddBarrier(streamPos, pBuffer, offset, range, oldAccessMask, oldStageMask, accessMask, stageMask);
+
+                // Update buffer access entry.
+                auto& finalAccessInfo = m_bufferAccesses.at(finalKey);
+                finalAccessInfo.streamPos = streamPos;
+                finalAccessInfo.accessMask = accessMask;
+                finalAccessInfo.stageMask = stageMask;
+            }
+        }
+        // A previous access entry exist with the same offset and range.  Check to see if a pipeline barrier is required.
+        else if (RequiresPipelineBarrier(std::get<0>(result)->second.accessMask, accessMask))
+        {
+            auto& prevEntry = std::get<0>(result)->second;
+            AddBarrier(streamPos, pBuffer, offset, range, prevEntry.accessMask, static_cast<VkPipelineStageFlags>(prevEntry.stageMask), accessMask, stageMask);
+
+            // Update buffer access entry.
+            m_bufferAccesses.erase(std::get<0>(result));
+            m_bufferAccesses.emplace(insertKey, bufferAccessInfo);
+        }
+    }
+
+    size_t GetAccessCount() const { return m_bufferAccesses.size(); }
+
+    size_t GetBarrierCount() const { return m_barriers.size(); }
+
+    void Clear()
+    {
+        m_bufferAccesses.clear();
+        m_barriers.clear();
+    }
+
+private:
+    // Returns true if a resource is transitioning from a write to anything, or between reads and writes.
+    static bool RequiresPipelineBarrier(VkAccessFlags oldAccessMask, VkAccessFlags newAccessMask)
+    {
+        const VkAccessFlags allReadAccesses = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+            | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+            | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_HOST_READ_BIT | VK_ACCESS_MEMORY_READ_BIT;
+
+        const VkAccessFlags allWriteAccesses = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+            | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+        bool oldRead = (oldAccessMask & allReadAccesses) != 0, oldWrite = (oldAccessMask & allWriteAccesses) != 0;
+        bool newRead = (newAccessMask & allReadAccesses) != 0, newWrite = (newAccessMask & allWriteAccesses) != 0;
+        return oldWrite || oldRead != newRead || oldWrite != newWrite;
+    }
+
+    void AddBarrier(uint64_t streamPos, Buffer* pBuffer, VkDeviceSize offset, VkDeviceSize range, VkAccessFlags srcAccessMask, VkPipelineStageFlags srcStageMask,
+        VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask)
+    {
+        // Create first barrier entry or merge with previous barrier if access is at same stream position.
+        if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
+            m_barriers.push_back({ streamPos, 0, 0, {}, {} });
+
+        VkBufferMemoryBarrier bufferBarrier = {};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = srcAccessMask;
+        bufferBarrier.dstAccessMask = dstAccessMask;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = pBuffer->GetHandle();
+        bufferBarrier.offset = offset;
+        bufferBarrier.size = range;
+
+        auto& barrier = m_barriers.back();
+        barrier.bufferBarriers.push_back(bufferBarrier);
+        barrier.srcStageMask |= srcStageMask;
+        barrier.dstStageMask |= dstStageMask;
+    }
+
+    std::map<BufferAccessKey, PipelineBarriers::BufferAccessInfo> m_bufferAccesses;
+    std::list<PipelineBarrier> m_barriers;
+};
+
+// Sub-ranges laid end to end with identical read accesses, such as a batch of dispatches each reading the next slice of a buffer.
+static std::vector<Access> CoalescedAccesses(uint32_t accessCount)
+{
+    std::vector<Access> accesses;
+    for (auto i = 0U; i < accessCount; ++i)
+        accesses.push_back({ i * 1024ULL, 1024ULL, VK_ACCESS_SHADER_READ_BIT });
+
+    return accesses;
+}
+
+// Fixed size sub-ranges at a constant stride, written by one pass over the buffer and read by the next, so every access after the first pass
+// requires a barrier.  Each pass is shifted by half a range, so accesses partially overlap two previous ones and split them.
+static std::vector<Access> StridedAccesses(uint32_t accessCount)
+{
+    const uint32_t rangesPerPass = std::max(accessCount / 4, 1U);
+    std::vector<Access> accesses;
+    for (auto i = 0U; i < accessCount; ++i)
+    {
+        auto pass = i / rangesPerPass;
+        accesses.push_back({ (i % rangesPerPass) * 4096ULL + (pass % 2) * 512ULL, 1024ULL, (pass % 2) ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_SHADER_WRITE_BIT });
+    }
+
+    return accesses;
+}
+
+// Sub-ranges of random offsets and sizes, a quarter of them written, so accesses are disjoint, identical, contained within or partially
+// overlapping previous ones.  The ranges are packed into a region sized to the access count so overlaps stay frequent.
+static std::vector<Access> RandomAccesses(uint32_t accessCount)
+{
+    std::mt19937_64 random(accessCount);
+    std::uniform_int_distribution<uint32_t> offsets(0, accessCount * 4 - 1);
+    std::uniform_int_distribution<uint32_t> sizes(1, 16);
+    std::uniform_int_distribution<uint32_t> writes(0, 3);
+
+    std::vector<Access> accesses;
+    for (auto i = 0U; i < accessCount; ++i)
+        accesses.push_back({ offsets(random) * 256ULL, sizes(random) * 256ULL, writes(random) == 0 ? VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT });
+
+    return accesses;
+}
+
+// Records the accesses repeatedly, clearing the tracker before each recording, and returns the fastest recording's time in milliseconds.
+template <typename Tracker>
+static double Record(Tracker& tracker, Buffer* pBuffer, const std::vector<Access>& accesses)
+{
+    auto bestTime = 1e30;
+    for (auto recording = 0U; recording < s_recordingCount; ++recording)
+    {
+        tracker.Clear();
+
+        auto startTime = Clock::now();
+        uint64_t streamPos = 0;
+        for (auto& access : accesses)
+            tracker.BufferAccess(++streamPos * 16, pBuffer, access.offset, access.range, access.accessMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        bestTime = std::min(bestTime, std::chrono::duration<double, std::milli>(Clock::now() - startTime).count());
+    }
+
+    return bestTime;
+}
+
+static void Compare(const char* name, Buffer* pBuffer, const std::vector<Access>& accesses)
+{
+    MapBufferTracker mapTracker;
+    auto mapTime = Record(mapTracker, pBuffer, accesses);
+
+    PipelineBarriers intervalTracker;
+    auto intervalTime = Record(intervalTracker, pBuffer, accesses);
+
+    auto accessCount = static_cast<double>(accesses.size());
+    std::cout << std::fixed << std::setprecision(1) << std::setw(10) << name << std::setw(8) << accesses.size()
+        << std::setw(12) << mapTime * 1e6 / accessCount << std::setw(8) << mapTracker.GetAccessCount() << std::setw(10) << mapTracker.GetBarrierCount()
+        << std::setw(12) << intervalTime * 1e6 / accessCount << std::setw(8) << intervalTracker.GetBufferAccesses()[pBuffer].size() << std::setw(10) << intervalTracker.GetBarriers().size()
+        << std::setw(9) << std::setprecision(2) << mapTime / intervalTime << "x\n";
+}
+
+int main(int argc, char** argv)
+{
+    // Buffers are only used as keys and for their handles, so no device is required.
+    VezBufferCreateInfo createInfo = {};
+    createInfo.size = s_bufferSize;
+    createInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    auto buffer = Buffer::CreateFromHandle(nullptr, &createInfo, VK_NULL_HANDLE, VK_NULL_HANDLE);
+
+    std::cout << "Best of " << s_recordingCount << " recordings, ns per access, tracked intervals and barriers at the end of a recording.\n";
+    std::cout << std::setw(10) << "Pattern" << std::setw(8) << "Count" << std::setw(12) << "Map ns" << std::setw(8) << "Ranges" << std::setw(10) << "Barriers"
+        << std::setw(12) << "Interval ns" << std::setw(8) << "Ranges" << std::setw(10) << "Barriers" << std::setw(10) << "Speedup\n";
+
+    for (auto accessCount : { 256U, 1024U, 4096U, 16384U })
+    {
+        Compare("Coalesced", buffer, CoalescedAccesses(accessCount));
+        Compare("Strided", buffer, StridedAccesses(accessCount));
+        Compare("Random", buffer, RandomAccesses(accessCount));
+    }
+
+    delete buffer;
+    return 0;
+}
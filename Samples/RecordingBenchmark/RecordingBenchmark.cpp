@@ -0,0 +1,190 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <VEZ_ext.h>
+#include "RecordingBenchmark.h"
+
+#define FATAL(msg) { std::cout << msg << "\n"; AppBase::Exit(); return; }
+
+typedef std::chrono::high_resolution_clock Clock;
+
+RecordingBenchmark::RecordingBenchmark(bool pushDescriptors, uint32_t maxThreadCount)
+    : AppBase("RecordingBenchmark Sample", 800, 600, 0, false, pushDescriptors ? std::vector<std::string>{ VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME } : std::vector<std::string>{})
+    , m_pushDescriptors(pushDescriptors)
+    , m_maxThreadCount(maxThreadCount)
+{
+
+}
+
+void RecordingBenchmark::Initialize()
+{
+    vezGetDeviceGraphicsQueue(AppBase::GetDevice(), 0, &m_graphicsQueue);
+    CreateStorageBuffer();
+    CreatePipeline();
+
+    std::cout << "Recording " << m_recordingCount << " command buffers of " << m_dispatchCount << " dispatches each per thread, "
+        << (m_pushDescriptors ? "pushing" : "binding descriptor sets for") << " storage buffer ranges of up to " << m_rangeSize << " bytes.\n";
+
+    // Record on 1, 2, 4 and more threads at once, up to the maximum thread count, each binding ranges of its own so their descriptor sets
+    // are allocated concurrently.  Recordings are numbered across all runs, so each run continues cycling through range sizes where the last one stopped.
+    uint32_t firstRecording = 0;
+    for (auto threadCount = 1U; ; threadCount = std::min(threadCount * 2, m_maxThreadCount))
+    {
+        std::vector<RecordingTimes> times(threadCount);
+        std::atomic<bool> start(false);
+        std::vector<std::thread> threads;
+        for (auto i = 0U; i < threadCount; ++i)
+        {
+            threads.emplace_back([this, i, firstRecording, &start, &times]() {
+                while (!start)
+                    std::this_thread::yield();
+
+                times[i] = RecordCommandBuffers(i, firstRecording);
+            });
+        }
+
+        auto startTime = Clock::now();
+        start = true;
+        for (auto& thread : threads)
+            thread.join();
+
+        PrintTimes(times, std::chrono::duration<double, std::milli>(Clock::now() - startTime).count());
+
+        firstRecording += m_recordingCount;
+        if (threadCount == m_maxThreadCount)
+            break;
+    }
+
+    VezStreamBlockPoolStatistics statistics = {};
+    vezGetStreamBlockPoolStatistics(AppBase::GetDevice(), &statistics);
+    std::cout << "Stream blocks: " << statistics.allocatedBlockCount << " allocated, " << statistics.highWaterInUseBytes << " bytes in use at most, "
+        << statistics.heapAllocationCount << " heap allocations.\n";
+
+    // Nothing is rendered, so the sample exits once the timings are printed.
+    AppBase::Quit();
+}
+
+void RecordingBenchmark::Cleanup()
+{
+    auto device = AppBase::GetDevice();
+
+    vezDestroyBuffer(device, m_storageBuffer);
+
+    vezDestroyPipeline(device, m_computePipeline.pipeline);
+    for (auto shaderModule : m_computePipeline.shaderModules)
+        vezDestroyShaderModule(device, shaderModule);
+}
+
+void RecordingBenchmark::CreateStorageBuffer()
+{
+    // Each dispatch of each thread binds a range of its own, aligned to the device's storage buffer offset alignment.
+    VkPhysicalDeviceProperties properties = {};
+    vkGetPhysicalDeviceProperties(AppBase::GetPhysicalDevice(), &properties);
+    m_rangeSize = std::max(static_cast<VkDeviceSize>(256), properties.limits.minStorageBufferOffsetAlignment);
+
+    VezBufferCreateInfo createInfo = {};
+    createInfo.size = m_rangeSize * m_dispatchCount * m_maxThreadCount;
+    createInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    if (vezCreateBuffer(AppBase::GetDevice(), VEZ_MEMORY_GPU_ONLY, &createInfo, &m_storageBuffer) != VK_SUCCESS)
+        FATAL("vkCreateBuffer failed for storage buffer");
+}
+
+void RecordingBenchmark::CreatePipeline()
+{
+    // The SimpleCompute sample's shader rotates the vertices of the bound storage buffer range.
+    if (!AppBase::CreatePipeline(
+    { { "../../Samples/Data/Shaders/SimpleCompute/SimpleCompute.comp", VK_SHADER_STAGE_COMPUTE_BIT } },
+        &m_computePipeline.pipeline, &m_computePipeline.shaderModules))
+    {
+        AppBase::Quit();
+    }
+}
+
+RecordingTimes RecordingBenchmark::RecordCommandBuffers(uint32_t threadIndex, uint32_t firstRecording)
+{
+    // Command buffers are allocated on the thread recording them.
+    VezCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.queue = m_graphicsQueue;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    if (vezAllocateCommandBuffers(AppBase::GetDevice(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+        return RecordingTimes();
+
+    struct
+    {
+        int vertexCount;
+        float theta;
+    } pushConstants;
+
+    pushConstants.theta = 0.0f;
+
+    RecordingTimes times;
+    for (auto recording = 0U; recording < m_recordingCount; ++recording)
+    {
+        // Shrink the ranges by four bytes for each recording, cycling through more sizes than the descriptor set cache retains recordings of,
+        // so the sets are never found in the cache.  The shader only processes the vertices within the range.
+        auto rangeSize = m_rangeSize - 4 * ((firstRecording + recording) % m_rangeSizeCount);
+        pushConstants.vertexCount = static_cast<int>(rangeSize / (4 * sizeof(float)));
+
+        auto startTime = Clock::now();
+        vezBeginCommandBuffer(commandBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        vezCmdBindPipeline(m_computePipeline.pipeline);
+        vezCmdPushConstants(0, sizeof(pushConstants), reinterpret_cast<const void*>(&pushConstants));
+        for (auto i = 0U; i < m_dispatchCount; ++i)
+        {
+            vezCmdBindBuffer(m_storageBuffer, (threadIndex * m_dispatchCount + i) * m_rangeSize, rangeSize, 0, 0, 0);
+            vezCmdDispatch(1, 1, 1);
+        }
+
+        vezEndCommandBuffer();
+
+        auto elapsedTime = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+        if (recording == 0)
+            times.firstRecording = elapsedTime;
+        else
+            times.averageRecording += elapsedTime / (m_recordingCount - 1);
+    }
+
+    vezFreeCommandBuffers(AppBase::GetDevice(), 1, &commandBuffer);
+    return times;
+}
+
+void RecordingBenchmark::PrintTimes(const std::vector<RecordingTimes>& times, double elapsedTime)
+{
+    // Report the slowest thread's first recording, the average of all threads' later recordings and the number of ranges bound per second.
+    RecordingTimes result;
+    for (auto& threadTimes : times)
+    {
+        result.firstRecording = std::max(result.firstRecording, threadTimes.firstRecording);
+        result.averageRecording += threadTimes.averageRecording / times.size();
+    }
+
+    auto bindsPerSecond = 1000.0 * m_dispatchCount * m_recordingCount * times.size() / elapsedTime;
+    std::cout << std::fixed << std::setprecision(3) << times.size() << (times.size() == 1 ? " thread" : " threads") << ": first recording "
+        << result.firstRecording << " ms, later recordings " << result.averageRecording << " ms on average, " << elapsedTime << " ms in total, "
+        << std::setprecision(0) << bindsPerSecond << " binds per second.\n";
+}
@@ -0,0 +1,69 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "../Common/AppBase.h"
+
+typedef struct PipelineDesc
+{
+    VezPipeline pipeline = VK_NULL_HANDLE;
+    std::vector<VkShaderModule> shaderModules;
+} PipelineDesc;
+
+// Timings of one thread's recordings, in milliseconds.
+typedef struct RecordingTimes
+{
+    double firstRecording = 0.0;
+    double averageRecording = 0.0;
+} RecordingTimes;
+
+// Measures the CPU time spent recording command buffers that bind a different range of a storage buffer for each dispatch, on 1, 2, 4 and
+// more threads at once up to the maximum thread count.  Each recording binds ranges of a different size so that every bind allocates and
+// writes a new descriptor set, rather than finding one written by an earlier recording in the device's descriptor set cache.
+// Each range is pushed instead when the VK_KHR_push_descriptor extension is enabled with --push-descriptors.
+class RecordingBenchmark : public AppBase
+{
+public:
+    RecordingBenchmark(bool pushDescriptors, uint32_t maxThreadCount);
+
+protected:
+    void Initialize() final;
+    void Cleanup() final;
+
+private:
+    void CreateStorageBuffer();
+    void CreatePipeline();
+    RecordingTimes RecordCommandBuffers(uint32_t threadIndex, uint32_t firstRecording);
+    void PrintTimes(const std::vector<RecordingTimes>& times, double elapsedTime);
+
+    bool m_pushDescriptors = false;
+    uint32_t m_maxThreadCount = 1;
+    VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+    VkBuffer m_storageBuffer = VK_NULL_HANDLE;
+    VkDeviceSize m_rangeSize = 0;
+    PipelineDesc m_computePipeline;
+    const uint32_t m_dispatchCount = 4096;
+    const uint32_t m_recordingCount = 100;
+    const uint32_t m_rangeSizeCount = 32;
+};
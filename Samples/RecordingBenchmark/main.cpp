@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include "RecordingBenchmark.h"
+
+int main(int argc, char** argv)
+{
+    // Usage: RecordingBenchmark [--push-descriptors] [--threads <count>]
+    // Recording is repeated on 1, 2, 4 and more threads up to the given count, which defaults to the number of hardware threads.
+    bool pushDescriptors = false;
+    uint32_t threadCount = std::max(1U, std::thread::hardware_concurrency());
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--push-descriptors") == 0)
+            pushDescriptors = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threadCount = static_cast<uint32_t>(std::max(1, atoi(argv[++i])));
+    }
+
+    RecordingBenchmark app(pushDescriptors, threadCount);
+    return app.Run();
+}
@@ -0,0 +1,183 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "Utility/MemoryBlockPool.h"
+#include "Utility/MemoryStream.h"
+#include "Core/CommandPackets.h"
+
+// Compares the cost of encoding and decoding a stream of draws in the field by field format StreamEncoder used to write,
+// where every parameter follows the command's id through MemoryStream::operator<< and is read back with operator>>,
+// against the command packet format, where each command is a single aligned packet read back in place.
+// Both decoders dispatch through a member function pointer table as StreamDecoder does, summing the draw parameters instead of calling vkCmdDraw.
+
+using namespace vez;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const uint32_t s_drawCount = 1000000;
+static const uint32_t s_repetitionCount = 10;
+
+class FieldFormat
+{
+public:
+    FieldFormat()
+    {
+        m_entryPoints.resize(COMMAND_ID_COUNT, &FieldFormat::CmdUnused);
+        m_entryPoints[DRAW] = &FieldFormat::CmdDraw;
+    }
+
+    void CmdDraw(MemoryStream& stream, uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance)
+    {
+        stream << DRAW << vertexCount << instanceCount << firstVertex << firstInstance;
+    }
+
+    uint64_t Decode(MemoryStream& stream)
+    {
+        m_checksum = 0;
+        stream.SeekG(0);
+        while (true)
+        {
+            // Parse and execute the next command in the stream.
+            CommandID cmd;
+            stream >> cmd;
+            if (stream.EndOfStream())
+                break;
+
+            (this->*m_entryPoints[cmd])(stream);
+        }
+
+        return m_checksum;
+    }
+
+private:
+    void CmdUnused(MemoryStream& stream) {}
+
+    void CmdDraw(MemoryStream& stream)
+    {
+        // Decode command parameters.
+        uint32_t vertexCount, instanceCount, firstVertex, firstInstance;
+        stream >> vertexCount >> instanceCount >> firstVertex >> firstInstance;
+        m_checksum += vertexCount + instanceCount + firstVertex + firstInstance;
+    }
+
+    typedef void(FieldFormat::*EntryPoint)(MemoryStream&);
+    std::vector<EntryPoint> m_entryPoints;
+    uint64_t m_checksum = 0;
+};
+
+class PacketFormat
+{
+public:
+    PacketFormat()
+    {
+        m_entryPoints.resize(COMMAND_ID_COUNT, &PacketFormat::CmdUnused);
+        m_entryPoints[DRAW] = &PacketFormat::CmdDraw;
+    }
+
+    void CmdDraw(MemoryStream& stream, uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance)
+    {
+        auto packet = WriteCommandPacket<DrawPacket>(stream, DRAW);
+        packet->vertexCount = vertexCount;
+        packet->instanceCount = instanceCount;
+        packet->firstVertex = firstVertex;
+        packet->firstInstance = firstInstance;
+    }
+
+    uint64_t Decode(MemoryStream& stream)
+    {
+        m_checksum = 0;
+        stream.SeekG(0);
+        while (true)
+        {
+            // Read the next command packet's header in place and exit if the end of the stream has been reached.
+            auto packet = stream.ReadPtr<const CommandPacket>();
+            if (!packet)
+                break;
+
+            // Advance the read position past the remainder of the packet and execute the command.
+            stream.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
+            (this->*m_entryPoints[packet->id])(packet);
+        }
+
+        return m_checksum;
+    }
+
+private:
+    void CmdUnused(const CommandPacket* pPacket) {}
+
+    void CmdDraw(const CommandPacket* pPacket)
+    {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const DrawPacket*>(pPacket);
+        m_checksum += packet->vertexCount + packet->instanceCount + packet->firstVertex + packet->firstInstance;
+    }
+
+    typedef void(PacketFormat::*EntryPoint)(const CommandPacket*);
+    std::vector<EntryPoint> m_entryPoints;
+    uint64_t m_checksum = 0;
+};
+
+// Encodes and decodes the same draws repeatedly into a stream backed by a block pool, as command buffers do, and reports the fastest repetitions.
+template <typename Format>
+void Run(const char* name)
+{
+    MemoryBlockPool blockPool;
+    MemoryStream stream(&blockPool);
+    Format format;
+
+    // The first repetition allocates the stream's blocks, which later repetitions reuse.
+    auto encodeTime = 1e30, decodeTime = 1e30;
+    uint64_t checksum = 0;
+    for (auto repetition = 0U; repetition <= s_repetitionCount; ++repetition)
+    {
+        auto startTime = Clock::now();
+        stream.Reset();
+        for (auto i = 0U; i < s_drawCount; ++i)
+            format.CmdDraw(stream, 3 + (i & 63), 1, i, 0);
+
+        auto midTime = Clock::now();
+        checksum = format.Decode(stream);
+        auto endTime = Clock::now();
+
+        if (repetition > 0)
+        {
+            encodeTime = std::min(encodeTime, std::chrono::duration<double, std::milli>(midTime - startTime).count());
+            decodeTime = std::min(decodeTime, std::chrono::duration<double, std::milli>(endTime - midTime).count());
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(3) << name << ": " << stream.TellP() / s_drawCount << " bytes per draw, encode " << encodeTime << " ms ("
+        << encodeTime * 1e6 / s_drawCount << " ns per draw), decode " << decodeTime << " ms (" << decodeTime * 1e6 / s_drawCount << " ns per draw), checksum "
+        << checksum << ".\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::cout << "Best of " << s_repetitionCount << " repetitions of " << s_drawCount << " draws.\n";
+    Run<FieldFormat>("Field format");
+    Run<PacketFormat>("Packet format");
+    return 0;
+}
@@ -20,7 +20,9 @@
 // THE SOFTWARE.
 //
 #include <cstring>
+#include <algorithm>
 #include "Device.h"
+#include "Queue.h"
 #include "Buffer.h"
 
 namespace vez
@@ -32,6 +34,119 @@ namespace vez
         memcpy(&instance->m_createInfo, pCreateInfo, sizeof(VezBufferCreateInfo));
         instance->m_handle = buffer;
         instance->m_allocation = allocation;
+        instance->m_exclusive = (pCreateInfo->queueFamilyIndexCount == 1);
         return instance;
     }
+
+    void Buffer::ResolveOwnership(const PipelineBarriers::BufferAccessList& accesses, Queue* pQueue, ResidentStateUpdates& updates, PipelineBarrier& barrier, std::unordered_map<Queue*, PipelineBarrier>& releaseBarriers)
+    {
+        if (!m_exclusive)
+            return;
+
+        // Start from the state staged by an earlier command buffer of the submission, or else the resident state.
+        auto it = updates.buffers.find(this);
+        if (it == updates.buffers.end())
+        {
+            m_residentStateLock.Lock();
+            it = updates.buffers.emplace(this, ResidentStateUpdates::BufferState{ m_residentAccesses, m_ownerQueue }).first;
+            m_residentStateLock.Unlock();
+        }
+
+        auto& state = it->second;
+        auto ownerQueue = state.ownerQueue;
+        state.ownerQueue = pQueue;
+
+        // Each accessed range is transferred, with the release and acquire barriers ordered by a semaphore.
+        // Both access lists are sorted by offset and never overlap, so the resident accesses overlapping a range are found with a binary search.
+        if (ownerQueue && ownerQueue->GetFamilyIndex() != pQueue->GetFamilyIndex())
+        {
+            PipelineStageFlags srcStageMask = 0;
+            for (auto& access : accesses)
+            {
+                VkBufferMemoryBarrier bufferBarrier = {};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                bufferBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+                bufferBarrier.srcQueueFamilyIndex = ownerQueue->GetFamilyIndex();
+                bufferBarrier.dstQueueFamilyIndex = pQueue->GetFamilyIndex();
+                bufferBarrier.buffer = m_handle;
+                bufferBarrier.offset = access.offset;
+                bufferBarrier.size = access.range;
+
+                auto end = access.offset + access.range;
+                auto resident = std::upper_bound(state.residentAccesses.cbegin(), state.residentAccesses.cend(), access.offset, [](VkDeviceSize value, const PipelineBarriers::BufferAccessInfo& residentAccess) {
+                    return value < residentAccess.offset + residentAccess.range;
+                });
+
+                for (; resident != state.residentAccesses.cend() && resident->offset < end; ++resident)
+                {
+                    bufferBarrier.srcAccessMask |= resident->accessMask;
+                    srcStageMask |= resident->stageMask;
+                }
+
+                releaseBarriers[ownerQueue].bufferBarriers.push_back(bufferBarrier);
+                barrier.bufferBarriers.push_back(bufferBarrier);
+            }
+
+            auto& releaseBarrier = releaseBarriers[ownerQueue];
+            releaseBarrier.srcStageMask |= (srcStageMask != 0) ? srcStageMask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            releaseBarrier.dstStageMask |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+            barrier.srcStageMask |= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            barrier.dstStageMask |= VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        }
+
+        // The accesses the command buffer leaves its ranges in replace the resident accesses of those ranges.
+        PipelineBarriers::BufferAccessList residentAccesses;
+        for (auto& residentAccess : state.residentAccesses)
+        {
+            auto begin = residentAccess.offset;
+            auto end = residentAccess.offset + residentAccess.range;
+            for (auto& access : accesses)
+            {
+                if (access.offset >= end)
+                    break;
+
+                if (access.offset + access.range <= begin)
+                    continue;
+
+                if (access.offset > begin)
+                {
+                    residentAccesses.push_back(residentAccess);
+                    residentAccesses.back().offset = begin;
+                    residentAccesses.back().range = access.offset - begin;
+                }
+
+                begin = access.offset + access.range;
+            }
+
+            if (begin < end)
+            {
+                residentAccesses.push_back(residentAccess);
+                residentAccesses.back().offset = begin;
+                residentAccesses.back().range = end - begin;
+            }
+        }
+
+        residentAccesses.insert(residentAccesses.end(), accesses.cbegin(), accesses.cend());
+        std::sort(residentAccesses.begin(), residentAccesses.end(), [](const PipelineBarriers::BufferAccessInfo& a, const PipelineBarriers::BufferAccessInfo& b) {
+            return a.offset < b.offset;
+        });
+
+        state.residentAccesses.swap(residentAccesses);
+    }
+
+    void Buffer::SetResidentState(const PipelineBarriers::BufferAccessList& residentAccesses, Queue* pOwnerQueue)
+    {
+        m_residentStateLock.Lock();
+        m_residentAccesses = residentAccesses;
+        m_ownerQueue = pOwnerQueue;
+        m_residentStateLock.Unlock();
+    }
+
+    void Buffer::AcquireOwnership(Queue* pOwnerQueue)
+    {
+        m_residentStateLock.Lock();
+        m_ownerQueue = pOwnerQueue;
+        m_residentStateLock.Unlock();
+    }
 }
\ No newline at end of file
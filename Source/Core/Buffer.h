@@ -21,6 +21,9 @@
 //
 #pragma once
 
+#include <unordered_map>
+#include "Utility/SpinLock.h"
+#include "PipelineBarriers.h"
 #include "VEZ.h"
 
 struct VmaAllocation_T;
@@ -29,6 +32,7 @@ typedef struct VmaAllocation_T* VmaAllocation;
 namespace vez
 {
     class Device;
+    class Queue;
 
     class Buffer
     {
@@ -43,10 +47,25 @@ namespace vez
 
         VmaAllocation GetAllocation() { return m_allocation; }
 
+        // Stages the queue as the owner of an exclusively owned buffer used by a command buffer submitted to it, along with the accesses
+        // the command buffer leaves its ranges in.  The ranges the command buffer accesses are released by a queue of another family that
+        // last used the buffer, waiting on the accesses left by that queue's submissions, and acquired before the command buffer.
+        void ResolveOwnership(const PipelineBarriers::BufferAccessList& accesses, Queue* pQueue, ResidentStateUpdates& updates, PipelineBarrier& barrier, std::unordered_map<Queue*, PipelineBarrier>& releaseBarriers);
+
+        // Applies the resident accesses and owner queue staged by a successful submission.
+        void SetResidentState(const PipelineBarriers::BufferAccessList& residentAccesses, Queue* pOwnerQueue);
+
+        // Makes the queue the owner once an acquire barrier completes the transfer of released ranges, for a submission that failed.
+        void AcquireOwnership(Queue* pOwnerQueue);
+
     private:
         Device* m_device = nullptr;
         VezBufferCreateInfo m_createInfo;
         VkBuffer m_handle = VK_NULL_HANDLE;
         VmaAllocation m_allocation = VK_NULL_HANDLE;
+        bool m_exclusive = false;
+        PipelineBarriers::BufferAccessList m_residentAccesses;
+        Queue* m_ownerQueue = nullptr;
+        SpinLock m_residentStateLock;
     };
 }
\ No newline at end of file
@@ -59,6 +59,9 @@ namespace vez
 
     BufferView::~BufferView()
     {
+        // Cached descriptor sets and memoized recordings must not outlive the buffer view.
+        m_device->InvalidateResource(reinterpret_cast<uint64_t>(m_handle));
+
         if (m_handle)
             vkDestroyBufferView(m_device->GetHandle(), m_handle, nullptr);
     }}
\ No newline at end of file
@@ -21,6 +21,9 @@
 //
 #include <array>
 #include "Utility/VkHelpers.h"
+#include "Utility/ThreadPool.h"
+#include "Instance.h"
+#include "PhysicalDevice.h"
 #include "Device.h"
 #include "Swapchain.h"
 #include "Queue.h"
@@ -37,33 +40,52 @@
 
 namespace vez
 {
-    CommandBuffer::CommandBuffer(CommandPool* pool, VkCommandBuffer handle, uint64_t streamEncoderBlockSize)
+    CommandBuffer::CommandBuffer(CommandPool* pool, VkCommandBuffer handle, VkCommandBufferLevel level, MemoryBlockPool* pStreamBlockPool)
         : m_pool(pool)
         , m_handle(handle)
-        , m_streamEncoder(this, streamEncoderBlockSize)
+        , m_level(level)
+        , m_streamEncoder(this, pStreamBlockPool)
+        , m_streamDecoder(pool)
     {
 
     }
 
     CommandBuffer::~CommandBuffer()
     {
-        // Free object handle.
+        // Wait for any in-flight decode to complete before the native handle is freed.
+        WaitForDecode();
+
+        // Free object handle, along with any additional native command buffers recorded for secondary execution.
+        ReleaseSecondaryRecordings();
+        if (m_freeSecondaryHandles.size() > 0)
+            m_pool->FreeCommandBuffers(static_cast<uint32_t>(m_freeSecondaryHandles.size()), m_freeSecondaryHandles.data());
+
         m_pool->FreeCommandBuffers(1, &m_handle);
     }
 
+    VkResult CommandBuffer::WaitForDecode()
+    {
+        // Block until an asynchronous decode queued by End has completed.
+        if (m_pendingDecode.valid())
+            m_pendingDecode.wait();
+
+        // Return the result of translating the last recording.
+        return m_decodeResult;
+    }
+
     VkResult CommandBuffer::Begin(VkCommandBufferUsageFlags flags)
     {
         // Don't allow Begin to be called more than once before End is called.
         if (m_isRecording)
             return VK_NOT_READY;
 
-        // Begin command recording.
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = static_cast<VkCommandBufferUsageFlags>(flags);
-        auto result = vkBeginCommandBuffer(m_handle, &beginInfo);
-        if (result != VK_SUCCESS)
-            return result;
+        // The previous recording must be fully decoded before the stream encoder can be reused.
+        WaitForDecode();
+        m_pendingDecode = std::shared_future<void>();
+        m_decodeResult = VK_SUCCESS;
+
+        // Native command recording is deferred until the command stream is decoded.
+        m_usageFlags = flags;
 
         // Mark CommandBuffer as recording and reset internal state.
         m_isRecording = true;
@@ -97,18 +119,176 @@ namespace vez
         // End stream encoder.
         m_streamEncoder.End();
 
-        // Decode command stream.
-        m_streamDecoder.Decode(*this, m_streamEncoder);
+        // Secondary command buffers are decoded when resolved against the render pass of the primary executing them.
+        if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+        {
+            m_nativeRecordingValid = false;
+            ReleaseSecondaryRecordings();
+            return VK_SUCCESS;
+        }
+
+        // A recording that failed, such as one executing a secondary command buffer that could not be resolved, is never decoded.
+        auto recordingResult = m_streamEncoder.GetRecordingResult();
+        if (recordingResult != VK_SUCCESS)
+        {
+            m_nativeRecordingValid = false;
+            m_decodeResult = recordingResult;
+            return recordingResult;
+        }
+
+        // A recording identical to the last decoded one reuses the native command buffer as is.
+        // Executed secondary command buffers may have been re-recorded since, so their primaries are always decoded again.
+        if (m_streamEncoder.IsTimelineUnchanged() && !m_streamEncoder.ExecutesSecondaryCommandBuffers() && m_nativeRecordingValid && m_nativeUsageFlags == m_usageFlags && !(m_usageFlags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT))
+        {
+            m_decodeResult = VK_SUCCESS;
+            return VK_SUCCESS;
+        }
+
+        // When asynchronous decode is enabled, translate the command stream on the instance's thread pool.
+        // Queue::Submit waits for the decode to complete before submitting the native command buffer.
+        if (m_asyncDecode)
+        {
+            auto threadPool = m_pool->GetDevice()->GetPhysicalDevice()->GetInstance()->GetThreadPool();
+            m_pendingDecode = threadPool->AddTask([this]() {
+                m_decodeResult = Decode(m_handle, VK_NULL_HANDLE, 0);
+            });
+
+            return VK_SUCCESS;
+        }
 
-        // End command recording.
-        return vkEndCommandBuffer(m_handle);
+        // Otherwise decode on the calling thread.
+        m_decodeResult = Decode(m_handle, VK_NULL_HANDLE, 0);
+        return m_decodeResult;
     }
 
     VkResult CommandBuffer::Reset()
     {
+        // Wait for any in-flight decode to complete.
+        WaitForDecode();
+
+        // Return the stream encoder's memory and transient resources, once no decode task references them.
+        m_streamDecoder.Reset();
+        m_streamEncoder.Reset();
+        m_nativeRecordingValid = false;
+        ReleaseSecondaryRecordings();
+
+        VkResult result = VK_SUCCESS;
         if (m_handle != VK_NULL_HANDLE)
-            return vkResetCommandBuffer(m_handle, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
-        return VK_SUCCESS;
+        {
+            m_pool->Lock();
+            result = vkResetCommandBuffer(m_handle, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
+            for (auto handle : m_freeSecondaryHandles)
+                vkResetCommandBuffer(handle, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
+
+            m_pool->Unlock();
+        }
+
+        return result;
+    }
+
+    VkResult CommandBuffer::Decode(VkCommandBuffer commandBuffer, VkRenderPass inheritedRenderPass, uint32_t inheritedSubpass)
+    {
+        // Native command buffers share their pool with other command buffers that may be decoded on another thread.
+        m_pool->Lock();
+        m_nativeRecordingValid = false;
+
+        // Begin command recording.
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = m_usageFlags;
+
+        // Secondary command buffers continue the render pass subpass they were resolved against.
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+        {
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass = inheritedRenderPass;
+            inheritanceInfo.subpass = inheritedSubpass;
+            beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+        }
+
+        auto result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (result == VK_SUCCESS)
+        {
+            // Decode command stream.
+            result = m_streamDecoder.Decode(commandBuffer, beginInfo.flags, m_streamEncoder.GetTimeline(), m_streamEncoder.ExecutesSecondaryCommandBuffers());
+
+            // End command recording.
+            auto endResult = vkEndCommandBuffer(commandBuffer);
+            if (result == VK_SUCCESS)
+                result = endResult;
+        }
+
+        m_pool->Unlock();
+
+        // Track the native recording so an identical subsequent recording can skip decoding.
+        m_nativeRecordingValid = (result == VK_SUCCESS);
+        m_nativeUsageFlags = m_usageFlags;
+        return result;
+    }
+
+    VkResult CommandBuffer::ResolveSecondary(RenderPass* pRenderPass, uint32_t subpassIndex, VkCommandBuffer* pHandle)
+    {
+        // The same secondary command buffer may be executed by primary command buffers recorded on different threads.
+        m_resolveLock.Lock();
+
+        // Reuse the native command buffer already recorded for the render pass and subpass, which is never recorded again.
+        auto renderPass = pRenderPass->GetHandle();
+        for (auto& recording : m_secondaryRecordings)
+        {
+            if (std::get<0>(recording) == renderPass && std::get<1>(recording) == subpassIndex)
+            {
+                *pHandle = std::get<2>(recording);
+                m_resolveLock.Unlock();
+                return VK_SUCCESS;
+            }
+        }
+
+        // Otherwise record the command buffer's own handle first, then a free or newly allocated native command buffer.
+        auto result = VK_SUCCESS;
+        auto handle = m_handle;
+        if (m_secondaryRecordings.size() > 0)
+        {
+            if (m_freeSecondaryHandles.size() > 0)
+            {
+                handle = m_freeSecondaryHandles.back();
+                m_freeSecondaryHandles.pop_back();
+            }
+            else
+            {
+                result = m_pool->AllocateCommandBuffers(nullptr, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 1, &handle);
+            }
+        }
+
+        if (result == VK_SUCCESS)
+        {
+            m_streamEncoder.ResolvePipelines(pRenderPass, subpassIndex);
+            result = Decode(handle, renderPass, subpassIndex);
+            if (result == VK_SUCCESS)
+            {
+                m_secondaryRecordings.push_back(std::make_tuple(renderPass, subpassIndex, handle));
+                *pHandle = handle;
+            }
+            else if (handle != m_handle)
+            {
+                m_freeSecondaryHandles.push_back(handle);
+            }
+        }
+
+        m_resolveLock.Unlock();
+        return result;
+    }
+
+    void CommandBuffer::ReleaseSecondaryRecordings()
+    {
+        for (auto& recording : m_secondaryRecordings)
+        {
+            if (std::get<2>(recording) != m_handle)
+                m_freeSecondaryHandles.push_back(std::get<2>(recording));
+        }
+
+        m_secondaryRecordings.clear();
     }
 
     void CommandBuffer::CmdBeginRenderPass(const VezRenderPassBeginInfo* pBeginInfo)
@@ -340,4 +520,9 @@ namespace vez
     {
         m_streamEncoder.CmdResetEvent(event, stageMask);
     }
+
+    void CommandBuffer::CmdExecuteCommands(uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers)
+    {
+        m_streamEncoder.CmdExecuteCommands(commandBufferCount, ppCommandBuffers);
+    }
 }
\ No newline at end of file
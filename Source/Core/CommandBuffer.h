@@ -25,7 +25,9 @@
 #include <unordered_map>
 #include <tuple>
 #include <functional>
+#include <future>
 #include "VEZ.h"
+#include "Utility/SpinLock.h"
 #include "GraphicsState.h"
 #include "ResourceBindings.h"
 #include "StreamEncoder.h"
@@ -38,11 +40,13 @@ namespace vez
     class VertexInputFormat;
     class BufferView;
     class ImageView;
+    class MemoryBlockPool;
+    class RenderPass;
 
     class CommandBuffer
     {
     public:
-        CommandBuffer(CommandPool* pool, VkCommandBuffer handle, uint64_t streamEncoderBlockSize);
+        CommandBuffer(CommandPool* pool, VkCommandBuffer handle, VkCommandBufferLevel level, MemoryBlockPool* pStreamBlockPool);
 
         ~CommandBuffer();
 
@@ -50,6 +54,26 @@ namespace vez
 
         VkCommandBuffer GetHandle() const { return m_handle; }
 
+        VkCommandBufferLevel GetLevel() const { return m_level; }
+
+        StreamEncoder& GetStreamEncoder() { return m_streamEncoder; }
+
+        void SetAsyncDecode(bool enabled) { m_asyncDecode = enabled; }
+
+        void SetMemoization(bool enabled) { m_streamEncoder.SetMemoization(enabled); }
+
+        void SetDrawMerging(bool enabled) { m_streamEncoder.SetDrawMerging(enabled); }
+
+        void SetSplitBarriers(bool enabled) { m_streamEncoder.SetSplitBarriers(enabled); }
+
+        void SetTransientDescriptorSets(bool enabled) { m_streamEncoder.SetTransientDescriptorSets(enabled); }
+
+        VkResult WaitForDecode();
+
+        // Secondary command buffers are translated to native commands once the render pass of the primary executing them is known.
+        // Returns the native command buffer recorded for the render pass and subpass.
+        VkResult ResolveSecondary(RenderPass* pRenderPass, uint32_t subpassIndex, VkCommandBuffer* pHandle);
+
         VkResult Begin(VkCommandBufferUsageFlags flags);
         VkResult End();
         VkResult Reset();
@@ -99,13 +123,33 @@ namespace vez
         void CmdResolveImage(Image* pSrcImage, Image* pDstImage, uint32_t regionCount, const VezImageResolve* pRegions);
         void CmdSetEvent(VkEvent event, VkPipelineStageFlags stageMask);
         void CmdResetEvent(VkEvent event, VkPipelineStageFlags stageMask);
+        void CmdExecuteCommands(uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers);
 
     private:
+        // Records the command stream into a native command buffer.  Secondary command buffers continue the given render pass subpass.
+        VkResult Decode(VkCommandBuffer commandBuffer, VkRenderPass inheritedRenderPass, uint32_t inheritedSubpass);
+
+        // Makes the native command buffers recorded for secondary execution available to the next recording.
+        void ReleaseSecondaryRecordings();
+
         CommandPool* m_pool;
         VkCommandBuffer m_handle = VK_NULL_HANDLE;
+        VkCommandBufferLevel m_level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         StreamEncoder m_streamEncoder;
         StreamDecoder m_streamDecoder;
+        VkCommandBufferUsageFlags m_usageFlags = 0;
         bool m_isRecording = false;
+        bool m_asyncDecode = false;
+        std::shared_future<void> m_pendingDecode;
+        VkResult m_decodeResult = VK_SUCCESS;
+        bool m_nativeRecordingValid = false;
+        VkCommandBufferUsageFlags m_nativeUsageFlags = 0;
+        SpinLock m_resolveLock;
+
+        // A secondary command buffer executed within several render passes or subpasses keeps a native command buffer recorded for each,
+        // since primaries already executing one of them may still be pending.  The first is always the command buffer's own handle.
+        std::vector<std::tuple<VkRenderPass, uint32_t, VkCommandBuffer>> m_secondaryRecordings;
+        std::vector<VkCommandBuffer> m_freeSecondaryHandles;
         bool m_submittedToQueue = false;
     };  
 }
\ No newline at end of file
@@ -0,0 +1,534 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "Utility/MemoryStream.h"
+#include "Utility/VkHelpers.h"
+#include "VEZ.h"
+
+namespace vez
+{
+    // List of all VulkanEZ commands which are encoded during command buffer recording.
+    typedef enum CommandID
+    {
+        BEGIN_RENDER_PASS,
+        NEXT_SUBPASS,
+        END_RENDER_PASS,
+        BIND_PIPELINE,
+        PUSH_CONSTANTS,
+        BIND_BUFFER,
+        BIND_BUFFER_VIEW,
+        BIND_IMAGE_VIEW,
+        BIND_SAMPLER,
+        BIND_VERTEX_BUFFERS,
+        BIND_INDEX_BUFFER,
+        SET_VERTEX_INPUT_FORMAT,
+        SET_VIEWPORT_STATE,
+        SET_INPUT_ASSEMBLY_STATE,
+        SET_RASTERIZATION_STATE,
+        SET_MULTISAMPLE_STATE,
+        SET_DEPTH_STENCIL_STATE,
+        SET_COLOR_BLEND_STATE,
+        SET_VIEWPORT,
+        SET_SCISSOR,
+        SET_LINE_WIDTH,
+        SET_DEPTH_BIAS,
+        SET_BLEND_CONSTANTS,
+        SET_DEPTH_BOUNDS,
+        SET_STENCIL_COMPARE_MASK,
+        SET_STENCIL_WRITE_MASK,
+        SET_STENCIL_REFERENCE,
+        DRAW,
+        DRAW_INDEXED,
+        DRAW_INDIRECT,
+        DRAW_INDEXED_INDIRECT,
+        DISPATCH,
+        DISPATCH_INDIRECT,
+        COPY_BUFFER,
+        COPY_IMAGE,
+        BLIT_IMAGE,
+        COPY_BUFFER_TO_IMAGE,
+        COPY_IMAGE_TO_BUFFER,
+        UPDATE_BUFFER,
+        FILL_BUFFER,
+        CLEAR_COLOR_IMAGE,
+        CLEAR_DEPTH_STENCIL_IMAGE,
+        CLEAR_ATTACHMENTS,
+        RESOLVE_IMAGE,
+        SET_EVENT,
+        RESET_EVENT,
+        WAIT_EVENTS,
+        BIND_DESCRIPTOR_SET,
+        PIPELINE_BARRIER,
+        EXECUTE_COMMANDS,
+        COMMAND_ID_COUNT,
+    } CommandID;
+
+    // Header at the start of every command packet in the stream.
+    // Size is the total number of bytes occupied by the packet, including the header, any trailing arrays and padding.
+    // Packets are always padded to a multiple of the header's alignment so the next packet can be read in place.
+    struct alignas(8) CommandPacket
+    {
+        CommandID id;
+        uint32_t size;
+    };
+
+    // Returns the padded size of a command packet with the given number of bytes.
+    inline uint32_t GetCommandPacketSize(uint64_t size)
+    {
+        return static_cast<uint32_t>((size + alignof(CommandPacket) - 1) & ~static_cast<uint64_t>(alignof(CommandPacket) - 1));
+    }
+
+    // Returns a pointer to the variable length data trailing a packet's fixed layout, offset by the given number of bytes.
+    template <typename T, typename Packet>
+    T* GetCommandPacketData(Packet* pPacket, uint64_t offset = 0)
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(pPacket + 1) + offset);
+    }
+
+    template <typename T, typename Packet>
+    const T* GetCommandPacketData(const Packet* pPacket, uint64_t offset = 0)
+    {
+        return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(pPacket + 1) + offset);
+    }
+
+    // Reserves a command packet, including any trailing arrays, with a single write to the memory stream.
+    // The fixed layout and trailing alignment padding are zeroed so identical commands always encode to identical bytes.
+    template <typename T>
+    T* WriteCommandPacket(MemoryStream& stream, CommandID id, uint64_t dataSize = 0)
+    {
+        auto size = GetCommandPacketSize(sizeof(T) + dataSize);
+        auto packet = reinterpret_cast<T*>(stream.WritePtr<uint8_t>(size));
+        memset(packet, 0, sizeof(T));
+        memset(reinterpret_cast<uint8_t*>(packet) + sizeof(T) + dataSize, 0, size - sizeof(T) - dataSize);
+        packet->header.id = id;
+        packet->header.size = size;
+        return packet;
+    }
+
+    // Fixed layout of each encoded command.  Arrays trail the fixed layout in the order listed in each packet's comment.
+    // Resources are stored as native Vulkan handles and regions as native Vulkan structures so they can be passed directly to vkCmd* calls.
+    // Followed by VkClearValue clearValues[clearValueCount].
+    struct BeginRenderPassPacket
+    {
+        CommandPacket header;
+        VkRenderPass renderPass;
+        VkFramebuffer framebuffer;
+        VkRect2D renderArea;
+        uint32_t clearValueCount;
+        VkSubpassContents contents;
+    };
+
+    struct NextSubpassPacket
+    {
+        CommandPacket header;
+        VkSubpassContents contents;
+    };
+
+    struct EndRenderPassPacket
+    {
+        CommandPacket header;
+    };
+
+    struct BindPipelinePacket
+    {
+        CommandPacket header;
+        VkPipelineBindPoint bindPoint;
+        VkPipeline pipeline;
+    };
+
+    // Followed by uint8_t values[size].
+    struct PushConstantsPacket
+    {
+        CommandPacket header;
+        VkPipelineLayout layout;
+        VkShaderStageFlags stageFlags;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // Followed by VkBuffer buffers[bindingCount] and VkDeviceSize offsets[bindingCount].
+    struct BindVertexBuffersPacket
+    {
+        CommandPacket header;
+        uint32_t firstBinding;
+        uint32_t bindingCount;
+    };
+
+    struct BindIndexBufferPacket
+    {
+        CommandPacket header;
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VkIndexType indexType;
+    };
+
+    // Followed by VkViewport viewports[viewportCount].
+    struct SetViewportPacket
+    {
+        CommandPacket header;
+        uint32_t firstViewport;
+        uint32_t viewportCount;
+    };
+
+    // Followed by VkRect2D scissors[scissorCount].
+    struct SetScissorPacket
+    {
+        CommandPacket header;
+        uint32_t firstScissor;
+        uint32_t scissorCount;
+    };
+
+    struct SetLineWidthPacket
+    {
+        CommandPacket header;
+        float lineWidth;
+    };
+
+    struct SetDepthBiasPacket
+    {
+        CommandPacket header;
+        float depthBiasConstantFactor;
+        float depthBiasClamp;
+        float depthBiasSlopeFactor;
+    };
+
+    struct SetBlendConstantsPacket
+    {
+        CommandPacket header;
+        float blendConstants[4];
+    };
+
+    struct SetDepthBoundsPacket
+    {
+        CommandPacket header;
+        float minDepthBounds;
+        float maxDepthBounds;
+    };
+
+    struct SetStencilCompareMaskPacket
+    {
+        CommandPacket header;
+        VkStencilFaceFlags faceMask;
+        uint32_t compareMask;
+    };
+
+    struct SetStencilWriteMaskPacket
+    {
+        CommandPacket header;
+        VkStencilFaceFlags faceMask;
+        uint32_t writeMask;
+    };
+
+    struct SetStencilReferencePacket
+    {
+        CommandPacket header;
+        VkStencilFaceFlags faceMask;
+        uint32_t reference;
+    };
+
+    struct DrawPacket
+    {
+        CommandPacket header;
+        uint32_t vertexCount;
+        uint32_t instanceCount;
+        uint32_t firstVertex;
+        uint32_t firstInstance;
+    };
+
+    struct DrawIndexedPacket
+    {
+        CommandPacket header;
+        uint32_t indexCount;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t firstInstance;
+    };
+
+    struct DrawIndirectPacket
+    {
+        CommandPacket header;
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        uint32_t drawCount;
+        uint32_t stride;
+    };
+
+    struct DrawIndexedIndirectPacket
+    {
+        CommandPacket header;
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        uint32_t drawCount;
+        uint32_t stride;
+    };
+
+    struct DispatchPacket
+    {
+        CommandPacket header;
+        uint32_t groupCountX;
+        uint32_t groupCountY;
+        uint32_t groupCountZ;
+    };
+
+    struct DispatchIndirectPacket
+    {
+        CommandPacket header;
+        VkBuffer buffer;
+        VkDeviceSize offset;
+    };
+
+    // Followed by VkBufferCopy regions[regionCount].
+    struct CopyBufferPacket
+    {
+        CommandPacket header;
+        VkBuffer srcBuffer;
+        VkBuffer dstBuffer;
+        uint32_t regionCount;
+    };
+
+    // Followed by VkImageCopy regions[regionCount].
+    struct CopyImagePacket
+    {
+        CommandPacket header;
+        VkImage srcImage;
+        VkImage dstImage;
+        VkImageLayout srcImageLayout;
+        VkImageLayout dstImageLayout;
+        uint32_t regionCount;
+    };
+
+    // Followed by VkImageBlit regions[regionCount].
+    struct BlitImagePacket
+    {
+        CommandPacket header;
+        VkImage srcImage;
+        VkImage dstImage;
+        VkImageLayout srcImageLayout;
+        VkImageLayout dstImageLayout;
+        VkFilter filter;
+        uint32_t regionCount;
+    };
+
+    // Followed by VkBufferImageCopy regions[regionCount].
+    struct CopyBufferToImagePacket
+    {
+        CommandPacket header;
+        VkBuffer srcBuffer;
+        VkImage dstImage;
+        uint32_t regionCount;
+    };
+
+    // Followed by VkBufferImageCopy regions[regionCount].
+    struct CopyImageToBufferPacket
+    {
+        CommandPacket header;
+        VkImage srcImage;
+        VkBuffer dstBuffer;
+        uint32_t regionCount;
+    };
+
+    // Followed by uint8_t data[dataSize].
+    struct UpdateBufferPacket
+    {
+        CommandPacket header;
+        VkBuffer dstBuffer;
+        VkDeviceSize dstOffset;
+        VkDeviceSize dataSize;
+    };
+
+    struct FillBufferPacket
+    {
+        CommandPacket header;
+        VkBuffer dstBuffer;
+        VkDeviceSize dstOffset;
+        VkDeviceSize size;
+        uint32_t data;
+    };
+
+    // Followed by VkImageSubresourceRange ranges[rangeCount].
+    struct ClearColorImagePacket
+    {
+        CommandPacket header;
+        VkImage image;
+        VkClearColorValue color;
+        uint32_t rangeCount;
+    };
+
+    // Followed by VkImageSubresourceRange ranges[rangeCount].
+    struct ClearDepthStencilImagePacket
+    {
+        CommandPacket header;
+        VkImage image;
+        VkClearDepthStencilValue depthStencil;
+        uint32_t rangeCount;
+    };
+
+    // Followed by VkClearAttachment attachments[attachmentCount] and VkClearRect rects[rectCount].
+    struct ClearAttachmentsPacket
+    {
+        CommandPacket header;
+        uint32_t attachmentCount;
+        uint32_t rectCount;
+    };
+
+    // Followed by VkImageResolve regions[regionCount].
+    struct ResolveImagePacket
+    {
+        CommandPacket header;
+        VkImage srcImage;
+        VkImage dstImage;
+        uint32_t regionCount;
+    };
+
+    struct SetEventPacket
+    {
+        CommandPacket header;
+        VkEvent event;
+        VkPipelineStageFlags stageMask;
+    };
+
+    struct ResetEventPacket
+    {
+        CommandPacket header;
+        VkEvent event;
+        VkPipelineStageFlags stageMask;
+    };
+
+    // Followed by VkBufferMemoryBarrier bufferBarriers[bufferBarrierCount] and VkImageMemoryBarrier imageBarriers[imageBarrierCount].
+    struct WaitEventsPacket
+    {
+        CommandPacket header;
+        VkEvent event;
+        VkPipelineStageFlags srcStageMask;
+        VkPipelineStageFlags dstStageMask;
+        uint32_t bufferBarrierCount;
+        uint32_t imageBarrierCount;
+    };
+
+    // Descriptor pushed into a command buffer, holding the record matching its type.
+    struct PushDescriptor
+    {
+        uint32_t binding;
+        uint32_t arrayElement;
+        VkDescriptorType descriptorType;
+        DescriptorRecord record;
+    };
+
+    // Followed by PushDescriptor pushDescriptors[pushDescriptorCount] for push descriptor layouts, whose descriptor set is VK_NULL_HANDLE.
+    struct BindDescriptorSetPacket
+    {
+        CommandPacket header;
+        VkPipelineBindPoint bindPoint;
+        VkPipelineLayout pipelineLayout;
+        uint32_t setIndex;
+        VkDescriptorSet descriptorSet;
+        uint32_t pushDescriptorCount;
+    };
+
+    // Followed by VkBufferMemoryBarrier bufferBarriers[bufferBarrierCount], VkImageMemoryBarrier imageBarriers[imageBarrierCount]
+    // and MemoryBarrierStages stages[bufferBarrierCount + imageBarrierCount].  The packet's stage masks hold the legacy stage bits.
+    struct PipelineBarrierPacket
+    {
+        CommandPacket header;
+        VkPipelineStageFlags srcStageMask;
+        VkPipelineStageFlags dstStageMask;
+        uint32_t bufferBarrierCount;
+        uint32_t imageBarrierCount;
+    };
+
+    // Followed by VkCommandBuffer commandBuffers[commandBufferCount].
+    struct ExecuteCommandsPacket
+    {
+        CommandPacket header;
+        uint32_t commandBufferCount;
+    };
+
+    // Returns whether a command packet sets pipeline or dynamic state and a key identifying the state it overwrites.
+    inline bool GetCommandPacketStateKey(const CommandPacket* pPacket, uint64_t* pKey)
+    {
+        auto key = static_cast<uint64_t>(pPacket->id);
+        switch (pPacket->id)
+        {
+        case BIND_PIPELINE:
+            key |= static_cast<uint64_t>(reinterpret_cast<const BindPipelinePacket*>(pPacket)->bindPoint) << 8;
+            break;
+
+        case BIND_DESCRIPTOR_SET:
+        {
+            auto packet = reinterpret_cast<const BindDescriptorSetPacket*>(pPacket);
+            key |= (static_cast<uint64_t>(packet->bindPoint) << 8) | (static_cast<uint64_t>(packet->setIndex) << 16);
+            break;
+        }
+
+        case PUSH_CONSTANTS:
+        {
+            auto packet = reinterpret_cast<const PushConstantsPacket*>(pPacket);
+            key |= (static_cast<uint64_t>(packet->offset) << 8) | (static_cast<uint64_t>(packet->size) << 24) | (static_cast<uint64_t>(packet->stageFlags) << 40);
+            break;
+        }
+
+        case BIND_VERTEX_BUFFERS:
+        {
+            auto packet = reinterpret_cast<const BindVertexBuffersPacket*>(pPacket);
+            key |= (static_cast<uint64_t>(packet->firstBinding) << 8) | (static_cast<uint64_t>(packet->bindingCount) << 36);
+            break;
+        }
+
+        case SET_VIEWPORT:
+        {
+            auto packet = reinterpret_cast<const SetViewportPacket*>(pPacket);
+            key |= (static_cast<uint64_t>(packet->firstViewport) << 8) | (static_cast<uint64_t>(packet->viewportCount) << 36);
+            break;
+        }
+
+        case SET_SCISSOR:
+        {
+            auto packet = reinterpret_cast<const SetScissorPacket*>(pPacket);
+            key |= (static_cast<uint64_t>(packet->firstScissor) << 8) | (static_cast<uint64_t>(packet->scissorCount) << 36);
+            break;
+        }
+
+        case SET_STENCIL_COMPARE_MASK:
+        case SET_STENCIL_WRITE_MASK:
+        case SET_STENCIL_REFERENCE:
+            key |= static_cast<uint64_t>(reinterpret_cast<const SetStencilCompareMaskPacket*>(pPacket)->faceMask) << 8;
+            break;
+
+        case BIND_INDEX_BUFFER:
+        case SET_LINE_WIDTH:
+        case SET_DEPTH_BIAS:
+        case SET_BLEND_CONSTANTS:
+        case SET_DEPTH_BOUNDS:
+            break;
+
+        default:
+            return false;
+        }
+
+        *pKey = key;
+        return true;
+    }
+}
\ No newline at end of file
@@ -51,22 +51,22 @@ namespace vez
             vkDestroyCommandPool(m_device->GetHandle(), m_handle, nullptr);
     }
 
-    VkResult CommandPool::AllocateCommandBuffers(const void* pNext, uint32_t commandBufferCount, VkCommandBuffer* pCommandBuffers)
+    VkResult CommandPool::AllocateCommandBuffers(const void* pNext, VkCommandBufferLevel level, uint32_t commandBufferCount, VkCommandBuffer* pCommandBuffers)
     {
         // Safe guard access to internal resources across threads.
-        m_spinLock.Lock();
+        m_mutex.lock();
 
         // Allocate a new command buffer.
         VkCommandBufferAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         allocInfo.pNext = pNext;
         allocInfo.commandPool = m_handle;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.level = level;
         allocInfo.commandBufferCount = commandBufferCount;
         auto result = vkAllocateCommandBuffers(m_device->GetHandle(), &allocInfo, pCommandBuffers);
 
         // Unlock access to internal resources.
-        m_spinLock.Unlock();
+        m_mutex.unlock();
 
         // Return result.
         return result;
@@ -75,8 +75,8 @@ namespace vez
     void CommandPool::FreeCommandBuffers(uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers)
     {
         // Safe guard access to internal resources across threads.
-        m_spinLock.Lock();
+        m_mutex.lock();
         vkFreeCommandBuffers(m_device->GetHandle(), m_handle, commandBufferCount, pCommandBuffers);
-        m_spinLock.Unlock();
+        m_mutex.unlock();
     }
 }
\ No newline at end of file
@@ -21,8 +21,8 @@
 //
 #pragma once
 
+#include <mutex>
 #include "VEZ.h"
-#include "Utility/SpinLock.h"
 
 namespace vez
 {
@@ -41,14 +41,21 @@ namespace vez
 
         VkCommandPool GetHandle() const { return m_handle; }
 
-        VkResult AllocateCommandBuffers(const void* pNext, uint32_t commandBufferCount, VkCommandBuffer* pCommandBuffers);
+        VkResult AllocateCommandBuffers(const void* pNext, VkCommandBufferLevel level, uint32_t commandBufferCount, VkCommandBuffer* pCommandBuffers);
 
         void FreeCommandBuffers(uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers);
 
+        // Command buffers from the same pool may be translated on different threads, so all use of a pool's native command buffers is guarded.
+        // Vulkan requires the pool to be externally synchronized while any of its command buffers is recorded, so the lock is held for a whole
+        // decode and waiting threads block rather than spin.
+        void Lock() { m_mutex.lock(); }
+
+        void Unlock() { m_mutex.unlock(); }
+
     private:
         Device* m_device = nullptr;
         uint32_t m_queueFamilyIndex = 0;
         VkCommandPool m_handle = VK_NULL_HANDLE;
-        SpinLock m_spinLock;
+        std::mutex m_mutex;
     };    
 }
\ No newline at end of file
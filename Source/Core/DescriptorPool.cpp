@@ -19,6 +19,9 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 //
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "Utility/VkHelpers.h"
 #include "Utility/SpinLock.h"
 #include "Device.h"
@@ -49,35 +52,68 @@ namespace vez
             m_poolSizes[index].descriptorCount = it.second * m_maxSetsPerPool;
             ++index;
         }
+
+        // Create a sub-pool for each hardware thread.
+        auto subPoolCount = std::max(1U, std::thread::hardware_concurrency());
+        for (auto i = 0U; i < subPoolCount; ++i)
+            m_subPools.push_back(new SubPool);
     }
 
     DescriptorPool::~DescriptorPool()
     {
-        // Destroy all allocated descriptor sets.
-        for (auto it : m_allocatedDescriptorSets)
+        // Destroy all created pools, which frees their descriptor sets.
+        for (auto subPool : m_subPools)
         {
-            vkFreeDescriptorSets(m_layout->GetDevice()->GetHandle(), m_pools[it.second], 1, &it.first);
+            for (auto block : subPool->blocks)
+            {
+                vkDestroyDescriptorPool(m_layout->GetDevice()->GetHandle(), block->handle, nullptr);
+                delete block;
+            }
+
+            delete subPool;
         }
 
-        // Destroy all created pools.
-        for (auto pool : m_pools)
+        for (auto block : m_spareBlocks)
         {
-            vkDestroyDescriptorPool(m_layout->GetDevice()->GetHandle(), pool, nullptr);
+            vkDestroyDescriptorPool(m_layout->GetDevice()->GetHandle(), block->handle, nullptr);
+            delete block;
         }
     }
 
-    VkDescriptorSet DescriptorPool::AllocateDescriptorSet()
+    VkDescriptorSet DescriptorPool::AllocateDescriptorSet(DescriptorPoolBlock** ppBlock)
     {
-        // Safe guard access to internal resources across threads.
-        m_spinLock.Lock();
+        // Select the calling thread's sub-pool, assigned in round-robin order on its first allocation, and guard access to it.
+        static std::atomic<uint32_t> nextThreadIndex(0U);
+        thread_local uint32_t threadIndex = nextThreadIndex++;
+        auto subPoolIndex = static_cast<uint32_t>(threadIndex % m_subPools.size());
+        auto subPool = m_subPools[subPoolIndex];
+        subPool->spinLock.Lock();
 
-        // Find the next pool to allocate from.
-        while (true)
+        // Find a block with free capacity, starting with the most recently added one.
+        DescriptorPoolBlock* block = nullptr;
+        for (auto it = subPool->blocks.rbegin(); it != subPool->blocks.rend(); ++it)
         {
-            // Allocate a new VkDescriptorPool if necessary.
-            if (m_pools.size() <= m_currentAllocationPoolIndex)
+            if ((*it)->allocatedSets < m_maxSetsPerPool)
+            {
+                block = *it;
+                break;
+            }
+        }
+
+        if (!block)
+        {
+            // The sub-pool ran dry, so take a spare block emptied by another sub-pool.
+            m_spinLock.Lock();
+            if (!m_spareBlocks.empty())
+            {
+                block = m_spareBlocks.back();
+                m_spareBlocks.pop_back();
+            }
+            m_spinLock.Unlock();
+
+            // Otherwise create a new Vulkan descriptor pool.
+            if (!block)
             {
-                // Create the Vulkan descriptor pool.
                 VkDescriptorPoolCreateInfo createInfo = {};
                 createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
                 createInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
@@ -87,74 +123,142 @@ namespace vez
                 VkDescriptorPool handle = VK_NULL_HANDLE;
                 auto result = vkCreateDescriptorPool(m_layout->GetDevice()->GetHandle(), &createInfo, nullptr, &handle);
                 if (result != VK_SUCCESS)
+                {
+                    subPool->spinLock.Unlock();
                     return VK_NULL_HANDLE;
+                }
 
-                // Add the Vulkan handle to the descriptor pool instance.
-                m_pools.push_back(handle);
-                m_allocatedSets.push_back(0);
-                break;
+                block = new DescriptorPoolBlock{ handle, 0, 0 };
             }
-            else if (m_allocatedSets[m_currentAllocationPoolIndex] < m_maxSetsPerPool)
-                break;
 
-            // Increment pool index.
-            ++m_currentAllocationPoolIndex;
+            // Add the block to the sub-pool.
+            block->subPoolIndex = subPoolIndex;
+            subPool->blocks.push_back(block);
         }
 
-        // Increment allocated set count for given pool.
-        ++m_allocatedSets[m_currentAllocationPoolIndex];
-
-        // Allocate a new descriptor set from the current pool index.
+        // Allocate a new descriptor set from the block.
         VkDescriptorSetLayout setLayout = m_layout->GetHandle();
 
         VkDescriptorSetAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = m_pools[m_currentAllocationPoolIndex];
+        allocInfo.descriptorPool = block->handle;
         allocInfo.descriptorSetCount = 1;
         allocInfo.pSetLayouts = &setLayout;
         VkDescriptorSet handle = VK_NULL_HANDLE;
         auto result = vkAllocateDescriptorSets(m_layout->GetDevice()->GetHandle(), &allocInfo, &handle);
-        if (result != VK_SUCCESS)
-            return VK_NULL_HANDLE;
-
-        // Store an internal mapping between the descriptor set handle and it's parent pool.
-        // This is used when FreeDescriptorSet is called downstream.
-        m_allocatedDescriptorSets.emplace(handle, m_currentAllocationPoolIndex);
+        if (result == VK_SUCCESS)
+        {
+            ++block->allocatedSets;
+            *ppBlock = block;
+        }
 
-        // Unlock access to internal resources.
-        m_spinLock.Unlock();
+        // Unlock access to the sub-pool.
+        subPool->spinLock.Unlock();
 
         // Return descriptor set handle.
         return handle;
     }
 
-    VkResult DescriptorPool::FreeDescriptorSet(VkDescriptorSet descriptorSet)
+    VkResult DescriptorPool::FreeDescriptorSet(VkDescriptorSet descriptorSet, DescriptorPoolBlock* pBlock)
     {
-        // Safe guard access to internal resources across threads.
-        m_spinLock.Lock();
-
-        // Get the index of the descriptor pool the descriptor set was allocated from.
-        auto it = m_allocatedDescriptorSets.find(descriptorSet);
-        if (it == m_allocatedDescriptorSets.end())
-            return VK_INCOMPLETE;
+        // Guard access to the sub-pool owning the block, which may belong to another thread.
+        auto subPool = m_subPools[pBlock->subPoolIndex];
+        subPool->spinLock.Lock();
 
-        // Return the descriptor set to the original pool.
-        auto poolIndex = it->second;
-        vkFreeDescriptorSets(m_layout->GetDevice()->GetHandle(), m_pools[poolIndex], 1, &descriptorSet);
+        // Return the descriptor set to the block.
+        vkFreeDescriptorSets(m_layout->GetDevice()->GetHandle(), pBlock->handle, 1, &descriptorSet);
 
-        // Remove descriptor set from allocatedDescriptorSets map.
-        m_allocatedDescriptorSets.erase(descriptorSet);
-
-        // Decrement the number of allocated descriptor sets for the pool.
-        --m_allocatedSets[poolIndex];
+        // Give an emptied block to the other sub-pools, keeping at least one block per sub-pool.
+        if (--pBlock->allocatedSets == 0 && subPool->blocks.size() > 1)
+        {
+            subPool->blocks.erase(std::find(subPool->blocks.begin(), subPool->blocks.end(), pBlock));
 
-        // Set the next allocation to use this pool index.
-        m_currentAllocationPoolIndex = poolIndex;
+            m_spinLock.Lock();
+            m_spareBlocks.push_back(pBlock);
+            m_spinLock.Unlock();
+        }
 
-        // Unlock access to internal resources.
-        m_spinLock.Unlock();
+        // Unlock access to the sub-pool.
+        subPool->spinLock.Unlock();
 
         // Return success.
         return VK_SUCCESS;
-    }    
-}
\ No newline at end of file
+    }
+
+    LinearDescriptorPool::LinearDescriptorPool(DescriptorSetLayout* layout)
+        : m_layout(layout)
+    {
+        // Count the descriptors of each type a single set of the layout requires.
+        std::unordered_map<VkDescriptorType, uint32_t> descriptorTypeCounts;
+        for (auto& binding : layout->GetBindings())
+            descriptorTypeCounts[binding.descriptorType] += binding.descriptorCount;
+
+        for (auto& it : descriptorTypeCounts)
+            m_layoutSizes.push_back({ it.first, it.second });
+    }
+
+    LinearDescriptorPool::~LinearDescriptorPool()
+    {
+        // Destroying the pools frees all of their descriptor sets.
+        for (auto pool : m_pools)
+            vkDestroyDescriptorPool(m_layout->GetDevice()->GetHandle(), pool, nullptr);
+    }
+
+    VkDescriptorSet LinearDescriptorPool::AllocateDescriptorSet()
+    {
+        // Move on to the next pool once the current one is full.
+        if (m_currentPoolIndex < m_pools.size() && m_allocatedSets == m_maxSets[m_currentPoolIndex])
+        {
+            ++m_currentPoolIndex;
+            m_allocatedSets = 0;
+        }
+
+        // Create a new pool twice the size of the last one if necessary.
+        if (m_currentPoolIndex == m_pools.size())
+        {
+            auto maxSets = m_maxSets.empty() ? m_initialSetsPerPool : m_maxSets.back() * 2;
+            auto poolSizes = m_layoutSizes;
+            for (auto& poolSize : poolSizes)
+                poolSize.descriptorCount *= maxSets;
+
+            VkDescriptorPoolCreateInfo createInfo = {};
+            createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            createInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+            createInfo.pPoolSizes = poolSizes.data();
+            createInfo.maxSets = maxSets;
+            VkDescriptorPool handle = VK_NULL_HANDLE;
+            auto result = vkCreateDescriptorPool(m_layout->GetDevice()->GetHandle(), &createInfo, nullptr, &handle);
+            if (result != VK_SUCCESS)
+                return VK_NULL_HANDLE;
+
+            m_pools.push_back(handle);
+            m_maxSets.push_back(maxSets);
+        }
+
+        // Allocate the next descriptor set from the current pool.
+        VkDescriptorSetLayout setLayout = m_layout->GetHandle();
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = m_pools[m_currentPoolIndex];
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &setLayout;
+        VkDescriptorSet handle = VK_NULL_HANDLE;
+        auto result = vkAllocateDescriptorSets(m_layout->GetDevice()->GetHandle(), &allocInfo, &handle);
+        if (result != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+
+        ++m_allocatedSets;
+        return handle;
+    }
+
+    void LinearDescriptorPool::Reset()
+    {
+        // Return every set allocated since the last reset at once.
+        for (auto i = 0U; i <= m_currentPoolIndex && i < m_pools.size(); ++i)
+            vkResetDescriptorPool(m_layout->GetDevice()->GetHandle(), m_pools[i], 0);
+
+        m_currentPoolIndex = 0;
+        m_allocatedSets = 0;
+    }
+}
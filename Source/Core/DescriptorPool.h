@@ -31,6 +31,23 @@ namespace vez
 {
     class DescriptorSetLayout;
 
+    // Vulkan descriptor pool owned by one of a DescriptorPool's sub-pools.  Each descriptor set is freed back to the block it was allocated from.
+    struct DescriptorPoolBlock
+    {
+        VkDescriptorPool handle;
+        uint32_t allocatedSets;
+        uint32_t subPoolIndex;
+    };
+
+    /* IMPLEMENTATION NOTES:
+        This class allocates the descriptor sets of a single layout for all threads.
+
+        Blocks of Vulkan descriptor pools are split between sub-pools, one per hardware thread.  Each thread is assigned the next sub-pool
+        index in round-robin order the first time it allocates, so threads only share a sub-pool once there are more of them than hardware
+        threads and allocation does not contend with other threads in the common case.  Sets may be freed from any thread,
+        locking the sub-pool owning their block.  When a sub-pool runs dry it takes a spare block emptied by another sub-pool before
+        creating a new one.  Only the spare blocks are shared between sub-pools, behind a single lock.
+    */
     class DescriptorPool
     {
     public:
@@ -38,19 +55,47 @@ namespace vez
 
         ~DescriptorPool();
 
-        VkDescriptorSet AllocateDescriptorSet();
+        // Allocates a descriptor set from the calling thread's sub-pool and returns the block it was allocated from.
+        VkDescriptorSet AllocateDescriptorSet(DescriptorPoolBlock** ppBlock);
 
-        VkResult FreeDescriptorSet(VkDescriptorSet descriptorSet);
+        VkResult FreeDescriptorSet(VkDescriptorSet descriptorSet, DescriptorPoolBlock* pBlock);
 
     private:
+        struct SubPool
+        {
+            std::vector<DescriptorPoolBlock*> blocks;
+            SpinLock spinLock;
+        };
+
         DescriptorSetLayout* m_layout = nullptr;
         std::vector<VkDescriptorPoolSize> m_poolSizes;
-        std::vector<VkDescriptorPool> m_pools;
-        std::vector<uint32_t> m_allocatedSets;
-        uint32_t m_currentAllocationPoolIndex = 0;
         uint32_t m_maxSetsPerPool = 50;
-
-        std::unordered_map<VkDescriptorSet, uint32_t> m_allocatedDescriptorSets;
+        std::vector<SubPool*> m_subPools;
+        std::vector<DescriptorPoolBlock*> m_spareBlocks;
         SpinLock m_spinLock;
     };
+
+    // Descriptor pool for transient descriptor sets of a single layout used by one command buffer.  Sets are bump allocated and never freed
+    // individually, instead all pools are reset at once when the command buffer is recorded again.  Each new pool holds twice as many sets
+    // as the one before it, and pools are kept across resets.
+    class LinearDescriptorPool
+    {
+    public:
+        LinearDescriptorPool(DescriptorSetLayout* layout);
+
+        ~LinearDescriptorPool();
+
+        VkDescriptorSet AllocateDescriptorSet();
+
+        void Reset();
+
+    private:
+        DescriptorSetLayout* m_layout = nullptr;
+        std::vector<VkDescriptorPoolSize> m_layoutSizes;
+        std::vector<VkDescriptorPool> m_pools;
+        std::vector<uint32_t> m_maxSets;
+        uint32_t m_currentPoolIndex = 0;
+        uint32_t m_allocatedSets = 0;
+        uint32_t m_initialSetsPerPool = 16;
+    };
 }
\ No newline at end of file
@@ -0,0 +1,196 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "Utility/VkHelpers.h"
+#include "Device.h"
+#include "DescriptorSetLayout.h"
+#include "DescriptorSetCache.h"
+
+namespace vez
+{
+    DescriptorSetCache::DescriptorSetCache(Device* device)
+        : m_device(device)
+    {
+
+    }
+
+    DescriptorSetCache::~DescriptorSetCache()
+    {
+        for (auto& it : m_entries)
+            it.second.layout->FreeDescriptorSet(it.first, it.second.poolBlock);
+    }
+
+    VkDescriptorSet DescriptorSetCache::AcquireDescriptorSet(DescriptorSetLayout* pLayout, const DescriptorSetContents& contents, const std::vector<uint64_t>& resources, const DescriptorRecord* pRecords, std::vector<VkWriteDescriptorSet>& descriptorWrites)
+    {
+        // Acquire access to the cache.
+        m_spinLock.Lock();
+
+        // Retain a cached descriptor set with identical contents.
+        auto it = m_lookup.find(contents);
+        if (it != m_lookup.end())
+        {
+            auto& entry = m_entries.at(it->second);
+            if (entry.references++ == 0)
+                m_unusedDescriptorSets.erase(entry.unusedPosition);
+
+            auto descriptorSet = it->second;
+            m_spinLock.Unlock();
+            return descriptorSet;
+        }
+
+        // Release access to the cache while allocating and writing a new descriptor set, which only locks the calling thread's sub-pool.
+        m_spinLock.Unlock();
+
+        DescriptorPoolBlock* poolBlock = nullptr;
+        auto descriptorSet = pLayout->AllocateDescriptorSet(&poolBlock);
+        if (!descriptorSet)
+            return VK_NULL_HANDLE;
+
+        pLayout->UpdateDescriptorSet(descriptorSet, pRecords, descriptorWrites);
+
+        // Count the descriptors the set holds towards the cache's budget.
+        auto descriptorCount = pLayout->GetDescriptorCount();
+
+        // Reacquire access to the cache.  If another thread added an identical set meanwhile, retain it instead.
+        m_spinLock.Lock();
+        it = m_lookup.find(contents);
+        if (it != m_lookup.end())
+        {
+            auto& entry = m_entries.at(it->second);
+            if (entry.references++ == 0)
+                m_unusedDescriptorSets.erase(entry.unusedPosition);
+
+            auto cachedDescriptorSet = it->second;
+            m_spinLock.Unlock();
+
+            pLayout->FreeDescriptorSet(descriptorSet, poolBlock);
+            return cachedDescriptorSet;
+        }
+
+        // Add the cache entry, retained by the caller.
+        DescriptorSetEntry entry = { pLayout, poolBlock, m_lookup.emplace(contents, descriptorSet).first, resources, descriptorCount, 1U, m_unusedDescriptorSets.end() };
+        m_entries.emplace(descriptorSet, std::move(entry));
+        for (auto handle : resources)
+            m_resourceDescriptorSets.emplace(handle, descriptorSet);
+
+        m_descriptorCount += descriptorCount;
+        EvictUnusedDescriptorSets();
+
+        // Release access to the cache.
+        m_spinLock.Unlock();
+
+        // Return descriptor set handle.
+        return descriptorSet;
+    }
+
+    void DescriptorSetCache::ReleaseDescriptorSet(VkDescriptorSet descriptorSet)
+    {
+        // Acquire access to the cache.
+        m_spinLock.Lock();
+
+        // Free invalidated sets once no longer retained, otherwise keep them as the most recently used.
+        auto it = m_entries.find(descriptorSet);
+        if (it != m_entries.end() && --it->second.references == 0)
+        {
+            if (it->second.lookup == m_lookup.end())
+            {
+                FreeDescriptorSet(descriptorSet);
+            }
+            else
+            {
+                it->second.unusedPosition = m_unusedDescriptorSets.insert(m_unusedDescriptorSets.end(), descriptorSet);
+                EvictUnusedDescriptorSets();
+            }
+        }
+
+        // Release access to the cache.
+        m_spinLock.Unlock();
+    }
+
+    void DescriptorSetCache::InvalidateResource(uint64_t handle)
+    {
+        // Acquire access to the cache.
+        m_spinLock.Lock();
+
+        // Find the descriptor sets referencing the resource.
+        std::vector<VkDescriptorSet> descriptorSets;
+        auto range = m_resourceDescriptorSets.equal_range(handle);
+        for (auto it = range.first; it != range.second; ++it)
+            descriptorSets.push_back(it->second);
+
+        // Remove them from the lookup so they are never returned again, and free the ones no longer retained.
+        for (auto descriptorSet : descriptorSets)
+        {
+            auto it = m_entries.find(descriptorSet);
+            if (it == m_entries.end() || it->second.lookup == m_lookup.end())
+                continue;
+
+            m_lookup.erase(it->second.lookup);
+            it->second.lookup = m_lookup.end();
+            if (it->second.references == 0)
+            {
+                m_unusedDescriptorSets.erase(it->second.unusedPosition);
+                FreeDescriptorSet(descriptorSet);
+            }
+        }
+
+        // Release access to the cache.
+        m_spinLock.Unlock();
+    }
+
+    void DescriptorSetCache::FreeDescriptorSet(VkDescriptorSet descriptorSet)
+    {
+        auto it = m_entries.find(descriptorSet);
+        auto& entry = it->second;
+
+        // Remove the set's lookup and resource references.
+        if (entry.lookup != m_lookup.end())
+            m_lookup.erase(entry.lookup);
+
+        for (auto handle : entry.resources)
+        {
+            auto range = m_resourceDescriptorSets.equal_range(handle);
+            for (auto resourceIt = range.first; resourceIt != range.second; ++resourceIt)
+            {
+                if (resourceIt->second == descriptorSet)
+                {
+                    m_resourceDescriptorSets.erase(resourceIt);
+                    break;
+                }
+            }
+        }
+
+        // Return the set to its layout's pool.
+        m_descriptorCount -= entry.descriptorCount;
+        entry.layout->FreeDescriptorSet(descriptorSet, entry.poolBlock);
+        m_entries.erase(it);
+    }
+
+    void DescriptorSetCache::EvictUnusedDescriptorSets()
+    {
+        while (m_descriptorCount > m_descriptorBudget && !m_unusedDescriptorSets.empty())
+        {
+            auto descriptorSet = m_unusedDescriptorSets.front();
+            m_unusedDescriptorSets.pop_front();
+            FreeDescriptorSet(descriptorSet);
+        }
+    }
+}
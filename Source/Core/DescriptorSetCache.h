@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+
+#include <vector>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include "Utility/SpinLock.h"
+#include "VEZ.h"
+
+namespace vez
+{
+    class Device;
+    class DescriptorSetLayout;
+    union DescriptorRecord;
+    struct DescriptorPoolBlock;
+
+    // Exact description of a descriptor set's layout and written descriptors, used to share identical descriptor sets between recordings.
+    typedef std::vector<uint64_t> DescriptorSetContents;
+
+    /* IMPLEMENTATION NOTES:
+        This class shares descriptor sets with identical contents between all command buffers recorded on a device.
+
+        Descriptor sets are looked up by their contents in an STL map.  A set is allocated and written on first use without holding the cache's
+        lock, never updated again and retained by every recording binding it until that recording is reset, which Vulkan only allows once the
+        command buffer has completed execution.  When two threads write identical sets at once, the second one is freed again.  Sets no longer retained stay cached in least recently used order and are freed once the descriptors held by the cache
+        exceed its budget.
+
+        Destroying a buffer, buffer view, image view or sampler removes the sets referencing its handle from the cache, since the handle may be
+        reused by a new object.  Sets still retained by recordings are freed once released.
+    */
+    class DescriptorSetCache
+    {
+    public:
+        DescriptorSetCache(Device* device);
+
+        ~DescriptorSetCache();
+
+        // Returns a descriptor set with the given contents, allocating one and writing it from the descriptor records or writes when none is cached.
+        // The handles of the resources the writes reference are given so the set can be invalidated when one is destroyed.
+        // The returned set must be released once no recording uses it anymore.
+        VkDescriptorSet AcquireDescriptorSet(DescriptorSetLayout* pLayout, const DescriptorSetContents& contents, const std::vector<uint64_t>& resources, const DescriptorRecord* pRecords, std::vector<VkWriteDescriptorSet>& descriptorWrites);
+
+        void ReleaseDescriptorSet(VkDescriptorSet descriptorSet);
+
+        // Removes the descriptor sets referencing a destroyed resource handle.
+        void InvalidateResource(uint64_t handle);
+
+    private:
+        struct DescriptorSetEntry
+        {
+            DescriptorSetLayout* layout;
+            DescriptorPoolBlock* poolBlock;
+            std::map<DescriptorSetContents, VkDescriptorSet>::iterator lookup;
+            std::vector<uint64_t> resources;
+            uint32_t descriptorCount;
+            uint32_t references;
+            std::list<VkDescriptorSet>::iterator unusedPosition;
+        };
+
+        // Frees a descriptor set no longer retained by any recording.
+        void FreeDescriptorSet(VkDescriptorSet descriptorSet);
+
+        // Frees the least recently used sets no longer retained until the cache is within its budget.
+        void EvictUnusedDescriptorSets();
+
+        Device* m_device = nullptr;
+        std::map<DescriptorSetContents, VkDescriptorSet> m_lookup;
+        std::unordered_map<VkDescriptorSet, DescriptorSetEntry> m_entries;
+        std::unordered_multimap<uint64_t, VkDescriptorSet> m_resourceDescriptorSets;
+        std::list<VkDescriptorSet> m_unusedDescriptorSets;
+        uint64_t m_descriptorCount = 0;
+        const uint64_t m_descriptorBudget = 65536ULL;
+        SpinLock m_spinLock;
+    };
+}
@@ -27,12 +27,13 @@
 
 namespace vez
 {
-    VkResult DescriptorSetLayout::Create(Device* device, const DescriptorSetLayoutHash& hash, const std::vector<VezPipelineResource>& setResources, DescriptorSetLayout** pLayout)
+    VkResult DescriptorSetLayout::Create(Device* device, const DescriptorSetLayoutHash& hash, const std::vector<VezPipelineResource>& setResources, bool pushDescriptor, DescriptorSetLayout** pLayout)
     {
         // Create a new DescriptorPool instance.
         auto descriptorSetLayout = new DescriptorSetLayout;
         descriptorSetLayout->m_device = device;
         descriptorSetLayout->m_hash = hash;
+        descriptorSetLayout->m_pushDescriptor = pushDescriptor;
 
         // Static mapping between VulkanEZ pipeline resource types to Vulkan descriptor types.
         std::unordered_map<VezPipelineResourceType, VkDescriptorType> resourceTypeMapping = {
@@ -81,6 +82,10 @@ namespace vez
         // Create the Vulkan descriptor set layout handle.
         VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
         layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+#ifdef VK_KHR_push_descriptor
+        if (pushDescriptor)
+            layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+#endif
         layoutCreateInfo.bindingCount = static_cast<uint32_t>(descriptorSetLayout->m_bindings.size());
         layoutCreateInfo.pBindings = descriptorSetLayout->m_bindings.data();
         auto result = vkCreateDescriptorSetLayout(descriptorSetLayout->m_device->GetHandle(), &layoutCreateInfo, nullptr, &descriptorSetLayout->m_handle);
@@ -90,8 +95,48 @@ namespace vez
             return result;
         }
 
-        // Allocate a DescriptorPool from the new instance.
-        descriptorSetLayout->m_descriptorPool = new DescriptorPool(descriptorSetLayout);
+#ifdef VK_KHR_descriptor_update_template
+        // Create a descriptor update template writing every descriptor of a set from its packed records when the extension is enabled.
+        std::vector<VkDescriptorUpdateTemplateEntryKHR> templateEntries;
+        for (auto& binding : descriptorSetLayout->m_bindings)
+        {
+            descriptorSetLayout->m_recordIndices.emplace(binding.binding, descriptorSetLayout->m_descriptorCount);
+            if (binding.descriptorCount > 0)
+            {
+                auto offset = static_cast<size_t>(descriptorSetLayout->m_descriptorCount) * sizeof(DescriptorRecord);
+                templateEntries.push_back({ binding.binding, 0, binding.descriptorCount, binding.descriptorType, offset, sizeof(DescriptorRecord) });
+                descriptorSetLayout->m_descriptorCount += binding.descriptorCount;
+            }
+        }
+
+        auto createDescriptorUpdateTemplate = device->GetCreateDescriptorUpdateTemplate();
+        if (createDescriptorUpdateTemplate && !templateEntries.empty() && !pushDescriptor)
+        {
+            VkDescriptorUpdateTemplateCreateInfoKHR templateCreateInfo = {};
+            templateCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+            templateCreateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(templateEntries.size());
+            templateCreateInfo.pDescriptorUpdateEntries = templateEntries.data();
+            templateCreateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+            templateCreateInfo.descriptorSetLayout = descriptorSetLayout->m_handle;
+            result = createDescriptorUpdateTemplate(device->GetHandle(), &templateCreateInfo, nullptr, &descriptorSetLayout->m_updateTemplate);
+            if (result != VK_SUCCESS)
+            {
+                delete descriptorSetLayout;
+                return result;
+            }
+        }
+#else
+        // Assign each binding's array elements their records.
+        for (auto& binding : descriptorSetLayout->m_bindings)
+        {
+            descriptorSetLayout->m_recordIndices.emplace(binding.binding, descriptorSetLayout->m_descriptorCount);
+            descriptorSetLayout->m_descriptorCount += binding.descriptorCount;
+        }
+#endif
+
+        // Allocate a DescriptorPool from the new instance, unless descriptors are pushed and need no pool space.
+        if (!pushDescriptor)
+            descriptorSetLayout->m_descriptorPool = new DescriptorPool(descriptorSetLayout);
 
         // Save handle.
         *pLayout = descriptorSetLayout;
@@ -102,6 +147,10 @@ namespace vez
 
     DescriptorSetLayout::~DescriptorSetLayout()
     {
+#ifdef VK_KHR_descriptor_update_template
+        if (m_updateTemplate)
+            m_device->GetDestroyDescriptorUpdateTemplate()(m_device->GetHandle(), m_updateTemplate, nullptr);
+#endif
         vkDestroyDescriptorSetLayout(m_device->GetHandle(), m_handle, nullptr);
         delete m_descriptorPool;
     }
@@ -116,15 +165,32 @@ namespace vez
         return true;
     }
 
-    VkDescriptorSet DescriptorSetLayout::AllocateDescriptorSet()
+    void DescriptorSetLayout::UpdateDescriptorSet(VkDescriptorSet descriptorSet, const DescriptorRecord* pRecords, std::vector<VkWriteDescriptorSet>& descriptorWrites)
+    {
+#ifdef VK_KHR_descriptor_update_template
+        // Each descriptor write covers a single array element, so they cover all descriptors when there are as many.
+        if (m_updateTemplate && descriptorWrites.size() == m_descriptorCount)
+        {
+            m_device->GetUpdateDescriptorSetWithTemplate()(m_device->GetHandle(), descriptorSet, m_updateTemplate, pRecords);
+            return;
+        }
+#endif
+
+        for (auto& dsWrite : descriptorWrites)
+            dsWrite.dstSet = descriptorSet;
+
+        vkUpdateDescriptorSets(m_device->GetHandle(), static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    VkDescriptorSet DescriptorSetLayout::AllocateDescriptorSet(DescriptorPoolBlock** ppBlock)
     {
         // Return new descriptor set allocation.
-        return m_descriptorPool->AllocateDescriptorSet();
+        return m_descriptorPool->AllocateDescriptorSet(ppBlock);
     }
 
-    VkResult DescriptorSetLayout::FreeDescriptorSet(VkDescriptorSet descriptorSet)
+    VkResult DescriptorSetLayout::FreeDescriptorSet(VkDescriptorSet descriptorSet, DescriptorPoolBlock* pBlock)
     {
         // Free descriptor set handle.
-        return m_descriptorPool->FreeDescriptorSet(descriptorSet);
+        return m_descriptorPool->FreeDescriptorSet(descriptorSet, pBlock);
     }
 }
\ No newline at end of file
@@ -31,11 +31,12 @@ namespace vez
 {
     class Device;
     class DescriptorPool;
+    struct DescriptorPoolBlock;
 
     class DescriptorSetLayout
     {
     public:
-        static VkResult Create(Device* device, const DescriptorSetLayoutHash& hash, const std::vector<VezPipelineResource>& setResources, DescriptorSetLayout** pLayout);
+        static VkResult Create(Device* device, const DescriptorSetLayoutHash& hash, const std::vector<VezPipelineResource>& setResources, bool pushDescriptor, DescriptorSetLayout** pLayout);
 
         ~DescriptorSetLayout();
 
@@ -49,9 +50,22 @@ namespace vez
 
         bool GetLayoutBinding(uint32_t bindingIndex, VkDescriptorSetLayoutBinding** pBinding);
 
-        VkDescriptorSet AllocateDescriptorSet();
+        // Returns whether the layout's descriptors are pushed into command buffers rather than allocated in descriptor sets.
+        bool IsPushDescriptor() const { return m_pushDescriptor; }
 
-        VkResult FreeDescriptorSet(VkDescriptorSet descriptorSet);
+        // Returns the number of descriptors in a set, each having its own record.
+        uint32_t GetDescriptorCount() const { return m_descriptorCount; }
+
+        // Returns the index of the record of a binding's first array element.
+        uint32_t GetRecordIndex(uint32_t bindingIndex) const { return m_recordIndices.at(bindingIndex); }
+
+        // Writes every descriptor of a set from its records with the layout's update template when the descriptor writes cover all of them,
+        // otherwise applies the descriptor writes.
+        void UpdateDescriptorSet(VkDescriptorSet descriptorSet, const DescriptorRecord* pRecords, std::vector<VkWriteDescriptorSet>& descriptorWrites);
+
+        VkDescriptorSet AllocateDescriptorSet(DescriptorPoolBlock** ppBlock);
+
+        VkResult FreeDescriptorSet(VkDescriptorSet descriptorSet, DescriptorPoolBlock* pBlock);
 
     private:
         Device* m_device = nullptr;
@@ -59,6 +73,12 @@ namespace vez
         VkDescriptorSetLayout m_handle = VK_NULL_HANDLE;
         std::vector<VkDescriptorSetLayoutBinding> m_bindings;
         std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> m_bindingsLookup;
-        DescriptorPool* m_descriptorPool;
+        std::unordered_map<uint32_t, uint32_t> m_recordIndices;
+        uint32_t m_descriptorCount = 0;
+        bool m_pushDescriptor = false;
+#ifdef VK_KHR_descriptor_update_template
+        VkDescriptorUpdateTemplateKHR m_updateTemplate = VK_NULL_HANDLE;
+#endif
+        DescriptorPool* m_descriptorPool = nullptr;
     };    
 }
\ No newline at end of file
@@ -27,7 +27,7 @@
 
 namespace vez
 {
-    static DescriptorSetLayoutHash GetHash(uint32_t setIndex, const std::vector<VezPipelineResource>& setResources)
+    static DescriptorSetLayoutHash GetHash(uint32_t setIndex, const std::vector<VezPipelineResource>& setResources, bool pushDescriptor)
     {
         // Descriptor set layout binding bit field declaration for generating hash.
         struct DescriptorSetLayoutBindingBitField
@@ -39,9 +39,10 @@ namespace vez
         };
 
         // Generate bit field entries for each descriptor set resource.
-        DescriptorSetLayoutHash hash(1 + setResources.size() * (sizeof(DescriptorSetLayoutBindingBitField) / 4));
+        DescriptorSetLayoutHash hash(2 + setResources.size() * (sizeof(DescriptorSetLayoutBindingBitField) / 4));
         hash[0] = setIndex;
-        DescriptorSetLayoutBindingBitField* bitfield = reinterpret_cast<DescriptorSetLayoutBindingBitField*>(&hash[1]);
+        hash[1] = pushDescriptor ? 1U : 0U;
+        DescriptorSetLayoutBindingBitField* bitfield = reinterpret_cast<DescriptorSetLayoutBindingBitField*>(&hash[2]);
         for (auto i = 0U; i < setResources.size(); ++i)
         {
             bitfield->binding = setResources[i].binding;
@@ -69,10 +70,10 @@ namespace vez
         }
     }
 
-    VkResult DescriptorSetLayoutCache::CreateLayout(uint32_t setIndex, const std::vector<VezPipelineResource>& setResources, DescriptorSetLayout** pLayout)
+    VkResult DescriptorSetLayoutCache::CreateLayout(uint32_t setIndex, const std::vector<VezPipelineResource>& setResources, bool pushDescriptor, DescriptorSetLayout** pLayout)
     {
         // Generate hash from resource layout.
-        auto hash = GetHash(setIndex, setResources);
+        auto hash = GetHash(setIndex, setResources, pushDescriptor);
 
         // Find or create a DescriptorSetLayout instance for the given descriptor set resouces.  Make thread-safe.
         DescriptorSetLayout* descriptorSetLayout = nullptr;
@@ -90,7 +91,7 @@ namespace vez
         }
         else
         {
-            auto result = DescriptorSetLayout::Create(m_device, hash, setResources, &descriptorSetLayout);
+            auto result = DescriptorSetLayout::Create(m_device, hash, setResources, pushDescriptor, &descriptorSetLayout);
             if (result == VK_SUCCESS)
             {
                 m_layouts.emplace(std::move(hash), descriptorSetLayout);
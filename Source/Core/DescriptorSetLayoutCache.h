@@ -40,7 +40,7 @@ namespace vez
 
         ~DescriptorSetLayoutCache();
 
-        VkResult CreateLayout(uint32_t setIndex, const std::vector<VezPipelineResource>& setResources, DescriptorSetLayout** pLayout);
+        VkResult CreateLayout(uint32_t setIndex, const std::vector<VezPipelineResource>& setResources, bool pushDescriptor, DescriptorSetLayout** pLayout);
 
         void DestroyLayout(DescriptorSetLayout* layout);
 
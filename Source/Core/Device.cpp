@@ -20,6 +20,7 @@
 // THE SOFTWARE.
 //
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <array>
 #include <unordered_map>
@@ -29,6 +30,7 @@
 #include "Utility/VkHelpers.h"
 #include "Utility/SpinLock.h"
 #include "Utility/ThreadPool.h"
+#include "Utility/MemoryBlockPool.h"
 #include "Utility/ObjectLookup.h"
 #include "Instance.h"
 #include "PhysicalDevice.h"
@@ -41,6 +43,7 @@
 #include "PipelineCache.h"
 #include "DescriptorSetLayoutCache.h"
 #include "RenderPassCache.h"
+#include "DescriptorSetCache.h"
 #include "Buffer.h"
 #include "Image.h"
 #include "ImageView.h"
@@ -99,6 +102,33 @@ namespace vez
         deviceCreateInfo.enabledExtensionCount = pCreateInfo->enabledExtensionCount;
         deviceCreateInfo.ppEnabledExtensionNames = pCreateInfo->ppEnabledExtensionNames;
 
+#ifdef VK_KHR_synchronization2
+        // Enable the synchronization2 feature when the application enables VK_KHR_synchronization2, along with the instance extensions it depends on.
+        // Applications chaining the feature structure themselves decide whether it is enabled.
+        bool synchronization2 = std::any_of(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->ppEnabledExtensionNames + pCreateInfo->enabledExtensionCount, [](const char* pName) {
+            return strcmp(pName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0;
+        });
+
+        bool synchronization2Chained = false;
+        for (auto pNext = reinterpret_cast<const VkBaseInStructure*>(pCreateInfo->pNext); pNext; pNext = pNext->pNext)
+        {
+            if (pNext->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR)
+            {
+                synchronization2Chained = true;
+                synchronization2 = synchronization2 && (reinterpret_cast<const VkPhysicalDeviceSynchronization2FeaturesKHR*>(pNext)->synchronization2 == VK_TRUE);
+            }
+        }
+
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = {};
+        if (synchronization2 && !synchronization2Chained)
+        {
+            synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+            synchronization2Features.pNext = const_cast<void*>(pCreateInfo->pNext);
+            synchronization2Features.synchronization2 = VK_TRUE;
+            deviceCreateInfo.pNext = &synchronization2Features;
+        }
+#endif
+
         VkDevice handle = VK_NULL_HANDLE;
         auto result = vkCreateDevice(pPhysicalDevice->GetHandle(), &deviceCreateInfo, nullptr, &handle);
         if (result != VK_SUCCESS)
@@ -109,10 +139,43 @@ namespace vez
         memcpy(&device->m_createInfo, pCreateInfo, sizeof(VezDeviceCreateInfo));
         device->m_physicalDevice = pPhysicalDevice;
         device->m_handle = handle;
+        device->m_enabledFeatures = enabledFeatures;
+
+        VkPhysicalDeviceProperties properties = {};
+        vkGetPhysicalDeviceProperties(pPhysicalDevice->GetHandle(), &properties);
+        device->m_limits = properties.limits;
+#ifdef VK_KHR_synchronization2
+        if (synchronization2)
+            device->m_cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(vkGetDeviceProcAddr(handle, "vkCmdPipelineBarrier2KHR"));
+#endif
+#ifdef VK_KHR_push_descriptor
+        // Small descriptor sets are pushed into command buffers when the application enables VK_KHR_push_descriptor.
+        bool pushDescriptor = std::any_of(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->ppEnabledExtensionNames + pCreateInfo->enabledExtensionCount, [](const char* pName) {
+            return strcmp(pName, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) == 0;
+        });
+
+        if (pushDescriptor)
+            device->m_cmdPushDescriptorSet = reinterpret_cast<PFN_vkCmdPushDescriptorSetKHR>(vkGetDeviceProcAddr(handle, "vkCmdPushDescriptorSetKHR"));
+#endif
+#ifdef VK_KHR_descriptor_update_template
+        // Descriptor sets are written with update templates when the application enables VK_KHR_descriptor_update_template.
+        bool descriptorUpdateTemplate = std::any_of(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->ppEnabledExtensionNames + pCreateInfo->enabledExtensionCount, [](const char* pName) {
+            return strcmp(pName, VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME) == 0;
+        });
+
+        if (descriptorUpdateTemplate)
+        {
+            device->m_createDescriptorUpdateTemplate = reinterpret_cast<PFN_vkCreateDescriptorUpdateTemplateKHR>(vkGetDeviceProcAddr(handle, "vkCreateDescriptorUpdateTemplateKHR"));
+            device->m_destroyDescriptorUpdateTemplate = reinterpret_cast<PFN_vkDestroyDescriptorUpdateTemplateKHR>(vkGetDeviceProcAddr(handle, "vkDestroyDescriptorUpdateTemplateKHR"));
+            device->m_updateDescriptorSetWithTemplate = reinterpret_cast<PFN_vkUpdateDescriptorSetWithTemplateKHR>(vkGetDeviceProcAddr(handle, "vkUpdateDescriptorSetWithTemplateKHR"));
+        }
+#endif
         device->m_syncPrimitivesPool = new SyncPrimitivesPool(device);
         device->m_pipelineCache = new PipelineCache(device);
         device->m_descriptorSetLayoutCache = new DescriptorSetLayoutCache(device);
-        device->m_renderPassCache = new RenderPassCache(device);        
+        device->m_descriptorSetCache = new DescriptorSetCache(device);
+        device->m_renderPassCache = new RenderPassCache(device);
+        device->m_streamBlockPool = new MemoryBlockPool();
 
         // Get handles to all of the previously enumerated and created queues.
         device->m_queues.resize(queueFamilyCount);        
@@ -213,6 +276,32 @@ namespace vez
         return bestQueue;
     }
 
+    void Device::InvalidateResource(uint64_t handle)
+    {
+        m_descriptorSetCache->InvalidateResource(handle);
+
+        // Notify every memoizing stream encoder so a new object reusing the handle never matches a previous recording.
+        m_memoizingStreamEncodersLock.Lock();
+        for (auto streamEncoder : m_memoizingStreamEncoders)
+            streamEncoder->InvalidateResource(handle);
+
+        m_memoizingStreamEncodersLock.Unlock();
+    }
+
+    void Device::AddMemoizingStreamEncoder(StreamEncoder* pStreamEncoder)
+    {
+        m_memoizingStreamEncodersLock.Lock();
+        m_memoizingStreamEncoders.insert(pStreamEncoder);
+        m_memoizingStreamEncodersLock.Unlock();
+    }
+
+    void Device::RemoveMemoizingStreamEncoder(StreamEncoder* pStreamEncoder)
+    {
+        m_memoizingStreamEncodersLock.Lock();
+        m_memoizingStreamEncoders.erase(pStreamEncoder);
+        m_memoizingStreamEncodersLock.Unlock();
+    }
+
     CommandPool* Device::GetCommandPool(Queue* queue)
     {
         CommandPool* pool = nullptr;
@@ -261,20 +350,20 @@ namespace vez
         return pool;
     }
 
-    VkResult Device::AllocateCommandBuffers(Queue* pQueue, const void* pNext, uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers, uint64_t streamEncoderBlockSize)
+    VkResult Device::AllocateCommandBuffers(Queue* pQueue, const void* pNext, VkCommandBufferLevel level, uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers)
     {
         // Get or create a CommandPool for the given queue and threadID.
         CommandPool* pool = GetCommandPool(pQueue);
 
         // Allocate object handles.
         std::vector<VkCommandBuffer> handles(commandBufferCount);
-        auto result = pool->AllocateCommandBuffers(pNext, commandBufferCount, handles.data());
+        auto result = pool->AllocateCommandBuffers(pNext, level, commandBufferCount, handles.data());
         if (result != VK_SUCCESS)
             return result;
 
         // Wrap handles with CommandBuffer class instances.
         for (auto i = 0U; i < commandBufferCount; ++i)
-            ppCommandBuffers[i] = new CommandBuffer(pool, handles[i], streamEncoderBlockSize);
+            ppCommandBuffers[i] = new CommandBuffer(pool, handles[i], level, m_streamBlockPool);
 
         // Return success.
         return VK_SUCCESS;
@@ -357,6 +446,9 @@ namespace vez
 
     void Device::DestroyBuffer(Buffer* pBuffer)
     {
+        // Cached descriptor sets and memoized recordings must not outlive the buffer.
+        InvalidateResource(reinterpret_cast<uint64_t>(pBuffer->GetHandle()));
+
         if (pBuffer->GetAllocation() != VK_NULL_HANDLE)
             vmaDestroyBuffer(m_memAllocator, pBuffer->GetHandle(), pBuffer->GetAllocation());
         else
@@ -446,6 +538,25 @@ namespace vez
         vmaUnmapMemory(m_memAllocator, pBuffer->GetAllocation());
     }
 
+    VkResult Device::FlushBuffer(Buffer* pBuffer)
+    {
+        VmaAllocationInfo allocInfo = {};
+        vmaGetAllocationInfo(m_memAllocator, pBuffer->GetAllocation(), &allocInfo);
+
+        VkMemoryPropertyFlags memoryFlags = 0;
+        vmaGetMemoryTypeProperties(m_memAllocator, allocInfo.memoryType, &memoryFlags);
+        if (memoryFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+            return VK_SUCCESS;
+
+        // The range is flushed to the end of the memory block so it always ends on a non coherent atom boundary.
+        VkMappedMemoryRange memoryRange = {};
+        memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        memoryRange.memory = allocInfo.deviceMemory;
+        memoryRange.offset = allocInfo.offset - (allocInfo.offset % m_limits.nonCoherentAtomSize);
+        memoryRange.size = VK_WHOLE_SIZE;
+        return vkFlushMappedMemoryRanges(m_handle, 1, &memoryRange);
+    }
+
     VkResult Device::FlushMappedBufferRanges(uint32_t bufferRangeCount, const VezMappedBufferRange* pBufferRanges)
     {
         std::vector<VkMappedMemoryRange> memoryRanges(bufferRangeCount);
@@ -551,24 +662,23 @@ namespace vez
             result = vkCreateImage(m_handle, &imageCreateInfo, nullptr, &handle);
         }
 
-        // Determine a "default" image layout based on the usage.  This default image layout will be assumed during command buffer recording.
+        // Determine a "default" image layout based on the usage.  This default image layout will be assumed during command buffer recording
+        // until the image is first used, after which it rests in the layout its last access left it in.
         // Ordering of conditional statements below determine image layout precedence.
-        // Example: When usage is SAMPLED_BIT, that takes precendence over the image being used as a color attachment or for transfer operations.
+        // Example: When usage is SAMPLED_BIT, that takes precendence over the image being used as a color attachment or for transfer operations,
+        // unless the image is also a storage image, which is only ever accessed by shaders in the general layout.
         auto usage = pCreateInfo->usage;
         VkImageLayout defaultLayout = imageCreateInfo.initialLayout;
-        if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) defaultLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        if (usage & VK_IMAGE_USAGE_STORAGE_BIT) defaultLayout = VK_IMAGE_LAYOUT_GENERAL;
+        else if (usage & VK_IMAGE_USAGE_SAMPLED_BIT) defaultLayout = IsDepthStencilFormat(pCreateInfo->format) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        else if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) defaultLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         else if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) defaultLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-        else if (usage & VK_IMAGE_USAGE_STORAGE_BIT) defaultLayout = VK_IMAGE_LAYOUT_GENERAL;
-        else if (usage & VK_IMAGE_USAGE_SAMPLED_BIT) defaultLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         else if (usage & VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT) defaultLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         else if (usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) defaultLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
         else if (usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) defaultLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
-        // Create an Image class instance from handle.
-        *ppImage = Image::CreateFromHandle(this, pCreateInfo, defaultLayout, handle, allocation);
-
-        // Transition image to a default layout.
-        TransitionImageLayout(*ppImage, imageCreateInfo.initialLayout, defaultLayout);
+        // Create an Image class instance from handle.  The image is transitioned from its initial layout by the first submitted command buffer accessing it.
+        *ppImage = Image::CreateFromHandle(this, pCreateInfo, defaultLayout, imageCreateInfo.initialLayout, handle, allocation);
 
         // Return success.
         return VK_SUCCESS;
@@ -576,6 +686,9 @@ namespace vez
 
     void Device::DestroyImage(Image* pImage)
     {
+        // Memoized recordings must not outlive the image.
+        InvalidateResource(reinterpret_cast<uint64_t>(pImage->GetHandle()));
+
         if (pImage->GetAllocation() != VK_NULL_HANDLE)
             vmaDestroyImage(m_memAllocator, pImage->GetHandle(), pImage->GetAllocation());
         else
@@ -593,50 +706,6 @@ namespace vez
             return CompressedImageSubData(pImage, pSubDataInfo, pData);
     }
 
-    void Device::TransitionImageLayout(Image* pImage, VkImageLayout oldLayout, VkImageLayout newLayout)
-    {
-        // Get the one-time submit command buffer instance created by the device.
-        CommandBuffer* cmdBuffer = GetOneTimeSubmitCommandBuffer();
-
-        // Fill in the memory barrier info.
-        VkImageMemoryBarrier barrier = {};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = 0;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = pImage->GetHandle();
-
-        // All mip levels and array layers will be transitioned.
-        const auto& imageCreateInfo = pImage->GetCreateInfo();
-        barrier.subresourceRange.aspectMask = GetImageAspectFlags(imageCreateInfo.format);
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = imageCreateInfo.mipLevels;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = imageCreateInfo.arrayLayers;
-
-        // Executive the native Vulkan call.
-        cmdBuffer->Begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-        vkCmdPipelineBarrier(cmdBuffer->GetHandle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-        cmdBuffer->End();
-
-        // Get the queue family index the command buffer was created for.
-        auto queue = m_queues[cmdBuffer->GetPool()->GetQueueFamilyIndex()][0];
-
-        // Submit to the queue.
-        auto cmdBufferHandle = cmdBuffer->GetHandle();
-
-        VezSubmitInfo submitInfo = {};
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &cmdBufferHandle;
-        queue->Submit(1, &submitInfo, nullptr);
-
-        // Wait for all operations to complete before returning.
-        queue->WaitIdle();
-    }
-
     void Device::QueueSubmission(Fence* pFence)
     {
         // Store references to all semaphores using fence as key so they can be released when fence is destroyed.
@@ -713,6 +782,13 @@ namespace vez
         for (auto it : m_oneTimeSubmitCommandBuffers)
             FreeCommandBuffers(1, &it.second);
 
+        // Destroy queues, which release their sync primitives.
+        for (auto& queueFamily : m_queues)
+        {
+            for (auto queue : queueFamily)
+                delete queue;
+        }
+
         // Destroy sync primitives pool.
         if (m_syncPrimitivesPool)
             delete m_syncPrimitivesPool;
@@ -721,6 +797,10 @@ namespace vez
         if (m_pipelineCache)
             delete m_pipelineCache;
 
+        // Destroy descriptor set cache before the layouts its sets were allocated with.
+        if (m_descriptorSetCache)
+            delete m_descriptorSetCache;
+
         // Destroy descriptor set layout cache.
         if (m_descriptorSetLayoutCache)
             delete m_descriptorSetLayoutCache;
@@ -738,6 +818,10 @@ namespace vez
             }
         }
 
+        // Destroy command stream block pool.
+        if (m_streamBlockPool)
+            delete m_streamBlockPool;
+
         // Destroy memory allocator.
         if (m_memAllocator)
             vmaDestroyAllocator(m_memAllocator);
@@ -1049,7 +1133,7 @@ namespace vez
         {
             // Create a new CommandBuffer instance.
             // By default one-time submit command buffers use the first queue family.
-            if (AllocateCommandBuffers(m_queues[0][0], nullptr, 1, &commandBuffer, KILOBYTES(8)) == VK_SUCCESS)
+            if (AllocateCommandBuffers(m_queues[0][0], nullptr, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &commandBuffer) == VK_SUCCESS)
                 m_oneTimeSubmitCommandBuffers.emplace(std::this_thread::get_id(), commandBuffer);
         }
 
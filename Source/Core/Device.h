@@ -24,8 +24,10 @@
 #include <vector>
 #include <queue>
 #include <unordered_map>
+#include <unordered_set>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include "Utility/Macros.h"
 #include "Utility/SpinLock.h"
 #include "VEZ.h"
@@ -43,11 +45,14 @@ namespace vez
     class SyncPrimitivesPool;
     class PipelineCache;
     class DescriptorSetLayoutCache;
+    class DescriptorSetCache;
     class RenderPassCache;
     class Framebuffer;
     class Buffer;
     class Image;
     class Fence;
+    class MemoryBlockPool;
+    class StreamEncoder;
 
     typedef std::vector<Queue*> QueueFamily;
     typedef std::unordered_map<Queue*, CommandPool*> QueueCommandPools;
@@ -63,6 +68,29 @@ namespace vez
 
         VkDevice GetHandle() const { return m_handle; }
 
+        const VkPhysicalDeviceFeatures& GetEnabledFeatures() const { return m_enabledFeatures; }
+
+        const VkPhysicalDeviceLimits& GetLimits() const { return m_limits; }
+
+#ifdef VK_KHR_synchronization2
+        // Returns the entry point recording VK_KHR_synchronization2 pipeline barriers, or null when the extension is not enabled.
+        PFN_vkCmdPipelineBarrier2KHR GetCmdPipelineBarrier2() const { return m_cmdPipelineBarrier2; }
+#endif
+
+#ifdef VK_KHR_push_descriptor
+        // Returns the entry point pushing descriptors into command buffers, or null when VK_KHR_push_descriptor is not enabled.
+        PFN_vkCmdPushDescriptorSetKHR GetCmdPushDescriptorSet() const { return m_cmdPushDescriptorSet; }
+#endif
+
+#ifdef VK_KHR_descriptor_update_template
+        // Return the VK_KHR_descriptor_update_template entry points, or null when the extension is not enabled.
+        PFN_vkCreateDescriptorUpdateTemplateKHR GetCreateDescriptorUpdateTemplate() const { return m_createDescriptorUpdateTemplate; }
+
+        PFN_vkDestroyDescriptorUpdateTemplateKHR GetDestroyDescriptorUpdateTemplate() const { return m_destroyDescriptorUpdateTemplate; }
+
+        PFN_vkUpdateDescriptorSetWithTemplateKHR GetUpdateDescriptorSetWithTemplate() const { return m_updateDescriptorSetWithTemplate; }
+#endif
+
         const std::vector<QueueFamily>& GetQueueFamilies() const { return m_queues; }
 
         SyncPrimitivesPool* GetSyncPrimitivesPool() { return m_syncPrimitivesPool; }
@@ -71,15 +99,33 @@ namespace vez
 
         DescriptorSetLayoutCache* GetDescriptorSetLayoutCache() { return m_descriptorSetLayoutCache; }
 
+        DescriptorSetCache* GetDescriptorSetCache() { return m_descriptorSetCache; }
+
         RenderPassCache* GetRenderPassCache() { return m_renderPassCache; }
 
+        // Removes a destroyed resource handle, which may be reused by a new object, from the descriptor set cache and memoized recordings.
+        void InvalidateResource(uint64_t handle);
+
+        // Memoizing stream encoders are notified of destroyed resource handles while registered.
+        void AddMemoizingStreamEncoder(StreamEncoder* pStreamEncoder);
+
+        void RemoveMemoizingStreamEncoder(StreamEncoder* pStreamEncoder);
+
+        // Queue submissions hold the lock from resolving the resident states of their resources until the resulting states are applied,
+        // so submissions to any queue resolve against the states left by the previous one in the order they reach their queues.
+        void LockResidentState() { m_residentStateMutex.lock(); }
+
+        void UnlockResidentState() { m_residentStateMutex.unlock(); }
+
+        MemoryBlockPool* GetStreamBlockPool() { return m_streamBlockPool; }
+
         Queue* GetQueue(uint32_t queueFamilyIndex, uint32_t queueIndex);
 
         Queue* GetQueueByFlags(VkQueueFlags queueFlags, uint32_t queueIndex);
 
         CommandPool* GetCommandPool(Queue* queue);
 
-        VkResult AllocateCommandBuffers(Queue* pQueue, const void* pNext, uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers, uint64_t streamEncoderBlockSize = MEGABYTES(8));
+        VkResult AllocateCommandBuffers(Queue* pQueue, const void* pNext, VkCommandBufferLevel level, uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers);
 
         void FreeCommandBuffers(uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers);
 
@@ -97,6 +143,9 @@ namespace vez
 
         void UnmapBuffer(Buffer* pBuffer);
 
+        // Makes host writes to a mapped buffer visible to the device when its memory is not host coherent.
+        VkResult FlushBuffer(Buffer* pBuffer);
+
         VkResult FlushMappedBufferRanges(uint32_t bufferRangeCount, const VezMappedBufferRange* pBufferRanges);
 
         VkResult InvalidateMappedBufferRanges(uint32_t bufferRangeCount, const VezMappedBufferRange* pBufferRanges);
@@ -109,8 +158,6 @@ namespace vez
 
         VkResult Present(Queue* pQueue, Image* pImage, const VezPresentInfo* pPresentInfo);
 
-        void TransitionImageLayout(Image* pImage, VkImageLayout oldLayout, VkImageLayout newLayout);
-
         void QueueSubmission(Fence* pFence);
 
         void DestroyFence(Fence* pFence);
@@ -129,6 +176,19 @@ namespace vez
         PhysicalDevice* m_physicalDevice = VK_NULL_HANDLE;
         VkDevice m_handle = VK_NULL_HANDLE;
         VezDeviceCreateInfo m_createInfo = {};
+        VkPhysicalDeviceFeatures m_enabledFeatures = {};
+        VkPhysicalDeviceLimits m_limits = {};
+#ifdef VK_KHR_synchronization2
+        PFN_vkCmdPipelineBarrier2KHR m_cmdPipelineBarrier2 = nullptr;
+#endif
+#ifdef VK_KHR_push_descriptor
+        PFN_vkCmdPushDescriptorSetKHR m_cmdPushDescriptorSet = nullptr;
+#endif
+#ifdef VK_KHR_descriptor_update_template
+        PFN_vkCreateDescriptorUpdateTemplateKHR m_createDescriptorUpdateTemplate = nullptr;
+        PFN_vkDestroyDescriptorUpdateTemplateKHR m_destroyDescriptorUpdateTemplate = nullptr;
+        PFN_vkUpdateDescriptorSetWithTemplateKHR m_updateDescriptorSetWithTemplate = nullptr;
+#endif
         VmaAllocator m_memAllocator = VK_NULL_HANDLE;
         std::vector<QueueFamily> m_queues = {};
         std::unordered_map<std::thread::id, QueueCommandPools> m_commandPools;
@@ -136,7 +196,9 @@ namespace vez
         SyncPrimitivesPool* m_syncPrimitivesPool = nullptr;
         PipelineCache* m_pipelineCache = nullptr;
         DescriptorSetLayoutCache* m_descriptorSetLayoutCache = nullptr;
+        DescriptorSetCache* m_descriptorSetCache = nullptr;
         RenderPassCache* m_renderPassCache = nullptr;
+        MemoryBlockPool* m_streamBlockPool = nullptr;
         Buffer* m_pinnedMemoryBuffer = nullptr;
         void* m_pinnedMemoryPtr = nullptr;
         VkBool32 m_vsyncEnabled = false;
@@ -144,6 +206,11 @@ namespace vez
         std::queue<Fence*> m_trackedFences;
         SpinLock m_trackedFencesLock;
 
+        std::unordered_set<StreamEncoder*> m_memoizingStreamEncoders;
+        SpinLock m_memoizingStreamEncodersLock;
+
+        std::mutex m_residentStateMutex;
+
         std::atomic<std::uint32_t> m_fencesQueuedRunningCount { 0U };
         const uint32_t m_fencesQueuedUntilTrackedFencesEval = 3U;
         const uint32_t m_fencesQueuedUntilRenderPassCacheEval = 5000U;
@@ -20,20 +20,107 @@
 // THE SOFTWARE.
 //
 #include <cstring>
+#include "Utility/VkHelpers.h"
 #include "Device.h"
+#include "Queue.h"
 #include "Image.h"
 
 namespace vez
 {
-    Image* Image::CreateFromHandle(Device* device, const VezImageCreateInfo* pCreateInfo, VkImageLayout defaultLayout, VkImage image, VmaAllocation allocation)
+    Image* Image::CreateFromHandle(Device* device, const VezImageCreateInfo* pCreateInfo, VkImageLayout defaultLayout, VkImageLayout initialLayout, VkImage image, VmaAllocation allocation)
     {
         // Create a new Image object instance.
         Image* instance = new Image;
         instance->m_device = device;
         memcpy(&instance->m_createInfo, pCreateInfo, sizeof(VezImageCreateInfo));
         instance->m_defaultImageLayout = defaultLayout;
+
+        // Images also used as storage images are read in the general layout, since a single command may access them both ways.
+        if (pCreateInfo->usage & VK_IMAGE_USAGE_STORAGE_BIT)
+            instance->m_shaderReadLayout = VK_IMAGE_LAYOUT_GENERAL;
+        else if (IsDepthStencilFormat(pCreateInfo->format))
+            instance->m_shaderReadLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
         instance->m_handle = image;
         instance->m_allocation = allocation;
+        instance->m_residentState = PipelineBarriers::ImageAccessTable(pCreateInfo->mipLevels, pCreateInfo->arrayLayers, initialLayout);
+        instance->m_exclusive = (pCreateInfo->queueFamilyIndexCount == 1);
         return instance;
-    }    
+    }
+
+    PipelineBarriers::ImageAccessTable Image::GetResidentState()
+    {
+        m_residentStateLock.Lock();
+        auto table = m_residentState;
+        m_residentStateLock.Unlock();
+        return table;
+    }
+
+    VkImageLayout Image::GetResidentLayout(uint32_t mipLevel, uint32_t arrayLayer)
+    {
+        m_residentStateLock.Lock();
+        auto layout = m_residentState.GetState(m_residentState.FindColumn(arrayLayer), mipLevel).layout;
+        m_residentStateLock.Unlock();
+
+        // Recording assumes subresources never transitioned since the image was created are in the default layout.
+        if (layout == VK_IMAGE_LAYOUT_UNDEFINED || layout == VK_IMAGE_LAYOUT_PREINITIALIZED)
+            layout = m_defaultImageLayout;
+
+        return layout;
+    }
+
+    void Image::ResolveResidentState(const PipelineBarriers::ImageAccessTable& table, Queue* pQueue, ResidentStateUpdates& updates, PipelineBarrier& barrier, std::unordered_map<Queue*, PipelineBarrier>& releaseBarriers)
+    {
+        // Start from the state staged by an earlier command buffer of the submission, or else the resident state.
+        auto it = updates.images.find(this);
+        if (it == updates.images.end())
+        {
+            m_residentStateLock.Lock();
+            it = updates.images.emplace(this, ResidentStateUpdates::ImageState{ m_residentState, m_ownerQueue }).first;
+            m_residentStateLock.Unlock();
+        }
+
+        auto& residentState = it->second.residentState;
+
+        // The queue becomes the owner of an exclusively owned image, which only needs to be transferred if a queue of another family owned it.
+        auto ownerQueue = it->second.ownerQueue;
+        if (m_exclusive)
+            it->second.ownerQueue = pQueue;
+
+        if (m_exclusive && ownerQueue && ownerQueue->GetFamilyIndex() != pQueue->GetFamilyIndex())
+        {
+            // The release and acquire barriers must be identical, including the layout transitions, and are ordered by a semaphore.
+            PipelineBarrier transferBarrier = {};
+            residentState.Resolve(this, table, ownerQueue->GetFamilyIndex(), pQueue->GetFamilyIndex(), transferBarrier);
+
+            auto& releaseBarrier = releaseBarriers[ownerQueue];
+            releaseBarrier.srcStageMask |= transferBarrier.srcStageMask;
+            releaseBarrier.dstStageMask |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            releaseBarrier.imageBarriers.insert(releaseBarrier.imageBarriers.end(), transferBarrier.imageBarriers.begin(), transferBarrier.imageBarriers.end());
+
+            barrier.srcStageMask |= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            barrier.dstStageMask |= transferBarrier.dstStageMask;
+            barrier.imageBarriers.insert(barrier.imageBarriers.end(), transferBarrier.imageBarriers.begin(), transferBarrier.imageBarriers.end());
+        }
+        else
+        {
+            residentState.Resolve(this, table, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, barrier);
+        }
+    }
+
+    void Image::SetResidentState(const PipelineBarriers::ImageAccessTable& residentState, Queue* pOwnerQueue)
+    {
+        m_residentStateLock.Lock();
+        m_residentState = residentState;
+        m_ownerQueue = pOwnerQueue;
+        m_residentStateLock.Unlock();
+    }
+
+    void Image::AcquireOwnership(const VkImageSubresourceRange& subresourceRange, VkImageLayout layout, Queue* pOwnerQueue)
+    {
+        m_residentStateLock.Lock();
+        m_residentState.Transition(subresourceRange, layout);
+        m_ownerQueue = pOwnerQueue;
+        m_residentStateLock.Unlock();
+    }
 }
\ No newline at end of file
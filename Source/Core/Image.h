@@ -21,6 +21,9 @@
 //
 #pragma once
 
+#include <unordered_map>
+#include "Utility/SpinLock.h"
+#include "PipelineBarriers.h"
 #include "VEZ.h"
 
 struct VmaAllocation_T;
@@ -29,11 +32,12 @@ typedef struct VmaAllocation_T* VmaAllocation;
 namespace vez
 {
     class Device;
+    class Queue;
 
     class Image
     {
     public:
-        static Image* CreateFromHandle(Device* device, const VezImageCreateInfo* pCreateInfo, VkImageLayout defaultLayout, VkImage image, VmaAllocation allocation);
+        static Image* CreateFromHandle(Device* device, const VezImageCreateInfo* pCreateInfo, VkImageLayout defaultLayout, VkImageLayout initialLayout, VkImage image, VmaAllocation allocation);
 
         Device* GetDevice() { return m_device; }
 
@@ -45,11 +49,35 @@ namespace vez
 
         VkImageLayout GetDefaultImageLayout() { return m_defaultImageLayout; }
 
+        // Returns the layout sampled image descriptors read the image in.
+        VkImageLayout GetShaderReadLayout() { return m_shaderReadLayout; }
+
+        // Returns a copy of the layouts and accesses the image is left in by the submitted command buffers.
+        PipelineBarriers::ImageAccessTable GetResidentState();
+
+        // Returns the layout a subresource is left in by the submitted command buffers, or the default layout if none has transitioned it yet.
+        VkImageLayout GetResidentLayout(uint32_t mipLevel, uint32_t arrayLayer);
+
+        // Appends the transitions a command buffer submitted to the queue requires for its recorded layouts and stages the resulting resident state.
+        // Exclusively owned images last used by a queue of another family are also released by that queue and acquired before the command buffer.
+        void ResolveResidentState(const PipelineBarriers::ImageAccessTable& table, Queue* pQueue, ResidentStateUpdates& updates, PipelineBarrier& barrier, std::unordered_map<Queue*, PipelineBarrier>& releaseBarriers);
+
+        // Applies a resident state and owner queue staged by a successful submission.
+        void SetResidentState(const PipelineBarriers::ImageAccessTable& residentState, Queue* pOwnerQueue);
+
+        // Applies an acquire barrier completing the ownership transfer of released subresources to the queue, for a submission that failed.
+        void AcquireOwnership(const VkImageSubresourceRange& subresourceRange, VkImageLayout layout, Queue* pOwnerQueue);
+
     private:
         Device* m_device = nullptr;
         VezImageCreateInfo m_createInfo;
         VkImage m_handle = VK_NULL_HANDLE;
         VmaAllocation m_allocation = VK_NULL_HANDLE;
-        VkImageLayout m_defaultImageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        VkImageLayout m_defaultImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout m_shaderReadLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        PipelineBarriers::ImageAccessTable m_residentState;
+        bool m_exclusive = false;
+        Queue* m_ownerQueue = nullptr;
+        SpinLock m_residentStateLock;
     };    
 }
\ No newline at end of file
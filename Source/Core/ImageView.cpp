@@ -67,6 +67,9 @@ namespace vez
 
     ImageView::~ImageView()
     {
+        // Cached descriptor sets and memoized recordings must not outlive the image view.
+        m_device->InvalidateResource(reinterpret_cast<uint64_t>(m_handle));
+
         if (m_handle)
             vkDestroyImageView(m_device->GetHandle(), m_handle, nullptr);
     }    
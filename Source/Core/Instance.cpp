@@ -20,6 +20,8 @@
 // THE SOFTWARE.
 //
 #include <iostream>
+#include <algorithm>
+#include <thread>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -83,9 +85,9 @@ namespace vez
             }
         }
 
-        // Initialize the Instance's thread pool with a single worker thread for now.
-        // TODO: Assess background tasks and performance before increasing thread count.
-        instance->m_threadPool = new ThreadPool(1);
+        // Initialize the Instance's thread pool with a worker thread per hardware thread, used for command buffer decoding.
+        auto threadCount = std::thread::hardware_concurrency();
+        instance->m_threadPool = new ThreadPool(std::max(threadCount, 1U));
 
         // Copy address of object instance.
         *ppInstance = instance;
@@ -38,6 +38,34 @@
 
 namespace vez
 {
+    // Returns whether a set's resources are all buffers, few enough to be pushed by every VK_KHR_push_descriptor implementation.
+    static bool CanPushDescriptors(const std::vector<VezPipelineResource>& setResources)
+    {
+        uint32_t descriptorCount = 0;
+        for (auto& resource : setResources)
+        {
+            switch (resource.resourceType)
+            {
+            case VEZ_PIPELINE_RESOURCE_TYPE_INPUT:
+            case VEZ_PIPELINE_RESOURCE_TYPE_OUTPUT:
+            case VEZ_PIPELINE_RESOURCE_TYPE_PUSH_CONSTANT_BUFFER:
+                break;
+
+            case VEZ_PIPELINE_RESOURCE_TYPE_UNIFORM_BUFFER:
+            case VEZ_PIPELINE_RESOURCE_TYPE_STORAGE_BUFFER:
+            case VEZ_PIPELINE_RESOURCE_TYPE_UNIFORM_TEXEL_BUFFER:
+            case VEZ_PIPELINE_RESOURCE_TYPE_STORAGE_TEXEL_BUFFER:
+                descriptorCount += resource.arraySize;
+                break;
+
+            default:
+                return false;
+            }
+        }
+
+        return descriptorCount > 0 && descriptorCount <= MAX_PUSH_DESCRIPTORS;
+    }
+
     VkResult Pipeline::Create(Device* pDevice, const VezGraphicsPipelineCreateInfo* pCreateInfo, Pipeline** ppPipeline)
     {
         // Get class objects for shader modules and validate there are no compute shader modules present.
@@ -399,11 +427,26 @@ namespace vez
 
     VkResult Pipeline::CreateDescriptorSetLayouts()
     {
+        // When VK_KHR_push_descriptor is enabled, the descriptors of one set are pushed into command buffers instead of being allocated.
+        // Sets holding only a few buffers typically change every draw, like per object transforms, so the highest such set index is chosen.
+        // A pipeline layout may only have a single push descriptor set.
+        auto pushDescriptorSet = ~0U;
+#ifdef VK_KHR_push_descriptor
+        if (m_device->GetCmdPushDescriptorSet())
+        {
+            for (auto& it : m_bindings)
+            {
+                if ((pushDescriptorSet == ~0U || it.first > pushDescriptorSet) && CanPushDescriptors(it.second))
+                    pushDescriptorSet = it.first;
+            }
+        }
+#endif
+
         // Iterate over each set binding and create a DescriptorSetLayout instance.
         for (auto it : m_bindings)
         {
             DescriptorSetLayout* descriptorSetLayout = nullptr;
-            auto result = m_device->GetDescriptorSetLayoutCache()->CreateLayout(it.first, it.second, &descriptorSetLayout);
+            auto result = m_device->GetDescriptorSetLayoutCache()->CreateLayout(it.first, it.second, it.first == pushDescriptorSet, &descriptorSetLayout);
             if (result != VK_SUCCESS)
                 return result;
 
@@ -22,10 +22,13 @@
 #include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <iterator>
+#include <tuple>
 #include "Utility/VkHelpers.h"
 #include "Buffer.h"
 #include "Image.h"
 #include "ImageView.h"
+#include "SyncPrimitivesPool.h"
 #include "PipelineBarriers.h"
 
 namespace vez
@@ -73,162 +76,431 @@ namespace vez
         else return false;
     }
 
-    PipelineBarriers::PipelineBarriers()
+    // Images with at most this many array layers store a column of subresource states per layer.
+    static const uint32_t s_maxDenseArrayLayers = 64;
+
+    // Minimum number of commands performing independent work between a barrier's accesses before it is split.
+    static const uint32_t s_minSplitBarrierWorkCount = 4;
+
+    // Rectangle of subresources in array layer and mip level space sharing the same value.
+    template <typename T>
+    struct SubresourceRect
+    {
+        T value;
+        uint32_t baseMipLevel;
+        uint32_t levelCount;
+        uint32_t baseArrayLayer;
+        uint32_t layerCount;
+    };
+
+    // Groups the subresources within a range of columns and mip levels into rectangles of identical values.
+    // Consecutive mip levels within a column are grouped first, then extend a rectangle of the previous column spanning the same mip levels.
+    // getValue returns false for subresources that should be skipped.
+    template <typename T, typename F>
+    static void CollectSubresourceRects(const PipelineBarriers::ImageAccessTable& table, uint32_t firstColumn, uint32_t lastColumn, uint32_t baseMipLevel, uint32_t mipLevelEnd, F getValue, std::vector<SubresourceRect<T>>& rects)
     {
+        std::vector<size_t> prevColumnRects, columnRects;
+        for (auto column = firstColumn; column < lastColumn; ++column)
+        {
+            columnRects.clear();
+            auto mipLevel = baseMipLevel;
+            while (mipLevel < mipLevelEnd)
+            {
+                T value;
+                if (!getValue(column, mipLevel, value))
+                {
+                    ++mipLevel;
+                    continue;
+                }
+
+                T nextValue;
+                auto levelEnd = mipLevel + 1;
+                while (levelEnd < mipLevelEnd && getValue(column, levelEnd, nextValue) && nextValue == value)
+                    ++levelEnd;
 
+                auto rectIndex = rects.size();
+                for (auto index : prevColumnRects)
+                {
+                    auto& rect = rects[index];
+                    if (rect.baseMipLevel == mipLevel && rect.levelCount == levelEnd - mipLevel && rect.value == value)
+                    {
+                        rect.layerCount += table.GetColumnLayerCount(column);
+                        rectIndex = index;
+                        break;
+                    }
+                }
+
+                if (rectIndex == rects.size())
+                    rects.push_back({ value, mipLevel, levelEnd - mipLevel, table.GetColumnFirstLayer(column), table.GetColumnLayerCount(column) });
+
+                columnRects.push_back(rectIndex);
+                mipLevel = levelEnd;
+            }
+
+            prevColumnRects.swap(columnRects);
+        }
     }
 
-    VkImageLayout PipelineBarriers::GetImageLayout(ImageView* pImageView)
+    PipelineBarriers::ImageAccessTable::ImageAccessTable(uint32_t mipLevels, uint32_t arrayLayers, VkImageLayout layout)
     {
-        // If an access entry exists for the image, find the one at the specified base mip level.
-        auto key = ImageAccessKey{ reinterpret_cast<uint64_t>(pImageView->GetImage()), static_cast<uint64_t>(pImageView->GetSubresourceRange().baseArrayLayer) };
-        auto entry = m_imageAccesses.find(key);
-        if (entry != m_imageAccesses.end())
+        m_mipLevels = mipLevels;
+        m_arrayLayers = arrayLayers;
+        m_dense = (m_arrayLayers <= s_maxDenseArrayLayers);
+
+        ImageSubresourceState state = {};
+        state.layout = layout;
+        state.initialLayout = layout;
+        if (m_dense)
+        {
+            m_columnLayers.resize(m_arrayLayers);
+            for (auto layer = 0U; layer < m_arrayLayers; ++layer)
+                m_columnLayers[layer] = layer;
+
+            m_states.resize(m_arrayLayers * m_mipLevels, state);
+        }
+        else
         {
-            auto& accessList = entry->second;
-            for (auto& access : accessList)
+            m_columnLayers.push_back(0);
+            m_states.resize(m_mipLevels, state);
+        }
+    }
+
+    PipelineBarriers::ImageAccessTable::ImageAccessTable(Image* pImage)
+    {
+        // Start from the layouts the image was left in by the last submitted command buffers accessing it.
+        // Subresources never transitioned since the image was created are assumed to be in the image's default layout.
+        *this = pImage->GetResidentState();
+        for (auto& state : m_states)
+        {
+            if (state.layout == VK_IMAGE_LAYOUT_UNDEFINED || state.layout == VK_IMAGE_LAYOUT_PREINITIALIZED)
+                state.layout = pImage->GetDefaultImageLayout();
+
+            state.initialLayout = state.layout;
+            state.streamPos = 0;
+            state.accessMask = 0;
+            state.stageMask = 0;
+        }
+
+        MergeColumns();
+    }
+
+    uint32_t PipelineBarriers::ImageAccessTable::FindColumn(uint32_t layer) const
+    {
+        if (m_dense)
+            return layer;
+
+        return static_cast<uint32_t>(std::upper_bound(m_columnLayers.begin(), m_columnLayers.end(), layer) - m_columnLayers.begin()) - 1;
+    }
+
+    uint32_t PipelineBarriers::ImageAccessTable::SplitColumn(uint32_t layer)
+    {
+        if (layer >= m_arrayLayers)
+            return GetColumnCount();
+
+        auto column = FindColumn(layer);
+        if (m_columnLayers[column] == layer)
+            return column;
+
+        // Duplicate the column's states for the layers starting at the split.
+        std::vector<ImageSubresourceState> states(m_states.begin() + column * m_mipLevels, m_states.begin() + (column + 1) * m_mipLevels);
+        m_states.insert(m_states.begin() + (column + 1) * m_mipLevels, states.begin(), states.end());
+        m_columnLayers.insert(m_columnLayers.begin() + column + 1, layer);
+        return column + 1;
+    }
+
+    void PipelineBarriers::ImageAccessTable::MergeColumns()
+    {
+        if (m_dense)
+            return;
+
+        auto column = 1U;
+        while (column < GetColumnCount())
+        {
+            auto identical = true;
+            for (auto mipLevel = 0U; mipLevel < m_mipLevels && identical; ++mipLevel)
             {
-                if (access.subresourceRange.baseMipLevel == pImageView->GetSubresourceRange().baseMipLevel)
-                    return access.layout;
+                auto& state = GetState(column, mipLevel);
+                auto& prevState = GetState(column - 1, mipLevel);
+                identical = (state.accessMask == prevState.accessMask && state.stageMask == prevState.stageMask && state.layout == prevState.layout && state.initialLayout == prevState.initialLayout);
+            }
+
+            // The merged states keep the latest stream position so barriers never signal before the last access.
+            if (identical)
+            {
+                for (auto mipLevel = 0U; mipLevel < m_mipLevels; ++mipLevel)
+                {
+                    auto& prevState = GetState(column - 1, mipLevel);
+                    prevState.streamPos = std::max(prevState.streamPos, GetState(column, mipLevel).streamPos);
+                }
+
+                m_states.erase(m_states.begin() + column * m_mipLevels, m_states.begin() + (column + 1) * m_mipLevels);
+                m_columnLayers.erase(m_columnLayers.begin() + column);
+            }
+            else
+            {
+                ++column;
+            }
+        }
+    }
+
+    void PipelineBarriers::ImageAccessTable::GetAccesses(std::vector<ImageAccessInfo>& accesses) const
+    {
+        typedef std::tuple<VkImageLayout, VkAccessFlags, PipelineStageFlags> AccessValue;
+        std::vector<SubresourceRect<AccessValue>> rects;
+        CollectSubresourceRects(*this, 0, GetColumnCount(), 0, m_mipLevels, [&](uint32_t column, uint32_t mipLevel, AccessValue& value) {
+            auto& state = GetState(column, mipLevel);
+            value = AccessValue(state.layout, state.accessMask, state.stageMask);
+            return (state.stageMask != 0);
+        }, rects);
+
+        accesses.clear();
+        for (auto& rect : rects)
+        {
+            ImageAccessInfo access = {};
+            access.layout = std::get<0>(rect.value);
+            access.accessMask = std::get<1>(rect.value);
+            access.stageMask = std::get<2>(rect.value);
+            access.subresourceRange.baseMipLevel = rect.baseMipLevel;
+            access.subresourceRange.levelCount = rect.levelCount;
+            access.subresourceRange.baseArrayLayer = rect.baseArrayLayer;
+            access.subresourceRange.layerCount = rect.layerCount;
+            accesses.push_back(access);
+        }
+    }
+
+    void PipelineBarriers::ImageAccessTable::Resolve(Image* pImage, const ImageAccessTable& recorded, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, PipelineBarrier& barrier)
+    {
+        // Split columns so each one maps to a single column of the recorded table.
+        for (auto column = 0U; column < recorded.GetColumnCount(); ++column)
+            SplitColumn(recorded.GetColumnFirstLayer(column));
+
+        // Group the subresources whose resident layout differs from the layout the command buffer was recorded against.
+        // All subresources are included when their ownership is transferred.
+        bool ownershipTransfer = (srcQueueFamilyIndex != dstQueueFamilyIndex);
+        typedef std::tuple<VkImageLayout, VkAccessFlags, VkImageLayout> TransitionValue;
+        std::vector<SubresourceRect<TransitionValue>> rects;
+        PipelineStageFlags srcStageMask = 0;
+        CollectSubresourceRects(*this, 0, GetColumnCount(), 0, m_mipLevels, [&](uint32_t column, uint32_t mipLevel, TransitionValue& value) {
+            auto& state = GetState(column, mipLevel);
+            auto& recordedState = recorded.GetState(recorded.FindColumn(GetColumnFirstLayer(column)), mipLevel);
+            if (state.layout == recordedState.initialLayout && !ownershipTransfer)
+                return false;
+
+            srcStageMask |= (state.stageMask != 0) ? state.stageMask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            value = TransitionValue(state.layout, state.accessMask, recordedState.initialLayout);
+            return true;
+        }, rects);
+
+        // The transitions complete before any command of the recorded command buffer executes.
+        if (!rects.empty())
+        {
+            barrier.srcStageMask |= srcStageMask;
+            barrier.dstStageMask |= VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        }
+
+        for (auto& rect : rects)
+        {
+            VkImageMemoryBarrier imageBarrier = {};
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarrier.srcAccessMask = std::get<1>(rect.value);
+            imageBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            imageBarrier.oldLayout = std::get<0>(rect.value);
+            imageBarrier.newLayout = std::get<2>(rect.value);
+            imageBarrier.srcQueueFamilyIndex = ownershipTransfer ? srcQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = ownershipTransfer ? dstQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.image = pImage->GetHandle();
+            imageBarrier.subresourceRange.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
+            imageBarrier.subresourceRange.baseMipLevel = rect.baseMipLevel;
+            imageBarrier.subresourceRange.levelCount = rect.levelCount;
+            imageBarrier.subresourceRange.baseArrayLayer = rect.baseArrayLayer;
+            imageBarrier.subresourceRange.layerCount = rect.layerCount;
+            barrier.imageBarriers.push_back(imageBarrier);
+        }
+
+        // The layouts and accesses the command buffer leaves the image in become resident.
+        for (auto column = 0U; column < GetColumnCount(); ++column)
+        {
+            auto recordedColumn = recorded.FindColumn(GetColumnFirstLayer(column));
+            for (auto mipLevel = 0U; mipLevel < m_mipLevels; ++mipLevel)
+            {
+                auto& state = GetState(column, mipLevel);
+                auto& recordedState = recorded.GetState(recordedColumn, mipLevel);
+                if (recordedState.stageMask != 0)
+                {
+                    state.layout = recordedState.layout;
+                    state.accessMask = recordedState.accessMask;
+                    state.stageMask = recordedState.stageMask;
+                }
+                else if (state.layout != recordedState.initialLayout)
+                {
+                    state.layout = recordedState.initialLayout;
+                    state.accessMask = 0;
+                    state.stageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                }
+            }
+        }
+
+        MergeColumns();
+    }
+
+    void PipelineBarriers::ImageAccessTable::Transition(const VkImageSubresourceRange& subresourceRange, VkImageLayout layout)
+    {
+        // Split columns at both ends of the range's array layers.
+        auto firstColumn = SplitColumn(subresourceRange.baseArrayLayer);
+        auto lastColumn = SplitColumn(subresourceRange.baseArrayLayer + subresourceRange.layerCount);
+        for (auto column = firstColumn; column < lastColumn; ++column)
+        {
+            for (auto mipLevel = subresourceRange.baseMipLevel; mipLevel < subresourceRange.baseMipLevel + subresourceRange.levelCount; ++mipLevel)
+            {
+                auto& state = GetState(column, mipLevel);
+                state.layout = layout;
+                state.accessMask = 0;
+                state.stageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
             }
         }
-        
-        // Else return the default layout.
-        return pImageView->GetImage()->GetDefaultImageLayout();
+
+        MergeColumns();
+    }
+
+    PipelineBarriers::PipelineBarriers()
+    {
+
+    }
+
+    VkImageLayout PipelineBarriers::GetImageLayout(uint64_t streamPos, ImageView* pImageView)
+    {
+        // The command at the stream position reads the image in the returned layout.
+        m_resourceUses.push_back({ streamPos, VK_NULL_HANDLE, pImageView->GetImage()->GetHandle() });
+
+        // Get the image's subresource state table, creating it so the layouts assumed by the command buffer are resolved at submission.
+        auto image = pImageView->GetImage();
+        auto entry = m_imageAccesses.find(image);
+        if (entry == m_imageAccesses.end())
+            entry = m_imageAccesses.emplace(image, ImageAccessTable(image)).first;
+
+        // Return the layout of the view's first subresource.
+        auto& table = entry->second;
+        return table.GetState(table.FindColumn(pImageView->GetSubresourceRange().baseArrayLayer), pImageView->GetSubresourceRange().baseMipLevel).layout;
     }
 
-    void PipelineBarriers::BufferAccess(uint64_t streamPos, Buffer* pBuffer, VkDeviceSize offset, VkDeviceSize range, VkAccessFlags accessMask, VkPipelineStageFlags stageMask)
+    void PipelineBarriers::BufferAccess(uint64_t streamPos, Buffer* pBuffer, VkDeviceSize offset, VkDeviceSize range, VkAccessFlags accessMask, PipelineStageFlags stageMask)
     {
-        // Insert new entry into buffer accesses map.
+        // Accesses without a buffer cannot be tracked.
+        if (!pBuffer)
+            return;
+
+        // Resolve whole size ranges so accesses can be compared as intervals.
+        if (range == VK_WHOLE_SIZE)
+            range = pBuffer->GetCreateInfo().size - offset;
+
+        if (range == 0)
+            return;
+
+        m_resourceUses.push_back({ streamPos, pBuffer->GetHandle(), VK_NULL_HANDLE });
+        auto end = offset + range;
+
         BufferAccessInfo bufferAccessInfo = {};
         bufferAccessInfo.streamPos = streamPos;
         bufferAccessInfo.accessMask = accessMask;
         bufferAccessInfo.stageMask = stageMask;
-        bufferAccessInfo.offset = offset;
-        bufferAccessInfo.range = range;
 
-        auto insertKey = BufferAccessKey{ reinterpret_cast<uint64_t>(pBuffer), offset, range };
-        auto result = m_bufferAccesses.emplace(insertKey, bufferAccessInfo);
+        // Previous accesses are sorted by offset and never overlap, so the ones overlapping the new access are contiguous, starting
+        // with the first one ending after its offset.  Adjacent accesses are included so they can be merged with the new one.
+        auto& accessList = m_bufferAccesses[pBuffer];
+        auto first = std::upper_bound(accessList.begin(), accessList.end(), offset, [](VkDeviceSize value, const BufferAccessInfo& access) {
+            return value < access.offset + access.range;
+        });
 
-        // If entry successfully inserted (i.e. key did not exist) then combine with previous entries.
-        if (std::get<1>(result) == true)
-        {
-            // Iterate over previous and proceeding entries that overlap new access.
-            auto finalKey = insertKey;
-            auto iter = std::get<0>(result); --iter;
-            bool combinedEntries = false;
-            bool insertPipelineBarrier = false;
-            bool createNewPipelineBarrierEntry = false;
-            VkAccessFlags oldAccessMask = 0;
-            VkPipelineStageFlags oldStageMask = 0;
-            while (iter != m_bufferAccesses.end() && iter->first[0] == insertKey[0])
+        if (first != accessList.begin() && std::prev(first)->offset + std::prev(first)->range == offset)
+            --first;
+
+        auto last = first;
+        while (last != accessList.end() && last->offset <= end)
+            ++last;
+
+        // Appends an interval to the split accesses, extending the previous one if it is adjacent and has identical accesses.
+        // The extended interval keeps the latest stream position so barriers never signal before the last access.
+        m_splitBufferAccesses.clear();
+        auto addAccess = [&](const BufferAccessInfo& access, VkDeviceSize intervalBegin, VkDeviceSize intervalEnd) {
+            if (intervalBegin >= intervalEnd)
+                return;
+
+            if (!m_splitBufferAccesses.empty())
             {
-                // Skip entry that was just inserted.
-                if (iter->first == insertKey)
+                auto& prevAccess = m_splitBufferAccesses.back();
+                if (prevAccess.offset + prevAccess.range == intervalBegin && prevAccess.accessMask == access.accessMask && prevAccess.stageMask == access.stageMask)
                 {
-                    ++iter;
-                    continue;
+                    prevAccess.range = intervalEnd - prevAccess.offset;
+                    prevAccess.streamPos = std::max(prevAccess.streamPos, access.streamPos);
+                    return;
                 }
+            }
+
+            m_splitBufferAccesses.push_back(access);
+            m_splitBufferAccesses.back().offset = intervalBegin;
+            m_splitBufferAccesses.back().range = intervalEnd - intervalBegin;
+        };
+
+        // Split previous accesses at the new access's boundaries.  Overlapped parts are combined with the new access, unless a pipeline barrier
+        // is required in which case the new access replaces them.  Gaps between previous accesses are covered by the new access.
+        bool insertPipelineBarrier = false;
+        VkAccessFlags oldAccessMask = 0;
+        PipelineStageFlags oldStageMask = 0;
+        uint64_t signalStreamPos = 0;
+        auto position = offset;
+        for (auto iter = first; iter != last; ++iter)
+        {
+            auto accessBegin = iter->offset;
+            auto accessEnd = iter->offset + iter->range;
+            addAccess(*iter, accessBegin, std::min(accessEnd, offset));
 
-                // Check to see if previous access overlaps with new access.
-                auto min = std::min(finalKey[1], iter->first[1]);
-                auto max = std::max(finalKey[1] + finalKey[2], iter->first[1] + iter->first[2]);
-                if (max - min < finalKey[2] + iter->first[2])
+            if (accessBegin > position)
+                addAccess(bufferAccessInfo, position, std::min(accessBegin, end));
+
+            auto overlapBegin = std::max(accessBegin, offset);
+            auto overlapEnd = std::min(accessEnd, end);
+            if (overlapBegin < overlapEnd)
+            {
+                if (RequiresPipelineBarrier(iter->accessMask, accessMask))
                 {
-                    // Check to see if new access requires a pipeline barrier.
-                    if (RequiresPipelineBarrier(iter->second.accessMask, accessMask))
-                    {
-                        // Set flags, merge accesses and delete old access entry.
-                        insertPipelineBarrier = true;
-                        createNewPipelineBarrierEntry = true;
-                        oldAccessMask |= iter->second.accessMask;
-                        oldStageMask |= iter->second.stageMask;
-                        iter = m_bufferAccesses.erase(iter);
-                    }
-                    else
-                    {
-                        // Combine old entry with new entry.
-                        auto newOffset = std::min(finalKey[1], iter->first[1]);
-                        auto newSize = std::max(finalKey[1] + finalKey[2], iter->first[1] + iter->first[2]) - newOffset;
-                        finalKey[1] = newOffset;
-                        finalKey[2] = newSize;
-                        accessMask |= iter->second.accessMask;
-                        stageMask |= iter->second.stageMask;
-                        iter = m_bufferAccesses.erase(iter);
-                        combinedEntries = true;
-                    }
+                    insertPipelineBarrier = true;
+                    oldAccessMask |= iter->accessMask;
+                    oldStageMask |= iter->stageMask;
+                    signalStreamPos = std::max(signalStreamPos, iter->streamPos + 1);
+                    addAccess(bufferAccessInfo, overlapBegin, overlapEnd);
                 }
-                // Else move to next entry.
                 else
                 {
-                    ++iter;
+                    auto combinedAccess = *iter;
+                    combinedAccess.streamPos = streamPos;
+                    combinedAccess.accessMask |= accessMask;
+                    combinedAccess.stageMask |= stageMask;
+                    addAccess(combinedAccess, overlapBegin, overlapEnd);
                 }
             }
 
-            // If entries were combined with new one, remove new entry and reinsert it with new key.
-            if (combinedEntries)
-            {
-                m_bufferAccesses.erase(insertKey);
+            addAccess(*iter, std::max(accessBegin, end), accessEnd);
+            position = std::max(position, accessEnd);
+        }
 
-                bufferAccessInfo.accessMask = accessMask;
-                bufferAccessInfo.stageMask = stageMask;
-                bufferAccessInfo.offset = offset;
-                bufferAccessInfo.range = range;
-                m_bufferAccesses.emplace(finalKey, bufferAccessInfo);
-            }
+        addAccess(bufferAccessInfo, position, end);
 
-            // Add pipeline barrier if required.
-            if (insertPipelineBarrier)
-            {
-                // Add a new entry if any of the erased entries were already assigned to a pipeline barrier index.
-                //if (createNewPipelineBarrierEntry)
-                //    m_barriers.push_back({ streamPos, 0, 0, {}, {} });
-                // Create first barrier entry or merge with previous barrier if access is at same stream position.
-                if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
-                    m_barriers.push_back({ streamPos, 0, 0, {}, {} });
-
-                // Add the new buffer memory barrier.
-                VkBufferMemoryBarrier bufferBarrier = {};
-                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-                bufferBarrier.pNext = nullptr;
-                bufferBarrier.srcAccessMask = oldAccessMask;
-                bufferBarrier.dstAccessMask = accessMask;
-                bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                bufferBarrier.buffer = pBuffer->GetHandle();
-                bufferBarrier.offset = offset;
-                bufferBarrier.size = range;
-
-                auto& barrier = m_barriers.back();
-                if (barrier.streamPosition == 0)
-                    barrier.streamPosition = streamPos;
-
-                barrier.bufferBarriers.push_back(bufferBarrier);
-                barrier.srcStageMask |= oldStageMask;
-                barrier.dstStageMask |= stageMask;
-
-                // Update buffer access entry.
-                auto& bufferAccessInfo = m_bufferAccesses.at(finalKey);
-                bufferAccessInfo.streamPos = streamPos;
-                bufferAccessInfo.accessMask = accessMask;
-                bufferAccessInfo.stageMask = stageMask;
-                bufferAccessInfo.offset = offset;
-                bufferAccessInfo.range = range;
-            }
-        }
-        // A previous access entry exist with the same offset and range.  Check to see if a pipeline barrier is required.
-        else if (RequiresPipelineBarrier(std::get<0>(result)->second.accessMask, accessMask))
+        // Replace the previous accesses with the split ones.
+        first = accessList.erase(first, last);
+        accessList.insert(first, m_splitBufferAccesses.begin(), m_splitBufferAccesses.end());
+
+        // Add pipeline barrier if required.
+        if (insertPipelineBarrier)
         {
             // Create first barrier entry or merge with previous barrier if access is at same stream position.
             if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
-                m_barriers.push_back({ streamPos, 0, 0,{},{} });
+                m_barriers.push_back({ streamPos, 0, 0, {}, {} });
 
-            // Add buffer memory barrier.
-            auto& prevEntry = std::get<0>(result)->second;
+            // Add the new buffer memory barrier.
             VkBufferMemoryBarrier bufferBarrier = {};
             bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
             bufferBarrier.pNext = nullptr;
-            bufferBarrier.srcAccessMask = prevEntry.accessMask;
+            bufferBarrier.srcAccessMask = oldAccessMask;
             bufferBarrier.dstAccessMask = accessMask;
             bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
             bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -241,275 +513,292 @@ namespace vez
                 barrier.streamPosition = streamPos;
 
             barrier.bufferBarriers.push_back(bufferBarrier);
-            barrier.srcStageMask |= prevEntry.stageMask;
+            barrier.bufferBarrierStages.push_back({ oldStageMask, stageMask });
+            barrier.srcStageMask |= oldStageMask;
+            barrier.dstStageMask |= stageMask;
+            barrier.signalStreamPosition = std::max(barrier.signalStreamPosition, signalStreamPos);
+        }
+    }
+
+    void PipelineBarriers::ImageAccess(uint64_t streamPos, Image* pImage, const VezImageSubresourceRange* pSubresourceRange, VkImageLayout layout, VkAccessFlags accessMask, PipelineStageFlags stageMask)
+    {
+        auto levelCount = pSubresourceRange->levelCount;
+        if (levelCount == VK_REMAINING_MIP_LEVELS)
+            levelCount = pImage->GetCreateInfo().mipLevels - pSubresourceRange->baseMipLevel;
+
+        auto layerCount = pSubresourceRange->layerCount;
+        if (layerCount == VK_REMAINING_ARRAY_LAYERS)
+            layerCount = pImage->GetCreateInfo().arrayLayers - pSubresourceRange->baseArrayLayer;
+
+        m_resourceUses.push_back({ streamPos, VK_NULL_HANDLE, pImage->GetHandle() });
+
+        // Get the image's subresource state table, creating it on first access.
+        auto entry = m_imageAccesses.find(pImage);
+        if (entry == m_imageAccesses.end())
+            entry = m_imageAccesses.emplace(pImage, ImageAccessTable(pImage)).first;
+
+        // Split the table's columns at the accessed array layer range.
+        auto& table = entry->second;
+        auto firstColumn = table.SplitColumn(pSubresourceRange->baseArrayLayer);
+        auto lastColumn = table.SplitColumn(pSubresourceRange->baseArrayLayer + layerCount);
+        auto baseMipLevel = pSubresourceRange->baseMipLevel;
+        auto mipLevelEnd = baseMipLevel + levelCount;
+
+        // Group the subresources requiring a barrier by previous layout and access mask.  Subresources not yet accessed within the command buffer
+        // only require a layout transition from the layout they were in when recording began.
+        typedef std::pair<VkImageLayout, VkAccessFlags> BarrierValue;
+        std::vector<SubresourceRect<BarrierValue>> rects;
+        PipelineStageFlags srcStageMask = 0;
+        uint64_t signalStreamPos = 0;
+        CollectSubresourceRects(table, firstColumn, lastColumn, baseMipLevel, mipLevelEnd, [&](uint32_t column, uint32_t mipLevel, BarrierValue& value) {
+            auto& state = table.GetState(column, mipLevel);
+            if (state.stageMask == 0)
+            {
+                if (state.layout == layout)
+                    return false;
+
+                srcStageMask |= stageMask;
+            }
+            else if (RequiresPipelineBarrier(state.accessMask, accessMask) || state.layout != layout)
+            {
+                srcStageMask |= state.stageMask;
+                signalStreamPos = std::max(signalStreamPos, state.streamPos + 1);
+            }
+            else
+            {
+                return false;
+            }
+
+            value = BarrierValue(state.layout, state.accessMask);
+            return true;
+        }, rects);
+
+        // Insert an image memory barrier for each rectangle of subresources.
+        if (!rects.empty())
+        {
+            // Create first barrier entry or merge with previous barrier if access is at same stream position.
+            if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
+                m_barriers.push_back({ streamPos, 0, 0, {}, {} });
+
+            auto& barrier = m_barriers.back();
+            barrier.srcStageMask |= srcStageMask;
             barrier.dstStageMask |= stageMask;
+            barrier.signalStreamPosition = std::max(barrier.signalStreamPosition, signalStreamPos);
+            for (auto& rect : rects)
+            {
+                VkImageMemoryBarrier imageBarrier = {};
+                imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                imageBarrier.srcAccessMask = rect.value.second;
+                imageBarrier.dstAccessMask = accessMask;
+                imageBarrier.oldLayout = rect.value.first;
+                imageBarrier.newLayout = layout;
+                imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.image = pImage->GetHandle();
+                imageBarrier.subresourceRange.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
+                imageBarrier.subresourceRange.baseMipLevel = rect.baseMipLevel;
+                imageBarrier.subresourceRange.levelCount = rect.levelCount;
+                imageBarrier.subresourceRange.baseArrayLayer = rect.baseArrayLayer;
+                imageBarrier.subresourceRange.layerCount = rect.layerCount;
+                barrier.imageBarriers.push_back(imageBarrier);
+                barrier.imageBarrierStages.push_back({ srcStageMask, stageMask });
+            }
+        }
 
-            // Update buffer access entry.
-            BufferAccessInfo bufferAccessInfo = {};
-            bufferAccessInfo.streamPos = streamPos;
-            bufferAccessInfo.accessMask = accessMask;
-            bufferAccessInfo.stageMask = stageMask;
-            bufferAccessInfo.offset = offset;
-            bufferAccessInfo.range = range;
-            m_bufferAccesses.erase(std::get<0>(result));
-            m_bufferAccesses.emplace(insertKey, bufferAccessInfo);
+        // Update the accessed subresources' states, combining accesses that did not require a barrier.
+        for (auto column = firstColumn; column < lastColumn; ++column)
+        {
+            for (auto mipLevel = baseMipLevel; mipLevel < mipLevelEnd; ++mipLevel)
+            {
+                auto& state = table.GetState(column, mipLevel);
+                if (state.stageMask == 0 || RequiresPipelineBarrier(state.accessMask, accessMask) || state.layout != layout)
+                {
+                    state.accessMask = accessMask;
+                    state.stageMask = stageMask;
+                    state.layout = layout;
+                }
+                else
+                {
+                    state.accessMask |= accessMask;
+                    state.stageMask |= stageMask;
+                }
+
+                state.streamPos = streamPos;
+            }
         }
+
+        table.MergeColumns();
     }
 
-    void PipelineBarriers::ImageAccess(uint64_t streamPos, Image* pImage, const VezImageSubresourceRange* pSubresourceRange, VkImageLayout layout, VkAccessFlags accessMask, VkPipelineStageFlags stageMask)
+    void PipelineBarriers::AttachmentAccess(uint64_t streamPos, Image* pImage, const VezImageSubresourceRange* pSubresourceRange, VkImageLayout layout, VkAccessFlags accessMask, PipelineStageFlags stageMask,
+        VkAccessFlags* pSrcAccessMask, VkPipelineStageFlags* pSrcStageMask, VkImageLayout* pSrcLayout)
     {
-        // Per image accesses per layer are stored/merged independently.
+        auto levelCount = pSubresourceRange->levelCount;
+        if (levelCount == VK_REMAINING_MIP_LEVELS)
+            levelCount = pImage->GetCreateInfo().mipLevels - pSubresourceRange->baseMipLevel;
+
         auto layerCount = pSubresourceRange->layerCount;
         if (layerCount == VK_REMAINING_ARRAY_LAYERS)
             layerCount = pImage->GetCreateInfo().arrayLayers - pSubresourceRange->baseArrayLayer;
 
-        for (auto layer = pSubresourceRange->baseArrayLayer; layer < pSubresourceRange->baseArrayLayer + layerCount; ++layer)
+        m_resourceUses.push_back({ streamPos, VK_NULL_HANDLE, pImage->GetHandle() });
+
+        // Get the image's subresource state table, creating it on first access.
+        auto entry = m_imageAccesses.find(pImage);
+        if (entry == m_imageAccesses.end())
+            entry = m_imageAccesses.emplace(pImage, ImageAccessTable(pImage)).first;
+
+        auto& table = entry->second;
+        auto firstColumn = table.SplitColumn(pSubresourceRange->baseArrayLayer);
+        auto lastColumn = table.SplitColumn(pSubresourceRange->baseArrayLayer + layerCount);
+        auto baseMipLevel = pSubresourceRange->baseMipLevel;
+        auto mipLevelEnd = baseMipLevel + levelCount;
+
+        // Collect the previous accesses and replace them with the attachment's access.
+        *pSrcAccessMask = 0;
+        *pSrcStageMask = 0;
+        *pSrcLayout = table.GetState(firstColumn, baseMipLevel).layout;
+        for (auto column = firstColumn; column < lastColumn; ++column)
         {
-            // Check if a previous access to buffer has already been stored.  If none exists, insert entry with empty access list.
-            auto key = ImageAccessKey{ reinterpret_cast<uint64_t>(pImage), static_cast<uint64_t>(layer) };
-            auto entry = m_imageAccesses.find(key);
-            if (entry != m_imageAccesses.end())
+            for (auto mipLevel = baseMipLevel; mipLevel < mipLevelEnd; ++mipLevel)
             {
-                // Mip level access bit mask.
-                auto levelCount = pSubresourceRange->levelCount;
-                if (levelCount == VK_REMAINING_MIP_LEVELS)
-                    levelCount = pImage->GetCreateInfo().mipLevels - pSubresourceRange->baseMipLevel;
+                auto& state = table.GetState(column, mipLevel);
+                *pSrcAccessMask |= state.accessMask;
+                *pSrcStageMask |= GetLegacyStageMask(state.stageMask);
+
+                state.streamPos = streamPos;
+                state.accessMask = accessMask;
+                state.stageMask = stageMask;
+                state.layout = layout;
+            }
+        }
+
+        table.MergeColumns();
+    }
 
-                auto mipLevelAccessMask = ((1U << levelCount) - 1U) << pSubresourceRange->baseMipLevel;
-                auto mipLevelBarrierMask = mipLevelAccessMask;
+    uint32_t PipelineBarriers::MergeBarriers(const std::vector<uint64_t>& renderPassStreamPositions)
+    {
+        // Resource uses are logged in recording order, so their stream positions never decrease.
+        auto findUse = [&](uint64_t streamPos) {
+            return std::lower_bound(m_resourceUses.begin(), m_resourceUses.end(), streamPos, [](const ResourceUse& use, uint64_t value) {
+                return use.streamPos < value;
+            });
+        };
+
+        uint32_t mergedCount = 0;
+        auto barrier = m_barriers.begin();
+        while (barrier != m_barriers.end())
+        {
+            auto next = std::next(barrier);
+            if (next == m_barriers.end())
+                break;
 
-                // List of new accesses to add after iteration (old accesses that were split).
-                std::list<ImageAccessInfo> splitAccesses;
+            // The accesses the next barrier waits on must all precede the barrier it would be merged into.
+            bool merge = (next->signalStreamPosition <= barrier->streamPosition);
 
-                // Iterate over list of previous accesses.
-                auto& accessList = entry->second;
-                auto iter = accessList.begin();
-                while (iter != accessList.end())
-                {
-                    // If no bits are currently set in mip level access, quit iterating.
-                    if (!mipLevelAccessMask)
-                        break;
+            // No render pass may begin in between, since the commands within render passes do not log all of their uses.
+            if (merge)
+            {
+                auto renderPass = std::lower_bound(renderPassStreamPositions.begin(), renderPassStreamPositions.end(), barrier->streamPosition);
+                merge = (renderPass == renderPassStreamPositions.end() || *renderPass >= next->streamPosition);
+            }
 
-                    // Check to see if new access requires a pipeline barrier based on the old access if or image layout is changing.
-                    if (RequiresPipelineBarrier(iter->accessMask, accessMask) || iter->layout != layout)
+            // None of the commands in between may use the buffers or images the next barrier protects.
+            if (merge)
+            {
+                for (auto use = findUse(barrier->streamPosition); use != m_resourceUses.end() && use->streamPos < next->streamPosition && merge; ++use)
+                {
+                    if (use->buffer != VK_NULL_HANDLE)
                     {
-                        // Check to see if previous and new access overlap across mip level range.
-                        auto min = std::min(pSubresourceRange->baseMipLevel, iter->subresourceRange.baseMipLevel);
-                        auto max = std::max(pSubresourceRange->baseMipLevel + levelCount, iter->subresourceRange.baseMipLevel + iter->subresourceRange.levelCount);
-                        if (max - min < levelCount + iter->subresourceRange.levelCount)
-                        {
-                            // Calculate min and max mip level range for intersection.
-                            auto baseMipLevelMin = std::max(iter->subresourceRange.baseMipLevel, pSubresourceRange->baseMipLevel);
-                            auto baseMipLevelMax = std::min(iter->subresourceRange.baseMipLevel + iter->subresourceRange.levelCount, pSubresourceRange->baseMipLevel + levelCount);
-                            auto levelCount = baseMipLevelMax - baseMipLevelMin;
-
-                            // Try and merge barriers if they're occuring at the same command stream position.  Else create a new barrier entry.
-                            if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
-                                m_barriers.push_back({ streamPos, iter->stageMask, stageMask, {}, {} });
-
-                            // Add image memory barrier for overlapping region.
-                            VkImageMemoryBarrier imageBarrier = {};
-                            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                            imageBarrier.srcAccessMask = iter->accessMask;;
-                            imageBarrier.dstAccessMask = accessMask;
-                            imageBarrier.oldLayout = iter->layout;
-                            imageBarrier.newLayout = layout;
-                            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                            imageBarrier.image = pImage->GetHandle();
-                            imageBarrier.subresourceRange.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
-                            imageBarrier.subresourceRange.baseMipLevel = baseMipLevelMin;
-                            imageBarrier.subresourceRange.levelCount = levelCount;
-                            imageBarrier.subresourceRange.baseArrayLayer = layer;
-                            imageBarrier.subresourceRange.layerCount = 1;
-                            m_barriers.back().imageBarriers.push_back(imageBarrier);
-
-                            // Shrink and/or split original entry.
-                            if (iter->subresourceRange.baseMipLevel < baseMipLevelMin && iter->subresourceRange.baseMipLevel + iter->subresourceRange.levelCount > baseMipLevelMax)
-                            {
-                                // Shrink original entry.
-                                iter->subresourceRange.levelCount = imageBarrier.subresourceRange.baseMipLevel - iter->subresourceRange.baseMipLevel;
-
-                                // Add a new entry for remaining tail end of previous access.
-                                ImageAccessInfo newAccessInfo = *iter;
-                                newAccessInfo.subresourceRange.baseMipLevel = baseMipLevelMax;
-                                newAccessInfo.subresourceRange.levelCount = (iter->subresourceRange.baseMipLevel + iter->subresourceRange.levelCount) - baseMipLevelMax;
-                                splitAccesses.push_back(newAccessInfo);
-
-                                // Move to next entry.
-                                ++iter;
-                            }
-                            // Old entry is split at the front.
-                            else if (iter->subresourceRange.baseMipLevel < baseMipLevelMin)
-                            {
-                                // Shrink original entry.
-                                iter->subresourceRange.levelCount = imageBarrier.subresourceRange.baseMipLevel - iter->subresourceRange.baseMipLevel;
-
-                                // Move to next entry.
-                                ++iter;
-                            }
-                            // Old entry is split at the tail.
-                            else if (iter->subresourceRange.baseMipLevel + iter->subresourceRange.levelCount > baseMipLevelMax)
-                            {
-                                // Shrink and adjust base mip level of original entry.
-                                iter->subresourceRange.levelCount = (iter->subresourceRange.baseMipLevel + iter->subresourceRange.levelCount) - baseMipLevelMax;
-                                iter->subresourceRange.baseMipLevel = baseMipLevelMax;
-
-                                // Move to next entry.
-                                ++iter;
-                            }
-                            // Else remove original entry.
-                            else
-                            {
-                                iter = accessList.erase(iter);
-                            }
-
-                            // Unset relevant bits in mip level access and barrier masks.
-                            auto unsetBits = (((1U << levelCount) - 1U) << baseMipLevelMin);
-                            //mipLevelAccessMask &= ~unsetBits;
-                            mipLevelBarrierMask &= ~unsetBits;
-                        }
-                        // If they don't overlap, no action needs to be taken.  Move onto next entry.
-                        else
-                        {
-                            ++iter;
-                        }
+                        merge = std::none_of(next->bufferBarriers.begin(), next->bufferBarriers.end(), [&](const VkBufferMemoryBarrier& bufferBarrier) {
+                            return bufferBarrier.buffer == use->buffer;
+                        });
                     }
-                    // See if old entry can be removed.
                     else
                     {
-                        // See if old and new access can be merged.
-                        auto expandedMipLevelAccessMask = mipLevelAccessMask | (mipLevelAccessMask << 1) | (mipLevelAccessMask >> 1);
-                        auto prevAccessMipLevelAccessMask = ((1U << iter->subresourceRange.levelCount) - 1U) << iter->subresourceRange.baseMipLevel;
-                        if ((prevAccessMipLevelAccessMask & expandedMipLevelAccessMask) != 0 && iter->layout == layout)
-                        {
-                            // Combine old access into new access.
-                            mipLevelAccessMask |= prevAccessMipLevelAccessMask;
-
-                            // Remove old access entry.
-                            iter = accessList.erase(iter);
-                        }
-                        // Else move onto next entry.
-                        else
-                        {
-                            ++iter;
-                        }
+                        merge = std::none_of(next->imageBarriers.begin(), next->imageBarriers.end(), [&](const VkImageMemoryBarrier& imageBarrier) {
+                            return imageBarrier.image == use->image;
+                        });
                     }
                 }
+            }
 
-                // Add all old accesses that were split back into access list.
-                accessList.insert(accessList.begin(), splitAccesses.begin(), splitAccesses.end());
+            if (!merge)
+            {
+                barrier = next;
+                continue;
+            }
 
-                // Add new entries for remaining active bits in access mask.
-                while (mipLevelAccessMask)
-                {
-                    // Determine start and end of next bit range.
-                    auto bitOffsetStart = FindLSB(mipLevelAccessMask);
-                    auto bitOffsetEnd = FindLSB(~mipLevelAccessMask & ~((1U << bitOffsetStart) - 1U));
-                    auto length = bitOffsetEnd - bitOffsetStart;
-
-                    // Remove bits from mask.
-                    mipLevelAccessMask &= ~((1U << bitOffsetEnd) - 1U);
-
-                    // Add new access entry.
-                    ImageAccessInfo access = {};
-                    access.streamPos = streamPos;
-                    access.accessMask = accessMask;
-                    access.stageMask = stageMask;
-                    access.layout = layout;
-                    access.subresourceRange.baseMipLevel = bitOffsetStart;
-                    access.subresourceRange.levelCount = length;
-                    access.subresourceRange.baseArrayLayer = layer;
-                    access.subresourceRange.layerCount = 1;
-                    accessList.push_back(access);
-                }
+            // Hoist the next barrier's memory barriers into this one and combine their stage masks.
+            barrier->srcStageMask |= next->srcStageMask;
+            barrier->dstStageMask |= next->dstStageMask;
+            barrier->signalStreamPosition = std::max(barrier->signalStreamPosition, next->signalStreamPosition);
+            barrier->bufferBarriers.insert(barrier->bufferBarriers.end(), next->bufferBarriers.begin(), next->bufferBarriers.end());
+            barrier->imageBarriers.insert(barrier->imageBarriers.end(), next->imageBarriers.begin(), next->imageBarriers.end());
+            barrier->bufferBarrierStages.insert(barrier->bufferBarrierStages.end(), next->bufferBarrierStages.begin(), next->bufferBarrierStages.end());
+            barrier->imageBarrierStages.insert(barrier->imageBarrierStages.end(), next->imageBarrierStages.begin(), next->imageBarrierStages.end());
+            m_barriers.erase(next);
+            ++mergedCount;
+        }
 
-                // If current access is changing the default image layout, add one or more image memory barriers.
-                if (pImage->GetDefaultImageLayout() != layout && mipLevelBarrierMask)
-                {
-                    // Create first barrier entry or merge with previous barrier if access is at same stream position.
-                    if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
-                        m_barriers.push_back({ streamPos, stageMask, stageMask, {}, {} });
+        return mergedCount;
+    }
 
-                    // Insert an image memory barrier for each group of active bits in mip level barrier mask.
-                    while (mipLevelBarrierMask)
+    uint32_t PipelineBarriers::SplitBarriers(const std::vector<uint64_t>& workStreamPositions, const std::vector<std::pair<uint64_t, uint64_t>>& renderPassRanges, SyncPrimitivesPool* pSyncPrimitivesPool, std::vector<VkEvent>& events)
+    {
+        // Returns whether a command inserted before the first recorded command at or after the stream position would be within a render pass.
+        // Render pass ranges span from the stream position of the render pass's begin to that of its end.
+        auto isWithinRenderPass = [&](uint64_t streamPos) {
+            auto range = std::upper_bound(renderPassRanges.begin(), renderPassRanges.end(), streamPos, [](uint64_t value, const std::pair<uint64_t, uint64_t>& entry) {
+                return value <= entry.second;
+            });
+            return (range != renderPassRanges.end() && range->first < streamPos);
+        };
+
+        // Returns the number of commands performing work within a range of stream positions.
+        auto countWork = [&](uint64_t beginStreamPos, uint64_t endStreamPos) {
+            auto first = std::lower_bound(workStreamPositions.begin(), workStreamPositions.end(), beginStreamPos);
+            auto last = std::lower_bound(first, workStreamPositions.end(), endStreamPos);
+            return static_cast<uint32_t>(std::distance(first, last));
+        };
+
+        // Barriers are visited in stream order, keeping those not split since they drain the pipeline stages they wait on.
+        std::vector<const PipelineBarrier*> drainingBarriers;
+        uint32_t splitCount = 0;
+        for (auto& barrier : m_barriers)
+        {
+            // Barriers without prior accesses to wait on, or waiting on accesses recorded after them within the same render pass, are never split.
+            auto signalStreamPos = barrier.signalStreamPosition;
+            bool split = (signalStreamPos != 0 && signalStreamPos <= barrier.streamPosition && !isWithinRenderPass(signalStreamPos) && !isWithinRenderPass(barrier.streamPosition));
+            if (split)
+            {
+                // Independent work starts after the last barrier already draining the stages this barrier waits on.
+                auto workStreamPos = signalStreamPos;
+                for (auto itr = drainingBarriers.rbegin(); itr != drainingBarriers.rend() && (*itr)->streamPosition > signalStreamPos; ++itr)
+                {
+                    if (((*itr)->srcStageMask & barrier.srcStageMask) == barrier.srcStageMask)
                     {
-                        // Determine start and end of next bit range.
-                        auto bitOffsetStart = FindLSB(mipLevelBarrierMask);
-                        auto bitOffsetEnd = FindLSB(~mipLevelBarrierMask & ~((1U << bitOffsetStart) - 1U));
-                        auto length = bitOffsetEnd - bitOffsetStart;
-
-                        // Remove bits from mask.
-                        mipLevelBarrierMask &= ~((1U << bitOffsetEnd) - 1U);
-
-                        VkImageMemoryBarrier imageBarrier = {};
-                        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                        imageBarrier.srcAccessMask = 0;
-                        imageBarrier.dstAccessMask = accessMask;
-                        imageBarrier.oldLayout = pImage->GetDefaultImageLayout();
-                        imageBarrier.newLayout = layout;
-                        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                        imageBarrier.image = pImage->GetHandle();
-                        imageBarrier.subresourceRange.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
-                        imageBarrier.subresourceRange.baseMipLevel = bitOffsetStart;
-                        imageBarrier.subresourceRange.levelCount = length;
-                        imageBarrier.subresourceRange.baseArrayLayer = layer;
-                        imageBarrier.subresourceRange.layerCount = 1;
-
-                        m_barriers.back().dstStageMask |= stageMask;
-                        m_barriers.back().imageBarriers.push_back(imageBarrier);
+                        workStreamPos = (*itr)->streamPosition;
+                        break;
                     }
                 }
+
+                split = (countWork(workStreamPos, barrier.streamPosition) >= s_minSplitBarrierWorkCount);
+            }
+
+            if (split && pSyncPrimitivesPool->AcquireEvent(&barrier.event) == VK_SUCCESS)
+            {
+                events.push_back(barrier.event);
+                ++splitCount;
             }
-            // Else check to see if new layout differs from default layout and insert a new image access info entry.
             else
             {
-                // Add image memory barrier if new layout differs from old layout.
-                auto defaultLayout = pImage->GetDefaultImageLayout();
-                auto pipelineBarrierIndex = -1;
-                if (defaultLayout != layout)
-                {
-                    // Create first barrier entry or merge with previous barrier if access is at same stream position.
-                    if (m_barriers.size() == 0 || m_barriers.back().streamPosition != streamPos)
-                        m_barriers.push_back({ streamPos, stageMask, stageMask, {}, {} });
-
-                    VkImageMemoryBarrier imageBarrier = {};
-                    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                    imageBarrier.srcAccessMask = 0;
-                    imageBarrier.dstAccessMask = accessMask;
-                    imageBarrier.oldLayout = defaultLayout;
-                    imageBarrier.newLayout = layout;
-                    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    imageBarrier.image = pImage->GetHandle();
-                    imageBarrier.subresourceRange.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
-                    imageBarrier.subresourceRange.baseMipLevel = pSubresourceRange->baseMipLevel;
-                    imageBarrier.subresourceRange.levelCount = pSubresourceRange->levelCount;
-                    imageBarrier.subresourceRange.baseArrayLayer = layer;
-                    imageBarrier.subresourceRange.layerCount = 1;
-
-                    m_barriers.back().dstStageMask |= stageMask;
-                    m_barriers.back().imageBarriers.push_back(imageBarrier);
-                }
-
-                // Add entry to image accesses.
-                ImageAccessInfo imageAccessInfo = {};
-                imageAccessInfo.streamPos = streamPos;
-                imageAccessInfo.accessMask = accessMask;
-                imageAccessInfo.stageMask = stageMask;
-                imageAccessInfo.layout = layout;
-                imageAccessInfo.subresourceRange.baseArrayLayer = layer;
-                imageAccessInfo.subresourceRange.layerCount = 1;
-                imageAccessInfo.subresourceRange.baseMipLevel = pSubresourceRange->baseMipLevel;
-                imageAccessInfo.subresourceRange.levelCount = pSubresourceRange->levelCount;
-                if (imageAccessInfo.subresourceRange.levelCount == VK_REMAINING_MIP_LEVELS)
-                    imageAccessInfo.subresourceRange.levelCount = pImage->GetCreateInfo().mipLevels - pSubresourceRange->baseMipLevel;
-
-                ImageAccessList accessList = { imageAccessInfo };
-                m_imageAccesses.emplace(key, std::move(accessList));
+                barrier.event = VK_NULL_HANDLE;
+                drainingBarriers.push_back(&barrier);
             }
-        }     
+        }
+
+        return splitCount;
     }
 
     void PipelineBarriers::Clear()
@@ -518,5 +807,6 @@ namespace vez
         m_bufferAccesses.clear();
         m_imageAccesses.clear();
         m_barriers.clear();
+        m_resourceUses.clear();
     }    
 }
\ No newline at end of file
@@ -24,35 +24,73 @@
 #include <array>
 #include <vector>
 #include <list>
-#include <map>
 #include <unordered_map>
+#include "Utility/VkHelpers.h"
 #include "VEZ.h"
 
 namespace vez
 {
+    class Buffer;
+    class Image;
+    class ImageView;
+    class SyncPrimitivesPool;
+    class Queue;
+
+    // The signal stream position immediately follows the last access the barrier waits on, or is zero if it only waits on no prior access.
+    // Split barriers set their event at the signal stream position and wait on it at the barrier's stream position.
+    // Barriers recorded into command buffers also keep the stage masks of each of their buffer and image memory barriers.
     struct PipelineBarrier
     {
         uint64_t streamPosition;
-        VkPipelineStageFlags srcStageMask;
-        VkPipelineStageFlags dstStageMask;
+        PipelineStageFlags srcStageMask;
+        PipelineStageFlags dstStageMask;
         std::vector<VkBufferMemoryBarrier> bufferBarriers;
         std::vector<VkImageMemoryBarrier> imageBarriers;
+        std::vector<MemoryBarrierStages> bufferBarrierStages;
+        std::vector<MemoryBarrierStages> imageBarrierStages;
+        uint64_t signalStreamPosition;
+        VkEvent event;
     };
 
     /* IMPLEMENTATION NOTES:    
         This class handles tracking resource usages within the same command buffer for automated pipeline barrier insertion.
     
-        Buffer accesses are tracked per region with read-combining and write-combining done on adjacent 1D ranges.
-        Buffer accesses are stored in an STL map keyed by the buffer's memory address, offset and range.
-    
-        Image accesses are tracked per array layer and mip level ranges.  Read and write combining are performed between 2D ranges where
-        the array layer is treated as the x-coordinate and mip level as the y-coordinate. If two accesses' rectangles intersect, then either
-        their regions are merged into a larger rectangle or a pipeline barrier is inserted if the accesses require it.
-        Images are stored in an STL unordered_map keyed by the image's memory address and value being a linked list of all accesses.
+        Buffer accesses are tracked per region with read-combining done on overlapping 1D ranges.
+        Each buffer's accesses are stored in a vector of non-overlapping intervals sorted by offset, keyed in an STL unordered_map by the buffer.
+        Overlapping intervals are found with a binary search, split where the new access partially covers them and adjacent intervals with
+        identical accesses are merged, so only the overlapped entries of the vector are touched.
     
-        This implementation likely needs to be optimized and improved to handle the cases of random scattered accesses across images and buffers as
-        the process of merging and pipeline barrier insertion could become quite expensive.  However in the ideal case where accesses and linear and semi-coallesced,
-        the performance should not be an issue.
+        Image accesses are tracked per subresource in a table of states indexed by array layer and mip level, stored in an STL unordered_map keyed
+        by the image.  Images with few array layers store one column of mip level states per layer, while images with many array layers store columns
+        for ranges of layers sharing identical states, split and merged again as accesses are made.  The pipeline barriers required by an access, and
+        the final layout transitions, are batched into rectangles of contiguous subresources where the array layer is treated as the x-coordinate
+        and mip level as the y-coordinate.
+
+        Recording starts from the layouts images were left in by previously submitted command buffers, as tracked by each Image object.
+        When a command buffer is submitted, the transitions from the images' resident layouts to the layouts it was recorded against are
+        resolved in submission order, and the layouts it leaves the images in become resident.  Buffers and images created for a single queue
+        family are exclusively owned by the family of the queue that last used them.  When a command buffer submitted to a queue of another
+        family uses them, a release barrier is submitted to that queue and a matching acquire barrier precedes the command buffer.  Buffers only
+        transfer the ranges the command buffer accesses, with the release waiting on the accesses earlier submissions left those ranges in.
+        The resident states and owners resolved for a submission are only applied once it is successfully submitted.  Submissions to all queues
+        resolve and apply resident states under a single device lock, so each resolves against the states left by the submission before it.
+        Ownership releases are only submitted once nothing but the acquiring submission itself can fail.  If it still fails, the released
+        resources are acquired on their own so their resident owner and layouts match the transfers that executed.
+
+        When split barriers are enabled, a pipeline barrier with enough independent work recorded between the accesses it waits on and the access
+        requiring it is replaced by an event set right after those accesses and waited on in its place, so the work in between is not drained.
+        Work preceding a barrier that is not split and already waits on the same pipeline stages is not counted as independent.  Events can only
+        be set and waited on outside of render passes.
+
+        Render pass attachments are not synchronized with pipeline barriers.  Their accesses are recorded once the render pass ends, returning the
+        accesses that preceded it so the render pass's external subpass dependencies can wait on them instead.
+
+        Every use of a resource is logged with its stream position so that, once recording ends, each pipeline barrier can be merged into the
+        one before it when no command in between uses the resources it protects and the accesses it waits on all precede that barrier.
+
+        Transfer commands are tracked with the separate copy, resolve, blit and clear stages, and every memory barrier keeps the stage masks of
+        the accesses it synchronizes.  When VK_KHR_synchronization2 is enabled each memory barrier waits on its own stages, even once merged with
+        others, otherwise the barrier's combined stage masks are used with the extended stages folded back into the transfer stage.
     */
     class PipelineBarriers
     {
@@ -61,7 +99,7 @@ namespace vez
         {
             uint64_t streamPos;
             VkAccessFlags accessMask;
-            VkPipelineStageFlags stageMask;
+            PipelineStageFlags stageMask;
         };
 
         struct BufferAccessInfo : AccessInfo
@@ -76,27 +114,131 @@ namespace vez
             VezImageSubresourceRange subresourceRange;
         };
 
-        typedef std::array<uint64_t, 3> BufferAccessKey;
-        typedef std::array<uint64_t, 2> ImageAccessKey;
-        typedef std::list<ImageAccessInfo> ImageAccessList;
+        typedef std::vector<BufferAccessInfo> BufferAccessList;
+        // Access state of a single image subresource.  Subresources not yet accessed have an empty stage mask.
+        // The initial layout is the one the subresource was assumed to be in when recording began.
+        struct ImageSubresourceState
+        {
+            uint64_t streamPos;
+            VkAccessFlags accessMask;
+            PipelineStageFlags stageMask;
+            VkImageLayout layout;
+            VkImageLayout initialLayout;
+        };
+
+        // Table of an image's subresource states, stored as columns of mip level states for ranges of array layers.
+        class ImageAccessTable
+        {
+        public:
+            ImageAccessTable() {}
+
+            // Creates a table with every subresource in the given layout and not yet accessed.
+            ImageAccessTable(uint32_t mipLevels, uint32_t arrayLayers, VkImageLayout layout);
+
+            // Creates a table starting from the layouts the image is left in by previously submitted command buffers.
+            ImageAccessTable(Image* pImage);
+
+            uint32_t GetColumnCount() const { return static_cast<uint32_t>(m_columnLayers.size()); }
+
+            uint32_t GetColumnFirstLayer(uint32_t column) const { return m_columnLayers[column]; }
+
+            uint32_t GetColumnLayerCount(uint32_t column) const { return (column + 1 < GetColumnCount() ? m_columnLayers[column + 1] : m_arrayLayers) - m_columnLayers[column]; }
+
+            ImageSubresourceState& GetState(uint32_t column, uint32_t mipLevel) { return m_states[column * m_mipLevels + mipLevel]; }
+
+            const ImageSubresourceState& GetState(uint32_t column, uint32_t mipLevel) const { return m_states[column * m_mipLevels + mipLevel]; }
+
+            // Returns the column containing the given array layer.
+            uint32_t FindColumn(uint32_t layer) const;
+
+            // Splits the column containing the given array layer so that a column starts at it, and returns that column.
+            uint32_t SplitColumn(uint32_t layer);
+
+            // Merges adjacent columns with identical states when array layers are range compressed.
+            void MergeColumns();
+
+            // Collects the rectangles of accessed subresources sharing the same layout, access and stage masks.
+            void GetAccesses(std::vector<ImageAccessInfo>& accesses) const;
+
+            // Adds the layout transitions from this resident state to the initial layouts a command buffer was recorded against,
+            // then updates the resident state to the layouts and accesses the command buffer leaves the image in.
+            // When the queue family indices differ, every subresource's ownership is transferred along with its layout transition.
+            void Resolve(Image* pImage, const ImageAccessTable& recorded, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, PipelineBarrier& barrier);
+
+            // Updates the resident state after a barrier transitioned a range of subresources to the given layout, completing their accesses.
+            void Transition(const VkImageSubresourceRange& subresourceRange, VkImageLayout layout);
+
+        private:
+            uint32_t m_mipLevels = 0;
+            uint32_t m_arrayLayers = 0;
+            bool m_dense = false;
+            std::vector<uint32_t> m_columnLayers;
+            std::vector<ImageSubresourceState> m_states;
+        };
 
         PipelineBarriers();
 
-        std::map<ImageAccessKey, ImageAccessList>& GetImageAccesses() { return m_imageAccesses; }
+        std::unordered_map<Buffer*, BufferAccessList>& GetBufferAccesses() { return m_bufferAccesses; }
+
+        std::unordered_map<Image*, ImageAccessTable>& GetImageAccesses() { return m_imageAccesses; }
 
         std::list<PipelineBarrier>& GetBarriers() { return m_barriers; }
 
-        VkImageLayout GetImageLayout(ImageView* pImageView);
+        VkImageLayout GetImageLayout(uint64_t streamPos, ImageView* pImageView);
 
-        void BufferAccess(uint64_t streamPos, Buffer* pBuffer, VkDeviceSize offset, VkDeviceSize range, VkAccessFlags accessMask, VkPipelineStageFlags stageMask);
+        void BufferAccess(uint64_t streamPos, Buffer* pBuffer, VkDeviceSize offset, VkDeviceSize range, VkAccessFlags accessMask, PipelineStageFlags stageMask);
 
-        void ImageAccess(uint64_t streamPos, Image* pImage, const VezImageSubresourceRange* pSubresourceRange, VkImageLayout layout, VkAccessFlags accessMask, VkPipelineStageFlags stageMask);
+        void ImageAccess(uint64_t streamPos, Image* pImage, const VezImageSubresourceRange* pSubresourceRange, VkImageLayout layout, VkAccessFlags accessMask, PipelineStageFlags stageMask);
+
+        // Records a render pass attachment's access without inserting a pipeline barrier, since the render pass's subpass dependencies synchronize it.
+        // Returns the access and legacy stage masks of the previous accesses to the attachment's subresources, and the layout its first subresource
+        // was left in, which accounts for transitions inserted before the render pass for accesses within it.
+        void AttachmentAccess(uint64_t streamPos, Image* pImage, const VezImageSubresourceRange* pSubresourceRange, VkImageLayout layout, VkAccessFlags accessMask, PipelineStageFlags stageMask,
+            VkAccessFlags* pSrcAccessMask, VkPipelineStageFlags* pSrcStageMask, VkImageLayout* pSrcLayout);
+
+        // Merges each pipeline barrier into the previous one when allowed, never moving it above the beginning of a render pass given the
+        // stream positions all render passes begin at.  Returns the number of barriers merged.
+        uint32_t MergeBarriers(const std::vector<uint64_t>& renderPassStreamPositions);
+
+        // Converts pipeline barriers into split barriers using events acquired from the pool, given the stream positions of all recorded commands
+        // performing work and the stream position ranges of all render passes.  Returns the number of barriers split.
+        uint32_t SplitBarriers(const std::vector<uint64_t>& workStreamPositions, const std::vector<std::pair<uint64_t, uint64_t>>& renderPassRanges, SyncPrimitivesPool* pSyncPrimitivesPool, std::vector<VkEvent>& events);
 
         void Clear();
 
     private:
-        std::map<BufferAccessKey, BufferAccessInfo> m_bufferAccesses;
-        std::map<ImageAccessKey, ImageAccessList> m_imageAccesses;
+        // Use of a buffer or image by the command at a stream position.
+        struct ResourceUse
+        {
+            uint64_t streamPos;
+            VkBuffer buffer;
+            VkImage image;
+        };
+
+        std::unordered_map<Buffer*, BufferAccessList> m_bufferAccesses;
+        BufferAccessList m_splitBufferAccesses;
+        std::unordered_map<Image*, ImageAccessTable> m_imageAccesses;
         std::list<PipelineBarrier> m_barriers;
-    };    
+        std::vector<ResourceUse> m_resourceUses;
+    };
+
+    // Resident image states and owner queues resolved for a queue submission, which are only applied to the resources once it succeeds.
+    // Later command buffers of the same submission resolve against the states left by earlier ones.
+    struct ResidentStateUpdates
+    {
+        struct ImageState
+        {
+            PipelineBarriers::ImageAccessTable residentState;
+            Queue* ownerQueue;
+        };
+
+        struct BufferState
+        {
+            PipelineBarriers::BufferAccessList residentAccesses;
+            Queue* ownerQueue;
+        };
+
+        std::unordered_map<Image*, ImageState> images;
+        std::unordered_map<Buffer*, BufferState> buffers;
+    };
 }
\ No newline at end of file
@@ -21,11 +21,13 @@
 //
 #include <cmath>
 #include <vector>
+#include <unordered_map>
 #include <cstring>
 #include "Utility/ObjectLookup.h"
 #include "Device.h"
 #include "Swapchain.h"
 #include "CommandBuffer.h"
+#include "Buffer.h"
 #include "Image.h"
 #include "SyncPrimitivesPool.h"
 #include "Fence.h"
@@ -43,8 +45,37 @@ namespace vez
 
     }
 
+    Queue::~Queue()
+    {
+        // Release the fences of submitted transition command buffers.
+        while (!m_pendingTransitionCommandBuffers.empty())
+        {
+            m_device->GetSyncPrimitivesPool()->ReleaseFence(std::get<0>(m_pendingTransitionCommandBuffers.front()));
+            m_pendingTransitionCommandBuffers.pop();
+        }
+
+        // Destroy the transition command pool along with all of its command buffers.
+        if (m_transitionCommandPool)
+            vkDestroyCommandPool(m_device->GetHandle(), m_transitionCommandPool, nullptr);
+    }
+
     VkResult Queue::Submit(uint32_t submitCount, const VezSubmitInfo* pSubmits, VkFence* pFence)
     {
+        // Wait for any command buffers still being decoded asynchronously.
+        for (auto i = 0U; i < submitCount; ++i)
+        {
+            for (auto k = 0U; k < pSubmits[i].commandBufferCount; ++k)
+            {
+                auto commandBuffer = ObjectLookup::GetObjectImpl(pSubmits[i].pCommandBuffers[k]);
+                if (commandBuffer)
+                {
+                    auto result = commandBuffer->WaitForDecode();
+                    if (result != VK_SUCCESS)
+                        return result;
+                }
+            }
+        }
+
         // Create a fence for the submission if calling application requests one.
         auto syncPrimitivesPool = m_device->GetSyncPrimitivesPool();
         VkFence fence = VK_NULL_HANDLE;
@@ -63,11 +94,93 @@ namespace vez
             totalSignalSemaphores += pSubmits[i].signalSemaphoreCount;
         }
 
-        // Fill native Vulkan data structures.
+        // Fill native Vulkan data structures.  Space is reserved for a transition command buffer preceding each command buffer.
         std::vector<VkSubmitInfo> submitInfos(submitCount);
+        std::vector<VkCommandBuffer> commandBuffers;
+        std::vector<VkCommandBuffer> transitionCommandBuffers;
+        std::vector<std::vector<VkSemaphore>> ownershipSemaphores(submitCount);
+        std::vector<VkSemaphore> signalSemaphores(totalSignalSemaphores);
+        uint32_t acquiredSignalSemaphoreCount = 0;
+        std::vector<OwnershipRelease> ownershipReleases;
+        uint32_t submittedReleaseCount = 0;
+        ResidentStateUpdates updates;
+        commandBuffers.reserve(totalCommandBuffers * 2);
+
+        // Return everything acquired for a submission that never reaches the queue.  Resident states staged for it are dropped.
+        // Resources already released by other queues are acquired on their own, which also waits on the releases' semaphores.
+        auto abortSubmission = [&](VkResult result) {
+            if (submittedReleaseCount > 0)
+                AcquireReleasedOwnership(submittedReleaseCount, ownershipReleases.data());
+
+            for (auto i = submittedReleaseCount; i < ownershipReleases.size(); ++i)
+                ownershipReleases[i].pQueue->DiscardOwnershipRelease(ownershipReleases[i]);
+
+            m_device->UnlockResidentState();
+            syncPrimitivesPool->ReleaseFence(fence);
+            if (acquiredSignalSemaphoreCount > 0)
+                syncPrimitivesPool->ReleaseSemaphores(acquiredSignalSemaphoreCount, signalSemaphores.data());
+
+            if (transitionCommandBuffers.size() > 0)
+                ReleaseTransitionCommandBuffers(static_cast<uint32_t>(transitionCommandBuffers.size()), transitionCommandBuffers.data());
+
+            return result;
+        };
+
+        // Resident states are resolved and applied under the device's lock, so no other submission resolves against them in between.
+        m_device->LockResidentState();
+
+        // Iterate over all submissions.
+        for (auto i = 0U; i < submitCount; ++i)
+        {
+            // Set submit info parameters to default values.
+            submitInfos[i] = {};
+            submitInfos[i].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfos[i].pCommandBuffers = commandBuffers.data() + commandBuffers.size();
+
+            // Resolve the image layouts each command buffer was recorded against in submission order.
+            // Any transitions from the images' resident layouts are recorded into a command buffer submitted right before it, along with
+            // the acquire barriers of resources released by queues of other families, which the submission waits on with semaphores.
+            // The releases are only submitted once nothing but the submission itself can fail.
+            for (auto k = 0U; k < pSubmits[i].commandBufferCount; ++k)
+            {
+                auto commandBuffer = ObjectLookup::GetObjectImpl(pSubmits[i].pCommandBuffers[k]);
+                if (commandBuffer)
+                {
+                    PipelineBarrier barrier = {};
+                    std::unordered_map<Queue*, PipelineBarrier> releaseBarriers;
+                    commandBuffer->GetStreamEncoder().ResolveResidentState(this, updates, barrier, releaseBarriers);
+                    for (auto& itr : releaseBarriers)
+                    {
+                        OwnershipRelease release = {};
+                        auto result = itr.first->PrepareOwnershipRelease(itr.second, &release);
+                        if (result != VK_SUCCESS)
+                            return abortSubmission(result);
+
+                        ownershipSemaphores[i].push_back(release.semaphore);
+                        ownershipReleases.push_back(std::move(release));
+                    }
+
+                    if (barrier.imageBarriers.size() > 0 || barrier.bufferBarriers.size() > 0)
+                    {
+                        VkCommandBuffer transitionCommandBuffer = VK_NULL_HANDLE;
+                        auto result = RecordTransitionCommandBuffer(barrier, &transitionCommandBuffer);
+                        if (result != VK_SUCCESS)
+                            return abortSubmission(result);
+
+                        commandBuffers.push_back(transitionCommandBuffer);
+                        transitionCommandBuffers.push_back(transitionCommandBuffer);
+                    }
+                }
+
+                commandBuffers.push_back(pSubmits[i].pCommandBuffers[k]);
+            }
+
+            submitInfos[i].commandBufferCount = static_cast<uint32_t>(commandBuffers.data() + commandBuffers.size() - submitInfos[i].pCommandBuffers);
+            totalWaitSemaphores += static_cast<uint32_t>(ownershipSemaphores[i].size());
+        }
+
         std::vector<VkSemaphore> waitSemaphores(totalWaitSemaphores);
         std::vector<VkPipelineStageFlags> waitDstStageMasks(totalWaitSemaphores);
-        std::vector<VkSemaphore> signalSemaphores(totalSignalSemaphores);
 
         VkSemaphore* pNextWaitSemaphore = nullptr;
         VkPipelineStageFlags* pNextWaitDstStageMask = nullptr;
@@ -77,15 +190,8 @@ namespace vez
         if (waitDstStageMasks.size() > 0) pNextWaitDstStageMask = &waitDstStageMasks[0];
         if (signalSemaphores.size() > 0) pNextSignalSemaphore = &signalSemaphores[0];
 
-        // Iterate over all submissions.
         for (auto i = 0U; i < submitCount; ++i)
         {
-            // Set submit info parameters to default values.
-            submitInfos[i] = {};
-            submitInfos[i].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfos[i].commandBufferCount = pSubmits[i].commandBufferCount;
-            submitInfos[i].pCommandBuffers = pSubmits[i].pCommandBuffers;
-           
             // Copy wait semaphores.
             for (auto k = 0U; k < pSubmits[i].waitSemaphoreCount; ++k)
             {
@@ -103,6 +209,23 @@ namespace vez
                 ++submitInfos[i].waitSemaphoreCount;
             }
 
+            // Wait on the ownership releases before the acquire barriers execute.
+            for (auto semaphore : ownershipSemaphores[i])
+            {
+                if (!submitInfos[i].pWaitSemaphores)
+                {
+                    submitInfos[i].pWaitSemaphores = pNextWaitSemaphore;
+                    submitInfos[i].pWaitDstStageMask = pNextWaitDstStageMask;
+                }
+
+                *pNextWaitSemaphore = semaphore;
+                *pNextWaitDstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+                ++pNextWaitSemaphore;
+                ++pNextWaitDstStageMask;
+                ++submitInfos[i].waitSemaphoreCount;
+            }
+
             // Copy signal semaphores.
             for (auto k = 0U; k < pSubmits[i].signalSemaphoreCount; ++k)
             {
@@ -112,9 +235,10 @@ namespace vez
                 VkSemaphore semaphore = VK_NULL_HANDLE;
                 auto result = syncPrimitivesPool->AcquireSemaphore(1, &semaphore);
                 if (result != VK_SUCCESS)
-                    return result;
+                    return abortSubmission(result);
 
                 *pNextSignalSemaphore = semaphore;
+                ++acquiredSignalSemaphoreCount;
                 pSubmits[i].pSignalSemaphores[k] = reinterpret_cast<VkSemaphore>(semaphore);
 
                 ++pNextSignalSemaphore;
@@ -122,8 +246,39 @@ namespace vez
             }
         }
 
+        // Submit the ownership releases, each after all previous submissions to its queue so it follows every command that used the resources there.
+        for (auto& release : ownershipReleases)
+        {
+            result = release.pQueue->SubmitOwnershipRelease(release);
+            if (result != VK_SUCCESS)
+                return abortSubmission(result);
+
+            ++submittedReleaseCount;
+        }
+
         // Submit to the Vulkan queue.
+        m_submitLock.Lock();
         result = vkQueueSubmit(m_handle, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), fence);
+        if (result != VK_SUCCESS)
+        {
+            m_submitLock.Unlock();
+            return abortSubmission(result);
+        }
+
+        // The layouts and owners the submitted command buffers leave their resources in become resident.
+        for (auto& itr : updates.images)
+            itr.first->SetResidentState(itr.second.residentState, itr.second.ownerQueue);
+
+        for (auto& itr : updates.buffers)
+            itr.first->SetResidentState(itr.second.residentAccesses, itr.second.ownerQueue);
+
+        m_device->UnlockResidentState();
+
+        // Track when the transition command buffers can be reused.
+        if (transitionCommandBuffers.size() > 0)
+            TrackTransitionCommandBuffers(transitionCommandBuffers);
+
+        m_submitLock.Unlock();
 
         // Wrap fence in Fence class object and store references to all signal semaphores.
         auto fenceImpl = new Fence(fence, totalWaitSemaphores, waitSemaphores.data());
@@ -249,7 +404,9 @@ namespace vez
         presentInfo.swapchainCount = static_cast<uint32_t>(swapchains.size());
         presentInfo.pSwapchains = swapchains.data();
         presentInfo.pImageIndices = imageIndices.data();
+        m_submitLock.Lock();
         result = vkQueuePresentKHR(m_handle, &presentInfo);
+        m_submitLock.Unlock();
 
         // Copy signal semaphores back to VezPresentInfo struct.
         for (auto i = 0U; i < pPresentInfo->signalSemaphoreCount; ++i)
@@ -277,6 +434,241 @@ namespace vez
         return static_cast<VkResult>(vkQueueWaitIdle(m_handle));
     }
 
+    VkResult Queue::RecordTransitionCommandBuffer(const PipelineBarrier& barrier, VkCommandBuffer* pCommandBuffer)
+    {
+        m_transitionLock.Lock();
+        auto result = RecordTransitionCommandBufferLocked(barrier, pCommandBuffer);
+        m_transitionLock.Unlock();
+        return result;
+    }
+
+    VkResult Queue::RecordTransitionCommandBufferLocked(const PipelineBarrier& barrier, VkCommandBuffer* pCommandBuffer)
+    {
+        // Reclaim the transition command buffers of completed submissions.
+        while (!m_pendingTransitionCommandBuffers.empty())
+        {
+            auto& pending = m_pendingTransitionCommandBuffers.front();
+            if (vkGetFenceStatus(m_device->GetHandle(), std::get<0>(pending)) != VK_SUCCESS)
+                break;
+
+            m_device->GetSyncPrimitivesPool()->ReleaseFence(std::get<0>(pending));
+            m_freeTransitionCommandBuffers.insert(m_freeTransitionCommandBuffers.end(), std::get<1>(pending).begin(), std::get<1>(pending).end());
+            m_pendingTransitionCommandBuffers.pop();
+        }
+
+        // Create the command pool on first use.
+        if (!m_transitionCommandPool)
+        {
+            VkCommandPoolCreateInfo createInfo = {};
+            createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            createInfo.queueFamilyIndex = m_queueFamilyIndex;
+            auto result = vkCreateCommandPool(m_device->GetHandle(), &createInfo, nullptr, &m_transitionCommandPool);
+            if (result != VK_SUCCESS)
+                return result;
+        }
+
+        // Reuse a free command buffer or allocate a new one.
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        if (m_freeTransitionCommandBuffers.size() > 0)
+        {
+            commandBuffer = m_freeTransitionCommandBuffers.back();
+            m_freeTransitionCommandBuffers.pop_back();
+        }
+        else
+        {
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = m_transitionCommandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+            auto result = vkAllocateCommandBuffers(m_device->GetHandle(), &allocInfo, &commandBuffer);
+            if (result != VK_SUCCESS)
+                return result;
+        }
+
+        // Record the image layout transitions.
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        auto result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (result != VK_SUCCESS)
+            return result;
+
+        vkCmdPipelineBarrier(commandBuffer, GetLegacyStageMask(barrier.srcStageMask), GetLegacyStageMask(barrier.dstStageMask), 0, 0, nullptr, static_cast<uint32_t>(barrier.bufferBarriers.size()), barrier.bufferBarriers.data(),
+            static_cast<uint32_t>(barrier.imageBarriers.size()), barrier.imageBarriers.data());
+
+        result = vkEndCommandBuffer(commandBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        *pCommandBuffer = commandBuffer;
+        return VK_SUCCESS;
+    }
+
+    void Queue::ReleaseTransitionCommandBuffers(uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers)
+    {
+        m_transitionLock.Lock();
+        m_freeTransitionCommandBuffers.insert(m_freeTransitionCommandBuffers.end(), pCommandBuffers, pCommandBuffers + commandBufferCount);
+        m_transitionLock.Unlock();
+    }
+
+    void Queue::TrackTransitionCommandBuffers(std::vector<VkCommandBuffer>& commandBuffers)
+    {
+        // Submit a fence signaled once all previous submissions to the queue complete.
+        auto syncPrimitivesPool = m_device->GetSyncPrimitivesPool();
+        VkFence fence = VK_NULL_HANDLE;
+        if (syncPrimitivesPool->AcquireFence(&fence) != VK_SUCCESS)
+            return;
+
+        if (vkQueueSubmit(m_handle, 0, nullptr, fence) != VK_SUCCESS)
+        {
+            syncPrimitivesPool->ReleaseFence(fence);
+            return;
+        }
+
+        m_transitionLock.Lock();
+        m_pendingTransitionCommandBuffers.push(std::make_tuple(fence, std::move(commandBuffers)));
+        m_transitionLock.Unlock();
+    }
+
+    VkResult Queue::PrepareOwnershipRelease(const PipelineBarrier& barrier, OwnershipRelease* pRelease)
+    {
+        // Record the release barriers into a transition command buffer.
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        auto result = RecordTransitionCommandBuffer(barrier, &commandBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        // Acquire the semaphore the acquiring submission waits on and a fence tracking when the command buffer can be reused.
+        auto syncPrimitivesPool = m_device->GetSyncPrimitivesPool();
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        result = syncPrimitivesPool->AcquireSemaphore(1, &semaphore);
+        if (result != VK_SUCCESS)
+        {
+            ReleaseTransitionCommandBuffers(1, &commandBuffer);
+            return result;
+        }
+
+        VkFence fence = VK_NULL_HANDLE;
+        result = syncPrimitivesPool->AcquireFence(&fence);
+        if (result != VK_SUCCESS)
+        {
+            ReleaseTransitionCommandBuffers(1, &commandBuffer);
+            syncPrimitivesPool->ReleaseSemaphores(1, &semaphore);
+            return result;
+        }
+
+        pRelease->pQueue = this;
+        pRelease->barrier = barrier;
+        pRelease->commandBuffer = commandBuffer;
+        pRelease->semaphore = semaphore;
+        pRelease->fence = fence;
+        return VK_SUCCESS;
+    }
+
+    VkResult Queue::SubmitOwnershipRelease(const OwnershipRelease& release)
+    {
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &release.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &release.semaphore;
+
+        m_submitLock.Lock();
+        auto result = vkQueueSubmit(m_handle, 1, &submitInfo, release.fence);
+        m_submitLock.Unlock();
+        if (result != VK_SUCCESS)
+            return result;
+
+        m_transitionLock.Lock();
+        m_pendingTransitionCommandBuffers.push(std::make_tuple(release.fence, std::vector<VkCommandBuffer>(1, release.commandBuffer)));
+        m_transitionLock.Unlock();
+        return VK_SUCCESS;
+    }
+
+    void Queue::DiscardOwnershipRelease(const OwnershipRelease& release)
+    {
+        ReleaseTransitionCommandBuffers(1, &release.commandBuffer);
+
+        auto syncPrimitivesPool = m_device->GetSyncPrimitivesPool();
+        syncPrimitivesPool->ReleaseFence(release.fence);
+        syncPrimitivesPool->ReleaseSemaphores(1, &release.semaphore);
+    }
+
+    void Queue::AcquireReleasedOwnership(uint32_t releaseCount, const OwnershipRelease* pReleases)
+    {
+        // The acquire barriers are identical to the release barriers, including their layout transitions, and wait on the releases' semaphores.
+        PipelineBarrier barrier = {};
+        barrier.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkPipelineStageFlags> waitDstStageMasks;
+        for (auto i = 0U; i < releaseCount; ++i)
+        {
+            auto& releaseBarrier = pReleases[i].barrier;
+            barrier.bufferBarriers.insert(barrier.bufferBarriers.end(), releaseBarrier.bufferBarriers.begin(), releaseBarrier.bufferBarriers.end());
+            barrier.imageBarriers.insert(barrier.imageBarriers.end(), releaseBarrier.imageBarriers.begin(), releaseBarrier.imageBarriers.end());
+            waitSemaphores.push_back(pReleases[i].semaphore);
+            waitDstStageMasks.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        }
+
+        // Without the acquire the resources are left released, which only happens once the device is lost.
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        if (RecordTransitionCommandBuffer(barrier, &commandBuffer) != VK_SUCCESS)
+            return;
+
+        auto syncPrimitivesPool = m_device->GetSyncPrimitivesPool();
+        VkFence fence = VK_NULL_HANDLE;
+        if (syncPrimitivesPool->AcquireFence(&fence) != VK_SUCCESS)
+        {
+            ReleaseTransitionCommandBuffers(1, &commandBuffer);
+            return;
+        }
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitDstStageMasks.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        m_submitLock.Lock();
+        if (vkQueueSubmit(m_handle, 1, &submitInfo, fence) != VK_SUCCESS)
+        {
+            m_submitLock.Unlock();
+            ReleaseTransitionCommandBuffers(1, &commandBuffer);
+            syncPrimitivesPool->ReleaseFence(fence);
+            return;
+        }
+
+        std::vector<VkCommandBuffer> transitionCommandBuffers(1, commandBuffer);
+        TrackTransitionCommandBuffers(transitionCommandBuffers);
+        m_submitLock.Unlock();
+
+        // The semaphores are returned to the pool along with the fence once the acquire completes.
+        auto fenceImpl = new Fence(fence, static_cast<uint32_t>(waitSemaphores.size()), waitSemaphores.data());
+        ObjectLookup::AddObjectImpl(fence, fenceImpl);
+        m_device->QueueSubmission(fenceImpl);
+
+        // The queue now owns the resources, with the released image subresources in the layouts the acquire transitioned them to.
+        for (auto& bufferBarrier : barrier.bufferBarriers)
+        {
+            auto buffer = ObjectLookup::GetObjectImpl(bufferBarrier.buffer);
+            if (buffer)
+                buffer->AcquireOwnership(this);
+        }
+
+        for (auto& imageBarrier : barrier.imageBarriers)
+        {
+            auto image = ObjectLookup::GetObjectImpl(imageBarrier.image);
+            if (image)
+                image->AcquireOwnership(imageBarrier.subresourceRange, imageBarrier.newLayout, this);
+        }
+    }
+
     VkResult Queue::AcquireCommandBuffer(CommandBuffer** pCommandBuffer)
     {
         // Check back of queue to see if there are any free command buffers.
@@ -294,7 +686,7 @@ namespace vez
         }
 
         // Create a new command buffer.
-        auto result = m_device->AllocateCommandBuffers(this, nullptr, 1, pCommandBuffer);
+        auto result = m_device->AllocateCommandBuffers(this, nullptr, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, pCommandBuffer);
         if (result != VK_SUCCESS)
             return result;
 
@@ -24,6 +24,9 @@
 #include <queue>
 #include <tuple>
 #include <map>
+#include <vector>
+#include "Utility/SpinLock.h"
+#include "PipelineBarriers.h"
 #include "VEZ.h"
 
 namespace vez
@@ -36,6 +39,8 @@ namespace vez
     public:
         Queue(Device* device, VkQueue queue, uint32_t queueFamilyIndex, uint32_t index, const VkQueueFamilyProperties& propertiesd);
 
+        ~Queue();
+
         Device* GetDevice() const { return m_device; }
 
         VkQueue GetHandle() const { return m_handle; }
@@ -53,8 +58,40 @@ namespace vez
         VkResult WaitIdle();
 
     private:
+        // Release barriers recorded for a queue of another family, along with the semaphore they signal and a fence tracking their command buffer.
+        struct OwnershipRelease
+        {
+            Queue* pQueue;
+            PipelineBarrier barrier;
+            VkCommandBuffer commandBuffer;
+            VkSemaphore semaphore;
+            VkFence fence;
+        };
+
         VkResult AcquireCommandBuffer(CommandBuffer** pCommandBuffer);
 
+        VkResult RecordTransitionCommandBuffer(const PipelineBarrier& barrier, VkCommandBuffer* pCommandBuffer);
+
+        VkResult RecordTransitionCommandBufferLocked(const PipelineBarrier& barrier, VkCommandBuffer* pCommandBuffer);
+
+        // Returns transition command buffers that were never submitted to the free list.
+        void ReleaseTransitionCommandBuffers(uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers);
+
+        // Tracks submitted transition command buffers until a fence signaled after them.  Called with the submit lock held.
+        void TrackTransitionCommandBuffers(std::vector<VkCommandBuffer>& commandBuffers);
+
+        // Records the release barriers of resources whose ownership is transferred to another queue family and acquires the synchronization
+        // primitives for their submission, so submitting them cannot fail on anything but the queue submission itself.
+        VkResult PrepareOwnershipRelease(const PipelineBarrier& barrier, OwnershipRelease* pRelease);
+
+        VkResult SubmitOwnershipRelease(const OwnershipRelease& release);
+
+        // Returns everything acquired for an ownership release that was never submitted.
+        void DiscardOwnershipRelease(const OwnershipRelease& release);
+
+        // Completes the ownership transfers of submitted releases whose acquiring submission failed, so the queue owns the resources.
+        void AcquireReleasedOwnership(uint32_t releaseCount, const OwnershipRelease* pReleases);
+
         Device* m_device = nullptr;
         VkQueue m_handle = VK_NULL_HANDLE;
         uint32_t m_queueFamilyIndex = 0;
@@ -70,5 +107,14 @@ namespace vez
         // when to release the waitSemaphores.
         typedef std::vector<uint64_t> PresentHash;
         std::map<PresentHash, VkSemaphore> m_presentWaitSemaphores;
+
+        // Native command buffers recording the image layout transitions and ownership transfers resolved at submission.
+        // Each submission using them signals a fence after which its command buffers are reused.
+        // Ownership releases are submitted by queues of other families, so the command buffers and queue submissions are locked.
+        VkCommandPool m_transitionCommandPool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> m_freeTransitionCommandBuffers;
+        std::queue<std::tuple<VkFence, std::vector<VkCommandBuffer>>> m_pendingTransitionCommandBuffers;
+        SpinLock m_transitionLock;
+        SpinLock m_submitLock;
     };
 }
\ No newline at end of file
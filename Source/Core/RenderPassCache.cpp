@@ -71,6 +71,7 @@ namespace vez
         struct SubpassDescriptionBitField
         {
             uint8_t pipelineCount : 8;
+            uint8_t depthStencilLayout : 4;
         };
 
         struct SubpassDependencyBitField
@@ -81,6 +82,7 @@ namespace vez
             uint32_t dstAccessMask : 32;
             uint16_t srcSubpass : 16;
             uint16_t dstSubpass : 16;
+            uint16_t dependencyFlags : 16;
         };
 
         struct RenderPassBitField
@@ -100,7 +102,7 @@ namespace vez
             (sizeof(AttachmentDescriptionBitField) * pDesc->attachments.size()) +
             (sizeof(SubpassDescriptionBitField) * pDesc->subpasses.size()) +
             (sizeof(VkPipeline) * totalPipelineCount) +
-            (sizeof(SubpassDependencyBitField) * pDesc->subpasses.size());
+            (sizeof(SubpassDependencyBitField) * pDesc->dependencies.size());
 
         // Get the number of 64-bit elements needed in the hash.
         uint32_t numElements = static_cast<uint32_t>(ceil(numBytes / 8.0f));
@@ -117,7 +119,7 @@ namespace vez
         // Fill in RenderPassBitField.
         renderPassBitField->attachmentCount = static_cast<uint8_t>(pDesc->attachments.size());
         renderPassBitField->subpassCount = static_cast<uint8_t>(pDesc->subpasses.size());
-        renderPassBitField->dependencyCount = static_cast<uint8_t>(pDesc->subpasses.size());
+        renderPassBitField->dependencyCount = static_cast<uint8_t>(pDesc->dependencies.size());
 
         // Fill in AttachmentDescriptionBitField array.
         for (auto i = 0U; i < pDesc->attachments.size(); ++i)
@@ -130,11 +132,12 @@ namespace vez
             attachmentDescriptions[i].storeOp = static_cast<uint8_t>(pDesc->attachments[i].storeOp);
         }
 
-        // Fill in SubpassDescriptionBitField and SubpassDependencyBitField arrays.
+        // Fill in SubpassDescriptionBitField array.
         for (auto i = 0U; i < pDesc->subpasses.size(); ++i)
         {
             // SubpassDescriptionBitField
             subpassDescriptions[i].pipelineCount = static_cast<uint8_t>(pDesc->subpasses[i].pipelineBindings.size());
+            subpassDescriptions[i].depthStencilLayout = imageLayoutToBitField.at(pDesc->subpasses[i].depthStencilLayout);
 
             // Copy pipeline handles to hash.
             for (auto& entry : pDesc->subpasses[i].pipelineBindings)
@@ -142,14 +145,18 @@ namespace vez
                 *pipelineBindings = reinterpret_cast<VkPipeline>(entry.pipeline);
                 ++pipelineBindings;
             }
+        }
 
-            // SubpassDependencyBitField
-            subpassDependencies[i].srcSubpass = static_cast<uint16_t>(pDesc->subpasses[i].dependency.srcSubpass);
-            subpassDependencies[i].dstSubpass = static_cast<uint16_t>(pDesc->subpasses[i].dependency.dstSubpass);
-            subpassDependencies[i].srcStageMask = static_cast<uint32_t>(pDesc->subpasses[i].dependency.srcStageMask);
-            subpassDependencies[i].dstStageMask = static_cast<uint32_t>(pDesc->subpasses[i].dependency.dstStageMask);
-            subpassDependencies[i].srcAccessMask = static_cast<uint32_t>(pDesc->subpasses[i].dependency.srcAccessMask);
-            subpassDependencies[i].dstAccessMask = static_cast<uint32_t>(pDesc->subpasses[i].dependency.dstAccessMask);
+        // Fill in SubpassDependencyBitField array.
+        for (auto i = 0U; i < pDesc->dependencies.size(); ++i)
+        {
+            subpassDependencies[i].srcSubpass = static_cast<uint16_t>(pDesc->dependencies[i].srcSubpass);
+            subpassDependencies[i].dstSubpass = static_cast<uint16_t>(pDesc->dependencies[i].dstSubpass);
+            subpassDependencies[i].srcStageMask = static_cast<uint32_t>(pDesc->dependencies[i].srcStageMask);
+            subpassDependencies[i].dstStageMask = static_cast<uint32_t>(pDesc->dependencies[i].dstStageMask);
+            subpassDependencies[i].srcAccessMask = static_cast<uint32_t>(pDesc->dependencies[i].srcAccessMask);
+            subpassDependencies[i].dstAccessMask = static_cast<uint32_t>(pDesc->dependencies[i].dstAccessMask);
+            subpassDependencies[i].dependencyFlags = static_cast<uint16_t>(pDesc->dependencies[i].dependencyFlags);
         }
 
         // Return the resulting hash.
@@ -267,7 +274,7 @@ namespace vez
             // If a depth stencil buffer is present, fill in the attachment reference (store vector size in pointer address and adjust in a second pass).
             if (depthStencilAttachmentIndex != VK_ATTACHMENT_UNUSED)
             {
-                allDepthStencilAttachments.push_back({ depthStencilAttachmentIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+                allDepthStencilAttachments.push_back({ depthStencilAttachmentIndex, pDesc->subpasses[i].depthStencilLayout });
                 subpassDescription.pDepthStencilAttachment = reinterpret_cast<const VkAttachmentReference*>(allDepthStencilAttachments.size());
             }
 
@@ -304,22 +311,6 @@ namespace vez
             }
         }
 
-        // Copy subpass dependencies.
-        std::vector<VkSubpassDependency> subpassDependencies;
-        for (auto& subpassDesc : pDesc->subpasses)
-            subpassDependencies.push_back(subpassDesc.dependency);
-
-        // Add a final subpass dependency between the last subpass and external proceeding calls.
-        VkSubpassDependency finalSubpassDependency = {};
-        finalSubpassDependency.dependencyFlags = 0;
-        finalSubpassDependency.srcSubpass = static_cast<uint32_t>(pDesc->subpasses.size() - 1);
-        finalSubpassDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
-        finalSubpassDependency.srcStageMask = subpassDependencies.back().dstStageMask;
-        finalSubpassDependency.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        finalSubpassDependency.srcAccessMask = subpassDependencies.back().dstAccessMask;
-        finalSubpassDependency.dstAccessMask = 0;
-        subpassDependencies.push_back(finalSubpassDependency);
-
         // Finally create Vulkan render pass object.
         VkRenderPassCreateInfo renderPassCreateInfo = {};
         renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -327,8 +318,8 @@ namespace vez
         renderPassCreateInfo.pAttachments = pDesc->attachments.data();
         renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpassDescriptions.size());
         renderPassCreateInfo.pSubpasses = subpassDescriptions.data();
-        renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
-        renderPassCreateInfo.pDependencies = subpassDependencies.data();
+        renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(pDesc->dependencies.size());
+        renderPassCreateInfo.pDependencies = pDesc->dependencies.data();
 
         VkRenderPass handle = VK_NULL_HANDLE;
         auto result = vkCreateRenderPass(m_device->GetHandle(), &renderPassCreateInfo, nullptr, &handle);
@@ -19,22 +19,92 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 //
-#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
 #include "Utility/VkHelpers.h"
+#include "Utility/ThreadPool.h"
+#include "Instance.h"
+#include "PhysicalDevice.h"
 #include "Device.h"
-#include "Buffer.h"
-#include "Image.h"
-#include "ImageView.h"
-#include "Framebuffer.h"
 #include "CommandPool.h"
 #include "CommandBuffer.h"
-#include "RenderPassCache.h"
-#include "StreamEncoder.h"
 #include "StreamDecoder.h"
 
 namespace vez
 {
-    StreamDecoder::StreamDecoder()
+    // Minimum number of command packets within a subpass for it to be recorded into a secondary command buffer.
+    static const size_t s_minSecondarySubpassPacketCount = 1024;
+
+    // Timelines smaller than this cannot contain two secondary subpasses and are always decoded serially.
+    static const uint64_t s_minParallelDecodeStreamSize = s_minSecondarySubpassPacketCount * 2 * sizeof(DrawPacket);
+
+    // Tracks the latest command packets setting each piece of bound state, in the order they were recorded.
+    // Secondary command buffers inherit no state, so the tracked packets are replayed at the start of each secondary
+    // and again on the primary after secondaries have been executed.
+    class StateTracker
+    {
+    public:
+        void Update(const CommandPacket* pPacket)
+        {
+            uint64_t key;
+            if (!GetCommandPacketStateKey(pPacket, &key))
+                return;
+
+            // Overwritten state is cleared in place so the remaining packets keep their relative order.
+            auto it = m_indices.find(key);
+            if (it != m_indices.end())
+            {
+                m_packets[it->second] = nullptr;
+                it->second = m_packets.size();
+            }
+            else
+            {
+                m_indices.emplace(key, m_packets.size());
+            }
+
+            m_packets.push_back(pPacket);
+
+            // Compact the packet list once most of its entries have been overwritten.
+            if (m_packets.size() > m_indices.size() * 4 + 64)
+                Compact();
+        }
+
+        void GetPackets(std::vector<const CommandPacket*>& packets) const
+        {
+            packets.clear();
+            for (auto packet : m_packets)
+            {
+                if (packet)
+                    packets.push_back(packet);
+            }
+        }
+
+    private:
+        void Compact()
+        {
+            size_t count = 0;
+            for (auto packet : m_packets)
+            {
+                if (!packet)
+                    continue;
+
+                uint64_t key;
+                GetCommandPacketStateKey(packet, &key);
+                m_indices[key] = count;
+                m_packets[count++] = packet;
+            }
+
+            m_packets.resize(count);
+        }
+
+        std::unordered_map<uint64_t, size_t> m_indices;
+        std::vector<const CommandPacket*> m_packets;
+    };
+
+    StreamDecoder::StreamDecoder(CommandPool* pPool)
+        : m_pool(pPool)
     {
         // Populate entry points array with each command's decode function.
         m_entryPoints.resize(COMMAND_ID_COUNT);
@@ -84,688 +154,905 @@ namespace vez
         m_entryPoints[RESOLVE_IMAGE] = &StreamDecoder::CmdResolveImage;
         m_entryPoints[SET_EVENT] = &StreamDecoder::CmdSetEvent;
         m_entryPoints[RESET_EVENT] = &StreamDecoder::CmdResetEvent;
+        m_entryPoints[WAIT_EVENTS] = &StreamDecoder::CmdWaitEvents;
+        m_entryPoints[BIND_DESCRIPTOR_SET] = &StreamDecoder::CmdBindDescriptorSet;
+        m_entryPoints[PIPELINE_BARRIER] = &StreamDecoder::CmdPipelineBarrier;
+        m_entryPoints[EXECUTE_COMMANDS] = &StreamDecoder::CmdExecuteCommands;
     }
 
-    void StreamDecoder::Decode(CommandBuffer& commandBuffer, StreamEncoder& encoder)
+    StreamDecoder::~StreamDecoder()
     {
-        // Get the memory stream from the stream encoder.
-        auto& stream = encoder.GetStream();
+        // Worker tasks must exit before the secondary command buffers they record are destroyed.
+        Reset();
 
-        // Get the list of pipeline barriers to be inserted at specific points.
-        auto nextPipelineBarrier = encoder.GetPipelineBarriers().cbegin();
+        // Destroy the native command pools of all secondary command buffers.
+        auto device = m_pool->GetDevice()->GetHandle();
+        for (auto& secondary : m_secondaryCommandBuffers)
+            vkDestroyCommandPool(device, secondary.pool, nullptr);
+    }
+
+    void StreamDecoder::Reset()
+    {
+        for (auto& task : m_pendingTasks)
+            task.wait();
 
-        // Get the list of render passes to ber inserted at specific points.
-        auto nextRenderPass = encoder.GetRenderPassBindings().cbegin();
+        m_pendingTasks.clear();
+    }
 
-        // Get the list of descriptor set bindings to be inserted at specific points.
-        auto nextDescriptorSetBinding = encoder.GetDescriptorSetBindings().cbegin();
+    VkResult StreamDecoder::Decode(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usageFlags, MemoryStream& stream, bool executesSecondaryCommandBuffers)
+    {
+        // Large command streams are split across the instance's worker threads when more than one is available.
+        // Streams executing application secondary command buffers take the same path so bound state is restored after them.
+        auto threadPool = m_pool->GetDevice()->GetPhysicalDevice()->GetInstance()->GetThreadPool();
+        auto parallel = (threadPool->GetThreadCount() > 1 && stream.TellP() >= s_minParallelDecodeStreamSize);
+        if (parallel || executesSecondaryCommandBuffers)
+        {
+            auto result = VK_SUCCESS;
+            if (DecodeSplit(commandBuffer, usageFlags, stream, parallel ? threadPool : nullptr, executesSecondaryCommandBuffers, &result))
+                return result;
+        }
 
-        // Get the list of pipeline bindings to be inserted at specific points.
-        auto nextPipelineBinding = encoder.GetPipelineBindings().cbegin();
+        // Otherwise decode the entire stream directly into the primary command buffer.
+        DecodeSerial(commandBuffer, stream);
+        return VK_SUCCESS;
+    }
 
+    void StreamDecoder::DecodeSerial(VkCommandBuffer commandBuffer, MemoryStream& stream)
+    {
         // Seek to the beginning of the stream for reading.
         stream.SeekG(0);
 
         // Read all of the stream's data and decode each command.
         while (true)
         {
-            // Get current stream read position.
-            auto streamPosition = stream.TellG();
+            // Read the next command packet's header in place and exit if the end of the stream has been reached.
+            auto packet = stream.ReadPtr<const CommandPacket>();
+            if (!packet)
+                break;
 
-            // Check to see if there are any pipeline barriers to be inserted at or before current stream position.
-            while ((nextPipelineBarrier != encoder.GetPipelineBarriers().cend()) && (nextPipelineBarrier->streamPosition <= streamPosition))
-            {
-                // Insert Vulkan pipeline barrier.
-                vkCmdPipelineBarrier(commandBuffer.GetHandle(), nextPipelineBarrier->srcStageMask, nextPipelineBarrier->dstStageMask, 0, 0, nullptr,
-                    static_cast<uint32_t>(nextPipelineBarrier->bufferBarriers.size()), nextPipelineBarrier->bufferBarriers.data(),
-                    static_cast<uint32_t>(nextPipelineBarrier->imageBarriers.size()), nextPipelineBarrier->imageBarriers.data());
+            // Advance the read position past the remainder of the packet, which is always contiguous with its header.
+            stream.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
 
-                // Move to the next pipeline barrier in the list.
-                ++nextPipelineBarrier;
-            }
+            // Execute the command.
+            Execute(commandBuffer, packet);
+        }
+    }
 
-            // Check to see if there are any render passes to be inserted.
-            if (nextRenderPass != encoder.GetRenderPassBindings().cend())
+    bool StreamDecoder::DecodeSplit(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usageFlags, MemoryStream& stream, ThreadPool* pThreadPool, bool executesSecondaryCommandBuffers, VkResult* pResult)
+    {
+        // The context is shared with worker tasks that may only start after this decode has completed.
+        auto context = std::make_shared<ParallelDecodeContext>();
+        context->usageFlags = usageFlags;
+        auto& packets = context->packets;
+        auto& subpasses = context->subpasses;
+
+        // Gather all packets and find the subpasses large enough to be recorded into secondary command buffers.
+        // The state bound at the start of each of these subpasses is captured so it can be replayed within the secondary.
+        // Subpasses already executing application secondary command buffers are never split.
+        StateTracker state;
+        const BeginRenderPassPacket* renderPass = nullptr;
+        uint32_t subpassIndex = 0;
+        size_t subpassStart = 0;
+        auto splittable = false;
+        std::vector<const CommandPacket*> subpassState;
+
+        stream.SeekG(0);
+        while (true)
+        {
+            auto packet = stream.ReadPtr<const CommandPacket>();
+            if (!packet)
+                break;
+
+            stream.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
+            packets.push_back(packet);
+
+            switch (packet->id)
             {
-                // Next render pass's stream position must be equal to the current read position.
-                if (nextRenderPass->streamPosition == streamPosition)
+            case BEGIN_RENDER_PASS:
+            case NEXT_SUBPASS:
+                // Close the previous subpass.
+                if (packet->id == NEXT_SUBPASS && splittable && packets.size() - 1 - subpassStart >= s_minSecondarySubpassPacketCount)
+                    subpasses.push_back({ renderPass, subpassIndex, subpassStart, packets.size() - 1, std::move(subpassState), VK_NULL_HANDLE });
+
+                // Begin the next subpass.
+                if (packet->id == BEGIN_RENDER_PASS)
+                {
+                    renderPass = reinterpret_cast<const BeginRenderPassPacket*>(packet);
+                    subpassIndex = 0;
+                    splittable = (pThreadPool && renderPass->contents == VK_SUBPASS_CONTENTS_INLINE);
+                }
+                else
                 {
-                    // Store internal reference to bound framebuffer.
-                    m_framebuffer = reinterpret_cast<Framebuffer*>(nextRenderPass->framebuffer);
-
-                    // Begin render pass.
-                    VkRenderPassBeginInfo beginInfo = {};
-                    beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-                    beginInfo.renderPass = nextRenderPass->renderPass->GetHandle();
-                    beginInfo.framebuffer = m_framebuffer->GetHandle(nextRenderPass->renderPass);
-                    beginInfo.renderArea.offset.x = 0;
-                    beginInfo.renderArea.offset.y = 0;
-                    beginInfo.renderArea.extent = reinterpret_cast<Framebuffer*>(nextRenderPass->framebuffer)->GetExtents();
-                    beginInfo.clearValueCount = static_cast<uint32_t>(nextRenderPass->clearValues.size());
-                    beginInfo.pClearValues = nextRenderPass->clearValues.data();
-                    vkCmdBeginRenderPass(commandBuffer.GetHandle(), &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-                    // Move to the next render pass in the list.
-                    ++nextRenderPass;
+                    ++subpassIndex;
+                    splittable = (pThreadPool && reinterpret_cast<const NextSubpassPacket*>(packet)->contents == VK_SUBPASS_CONTENTS_INLINE);
                 }
+
+                subpassStart = packets.size();
+                state.GetPackets(subpassState);
+                break;
+
+            case END_RENDER_PASS:
+                if (splittable && packets.size() - 1 - subpassStart >= s_minSecondarySubpassPacketCount)
+                    subpasses.push_back({ renderPass, subpassIndex, subpassStart, packets.size() - 1, std::move(subpassState), VK_NULL_HANDLE });
+                break;
+
+            default:
+                state.Update(packet);
+                break;
             }
+        }
 
-            // Check to see if there are any pipeline bindings to be inserted.
-            if (nextPipelineBinding != encoder.GetPipelineBindings().cend())
+        // Splitting only pays off when at least two subpasses can be recorded concurrently.
+        if (subpasses.size() < 2)
+        {
+            if (!executesSecondaryCommandBuffers)
+                return false;
+
+            subpasses.clear();
+        }
+
+        if (!subpasses.empty())
+        {
+            // Get a secondary command buffer for each subpass.
+            *pResult = GetSecondaryCommandBuffers(subpasses);
+            if (*pResult != VK_SUCCESS)
+                return true;
+
+            // Forget the tasks of previous decodes that have already exited.
+            m_pendingTasks.erase(std::remove_if(m_pendingTasks.begin(), m_pendingTasks.end(), [](const std::shared_future<void>& task) {
+                return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            }), m_pendingTasks.end());
+
+            // Record the secondary command buffers on the worker threads, with the calling thread also taking part.
+            // Only the subpasses claimed by running tasks are waited on, rather than the tasks themselves, so a decode running
+            // within the thread pool itself never waits on tasks queued behind it.  The tasks are joined by Reset instead.
+            auto workerCount = std::min(pThreadPool->GetThreadCount(), static_cast<uint32_t>(subpasses.size()) - 1);
+            for (auto i = 0U; i < workerCount; ++i)
+                m_pendingTasks.push_back(pThreadPool->AddTask([this, context]() { RecordSecondarySubpasses(*context); }));
+
+            RecordSecondarySubpasses(*context);
+            std::unique_lock<std::mutex> lock(context->mutex);
+            context->subpassCompleted.wait(lock, [&]() { return context->completedSubpasses == subpasses.size(); });
+            lock.unlock();
+
+            *pResult = static_cast<VkResult>(context->result.load());
+            if (*pResult != VK_SUCCESS)
+                return true;
+        }
+
+        // Record the primary command buffer, executing the secondary command buffers in place of their subpass's packets.
+        // Secondary command buffers leave the primary's state undefined, so the tracked state is replayed once recording
+        // returns to the primary.
+        // Subpasses executing application secondary command buffers may only contain vkCmdExecuteCommands, so any other
+        // packets within them only update the tracked state.
+        auto nextSubpass = subpasses.begin();
+        auto subpassContents = VK_SUBPASS_CONTENTS_INLINE;
+        auto restoreState = false;
+        StateTracker primaryState;
+        std::vector<const CommandPacket*> statePackets;
+        for (size_t i = 0; i < packets.size(); ++i)
+        {
+            auto packet = packets[i];
+            switch (packet->id)
+            {
+            case BEGIN_RENDER_PASS:
+            case NEXT_SUBPASS:
             {
-                // The next pipeline binding's stream position must be equal to the current read position.
-                if (nextPipelineBinding->streamPosition == streamPosition)
+                auto secondary = (nextSubpass != subpasses.end() && nextSubpass->firstPacket == i + 1);
+                if (packet->id == BEGIN_RENDER_PASS)
+                    subpassContents = reinterpret_cast<const BeginRenderPassPacket*>(packet)->contents;
+                else
+                    subpassContents = reinterpret_cast<const NextSubpassPacket*>(packet)->contents;
+
+                auto contents = secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : subpassContents;
+                if (packet->id == BEGIN_RENDER_PASS)
+                    BeginRenderPass(commandBuffer, reinterpret_cast<const BeginRenderPassPacket*>(packet), contents);
+                else
+                    vkCmdNextSubpass(commandBuffer, contents);
+
+                if (secondary)
                 {
-                    // Bind the pipeline.
-                    vkCmdBindPipeline(commandBuffer.GetHandle(), nextPipelineBinding->bindPoint, nextPipelineBinding->pipeline);
+                    vkCmdExecuteCommands(commandBuffer, 1, &nextSubpass->handle);
+
+                    // Skip to the packet ending the subpass, keeping track of the state it leaves behind.
+                    for (i = nextSubpass->firstPacket; i < nextSubpass->lastPacket; ++i)
+                        primaryState.Update(packets[i]);
 
-                    // Move to the next pipelien binding in the list.
-                    ++nextPipelineBinding;
+                    --i;
+                    ++nextSubpass;
+                    restoreState = true;
                 }
+                else if (restoreState && subpassContents == VK_SUBPASS_CONTENTS_INLINE)
+                {
+                    primaryState.GetPackets(statePackets);
+                    for (auto statePacket : statePackets)
+                        Execute(commandBuffer, statePacket);
+
+                    restoreState = false;
+                }
+                break;
             }
 
-            // Check to see if there are any descriptor set bindings to be inserted.
-            if (nextDescriptorSetBinding != encoder.GetDescriptorSetBindings().cend())
-            {
-                // The next descriptor set binding's stream position must be equal to the current read position.
-                while (nextDescriptorSetBinding->streamPosition == streamPosition)
+            case END_RENDER_PASS:
+                vkCmdEndRenderPass(commandBuffer);
+                subpassContents = VK_SUBPASS_CONTENTS_INLINE;
+                if (restoreState)
                 {
-                    // Bind the descriptor set.
-                    vkCmdBindDescriptorSets(commandBuffer.GetHandle(), nextDescriptorSetBinding->bindPoint, nextDescriptorSetBinding->pipelineLayout,
-                        nextDescriptorSetBinding->setIndex, 1, &nextDescriptorSetBinding->descriptorSet, 0, nullptr);
+                    primaryState.GetPackets(statePackets);
+                    for (auto statePacket : statePackets)
+                        Execute(commandBuffer, statePacket);
 
-                    // Move to the next descriptor set binding in the list.
-                    if (++nextDescriptorSetBinding == encoder.GetDescriptorSetBindings().cend())
-                        break;
+                    restoreState = false;
                 }
+                break;
+
+            case EXECUTE_COMMANDS:
+                Execute(commandBuffer, packet);
+                restoreState = true;
+                break;
+
+            default:
+                primaryState.Update(packet);
+                if (subpassContents == VK_SUBPASS_CONTENTS_INLINE)
+                    Execute(commandBuffer, packet);
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    VkResult StreamDecoder::GetSecondaryCommandBuffers(std::vector<SecondarySubpass>& subpasses)
+    {
+        auto device = m_pool->GetDevice()->GetHandle();
+
+        // Reset the command pools of the secondary command buffers from the previous decode.
+        for (auto& secondary : m_secondaryCommandBuffers)
+        {
+            auto result = vkResetCommandPool(device, secondary.pool, 0);
+            if (result != VK_SUCCESS)
+                return result;
+        }
+
+        // Each secondary command buffer has its own command pool so they can be recorded concurrently.
+        while (m_secondaryCommandBuffers.size() < subpasses.size())
+        {
+            VkCommandPoolCreateInfo poolCreateInfo = {};
+            poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolCreateInfo.queueFamilyIndex = m_pool->GetQueueFamilyIndex();
+
+            SecondaryCommandBuffer secondary = {};
+            auto result = vkCreateCommandPool(device, &poolCreateInfo, nullptr, &secondary.pool);
+            if (result != VK_SUCCESS)
+                return result;
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = secondary.pool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            result = vkAllocateCommandBuffers(device, &allocInfo, &secondary.handle);
+            if (result != VK_SUCCESS)
+            {
+                vkDestroyCommandPool(device, secondary.pool, nullptr);
+                return result;
             }
 
-            // Parse and execute the next command in the stream.
-            CommandID cmd;
-            stream >> cmd;
-            if (stream.EndOfStream())
+            m_secondaryCommandBuffers.push_back(secondary);
+        }
+
+        for (size_t i = 0; i < subpasses.size(); ++i)
+            subpasses[i].handle = m_secondaryCommandBuffers[i].handle;
+
+        return VK_SUCCESS;
+    }
+
+    void StreamDecoder::RecordSecondarySubpasses(ParallelDecodeContext& context)
+    {
+        while (true)
+        {
+            // Claim the next subpass to record.
+            auto index = context.nextSubpass++;
+            if (index >= context.subpasses.size())
                 break;
 
-            (this->*m_entryPoints[cmd])(commandBuffer, stream);
+            auto& subpass = context.subpasses[index];
+
+            // Begin recording within the subpass of the render pass.
+            VkCommandBufferInheritanceInfo inheritanceInfo = {};
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass = subpass.renderPass->renderPass;
+            inheritanceInfo.subpass = subpass.subpassIndex;
+            inheritanceInfo.framebuffer = subpass.renderPass->framebuffer;
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            // The primary executing the secondary may be submitted again, and possibly while still pending.
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | (context.usageFlags & VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+            auto result = vkBeginCommandBuffer(subpass.handle, &beginInfo);
+            if (result == VK_SUCCESS)
+            {
+                // Replay the state bound before the subpass began, followed by the subpass's own packets.
+                for (auto packet : subpass.state)
+                    Execute(subpass.handle, packet);
+
+                for (auto i = subpass.firstPacket; i < subpass.lastPacket; ++i)
+                    Execute(subpass.handle, context.packets[i]);
+
+                result = vkEndCommandBuffer(subpass.handle);
+            }
+
+            // Keep the first error encountered.
+            if (result != VK_SUCCESS)
+            {
+                int32_t expected = VK_SUCCESS;
+                context.result.compare_exchange_strong(expected, result);
+            }
+
+            std::lock_guard<std::mutex> lock(context.mutex);
+            if (++context.completedSubpasses == context.subpasses.size())
+                context.subpassCompleted.notify_all();
         }
     }
 
-    void StreamDecoder::CmdBeginRenderPass(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::BeginRenderPass(VkCommandBuffer commandBuffer, const BeginRenderPassPacket* pPacket, VkSubpassContents contents)
     {
-        // This command is never encoded by StreamEncoder.
+        VkRenderPassBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        beginInfo.renderPass = pPacket->renderPass;
+        beginInfo.framebuffer = pPacket->framebuffer;
+        beginInfo.renderArea = pPacket->renderArea;
+        beginInfo.clearValueCount = pPacket->clearValueCount;
+        beginInfo.pClearValues = GetCommandPacketData<VkClearValue>(pPacket);
+        vkCmdBeginRenderPass(commandBuffer, &beginInfo, contents);
     }
 
-    void StreamDecoder::CmdNextSubpass(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBeginRenderPass(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const BeginRenderPassPacket*>(pPacket);
+
         // Call native Vulkan function.
-        vkCmdNextSubpass(commandBuffer.GetHandle(), VK_SUBPASS_CONTENTS_INLINE);
+        BeginRenderPass(commandBuffer, packet, packet->contents);
     }
 
-    void StreamDecoder::CmdEndRenderPass(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdNextSubpass(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const NextSubpassPacket*>(pPacket);
+
         // Call native Vulkan function.
-        vkCmdEndRenderPass(commandBuffer.GetHandle());
+        vkCmdNextSubpass(commandBuffer, packet->contents);
+    }
 
-        // Reset bound framebuffer.
-        m_framebuffer = nullptr;
+    void StreamDecoder::CmdEndRenderPass(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
+    {
+        // Call native Vulkan function.
+        vkCmdEndRenderPass(commandBuffer);
     }
 
-    void StreamDecoder::CmdBindPipeline(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindPipeline(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
-        // This command is never encoded by StreamEncoder.
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const BindPipelinePacket*>(pPacket);
+
+        // Call native Vulkan function.
+        vkCmdBindPipeline(commandBuffer, packet->bindPoint, packet->pipeline);
     }
 
-    void StreamDecoder::CmdPushConstants(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdPushConstants(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        VkPipelineLayout layout;
-        VkShaderStageFlags shaderStages;
-        uint32_t offset, size;
-        stream >> layout >> shaderStages >> offset >> size;
-        auto pValues = reinterpret_cast<const void*>(stream.ReadPtr<const uint8_t>(size));
+        auto packet = reinterpret_cast<const PushConstantsPacket*>(pPacket);
+        auto pValues = GetCommandPacketData<void>(packet);
 
-        // Call native Vulkan function.       
-        vkCmdPushConstants(commandBuffer.GetHandle(), layout, shaderStages, offset, size, pValues);
+        // Call native Vulkan function.
+        vkCmdPushConstants(commandBuffer, packet->layout, packet->stageFlags, packet->offset, packet->size, pValues);
     }
 
-    void StreamDecoder::CmdBindBuffer(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdBindBufferView(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindBufferView(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdBindImageView(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindImageView(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdBindSampler(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindSampler(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdBindVertexBuffers(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindVertexBuffers(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t firstBinding, bindingCount;
-        stream >> firstBinding >> bindingCount;
-        auto ppBuffers = stream.ReadPtr<Buffer*>(bindingCount);
-        auto pOffsets = stream.ReadPtr<const VkDeviceSize>(bindingCount);
+        auto packet = reinterpret_cast<const BindVertexBuffersPacket*>(pPacket);
+        auto pBuffers = GetCommandPacketData<VkBuffer>(packet);
+        auto pOffsets = GetCommandPacketData<VkDeviceSize>(packet, sizeof(VkBuffer) * packet->bindingCount);
 
         // Call native Vulkan function.
-        std::vector<VkBuffer> buffers(bindingCount);
-        for (auto i = 0U; i < bindingCount; ++i)
-            buffers[i] = ppBuffers[i]->GetHandle();
-
-        vkCmdBindVertexBuffers(commandBuffer.GetHandle(), firstBinding, bindingCount, buffers.data(), reinterpret_cast<const VkDeviceSize*>(pOffsets));
+        vkCmdBindVertexBuffers(commandBuffer, packet->firstBinding, packet->bindingCount, pBuffers, pOffsets);
     }
 
-    void StreamDecoder::CmdBindIndexBuffer(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBindIndexBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pBuffer;
-        VkDeviceSize offset;
-        VkIndexType indexType;
-        stream >> pBuffer >> offset >> indexType;
+        auto packet = reinterpret_cast<const BindIndexBufferPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdBindIndexBuffer(commandBuffer.GetHandle(), pBuffer->GetHandle(), offset, static_cast<VkIndexType>(indexType));
+        vkCmdBindIndexBuffer(commandBuffer, packet->buffer, packet->offset, packet->indexType);
     }
 
-    void StreamDecoder::CmdSetVertexInputFormat(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetVertexInputFormat(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetViewportState(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetViewportState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetInputAssemblyState(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetInputAssemblyState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetRasterizationState(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetRasterizationState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetMultisampleState(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetMultisampleState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetDepthStencilState(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetDepthStencilState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetColorBlendState(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetColorBlendState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // This command is never encoded by StreamEncoder.
     }
 
-    void StreamDecoder::CmdSetViewport(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetViewport(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t firstViewport, viewportCount;
-        stream >> firstViewport >> viewportCount;
-        auto pViewports = stream.ReadPtr<const VkViewport>(viewportCount);
+        auto packet = reinterpret_cast<const SetViewportPacket*>(pPacket);
+        auto pViewports = GetCommandPacketData<VkViewport>(packet);
 
         // Call native Vulkan function.
-        vkCmdSetViewport(commandBuffer.GetHandle(), firstViewport, viewportCount, reinterpret_cast<const VkViewport*>(pViewports));
+        vkCmdSetViewport(commandBuffer, packet->firstViewport, packet->viewportCount, pViewports);
     }
 
-    void StreamDecoder::CmdSetScissor(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetScissor(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t firstScissor, scissorCount;
-        stream >> firstScissor >> scissorCount;
-        auto pScissors = stream.ReadPtr<const VkRect2D>(scissorCount);
+        auto packet = reinterpret_cast<const SetScissorPacket*>(pPacket);
+        auto pScissors = GetCommandPacketData<VkRect2D>(packet);
 
         // Call native Vulkan function.
-        vkCmdSetScissor(commandBuffer.GetHandle(), firstScissor, scissorCount, reinterpret_cast<const VkRect2D*>(pScissors));
+        vkCmdSetScissor(commandBuffer, packet->firstScissor, packet->scissorCount, pScissors);
     }
 
-    void StreamDecoder::CmdSetLineWidth(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetLineWidth(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        float lineWidth;
-        stream >> lineWidth;
+        auto packet = reinterpret_cast<const SetLineWidthPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetLineWidth(commandBuffer.GetHandle(), lineWidth);
+        vkCmdSetLineWidth(commandBuffer, packet->lineWidth);
     }
 
-    void StreamDecoder::CmdSetDepthBias(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetDepthBias(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        float depthBiasConstantFactor, depthBiasClamp, depthBiasSlopeFactor;
-        stream >> depthBiasConstantFactor >> depthBiasClamp >> depthBiasSlopeFactor;
+        auto packet = reinterpret_cast<const SetDepthBiasPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetDepthBias(commandBuffer.GetHandle(), depthBiasConstantFactor, depthBiasClamp, depthBiasSlopeFactor);
+        vkCmdSetDepthBias(commandBuffer, packet->depthBiasConstantFactor, packet->depthBiasClamp, packet->depthBiasSlopeFactor);
     }
 
-    void StreamDecoder::CmdSetBlendConstants(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetBlendConstants(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        auto blendConstants = stream.ReadPtr<float>(4);
+        auto packet = reinterpret_cast<const SetBlendConstantsPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetBlendConstants(commandBuffer.GetHandle(), blendConstants);
+        vkCmdSetBlendConstants(commandBuffer, packet->blendConstants);
     }
 
-    void StreamDecoder::CmdSetDepthBounds(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetDepthBounds(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        float minDepthBounds, maxDepthBounds;
-        stream >> minDepthBounds >> maxDepthBounds;
+        auto packet = reinterpret_cast<const SetDepthBoundsPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetDepthBounds(commandBuffer.GetHandle(), minDepthBounds, maxDepthBounds);
+        vkCmdSetDepthBounds(commandBuffer, packet->minDepthBounds, packet->maxDepthBounds);
     }
 
-    void StreamDecoder::CmdSetStencilCompareMask(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetStencilCompareMask(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        VkStencilFaceFlags faceMask;
-        uint32_t compareMask;
-        stream >> faceMask >> compareMask;
+        auto packet = reinterpret_cast<const SetStencilCompareMaskPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetStencilCompareMask(commandBuffer.GetHandle(), static_cast<VkStencilFaceFlags>(faceMask), compareMask);
+        vkCmdSetStencilCompareMask(commandBuffer, packet->faceMask, packet->compareMask);
     }
 
-    void StreamDecoder::CmdSetStencilWriteMask(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetStencilWriteMask(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        VkStencilFaceFlags faceMask;
-        uint32_t writeMask;
-        stream >> faceMask >> writeMask;
+        auto packet = reinterpret_cast<const SetStencilWriteMaskPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetStencilWriteMask(commandBuffer.GetHandle(), static_cast<VkStencilFaceFlags>(faceMask), writeMask);
+        vkCmdSetStencilWriteMask(commandBuffer, packet->faceMask, packet->writeMask);
     }
 
-    void StreamDecoder::CmdSetStencilReference(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetStencilReference(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        VkStencilFaceFlags faceMask;
-        uint32_t reference;
-        stream >> faceMask >> reference;
+        auto packet = reinterpret_cast<const SetStencilReferencePacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdSetStencilReference(commandBuffer.GetHandle(), static_cast<VkStencilFaceFlags>(faceMask), reference);
+        vkCmdSetStencilReference(commandBuffer, packet->faceMask, packet->reference);
     }
 
-    void StreamDecoder::CmdDraw(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdDraw(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t vertexCount, instanceCount, firstVertex, firstInstance;
-        stream >> vertexCount >> instanceCount >> firstVertex >> firstInstance;
+        auto packet = reinterpret_cast<const DrawPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdDraw(commandBuffer.GetHandle(), vertexCount, instanceCount, firstVertex, firstInstance);
+        vkCmdDraw(commandBuffer, packet->vertexCount, packet->instanceCount, packet->firstVertex, packet->firstInstance);
     }
 
-    void StreamDecoder::CmdDrawIndexed(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdDrawIndexed(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t indexCount, instanceCount, firstIndex, vertexOffset, firstInstance;
-        stream >> indexCount >> instanceCount >> firstIndex >> vertexOffset >> firstInstance;
-
-        auto streamPos = stream.TellG();
+        auto packet = reinterpret_cast<const DrawIndexedPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdDrawIndexed(commandBuffer.GetHandle(), indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+        vkCmdDrawIndexed(commandBuffer, packet->indexCount, packet->instanceCount, packet->firstIndex, packet->vertexOffset, packet->firstInstance);
     }
 
-    void StreamDecoder::CmdDrawIndirect(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdDrawIndirect(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pBuffer;
-        VkDeviceSize offset;
-        uint32_t drawCount, stride;
-        stream >> pBuffer >> offset >> drawCount >> stride;
+        auto packet = reinterpret_cast<const DrawIndirectPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdDrawIndirect(commandBuffer.GetHandle(), pBuffer->GetHandle(), offset, drawCount, stride);
+        vkCmdDrawIndirect(commandBuffer, packet->buffer, packet->offset, packet->drawCount, packet->stride);
     }
 
-    void StreamDecoder::CmdDrawIndexedIndirect(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdDrawIndexedIndirect(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pBuffer;
-        VkDeviceSize offset;
-        uint32_t drawCount, stride;
-        stream >> pBuffer >> offset >> drawCount >> stride;
+        auto packet = reinterpret_cast<const DrawIndexedIndirectPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdDrawIndexedIndirect(commandBuffer.GetHandle(), pBuffer->GetHandle(), offset, drawCount, stride);
+        vkCmdDrawIndexedIndirect(commandBuffer, packet->buffer, packet->offset, packet->drawCount, packet->stride);
     }
 
-    void StreamDecoder::CmdDispatch(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdDispatch(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t groupCountX, groupCountY, groupCountZ;
-        stream >> groupCountX >> groupCountY >> groupCountZ;
+        auto packet = reinterpret_cast<const DispatchPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdDispatch(commandBuffer.GetHandle(), groupCountX, groupCountY, groupCountZ);
+        vkCmdDispatch(commandBuffer, packet->groupCountX, packet->groupCountY, packet->groupCountZ);
     }
 
-    void StreamDecoder::CmdDispatchIndirect(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdDispatchIndirect(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pBuffer;
-        VkDeviceSize offset;
-        stream >> pBuffer >> offset;
+        auto packet = reinterpret_cast<const DispatchIndirectPacket*>(pPacket);
 
         // Call native Vulkan function.
-        vkCmdDispatchIndirect(commandBuffer.GetHandle(), pBuffer->GetHandle(), offset);
+        vkCmdDispatchIndirect(commandBuffer, packet->buffer, packet->offset);
     }
 
-    void StreamDecoder::CmdCopyBuffer(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdCopyBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pSrcBuffer;
-        Buffer* pDstBuffer;
-        uint32_t regionCount;
-        stream >> pSrcBuffer >> pDstBuffer >> regionCount;
-        auto pRegions = stream.ReadPtr<const VezBufferCopy>(regionCount);
+        auto packet = reinterpret_cast<const CopyBufferPacket*>(pPacket);
+        auto pRegions = GetCommandPacketData<VkBufferCopy>(packet);
 
         // Call native Vulkan function.
-        std::vector<VkBufferCopy> regions(regionCount);
-        for (auto i = 0U; i < regionCount; ++i)
-        {
-            regions[i].srcOffset = pRegions[i].srcOffset;
-            regions[i].dstOffset = pRegions[i].dstOffset;
-            regions[i].size = pRegions[i].size;
-        }
-
-        vkCmdCopyBuffer(commandBuffer.GetHandle(), pSrcBuffer->GetHandle(), pDstBuffer->GetHandle(), regionCount, regions.data());
+        vkCmdCopyBuffer(commandBuffer, packet->srcBuffer, packet->dstBuffer, packet->regionCount, pRegions);
     }
 
-    void StreamDecoder::CmdCopyImage(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdCopyImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Image* pSrcImage;
-        Image* pDstImage;
-        uint32_t regionCount;
-        stream >> pSrcImage >> pDstImage >> regionCount;
-        auto pRegions = stream.ReadPtr<const VezImageCopy>(regionCount);
-
-        VkImageLayout srcLayout, dstLayout;
-        stream >> srcLayout >> dstLayout;
+        auto packet = reinterpret_cast<const CopyImagePacket*>(pPacket);
+        auto pRegions = GetCommandPacketData<VkImageCopy>(packet);
 
         // Call native Vulkan function.
-        std::vector<VkImageCopy> regions(regionCount);
-        for (auto i = 0U; i < regionCount; ++i)
-        {
-            VkImageCopy& region = regions[i];
-            memcpy(&region.srcOffset, &pRegions[i].srcOffset, sizeof(VkOffset3D));
-            memcpy(&region.dstOffset, &pRegions[i].dstOffset, sizeof(VkOffset3D));
-            memcpy(&region.extent, &pRegions[i].extent, sizeof(VkExtent3D));
-            region.srcSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
-            region.srcSubresource.mipLevel = pRegions[i].srcSubresource.mipLevel;
-            region.srcSubresource.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
-            region.srcSubresource.layerCount = pRegions[i].srcSubresource.layerCount;
-            region.dstSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
-            region.dstSubresource.mipLevel = pRegions[i].dstSubresource.mipLevel;
-            region.dstSubresource.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
-            region.dstSubresource.layerCount = pRegions[i].dstSubresource.layerCount;
-        }
-
-        vkCmdCopyImage(commandBuffer.GetHandle(), pSrcImage->GetHandle(), srcLayout, pDstImage->GetHandle(), dstLayout, regionCount, regions.data());
+        vkCmdCopyImage(commandBuffer, packet->srcImage, packet->srcImageLayout, packet->dstImage, packet->dstImageLayout, packet->regionCount, pRegions);
     }
 
-    void StreamDecoder::CmdBlitImage(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdBlitImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Image* pSrcImage;
-        Image* pDstImage;
-        uint32_t regionCount;
-        VkFilter filter;
-        stream >> pSrcImage >> pDstImage >> regionCount;
-        auto pRegions = stream.ReadPtr<const VezImageBlit>(regionCount);
-        stream >> filter;
-
-        VkImageLayout srcLayout, dstLayout;
-        stream >> srcLayout >> dstLayout;
+        auto packet = reinterpret_cast<const BlitImagePacket*>(pPacket);
+        auto pRegions = GetCommandPacketData<VkImageBlit>(packet);
 
         // Call native Vulkan function.
-        std::vector<VkImageBlit> regions(regionCount);
-        for (auto i = 0U; i < regionCount; ++i)
-        {
-            VkImageBlit& region = regions[i];
-            memcpy(&region.srcOffsets[0], &pRegions[i].srcOffsets[0], sizeof(VkOffset3D));
-            memcpy(&region.srcOffsets[1], &pRegions[i].srcOffsets[1], sizeof(VkOffset3D));
-            memcpy(&region.dstOffsets[0], &pRegions[i].dstOffsets[0], sizeof(VkOffset3D));
-            memcpy(&region.dstOffsets[1], &pRegions[i].dstOffsets[1], sizeof(VkOffset3D));
-            region.srcSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
-            region.srcSubresource.mipLevel = pRegions[i].srcSubresource.mipLevel;
-            region.srcSubresource.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
-            region.srcSubresource.layerCount = pRegions[i].srcSubresource.layerCount;
-            region.dstSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
-            region.dstSubresource.mipLevel = pRegions[i].dstSubresource.mipLevel;
-            region.dstSubresource.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
-            region.dstSubresource.layerCount = pRegions[i].dstSubresource.layerCount;
-        }
-
-        vkCmdBlitImage(commandBuffer.GetHandle(), pSrcImage->GetHandle(), srcLayout, pDstImage->GetHandle(), dstLayout, regionCount, regions.data(), static_cast<VkFilter>(filter));
+        vkCmdBlitImage(commandBuffer, packet->srcImage, packet->srcImageLayout, packet->dstImage, packet->dstImageLayout, packet->regionCount, pRegions, packet->filter);
     }
 
-    void StreamDecoder::CmdCopyBufferToImage(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdCopyBufferToImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pSrcBuffer;
-        Image* pDstImage;
-        uint32_t regionCount;
-        stream >> pSrcBuffer >> pDstImage >> regionCount;
-        auto pRegions = stream.ReadPtr<const VezBufferImageCopy>(regionCount);
+        auto packet = reinterpret_cast<const CopyBufferToImagePacket*>(pPacket);
+        auto pRegions = GetCommandPacketData<VkBufferImageCopy>(packet);
 
         // Call the native Vulkan function.
-        std::vector<VkBufferImageCopy> regions(regionCount);
-        for (auto i = 0U; i < regionCount; ++i)
-        {
-            VkBufferImageCopy& region = regions[i];
-            region.bufferOffset = pRegions[i].bufferOffset;
-            region.bufferRowLength = pRegions[i].bufferRowLength;
-            region.bufferImageHeight = pRegions[i].bufferImageHeight;
-            memcpy(&region.imageOffset, &pRegions[i].imageOffset, sizeof(VkOffset3D));
-            memcpy(&region.imageExtent, &pRegions[i].imageExtent, sizeof(VkExtent3D));
-            region.imageSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
-            region.imageSubresource.mipLevel = pRegions[i].imageSubresource.mipLevel;
-            region.imageSubresource.baseArrayLayer = pRegions[i].imageSubresource.baseArrayLayer;
-            region.imageSubresource.layerCount = pRegions[i].imageSubresource.layerCount;
-        }
-
-        vkCmdCopyBufferToImage(commandBuffer.GetHandle(), pSrcBuffer->GetHandle(), pDstImage->GetHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions.data());
+        vkCmdCopyBufferToImage(commandBuffer, packet->srcBuffer, packet->dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, packet->regionCount, pRegions);
     }
 
-    void StreamDecoder::CmdCopyImageToBuffer(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdCopyImageToBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Image* pSrcImage;
-        Buffer* pDstBuffer;
-        uint32_t regionCount;
-        stream >> pSrcImage >> pDstBuffer >> regionCount;
-        auto pRegions = stream.ReadPtr<const VezBufferImageCopy>(regionCount);
+        auto packet = reinterpret_cast<const CopyImageToBufferPacket*>(pPacket);
+        auto pRegions = GetCommandPacketData<VkBufferImageCopy>(packet);
 
         // Call the native Vulkan function.
-        std::vector<VkBufferImageCopy> regions(regionCount);
-        for (auto i = 0U; i < regionCount; ++i)
-        {
-            VkBufferImageCopy& region = regions[i];
-            region.bufferOffset = pRegions[i].bufferOffset;
-            region.bufferRowLength = pRegions[i].bufferRowLength;
-            region.bufferImageHeight = pRegions[i].bufferImageHeight;
-            memcpy(&region.imageOffset, &pRegions[i].imageOffset, sizeof(VkOffset3D));
-            memcpy(&region.imageExtent, &pRegions[i].imageExtent, sizeof(VkExtent3D));
-            region.imageSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
-            region.imageSubresource.mipLevel = pRegions[i].imageSubresource.mipLevel;
-            region.imageSubresource.baseArrayLayer = pRegions[i].imageSubresource.baseArrayLayer;
-            region.imageSubresource.layerCount = pRegions[i].imageSubresource.layerCount;
-        }
-
-        vkCmdCopyImageToBuffer(commandBuffer.GetHandle(), pSrcImage->GetHandle(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pDstBuffer->GetHandle(), regionCount, regions.data());
+        vkCmdCopyImageToBuffer(commandBuffer, packet->srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, packet->dstBuffer, packet->regionCount, pRegions);
     }
 
-    void StreamDecoder::CmdUpdateBuffer(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdUpdateBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pDstBuffer;
-        VkDeviceSize dstOffset, dataSize;
-        stream >> pDstBuffer >> dstOffset >> dataSize;
-        auto pData = reinterpret_cast<const void*>(stream.ReadPtr<const uint8_t>(dataSize));
+        auto packet = reinterpret_cast<const UpdateBufferPacket*>(pPacket);
+        auto pData = GetCommandPacketData<void>(packet);
 
         // Call the native Vulkan function.
-        vkCmdUpdateBuffer(commandBuffer.GetHandle(), pDstBuffer->GetHandle(), dstOffset, dataSize, pData);
+        vkCmdUpdateBuffer(commandBuffer, packet->dstBuffer, packet->dstOffset, packet->dataSize, pData);
     }
 
-    void StreamDecoder::CmdFillBuffer(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdFillBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Buffer* pDstBuffer;
-        VkDeviceSize dstOffset, size;
-        uint32_t data;
-        stream >> pDstBuffer >> dstOffset >> size >> data;
+        auto packet = reinterpret_cast<const FillBufferPacket*>(pPacket);
 
         // Call the native Vulkan function.
-        vkCmdFillBuffer(commandBuffer.GetHandle(), pDstBuffer->GetHandle(), dstOffset, size, data);
+        vkCmdFillBuffer(commandBuffer, packet->dstBuffer, packet->dstOffset, packet->size, packet->data);
     }
 
-    void StreamDecoder::CmdClearColorImage(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdClearColorImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Image* pImage;
-        stream >> pImage;
-        auto pColor = stream.ReadPtr<const VkClearColorValue>();
-        uint32_t rangeCount;
-        stream >> rangeCount;
-        auto pRanges = stream.ReadPtr<const VezImageSubresourceRange>(rangeCount);
+        auto packet = reinterpret_cast<const ClearColorImagePacket*>(pPacket);
+        auto pRanges = GetCommandPacketData<VkImageSubresourceRange>(packet);
 
         // Call the native Vulkan function.
-        std::vector<VkImageSubresourceRange> ranges(rangeCount);
-        for (auto i = 0U; i < rangeCount; ++i)
-        {
-            VkImageSubresourceRange& range = ranges[i];
-            range.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
-            range.baseMipLevel = pRanges[i].baseMipLevel;
-            range.levelCount = pRanges[i].levelCount;
-            range.baseArrayLayer = pRanges[i].baseArrayLayer;
-            range.layerCount = pRanges[i].layerCount;
-        }
+        vkCmdClearColorImage(commandBuffer, packet->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &packet->color, packet->rangeCount, pRanges);
+    }
+
+    void StreamDecoder::CmdClearDepthStencilImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
+    {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const ClearDepthStencilImagePacket*>(pPacket);
+        auto pRanges = GetCommandPacketData<VkImageSubresourceRange>(packet);
 
-        vkCmdClearColorImage(commandBuffer.GetHandle(), pImage->GetHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, reinterpret_cast<const VkClearColorValue*>(pColor), rangeCount, ranges.data());
+        // Call the native Vulkan function.
+        vkCmdClearDepthStencilImage(commandBuffer, packet->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &packet->depthStencil, packet->rangeCount, pRanges);
     }
 
-    void StreamDecoder::CmdClearDepthStencilImage(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdClearAttachments(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Image* pImage;
-        stream >> pImage;
-        auto pDepthStencil = stream.ReadPtr<const VkClearDepthStencilValue>();
-        uint32_t rangeCount;
-        stream >> rangeCount;
-        auto pRanges = stream.ReadPtr<const VezImageSubresourceRange>(rangeCount);
+        auto packet = reinterpret_cast<const ClearAttachmentsPacket*>(pPacket);
+        auto pAttachments = GetCommandPacketData<VkClearAttachment>(packet);
+        auto pRects = GetCommandPacketData<VkClearRect>(packet, sizeof(VkClearAttachment) * packet->attachmentCount);
 
         // Call the native Vulkan function.
-        std::vector<VkImageSubresourceRange> ranges(rangeCount);
-        for (auto i = 0U; i < rangeCount; ++i)
-        {
-            VkImageSubresourceRange& range = ranges[i];
-            range.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
-            range.baseMipLevel = pRanges[i].baseMipLevel;
-            range.levelCount = pRanges[i].levelCount;
-            range.baseArrayLayer = pRanges[i].baseArrayLayer;
-            range.layerCount = pRanges[i].layerCount;
-        }
+        vkCmdClearAttachments(commandBuffer, packet->attachmentCount, pAttachments, packet->rectCount, pRects);
+    }
 
-        vkCmdClearDepthStencilImage(commandBuffer.GetHandle(), pImage->GetHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, reinterpret_cast<const VkClearDepthStencilValue*>(pDepthStencil), rangeCount, ranges.data());
+    void StreamDecoder::CmdResolveImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
+    {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const ResolveImagePacket*>(pPacket);
+        auto pRegions = GetCommandPacketData<VkImageResolve>(packet);
 
+        // Call the native Vulkan function.
+        vkCmdResolveImage(commandBuffer, packet->srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, packet->dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, packet->regionCount, pRegions);
     }
 
-    void StreamDecoder::CmdClearAttachments(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdSetEvent(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        uint32_t attachmentCount;
-        stream >> attachmentCount;
-        auto pAttachments = stream.ReadPtr<const VezClearAttachment>(attachmentCount);
-        uint32_t rectCount;
-        stream >> rectCount;
-        auto pRects = stream.ReadPtr<const VkClearRect>(rectCount);
+        auto packet = reinterpret_cast<const SetEventPacket*>(pPacket);
 
         // Call the native Vulkan function.
-        std::vector<VkClearAttachment> attachments(attachmentCount);
-        for (auto i = 0U; i < attachmentCount; ++i)
-        {
-            VkClearAttachment& attachment = attachments[i];
-            attachment.aspectMask = GetImageAspectFlags(m_framebuffer->GetAttachment(i)->GetImage()->GetCreateInfo().format);
-            attachment.colorAttachment = pAttachments[i].colorAttachment;
-            memcpy(&attachment.clearValue, &pAttachments[i].clearValue, sizeof(VkClearValue));
-        }
+        vkCmdSetEvent(commandBuffer, packet->event, packet->stageMask);
+    }
 
-        vkCmdClearAttachments(commandBuffer.GetHandle(), attachmentCount, attachments.data(), rectCount, reinterpret_cast<const VkClearRect*>(pRects));
+    void StreamDecoder::CmdResetEvent(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
+    {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const ResetEventPacket*>(pPacket);
+
+        // Call the native Vulkan function.
+        vkCmdResetEvent(commandBuffer, packet->event, packet->stageMask);
     }
 
-    void StreamDecoder::CmdResolveImage(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdWaitEvents(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        Image* pSrcImage;
-        Image* pDstImage;
-        uint32_t regionCount;
-        stream >> pSrcImage >> pDstImage >> regionCount;
-        auto pRegions = stream.ReadPtr<const VezImageResolve>();
+        auto packet = reinterpret_cast<const WaitEventsPacket*>(pPacket);
+        auto pBufferBarriers = GetCommandPacketData<VkBufferMemoryBarrier>(packet);
+        auto pImageBarriers = GetCommandPacketData<VkImageMemoryBarrier>(packet, sizeof(VkBufferMemoryBarrier) * packet->bufferBarrierCount);
 
         // Call the native Vulkan function.
-        std::vector<VkImageResolve> regions(regionCount);
-        for (auto i = 0U; i < regionCount; ++i)
+        vkCmdWaitEvents(commandBuffer, 1, &packet->event, packet->srcStageMask, packet->dstStageMask, 0, nullptr,
+            packet->bufferBarrierCount, pBufferBarriers, packet->imageBarrierCount, pImageBarriers);
+    }
+
+    void StreamDecoder::CmdBindDescriptorSet(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
+    {
+        // Decode command parameters.
+        auto packet = reinterpret_cast<const BindDescriptorSetPacket*>(pPacket);
+
+#ifdef VK_KHR_push_descriptor
+        // Push the descriptors of push descriptor layouts, which never exceed the supported maximum.
+        if (packet->descriptorSet == VK_NULL_HANDLE)
         {
-            VkImageResolve& region = regions[i];
-            memcpy(&region.srcOffset, &pRegions[i].srcOffset, sizeof(VkOffset3D));
-            memcpy(&region.dstOffset, &pRegions[i].dstOffset, sizeof(VkOffset3D));
-            memcpy(&region.extent, &pRegions[i].extent, sizeof(VkExtent3D));
-            region.srcSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
-            region.srcSubresource.mipLevel = pRegions[i].srcSubresource.mipLevel;
-            region.srcSubresource.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
-            region.srcSubresource.layerCount = pRegions[i].srcSubresource.layerCount;
-            region.dstSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
-            region.dstSubresource.mipLevel = pRegions[i].dstSubresource.mipLevel;
-            region.dstSubresource.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
-            region.dstSubresource.layerCount = pRegions[i].dstSubresource.layerCount;
-        }
+            auto pPushDescriptors = GetCommandPacketData<PushDescriptor>(packet);
+            VkWriteDescriptorSet descriptorWrites[MAX_PUSH_DESCRIPTORS];
+            for (auto i = 0U; i < packet->pushDescriptorCount; ++i)
+            {
+                auto& pushDescriptor = pPushDescriptors[i];
+                auto& dsWrite = descriptorWrites[i];
+                dsWrite = {};
+                dsWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                dsWrite.dstBinding = pushDescriptor.binding;
+                dsWrite.dstArrayElement = pushDescriptor.arrayElement;
+                dsWrite.descriptorCount = 1;
+                dsWrite.descriptorType = pushDescriptor.descriptorType;
+                switch (pushDescriptor.descriptorType)
+                {
+                case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+                case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+                case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+                case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+                    dsWrite.pBufferInfo = &pushDescriptor.record.bufferInfo;
+                    break;
+
+                case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+                case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+                    dsWrite.pTexelBufferView = &pushDescriptor.record.texelBufferView;
+                    break;
+
+                default:
+                    dsWrite.pImageInfo = &pushDescriptor.record.imageInfo;
+                    break;
+                }
+            }
+
+            if (packet->pushDescriptorCount > 0)
+                m_pool->GetDevice()->GetCmdPushDescriptorSet()(commandBuffer, packet->bindPoint, packet->pipelineLayout, packet->setIndex, packet->pushDescriptorCount, descriptorWrites);
 
-        vkCmdResolveImage(commandBuffer.GetHandle(), pSrcImage->GetHandle(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pDstImage->GetHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions.data());
+            return;
+        }
+#endif
 
+        // Call the native Vulkan function.
+        vkCmdBindDescriptorSets(commandBuffer, packet->bindPoint, packet->pipelineLayout, packet->setIndex, 1, &packet->descriptorSet, 0, nullptr);
     }
 
-    void StreamDecoder::CmdSetEvent(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdPipelineBarrier(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        VkEvent event;
-        VkPipelineStageFlags stageMask;
-        stream >> event >> stageMask;
+        auto packet = reinterpret_cast<const PipelineBarrierPacket*>(pPacket);
+        auto pBufferBarriers = GetCommandPacketData<VkBufferMemoryBarrier>(packet);
+        auto pImageBarriers = GetCommandPacketData<VkImageMemoryBarrier>(packet, sizeof(VkBufferMemoryBarrier) * packet->bufferBarrierCount);
+
+#ifdef VK_KHR_synchronization2
+        // Give each memory barrier its own stage masks, including the separate copy, resolve, blit and clear stages.
+        auto cmdPipelineBarrier2 = m_pool->GetDevice()->GetCmdPipelineBarrier2();
+        if (cmdPipelineBarrier2)
+        {
+            auto pStages = GetCommandPacketData<MemoryBarrierStages>(packet, sizeof(VkBufferMemoryBarrier) * packet->bufferBarrierCount + sizeof(VkImageMemoryBarrier) * packet->imageBarrierCount);
+
+            // The barriers reuse the decoder's storage, which is safe since pipeline barriers are never recorded within render passes
+            // and so are only decoded by the thread recording the primary command buffer.
+            auto& bufferBarriers = m_bufferBarriers2;
+            auto& imageBarriers = m_imageBarriers2;
+            bufferBarriers.resize(packet->bufferBarrierCount);
+            imageBarriers.resize(packet->imageBarrierCount);
+
+            PipelineStageFlags srcStageMask = 0;
+            PipelineStageFlags dstStageMask = 0;
+            for (auto i = 0U; i < packet->bufferBarrierCount; ++i)
+            {
+                auto& bufferBarrier = bufferBarriers[i];
+                bufferBarrier = {};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+                bufferBarrier.srcStageMask = pStages[i].srcStageMask;
+                bufferBarrier.srcAccessMask = pBufferBarriers[i].srcAccessMask;
+                bufferBarrier.dstStageMask = pStages[i].dstStageMask;
+                bufferBarrier.dstAccessMask = pBufferBarriers[i].dstAccessMask;
+                bufferBarrier.srcQueueFamilyIndex = pBufferBarriers[i].srcQueueFamilyIndex;
+                bufferBarrier.dstQueueFamilyIndex = pBufferBarriers[i].dstQueueFamilyIndex;
+                bufferBarrier.buffer = pBufferBarriers[i].buffer;
+                bufferBarrier.offset = pBufferBarriers[i].offset;
+                bufferBarrier.size = pBufferBarriers[i].size;
+                srcStageMask |= pStages[i].srcStageMask;
+                dstStageMask |= pStages[i].dstStageMask;
+            }
+
+            pStages += packet->bufferBarrierCount;
+            for (auto i = 0U; i < packet->imageBarrierCount; ++i)
+            {
+                auto& imageBarrier = imageBarriers[i];
+                imageBarrier = {};
+                imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+                imageBarrier.srcStageMask = pStages[i].srcStageMask;
+                imageBarrier.srcAccessMask = pImageBarriers[i].srcAccessMask;
+                imageBarrier.dstStageMask = pStages[i].dstStageMask;
+                imageBarrier.dstAccessMask = pImageBarriers[i].dstAccessMask;
+                imageBarrier.oldLayout = pImageBarriers[i].oldLayout;
+                imageBarrier.newLayout = pImageBarriers[i].newLayout;
+                imageBarrier.srcQueueFamilyIndex = pImageBarriers[i].srcQueueFamilyIndex;
+                imageBarrier.dstQueueFamilyIndex = pImageBarriers[i].dstQueueFamilyIndex;
+                imageBarrier.image = pImageBarriers[i].image;
+                imageBarrier.subresourceRange = pImageBarriers[i].subresourceRange;
+                srcStageMask |= pStages[i].srcStageMask;
+                dstStageMask |= pStages[i].dstStageMask;
+            }
+
+            // The packet's stage masks also carry execution dependencies without memory barriers, such as those of barriers with no memory
+            // barriers at all, so they are kept as an execution only barrier whenever the memory barriers' own stages do not cover them.
+            VkMemoryBarrier2KHR memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+            memoryBarrier.srcStageMask = packet->srcStageMask;
+            memoryBarrier.dstStageMask = packet->dstStageMask;
+
+            VkDependencyInfoKHR dependencyInfo = {};
+            dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+            if ((packet->srcStageMask & ~GetLegacyStageMask(srcStageMask)) || (packet->dstStageMask & ~GetLegacyStageMask(dstStageMask)))
+            {
+                dependencyInfo.memoryBarrierCount = 1;
+                dependencyInfo.pMemoryBarriers = &memoryBarrier;
+            }
+
+            dependencyInfo.bufferMemoryBarrierCount = packet->bufferBarrierCount;
+            dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+            dependencyInfo.imageMemoryBarrierCount = packet->imageBarrierCount;
+            dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+            cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+            return;
+        }
+#endif
 
         // Call the native Vulkan function.
-        vkCmdSetEvent(commandBuffer.GetHandle(), event, stageMask);
+        vkCmdPipelineBarrier(commandBuffer, packet->srcStageMask, packet->dstStageMask, 0, 0, nullptr,
+            packet->bufferBarrierCount, pBufferBarriers, packet->imageBarrierCount, pImageBarriers);
     }
 
-    void StreamDecoder::CmdResetEvent(CommandBuffer& commandBuffer, MemoryStream& stream)
+    void StreamDecoder::CmdExecuteCommands(VkCommandBuffer commandBuffer, const CommandPacket* pPacket)
     {
         // Decode command parameters.
-        VkEvent event;
-        VkPipelineStageFlags stageMask;
-        stream >> event >> stageMask;
+        auto packet = reinterpret_cast<const ExecuteCommandsPacket*>(pPacket);
+        auto pCommandBuffers = GetCommandPacketData<VkCommandBuffer>(packet);
 
         // Call the native Vulkan function.
-        vkCmdResetEvent(commandBuffer.GetHandle(), event, stageMask);
+        vkCmdExecuteCommands(commandBuffer, packet->commandBufferCount, pCommandBuffers);
     }
 }
\ No newline at end of file
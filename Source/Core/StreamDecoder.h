@@ -22,72 +22,140 @@
 #pragma once
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <condition_variable>
 #include "Utility/MemoryStream.h"
+#include "CommandPackets.h"
 #include "VEZ.h"
 
 namespace vez
 {
-    class Framebuffer;
-    class CommandBuffer;
-    class StreamEncoder;
+    class CommandPool;
+    class ThreadPool;
 
+    // Translates an encoded command stream into native Vulkan commands.
+    // Large command buffers with several render passes are split at subpass boundaries, with each large subpass recorded
+    // into a secondary command buffer on the instance's thread pool while the primary only executes them in order.
     class StreamDecoder
     {
     public:
-        StreamDecoder();
+        StreamDecoder(CommandPool* pPool);
 
-        void Decode(CommandBuffer& commandBuffer, StreamEncoder& encoder);
+        ~StreamDecoder();
+
+        VkResult Decode(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usageFlags, MemoryStream& stream, bool executesSecondaryCommandBuffers);
+
+        // Waits for the worker tasks of previous decodes to exit, since they reference the decoder.
+        void Reset();
 
     private:
-        void CmdBeginRenderPass(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdNextSubpass(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdEndRenderPass(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindPipeline(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdPushConstants(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindBuffer(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindBufferView(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindImageView(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindSampler(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindVertexBuffers(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBindIndexBuffer(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetVertexInputFormat(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetViewportState(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetInputAssemblyState(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetRasterizationState(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetMultisampleState(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetDepthStencilState(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetColorBlendState(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetViewport(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetScissor(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetLineWidth(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetDepthBias(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetBlendConstants(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetDepthBounds(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetStencilCompareMask(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetStencilWriteMask(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetStencilReference(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdDraw(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdDrawIndexed(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdDrawIndirect(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdDrawIndexedIndirect(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdDispatch(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdDispatchIndirect(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdCopyBuffer(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdCopyImage(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdBlitImage(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdCopyBufferToImage(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdCopyImageToBuffer(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdUpdateBuffer(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdFillBuffer(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdClearColorImage(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdClearDepthStencilImage(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdClearAttachments(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdResolveImage(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdSetEvent(CommandBuffer& commandBuffer, MemoryStream& stream);
-        void CmdResetEvent(CommandBuffer& commandBuffer, MemoryStream& stream);
-
-        typedef void(StreamDecoder::*EntryPoint)(CommandBuffer&, MemoryStream&);
+        // Range of a subpass's command packets recorded into a secondary command buffer.
+        struct SecondarySubpass
+        {
+            const BeginRenderPassPacket* renderPass;
+            uint32_t subpassIndex;
+            size_t firstPacket;
+            size_t lastPacket;
+            std::vector<const CommandPacket*> state;
+            VkCommandBuffer handle;
+        };
+
+        // Native command pool and secondary command buffer reused across decodes.
+        struct SecondaryCommandBuffer
+        {
+            VkCommandPool pool;
+            VkCommandBuffer handle;
+        };
+
+        // Shared by the threads recording secondary command buffers so late starting tasks can safely exit.
+        // The decoding thread waits on the condition variable until every subpass has been recorded.
+        struct ParallelDecodeContext
+        {
+            std::vector<const CommandPacket*> packets;
+            std::vector<SecondarySubpass> subpasses;
+            VkCommandBufferUsageFlags usageFlags;
+            std::atomic<uint32_t> nextSubpass { 0U };
+            uint32_t completedSubpasses = 0;
+            std::atomic<int32_t> result { VK_SUCCESS };
+            std::mutex mutex;
+            std::condition_variable subpassCompleted;
+        };
+
+        void DecodeSerial(VkCommandBuffer commandBuffer, MemoryStream& stream);
+
+        bool DecodeSplit(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usageFlags, MemoryStream& stream, ThreadPool* pThreadPool, bool executesSecondaryCommandBuffers, VkResult* pResult);
+
+        VkResult GetSecondaryCommandBuffers(std::vector<SecondarySubpass>& subpasses);
+
+        void RecordSecondarySubpasses(ParallelDecodeContext& context);
+
+        void BeginRenderPass(VkCommandBuffer commandBuffer, const BeginRenderPassPacket* pPacket, VkSubpassContents contents);
+
+        void Execute(VkCommandBuffer commandBuffer, const CommandPacket* pPacket) { (this->*m_entryPoints[pPacket->id])(commandBuffer, pPacket); }
+
+        void CmdBeginRenderPass(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdNextSubpass(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdEndRenderPass(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindPipeline(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdPushConstants(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindBufferView(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindImageView(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindSampler(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindVertexBuffers(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindIndexBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetVertexInputFormat(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetViewportState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetInputAssemblyState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetRasterizationState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetMultisampleState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetDepthStencilState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetColorBlendState(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetViewport(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetScissor(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetLineWidth(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetDepthBias(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetBlendConstants(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetDepthBounds(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetStencilCompareMask(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetStencilWriteMask(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetStencilReference(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdDraw(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdDrawIndexed(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdDrawIndirect(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdDrawIndexedIndirect(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdDispatch(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdDispatchIndirect(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdCopyBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdCopyImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBlitImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdCopyBufferToImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdCopyImageToBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdUpdateBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdFillBuffer(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdClearColorImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdClearDepthStencilImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdClearAttachments(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdResolveImage(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdSetEvent(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdResetEvent(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdWaitEvents(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdBindDescriptorSet(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdPipelineBarrier(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+        void CmdExecuteCommands(VkCommandBuffer commandBuffer, const CommandPacket* pPacket);
+
+        typedef void(StreamDecoder::*EntryPoint)(VkCommandBuffer, const CommandPacket*);
         std::vector<EntryPoint> m_entryPoints;
-        Framebuffer* m_framebuffer = nullptr;
+
+        CommandPool* m_pool = nullptr;
+        std::vector<SecondaryCommandBuffer> m_secondaryCommandBuffers;
+        std::vector<std::shared_future<void>> m_pendingTasks;
+#ifdef VK_KHR_synchronization2
+        std::vector<VkBufferMemoryBarrier2KHR> m_bufferBarriers2;
+        std::vector<VkImageMemoryBarrier2KHR> m_imageBarriers2;
+#endif
     };
 }
\ No newline at end of file
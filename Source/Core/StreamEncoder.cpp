@@ -21,6 +21,8 @@
 //
 #include <cstring>
 #include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
 #include "Utility/VkHelpers.h"
 #include "Buffer.h"
 #include "BufferView.h"
@@ -29,103 +31,1064 @@
 #include "Framebuffer.h"
 #include "Pipeline.h"
 #include "DescriptorSetLayout.h"
+#include "DescriptorPool.h"
+#include "DescriptorSetCache.h"
 #include "RenderPassCache.h"
 #include "CommandBuffer.h"
 #include "CommandPool.h"
 #include "Device.h"
+#include "SyncPrimitivesPool.h"
 #include "StreamEncoder.h"
 
 namespace vez
 {
-    StreamEncoder::StreamEncoder(CommandBuffer* commandBuffer, uint64_t memoryStreamBlockSize)
+    // Smallest number of draws the merged indirect draw buffer is created with.
+    static const uint32_t s_minIndirectDrawCount = 256;
+
+    // Returns whether a recorded command has no effect and can be dropped.
+    static bool IsNoOpCommandPacket(const CommandPacket* pPacket)
+    {
+        switch (pPacket->id)
+        {
+        case DRAW:
+        {
+            auto packet = reinterpret_cast<const DrawPacket*>(pPacket);
+            return (packet->vertexCount == 0 || packet->instanceCount == 0);
+        }
+
+        case DRAW_INDEXED:
+        {
+            auto packet = reinterpret_cast<const DrawIndexedPacket*>(pPacket);
+            return (packet->indexCount == 0 || packet->instanceCount == 0);
+        }
+
+        case DRAW_INDIRECT:
+            return (reinterpret_cast<const DrawIndirectPacket*>(pPacket)->drawCount == 0);
+
+        case DRAW_INDEXED_INDIRECT:
+            return (reinterpret_cast<const DrawIndexedIndirectPacket*>(pPacket)->drawCount == 0);
+
+        case DISPATCH:
+        {
+            auto packet = reinterpret_cast<const DispatchPacket*>(pPacket);
+            return (packet->groupCountX == 0 || packet->groupCountY == 0 || packet->groupCountZ == 0);
+        }
+
+        case COPY_BUFFER:
+            return (reinterpret_cast<const CopyBufferPacket*>(pPacket)->regionCount == 0);
+
+        default:
+            return false;
+        }
+    }
+
+    // Returns whether any region's source subresources are also the destination of a region, in which case an image copied or blitted
+    // to itself must use the same layout for both.
+    template <typename Region>
+    static bool RegionSubresourcesOverlap(uint32_t regionCount, const Region* pRegions)
+    {
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            auto& src = pRegions[i].srcSubresource;
+            for (auto j = 0U; j < regionCount; ++j)
+            {
+                auto& dst = pRegions[j].dstSubresource;
+                if (src.mipLevel == dst.mipLevel && src.baseArrayLayer < dst.baseArrayLayer + dst.layerCount && dst.baseArrayLayer < src.baseArrayLayer + src.layerCount)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Returns whether the stencil test can modify the stencil aspect, which it cannot when every stencil operation keeps the stored value.
+    static bool WritesStencil(const VezDepthStencilState& depthStencilState)
+    {
+        if (!depthStencilState.stencilTestEnable)
+            return false;
+
+        for (auto& opState : { depthStencilState.front, depthStencilState.back })
+        {
+            if (opState.failOp != VK_STENCIL_OP_KEEP || opState.passOp != VK_STENCIL_OP_KEEP || opState.depthFailOp != VK_STENCIL_OP_KEEP)
+                return true;
+        }
+
+        return false;
+    }
+
+    StreamEncoder::StreamEncoder(CommandBuffer* commandBuffer, MemoryBlockPool* pStreamBlockPool)
         : m_commandBuffer(commandBuffer)
-        , m_stream(memoryStreamBlockSize)
+        , m_stream(pStreamBlockPool)
+        , m_timeline(pStreamBlockPool)
+        , m_optimizedTimeline(pStreamBlockPool)
+        , m_previousTimeline(pStreamBlockPool)
+    {
+
+    }
+
+    StreamEncoder::~StreamEncoder()
+    {
+        // Stop receiving destroyed resource handles.
+        SetMemoization(false);
+
+        // Free any transient resources.
+        Reset();
+
+        // The transient descriptor pools are kept across recordings.
+        for (auto& it : m_transientDescriptorPools)
+            delete it.second;
+
+        for (auto& it : m_previousTransientDescriptorPools)
+            delete it.second;
+
+        // The indirect buffer is kept across recordings.
+        if (m_indirectBuffer)
+            m_commandBuffer->GetPool()->GetDevice()->DestroyBuffer(m_indirectBuffer);
+    }
+
+    void StreamEncoder::Reset()
+    {
+        // Free any transient resources.
+        for (auto destroyCallback : m_transientResources)
+            destroyCallback();
+
+        m_transientResources.clear();
+
+        auto descriptorSetCache = m_commandBuffer->GetPool()->GetDevice()->GetDescriptorSetCache();
+        for (auto descriptorSet : m_descriptorSets)
+            descriptorSetCache->ReleaseDescriptorSet(descriptorSet);
+
+        m_descriptorSets.clear();
+
+        for (auto& it : m_transientDescriptorPools)
+            it.second->Reset();
+
+        m_unresolvedPipelinePackets.clear();
+
+        // Free anything still retained from the recording before.
+        ReleasePreviousRecording();
+        m_timelineUnchanged = false;
+
+        m_previousResourcesLock.Lock();
+        m_previousResources.clear();
+        m_previousResourceDestroyed = false;
+        m_previousResourcesLock.Unlock();
+
+        // Return the memory streams' blocks to the device's pool.
+        m_stream.Release();
+        m_timeline.Release();
+    }
+
+    void StreamEncoder::Begin()
+    {
+        if (m_memoize)
+        {
+            // Retain the previous recording's resources and timeline until End so they can be reused or compared against.
+            ReleasePreviousRecording();
+            m_previousTransientResources.swap(m_transientResources);
+            m_previousDescriptorSets.swap(m_descriptorSets);
+            m_previousTransientDescriptorPools.swap(m_transientDescriptorPools);
+            m_previousTimeline.Swap(m_timeline);
+            m_stream.Release();
+        }
+        else
+        {
+            // Free any transient resources and memory stream blocks from the previous recording.
+            Reset();
+        }
+
+        m_timelineUnchanged = false;
+        m_optimizationStatistics = {};
+        m_recordedResources.clear();
+
+        // Clear all internal state.
+        m_graphicsState.Reset();
+        m_resourceBindings.Reset();
+        m_pipelineBarriers.Clear();
+        m_descriptorSetBindings.clear();
+        m_pushDescriptors.clear();
+        m_renderPasses.clear();
+        m_pipelineBindings.clear();
+        m_boundDescriptorSetLayouts.clear();
+        m_unresolvedPipelinePackets.clear();
+        m_inRenderPass = false;
+        m_executesSecondaryCommandBuffers = false;
+        m_recordingResult = VK_SUCCESS;
+
+        // Secondary command buffers are recorded as if within a single subpass of a render pass that is only known once executed.
+        // Their graphics pipeline bindings are collected in a placeholder render pass without a framebuffer.
+        m_isSecondary = (m_commandBuffer->GetLevel() == VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        if (m_isSecondary)
+        {
+            RenderPassDesc renderPassDesc = {};
+            renderPassDesc.subpasses.push_back(SubpassDesc{});
+            m_renderPasses.push_back(renderPassDesc);
+            m_inRenderPass = true;
+        }
+    }
+
+    void StreamEncoder::End()
+    {
+        // Find the recorded commands that can be dropped before they are copied to the timeline.
+        OptimizeStream();
+
+        // A secondary command buffer's accesses are merged into the primary executing it, which inserts all required barriers.
+        if (m_isSecondary)
+        {
+            m_pipelineBarriers.GetBarriers().clear();
+
+            // Graphics pipeline bindings are inserted without a native handle until resolved against the primary's render pass.
+            for (auto& entry : m_renderPasses.back().subpasses.back().pipelineBindings)
+                m_pipelineBindings.push_back({ entry.streamPosition, VK_NULL_HANDLE, entry.pipeline->GetBindPoint(), entry.pipeline->GetPipelineLayout() });
+
+            std::stable_sort(m_pipelineBindings.begin(), m_pipelineBindings.end(), [](const PipelineBinding& a, const PipelineBinding& b) {
+                return a.streamPosition < b.streamPosition;
+            });
+
+            BuildTimeline();
+            OptimizeTimeline();
+            return;
+        }
+
+        // Images stay in the layouts the command buffer leaves them in, which become resident once it is submitted.
+        // Only presentable images are returned to their default layout so they can be presented after any submission.
+        auto& imageAccesses = m_pipelineBarriers.GetImageAccesses();
+        if (imageAccesses.size() > 0)
+        {
+            std::vector<std::pair<Image*, PipelineBarriers::ImageAccessInfo>> presentTransitions;
+            std::vector<PipelineBarriers::ImageAccessInfo> accessList;
+            for (auto& itr : imageAccesses)
+            {
+                auto image = itr.first;
+                if (image->GetDefaultImageLayout() != VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+                    continue;
+
+                itr.second.GetAccesses(accessList);
+                for (auto& entry : accessList)
+                {
+                    if (entry.layout != VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+                        presentTransitions.push_back(std::make_pair(image, entry));
+                }
+            }
+
+            for (auto& transition : presentTransitions)
+                m_pipelineBarriers.ImageAccess(m_stream.TellP(), transition.first, &transition.second.subresourceRange, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+        }
+
+        // Remove last pipeline barrier if srcStageMask and dstStageMask were never set.
+        auto& barriers = m_pipelineBarriers.GetBarriers();
+        if (!barriers.empty())
+        {
+            if (barriers.back().srcStageMask == 0 && barriers.back().dstStageMask == 0)
+                barriers.pop_back();
+        }
+
+        // Merge adjacent pipeline barriers with no commands depending on them in between.
+        std::vector<uint64_t> renderPassStreamPositions;
+        for (auto& renderPass : m_renderPasses)
+            renderPassStreamPositions.push_back(renderPass.streamPosition);
+
+        m_optimizationStatistics.mergedBarrierCount = m_pipelineBarriers.MergeBarriers(renderPassStreamPositions);
+
+        // Split the pipeline barriers with enough independent work before them.
+        if (m_splitBarriers)
+            SplitPipelineBarriers();
+
+        // Merge the recorded commands and all deferred bindings and barriers into the timeline stream.
+        BuildTimeline();
+        OptimizeTimeline();
+
+        // Compare against the previous recording's timeline, then free whatever this recording did not reuse from it.
+        // Split barriers wait on events acquired by this recording, so its timeline never matches the previous one.
+        if (m_memoize)
+        {
+            // Gather the handles of every buffer and image the recording accesses, in addition to the views and samplers its descriptors
+            // and render passes reference, so the recording is known to be stale once any of them is destroyed.
+            for (auto& itr : m_pipelineBarriers.GetBufferAccesses())
+                m_recordedResources.push_back(reinterpret_cast<uint64_t>(itr.first->GetHandle()));
+
+            for (auto& itr : m_pipelineBarriers.GetImageAccesses())
+                m_recordedResources.push_back(reinterpret_cast<uint64_t>(itr.first->GetHandle()));
+
+            std::sort(m_recordedResources.begin(), m_recordedResources.end());
+            m_recordedResources.erase(std::unique(m_recordedResources.begin(), m_recordedResources.end()), m_recordedResources.end());
+
+            // The previous recording's handles may belong to new objects if any of them was destroyed since.
+            m_previousResourcesLock.Lock();
+            auto previousResourceDestroyed = m_previousResourceDestroyed;
+            m_previousResources.swap(m_recordedResources);
+            m_previousResourceDestroyed = false;
+            m_previousResourcesLock.Unlock();
+
+            m_timelineUnchanged = (!previousResourceDestroyed && m_optimizationStatistics.splitBarrierCount == 0 && CompareTimelines());
+            ReleasePreviousRecording();
+        }
+    }
+
+    void StreamEncoder::SetMemoization(bool enabled)
+    {
+        if (enabled == m_memoize)
+            return;
+
+        auto device = m_commandBuffer->GetPool()->GetDevice();
+        if (enabled)
+            device->AddMemoizingStreamEncoder(this);
+        else
+            device->RemoveMemoizingStreamEncoder(this);
+
+        m_memoize = enabled;
+    }
+
+    void StreamEncoder::InvalidateResource(uint64_t handle)
+    {
+        m_previousResourcesLock.Lock();
+        if (std::binary_search(m_previousResources.begin(), m_previousResources.end(), handle))
+            m_previousResourceDestroyed = true;
+
+        m_previousResourcesLock.Unlock();
+    }
+
+    void StreamEncoder::ResolveResidentState(Queue* pQueue, ResidentStateUpdates& updates, PipelineBarrier& barrier, std::unordered_map<Queue*, PipelineBarrier>& releaseBarriers)
+    {
+        // Secondary command buffers' accesses are resolved as part of the primary command buffers executing them.
+        if (m_isSecondary)
+            return;
+
+        for (auto& itr : m_pipelineBarriers.GetImageAccesses())
+            itr.first->ResolveResidentState(itr.second, pQueue, updates, barrier, releaseBarriers);
+
+        for (auto& itr : m_pipelineBarriers.GetBufferAccesses())
+            itr.first->ResolveOwnership(itr.second, pQueue, updates, barrier, releaseBarriers);
+    }
+
+    void StreamEncoder::ReleasePreviousRecording()
+    {
+        for (auto destroyCallback : m_previousTransientResources)
+            destroyCallback();
+
+        m_previousTransientResources.clear();
+
+        auto descriptorSetCache = m_commandBuffer->GetPool()->GetDevice()->GetDescriptorSetCache();
+        for (auto descriptorSet : m_previousDescriptorSets)
+            descriptorSetCache->ReleaseDescriptorSet(descriptorSet);
+
+        m_previousDescriptorSets.clear();
+
+        for (auto& it : m_previousTransientDescriptorPools)
+            it.second->Reset();
+
+        m_previousTimeline.Release();
+    }
+
+    bool StreamEncoder::CompareTimelines()
+    {
+        // Compare both timelines packet by packet since each stream may be split into blocks at different positions.
+        m_timeline.SeekG(0);
+        m_previousTimeline.SeekG(0);
+        while (true)
+        {
+            auto packet = m_timeline.ReadPtr<const CommandPacket>();
+            auto previousPacket = m_previousTimeline.ReadPtr<const CommandPacket>();
+            if (!packet || !previousPacket)
+                return !packet && !previousPacket;
+
+            if (packet->size != previousPacket->size)
+                return false;
+
+            auto dataSize = packet->size - sizeof(CommandPacket);
+            m_timeline.ReadPtr<const uint8_t>(dataSize);
+            m_previousTimeline.ReadPtr<const uint8_t>(dataSize);
+            if (memcmp(packet, previousPacket, packet->size) != 0)
+                return false;
+        }
+    }
+
+    void StreamEncoder::OptimizeStream()
+    {
+        // Recorded packets are identified by their index within the stream.
+        m_removedPackets.clear();
+        m_indexedDrawCount = 0;
+
+        // Track the last kept packet of each command along with the state packets no draw has used yet.
+        std::vector<const CommandPacket*> lastPackets(COMMAND_ID_COUNT, nullptr);
+        std::unordered_map<uint64_t, size_t> unusedState;
+
+        m_stream.SeekG(0);
+        while (true)
+        {
+            auto packet = m_stream.ReadPtr<const CommandPacket>();
+            if (!packet)
+                break;
+
+            m_stream.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
+            auto index = m_removedPackets.size();
+            m_removedPackets.push_back(false);
+
+            // Drop commands that have no effect.
+            if (IsNoOpCommandPacket(packet))
+            {
+                m_removedPackets[index] = true;
+                ++m_optimizationStatistics.noOpCommandCount;
+                continue;
+            }
+
+            if (packet->id == DRAW_INDEXED)
+                ++m_indexedDrawCount;
+
+            switch (packet->id)
+            {
+            case BIND_VERTEX_BUFFERS:
+            case BIND_INDEX_BUFFER:
+            case SET_VIEWPORT:
+            case SET_SCISSOR:
+            case SET_LINE_WIDTH:
+            case SET_DEPTH_BIAS:
+            case SET_BLEND_CONSTANTS:
+            case SET_DEPTH_BOUNDS:
+            case SET_STENCIL_COMPARE_MASK:
+            case SET_STENCIL_WRITE_MASK:
+            case SET_STENCIL_REFERENCE:
+            {
+                // Drop state identical to the last state set by the same command.
+                auto lastPacket = lastPackets[packet->id];
+                if (lastPacket && lastPacket->size == packet->size && memcmp(lastPacket, packet, packet->size) == 0)
+                {
+                    m_removedPackets[index] = true;
+                    ++m_optimizationStatistics.redundantStateCount;
+                    break;
+                }
+
+                // Drop earlier state overwritten before any draw used it.
+                uint64_t key;
+                GetCommandPacketStateKey(packet, &key);
+                auto it = unusedState.find(key);
+                if (it != unusedState.end())
+                {
+                    m_removedPackets[it->second] = true;
+                    ++m_optimizationStatistics.unusedStateCount;
+                    it->second = index;
+                }
+                else
+                {
+                    unusedState.emplace(key, index);
+                }
+
+                lastPackets[packet->id] = packet;
+                break;
+            }
+
+            case DRAW:
+            case DRAW_INDEXED:
+            case DRAW_INDIRECT:
+            case DRAW_INDEXED_INDIRECT:
+                unusedState.clear();
+                break;
+
+            case EXECUTE_COMMANDS:
+                // Bound state is undefined after executing secondary command buffers.
+                unusedState.clear();
+                std::fill(lastPackets.begin(), lastPackets.end(), nullptr);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        // State never used by a draw does not outlive the command buffer.
+        for (auto& entry : unusedState)
+            m_removedPackets[entry.second] = true;
+
+        m_optimizationStatistics.unusedStateCount += static_cast<uint32_t>(unusedState.size());
+    }
+
+    void StreamEncoder::SplitPipelineBarriers()
     {
+        // Collect the stream positions of the kept commands performing work and the stream position ranges of the render passes.
+        // Commands from DRAW through RESOLVE_IMAGE in CommandID all perform work.
+        std::vector<uint64_t> workStreamPositions;
+        std::vector<std::pair<uint64_t, uint64_t>> renderPassRanges;
+        size_t packetIndex = 0;
+        m_stream.SeekG(0);
+        while (true)
+        {
+            auto streamPosition = m_stream.TellG();
+            auto packet = m_stream.ReadPtr<const CommandPacket>();
+            if (!packet)
+                break;
+
+            m_stream.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
+            if (m_removedPackets[packetIndex++])
+                continue;
+
+            if ((packet->id >= DRAW && packet->id <= RESOLVE_IMAGE) || packet->id == EXECUTE_COMMANDS)
+                workStreamPositions.push_back(streamPosition);
+            else if (packet->id == END_RENDER_PASS && renderPassRanges.size() < m_renderPasses.size())
+                renderPassRanges.push_back(std::make_pair(m_renderPasses[renderPassRanges.size()].streamPosition, streamPosition));
+        }
 
+        // The events are returned to the device's pool when the recording is reset.
+        std::vector<VkEvent> events;
+        auto syncPrimitivesPool = m_commandBuffer->GetPool()->GetDevice()->GetSyncPrimitivesPool();
+        m_optimizationStatistics.splitBarrierCount = m_pipelineBarriers.SplitBarriers(workStreamPositions, renderPassRanges, syncPrimitivesPool, events);
+        if (!events.empty())
+        {
+            m_transientResources.push_back([syncPrimitivesPool, events]() -> void {
+                syncPrimitivesPool->ReleaseEvents(static_cast<uint32_t>(events.size()), events.data());
+            });
+        }
     }
 
-    StreamEncoder::~StreamEncoder()
-    {
-        // Free any transient resources.
-        for (auto destroyCallback : m_transientResources)
-            destroyCallback();
-    }
+    void StreamEncoder::BuildTimeline()
+    {
+        // Get the lists of pipeline barriers, render passes, pipeline bindings and descriptor set bindings to be inserted at specific stream positions.
+        // Each list is ordered by stream position.
+        const auto& barriers = m_pipelineBarriers.GetBarriers();
+        auto nextPipelineBarrier = barriers.cbegin();
+        auto nextRenderPass = m_isSecondary ? m_renderPasses.cend() : m_renderPasses.cbegin();
+        auto nextPipelineBinding = m_pipelineBindings.cbegin();
+        auto nextDescriptorSetBinding = m_descriptorSetBindings.cbegin();
+
+        // Split barriers set their events in order of their signal stream positions.
+        std::vector<const PipelineBarrier*> splitBarriers;
+        for (auto& barrier : barriers)
+        {
+            if (barrier.event != VK_NULL_HANDLE)
+                splitBarriers.push_back(&barrier);
+        }
+
+        std::stable_sort(splitBarriers.begin(), splitBarriers.end(), [](const PipelineBarrier* a, const PipelineBarrier* b) {
+            return a->signalStreamPosition < b->signalStreamPosition;
+        });
+
+        auto nextSplitBarrier = splitBarriers.cbegin();
+
+        // Returns whether any events must be inserted at or before the given stream position.
+        auto hasPendingEvents = [&](uint64_t streamPosition) {
+            return (nextSplitBarrier != splitBarriers.cend() && (*nextSplitBarrier)->signalStreamPosition <= streamPosition)
+                || (nextPipelineBarrier != barriers.cend() && nextPipelineBarrier->streamPosition <= streamPosition)
+                || (nextRenderPass != m_renderPasses.cend() && nextRenderPass->streamPosition <= streamPosition)
+                || (nextPipelineBinding != m_pipelineBindings.cend() && nextPipelineBinding->streamPosition <= streamPosition)
+                || (nextDescriptorSetBinding != m_descriptorSetBindings.cend() && nextDescriptorSetBinding->streamPosition <= streamPosition);
+        };
+
+        // Merged copies hold no more regions than fit in a single block of the timeline along with their packet.
+        auto maxCopyRegionCount = (m_timeline.GetBlockSize() - GetCommandPacketSize(sizeof(CopyBufferPacket))) / sizeof(VkBufferCopy);
+
+        // Seek to the beginning of the recorded stream for reading.
+        m_stream.SeekG(0);
+        size_t packetIndex = 0;
+
+        // Copy each recorded command packet to the timeline, preceded by any events occurring at or before its stream position.
+        while (true)
+        {
+            // Once the end of the recorded stream is reached, all remaining events are appended.
+            auto streamPosition = m_stream.TellG();
+            auto packet = m_stream.ReadPtr<const CommandPacket>();
+            if (!packet)
+                streamPosition = ~0ULL;
+
+            // Insert the event sets of split barriers.
+            for (; nextSplitBarrier != splitBarriers.cend() && (*nextSplitBarrier)->signalStreamPosition <= streamPosition; ++nextSplitBarrier)
+            {
+                auto setPacket = WriteCommandPacket<SetEventPacket>(m_timeline, SET_EVENT);
+                setPacket->event = (*nextSplitBarrier)->event;
+                setPacket->stageMask = GetLegacyStageMask((*nextSplitBarrier)->srcStageMask);
+            }
+
+            // Insert pipeline barriers.
+            for (; nextPipelineBarrier != barriers.cend() && nextPipelineBarrier->streamPosition <= streamPosition; ++nextPipelineBarrier)
+            {
+                auto bufferBarrierCount = static_cast<uint32_t>(nextPipelineBarrier->bufferBarriers.size());
+                auto imageBarrierCount = static_cast<uint32_t>(nextPipelineBarrier->imageBarriers.size());
+
+                // Split barriers wait on their event instead, then reset it once the waiting stages complete so the recording can be resubmitted.
+                if (nextPipelineBarrier->event != VK_NULL_HANDLE)
+                {
+                    auto waitPacket = WriteCommandPacket<WaitEventsPacket>(m_timeline, WAIT_EVENTS, sizeof(VkBufferMemoryBarrier) * bufferBarrierCount + sizeof(VkImageMemoryBarrier) * imageBarrierCount);
+                    waitPacket->event = nextPipelineBarrier->event;
+                    waitPacket->srcStageMask = GetLegacyStageMask(nextPipelineBarrier->srcStageMask);
+                    waitPacket->dstStageMask = GetLegacyStageMask(nextPipelineBarrier->dstStageMask);
+                    waitPacket->bufferBarrierCount = bufferBarrierCount;
+                    waitPacket->imageBarrierCount = imageBarrierCount;
+                    memcpy(GetCommandPacketData<VkBufferMemoryBarrier>(waitPacket), nextPipelineBarrier->bufferBarriers.data(), sizeof(VkBufferMemoryBarrier) * bufferBarrierCount);
+                    memcpy(GetCommandPacketData<VkImageMemoryBarrier>(waitPacket, sizeof(VkBufferMemoryBarrier) * bufferBarrierCount), nextPipelineBarrier->imageBarriers.data(), sizeof(VkImageMemoryBarrier) * imageBarrierCount);
+
+                    auto resetPacket = WriteCommandPacket<ResetEventPacket>(m_timeline, RESET_EVENT);
+                    resetPacket->event = nextPipelineBarrier->event;
+                    resetPacket->stageMask = GetLegacyStageMask(nextPipelineBarrier->dstStageMask);
+                    continue;
+                }
+
+                // The memory barriers' own stage masks follow them for devices with VK_KHR_synchronization2 enabled.
+                auto barriersSize = sizeof(VkBufferMemoryBarrier) * bufferBarrierCount + sizeof(VkImageMemoryBarrier) * imageBarrierCount;
+                auto barrierPacket = WriteCommandPacket<PipelineBarrierPacket>(m_timeline, PIPELINE_BARRIER, barriersSize + sizeof(MemoryBarrierStages) * (bufferBarrierCount + imageBarrierCount));
+                barrierPacket->srcStageMask = GetLegacyStageMask(nextPipelineBarrier->srcStageMask);
+                barrierPacket->dstStageMask = GetLegacyStageMask(nextPipelineBarrier->dstStageMask);
+                barrierPacket->bufferBarrierCount = bufferBarrierCount;
+                barrierPacket->imageBarrierCount = imageBarrierCount;
+                memcpy(GetCommandPacketData<VkBufferMemoryBarrier>(barrierPacket), nextPipelineBarrier->bufferBarriers.data(), sizeof(VkBufferMemoryBarrier) * bufferBarrierCount);
+                memcpy(GetCommandPacketData<VkImageMemoryBarrier>(barrierPacket, sizeof(VkBufferMemoryBarrier) * bufferBarrierCount), nextPipelineBarrier->imageBarriers.data(), sizeof(VkImageMemoryBarrier) * imageBarrierCount);
+                memcpy(GetCommandPacketData<MemoryBarrierStages>(barrierPacket, barriersSize), nextPipelineBarrier->bufferBarrierStages.data(), sizeof(MemoryBarrierStages) * bufferBarrierCount);
+                memcpy(GetCommandPacketData<MemoryBarrierStages>(barrierPacket, barriersSize + sizeof(MemoryBarrierStages) * bufferBarrierCount), nextPipelineBarrier->imageBarrierStages.data(), sizeof(MemoryBarrierStages) * imageBarrierCount);
+            }
+
+            // Insert render pass begins.
+            for (; nextRenderPass != m_renderPasses.cend() && nextRenderPass->streamPosition <= streamPosition; ++nextRenderPass)
+            {
+                auto clearValueCount = static_cast<uint32_t>(nextRenderPass->clearValues.size());
+                auto beginPacket = WriteCommandPacket<BeginRenderPassPacket>(m_timeline, BEGIN_RENDER_PASS, sizeof(VkClearValue) * clearValueCount);
+                beginPacket->renderPass = nextRenderPass->renderPass->GetHandle();
+                beginPacket->framebuffer = nextRenderPass->framebuffer->GetHandle(nextRenderPass->renderPass);
+                beginPacket->renderArea.offset.x = 0;
+                beginPacket->renderArea.offset.y = 0;
+                beginPacket->renderArea.extent = nextRenderPass->framebuffer->GetExtents();
+                beginPacket->clearValueCount = clearValueCount;
+                beginPacket->contents = nextRenderPass->subpasses.front().contents;
+                memcpy(GetCommandPacketData<VkClearValue>(beginPacket), nextRenderPass->clearValues.data(), sizeof(VkClearValue) * clearValueCount);
+            }
+
+            // Insert pipeline bindings.
+            for (; nextPipelineBinding != m_pipelineBindings.cend() && nextPipelineBinding->streamPosition <= streamPosition; ++nextPipelineBinding)
+            {
+                auto bindPacket = WriteCommandPacket<BindPipelinePacket>(m_timeline, BIND_PIPELINE);
+                bindPacket->bindPoint = nextPipelineBinding->bindPoint;
+                bindPacket->pipeline = nextPipelineBinding->pipeline;
+                if (bindPacket->pipeline == VK_NULL_HANDLE)
+                    m_unresolvedPipelinePackets.push_back(bindPacket);
+            }
+
+            // Insert descriptor set bindings.
+            for (; nextDescriptorSetBinding != m_descriptorSetBindings.cend() && nextDescriptorSetBinding->streamPosition <= streamPosition; ++nextDescriptorSetBinding)
+            {
+                auto pushDescriptorCount = nextDescriptorSetBinding->pushDescriptorCount;
+                auto bindPacket = WriteCommandPacket<BindDescriptorSetPacket>(m_timeline, BIND_DESCRIPTOR_SET, sizeof(PushDescriptor) * pushDescriptorCount);
+                bindPacket->bindPoint = nextDescriptorSetBinding->bindPoint;
+                bindPacket->pipelineLayout = nextDescriptorSetBinding->pipelineLayout;
+                bindPacket->setIndex = nextDescriptorSetBinding->setIndex;
+                bindPacket->descriptorSet = nextDescriptorSetBinding->descriptorSet;
+                bindPacket->pushDescriptorCount = pushDescriptorCount;
+                memcpy(GetCommandPacketData<PushDescriptor>(bindPacket), m_pushDescriptors.data() + nextDescriptorSetBinding->firstPushDescriptor, sizeof(PushDescriptor) * pushDescriptorCount);
+            }
+
+            if (!packet)
+                break;
+
+            // Skip the packet if the optimization pass removed it, otherwise copy it since it is always contiguous with its header.
+            m_stream.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
+            if (m_removedPackets[packetIndex++])
+                continue;
+
+            if (packet->id != COPY_BUFFER)
+            {
+                memcpy(m_timeline.WritePtr<uint8_t>(packet->size), packet, packet->size);
+                continue;
+            }
+
+            // Merge the regions of consecutive copies between the same two buffers when nothing is inserted between them.
+            auto copyPacket = reinterpret_cast<const CopyBufferPacket*>(packet);
+            auto pRegions = GetCommandPacketData<VkBufferCopy>(copyPacket);
+            m_copyRegions.assign(pRegions, pRegions + copyPacket->regionCount);
+            while (copyPacket->srcBuffer != copyPacket->dstBuffer)
+            {
+                auto nextStreamPosition = m_stream.TellG();
+                if (hasPendingEvents(nextStreamPosition))
+                    break;
+
+                auto nextPacket = reinterpret_cast<const CopyBufferPacket*>(m_stream.ReadPtr<const CommandPacket>());
+                if (!nextPacket || nextPacket->header.id != COPY_BUFFER || (!m_removedPackets[packetIndex] &&
+                    (nextPacket->srcBuffer != copyPacket->srcBuffer || nextPacket->dstBuffer != copyPacket->dstBuffer || m_copyRegions.size() + nextPacket->regionCount > maxCopyRegionCount)))
+                {
+                    m_stream.SeekG(nextStreamPosition);
+                    break;
+                }
+
+                m_stream.ReadPtr<const uint8_t>(nextPacket->header.size - sizeof(CommandPacket));
+                if (m_removedPackets[packetIndex++])
+                    continue;
+
+                pRegions = GetCommandPacketData<VkBufferCopy>(nextPacket);
+                m_copyRegions.insert(m_copyRegions.end(), pRegions, pRegions + nextPacket->regionCount);
+                ++m_optimizationStatistics.coalescedCopyCount;
+            }
+
+            // Merge regions continuing the previous region in both buffers.
+            size_t regionCount = 0;
+            for (size_t i = 0; i < m_copyRegions.size(); ++i)
+            {
+                auto& region = m_copyRegions[i];
+                if (regionCount > 0)
+                {
+                    auto& previousRegion = m_copyRegions[regionCount - 1];
+                    if (previousRegion.srcOffset + previousRegion.size == region.srcOffset && previousRegion.dstOffset + previousRegion.size == region.dstOffset)
+                    {
+                        previousRegion.size += region.size;
+                        ++m_optimizationStatistics.coalescedCopyRegionCount;
+                        continue;
+                    }
+                }
+
+                m_copyRegions[regionCount++] = region;
+            }
+
+            auto mergedPacket = WriteCommandPacket<CopyBufferPacket>(m_timeline, COPY_BUFFER, sizeof(VkBufferCopy) * regionCount);
+            mergedPacket->srcBuffer = copyPacket->srcBuffer;
+            mergedPacket->dstBuffer = copyPacket->dstBuffer;
+            mergedPacket->regionCount = static_cast<uint32_t>(regionCount);
+            memcpy(GetCommandPacketData<VkBufferCopy>(mergedPacket), m_copyRegions.data(), sizeof(VkBufferCopy) * regionCount);
+        }
+
+        // The recorded stream's blocks are no longer needed.
+        m_stream.Release();
+    }
+
+    void StreamEncoder::OptimizeTimeline()
+    {
+        // Indexed draw arguments are written straight into the indirect buffer when draw merging is possible.
+        auto device = m_commandBuffer->GetPool()->GetDevice();
+        VkDrawIndexedIndirectCommand* pIndirectDraws = nullptr;
+        if (m_mergeDraws && m_indexedDrawCount > 1 && device->GetEnabledFeatures().multiDrawIndirect)
+            pIndirectDraws = MapIndirectBuffer(m_indexedDrawCount);
+
+        // Draws with a non-zero first instance may only be merged when the device supports it, and merged draws never exceed the
+        // device's indirect draw count limit.
+        auto drawIndirectFirstInstance = device->GetEnabledFeatures().drawIndirectFirstInstance;
+        auto maxDrawIndirectCount = device->GetLimits().maxDrawIndirectCount;
+
+        // Only rewrite the timeline if draws may be merged or reordered.
+        auto sortDraws = std::any_of(m_renderPasses.cbegin(), m_renderPasses.cend(), [](const RenderPassDesc& renderPassDesc) {
+            return renderPassDesc.orderIndependentDraws;
+        });
+
+        if (!pIndirectDraws && !sortDraws)
+            return;
+
+        // Latest packet setting a piece of state, ordered by when it was recorded.
+        struct TrackedState
+        {
+            uint64_t order;
+            uint64_t key;
+            const CommandPacket* packet;
+        };
+
+        // Full state a reordered draw was recorded with, along with the bound objects it is sorted by.
+        struct StateSnapshot
+        {
+            std::vector<TrackedState> packets;
+            std::vector<std::pair<uint64_t, uint64_t>> sortKey;
+        };
+
+        // Draw within an order-independent subpass waiting to be reordered.
+        struct SortedDraw
+        {
+            size_t snapshotIndex;
+            size_t drawIndex;
+            const CommandPacket* packet;
+        };
+
+        // Packets written to the new timeline are pointed to again by any unresolved pipeline bindings.
+        m_unresolvedPipelinePackets.clear();
+
+        // Consecutive indexed draws are accumulated into the indirect buffer until any other packet is written.
+        const CommandPacket* firstIndexedDraw = nullptr;
+        uint32_t firstDraw = 0;
+        uint32_t indirectDrawCount = 0;
+        auto endIndexedDraws = [&]() {
+            if (!firstIndexedDraw)
+                return;
+
+            // A single draw is copied as is.
+            auto drawCount = indirectDrawCount - firstDraw;
+            if (drawCount == 1)
+            {
+                --indirectDrawCount;
+                memcpy(m_optimizedTimeline.WritePtr<uint8_t>(firstIndexedDraw->size), firstIndexedDraw, firstIndexedDraw->size);
+            }
+            else
+            {
+                auto indirectPacket = WriteCommandPacket<DrawIndexedIndirectPacket>(m_optimizedTimeline, DRAW_INDEXED_INDIRECT);
+                indirectPacket->buffer = m_indirectBuffer->GetHandle();
+                indirectPacket->offset = sizeof(VkDrawIndexedIndirectCommand) * firstDraw;
+                indirectPacket->drawCount = drawCount;
+                indirectPacket->stride = sizeof(VkDrawIndexedIndirectCommand);
+                m_optimizationStatistics.mergedDrawCount += drawCount - 1;
+            }
+
+            firstIndexedDraw = nullptr;
+        };
+
+        auto write = [&](const CommandPacket* packet) {
+            if (packet->id == DRAW_INDEXED && pIndirectDraws && (drawIndirectFirstInstance || reinterpret_cast<const DrawIndexedPacket*>(packet)->firstInstance == 0))
+            {
+                if (firstIndexedDraw && indirectDrawCount - firstDraw == maxDrawIndirectCount)
+                    endIndexedDraws();
+
+                if (!firstIndexedDraw)
+                {
+                    firstIndexedDraw = packet;
+                    firstDraw = indirectDrawCount;
+                }
+
+                auto drawPacket = reinterpret_cast<const DrawIndexedPacket*>(packet);
+                auto& drawCommand = pIndirectDraws[indirectDrawCount++];
+                drawCommand.indexCount = drawPacket->indexCount;
+                drawCommand.instanceCount = drawPacket->instanceCount;
+                drawCommand.firstIndex = drawPacket->firstIndex;
+                drawCommand.vertexOffset = drawPacket->vertexOffset;
+                drawCommand.firstInstance = drawPacket->firstInstance;
+                return;
+            }
+
+            endIndexedDraws();
+            auto copy = m_optimizedTimeline.WritePtr<uint8_t>(packet->size);
+            memcpy(copy, packet, packet->size);
+            if (packet->id == BIND_PIPELINE && reinterpret_cast<const BindPipelinePacket*>(packet)->pipeline == VK_NULL_HANDLE)
+                m_unresolvedPipelinePackets.push_back(reinterpret_cast<BindPipelinePacket*>(copy));
+        };
+
+        // Current state, and the state last written to the new timeline within an order-independent subpass.
+        std::unordered_map<uint64_t, TrackedState> state;
+        std::unordered_map<uint64_t, const CommandPacket*> writtenState;
+        uint64_t stateOrder = 0;
+        bool stateChanged = true;
+
+        auto takeSnapshot = [&]() {
+            StateSnapshot snapshot;
+            for (auto& entry : state)
+            {
+                auto packet = entry.second.packet;
+                snapshot.packets.push_back(entry.second);
+
+                // Draws are grouped by pipeline first, then by descriptor sets, vertex buffers and index buffer.
+                switch (packet->id)
+                {
+                case BIND_PIPELINE:
+                    snapshot.sortKey.emplace_back(0ULL, reinterpret_cast<uint64_t>(reinterpret_cast<const BindPipelinePacket*>(packet)->pipeline));
+                    break;
+
+                case BIND_DESCRIPTOR_SET:
+                {
+                    auto bindPacket = reinterpret_cast<const BindDescriptorSetPacket*>(packet);
+                    snapshot.sortKey.emplace_back(1ULL + bindPacket->setIndex, reinterpret_cast<uint64_t>(bindPacket->descriptorSet));
+                    break;
+                }
+
+                case BIND_VERTEX_BUFFERS:
+                {
+                    auto bindPacket = reinterpret_cast<const BindVertexBuffersPacket*>(packet);
+                    snapshot.sortKey.emplace_back((1ULL << 32) | bindPacket->firstBinding, reinterpret_cast<uint64_t>(*GetCommandPacketData<VkBuffer>(bindPacket)));
+                    break;
+                }
+
+                case BIND_INDEX_BUFFER:
+                    snapshot.sortKey.emplace_back(2ULL << 32, reinterpret_cast<uint64_t>(reinterpret_cast<const BindIndexBufferPacket*>(packet)->buffer));
+                    break;
+
+                default:
+                    break;
+                }
+            }
+
+            std::sort(snapshot.packets.begin(), snapshot.packets.end(), [](const TrackedState& a, const TrackedState& b) {
+                return a.order < b.order;
+            });
+
+            std::sort(snapshot.sortKey.begin(), snapshot.sortKey.end());
+            return snapshot;
+        };
+
+        // Writes the state packets that differ from the last written state, in the order they were recorded.
+        // Packets of the same command may overlap, so all of them are rewritten if any differ, and changing the pipeline or a
+        // descriptor set rebinds all descriptor sets and push constants since pipeline layouts may differ.
+        auto writeState = [&](const std::vector<TrackedState>& packets) {
+            bool changed[COMMAND_ID_COUNT] = {};
+            for (auto& entry : packets)
+            {
+                auto itr = writtenState.find(entry.key);
+                if (itr == writtenState.end() || itr->second->size != entry.packet->size || memcmp(itr->second, entry.packet, entry.packet->size) != 0)
+                    changed[entry.packet->id] = true;
+            }
+
+            if (changed[BIND_PIPELINE] || changed[BIND_DESCRIPTOR_SET])
+            {
+                changed[BIND_DESCRIPTOR_SET] = true;
+                changed[PUSH_CONSTANTS] = true;
+            }
+
+            for (auto& entry : packets)
+            {
+                if (changed[entry.packet->id])
+                {
+                    write(entry.packet);
+                    writtenState[entry.key] = entry.packet;
+                }
+            }
+        };
+
+        // Draws of an order-independent subpass are collected until the next command that is neither a draw nor a state change.
+        std::vector<StateSnapshot> snapshots;
+        std::vector<SortedDraw> draws;
+        bool sortSubpass = false;
+        auto flushDraws = [&]() {
+            if (!sortSubpass)
+                return;
+
+            // Sort by the bound objects, keeping the recorded order of draws sharing them.
+            std::stable_sort(draws.begin(), draws.end(), [&](const SortedDraw& a, const SortedDraw& b) {
+                return snapshots[a.snapshotIndex].sortKey < snapshots[b.snapshotIndex].sortKey;
+            });
+
+            for (auto i = 0U; i < draws.size(); ++i)
+            {
+                writeState(snapshots[draws[i].snapshotIndex].packets);
+                write(draws[i].packet);
+                if (draws[i].drawIndex != i)
+                    ++m_optimizationStatistics.sortedDrawCount;
+            }
+
+            // Leave the state as recorded after the last draw for the commands following it.
+            writeState(takeSnapshot().packets);
+            snapshots.clear();
+            draws.clear();
+            stateChanged = true;
+        };
+
+        // Walk the timeline, keeping track of which render pass each render pass begin refers to.
+        auto nextRenderPass = m_renderPasses.cbegin();
+        m_timeline.SeekG(0);
+        while (true)
+        {
+            auto packet = m_timeline.ReadPtr<const CommandPacket>();
+            if (!packet)
+                break;
+
+            m_timeline.ReadPtr<const uint8_t>(packet->size - sizeof(CommandPacket));
+
+            // Track the latest packet setting each piece of state, deferring it within order-independent subpasses
+            // until a draw depending on it is written.
+            uint64_t key;
+            if (GetCommandPacketStateKey(packet, &key))
+            {
+                state[key] = { stateOrder++, key, packet };
+                stateChanged = true;
+                if (!sortSubpass)
+                    write(packet);
+
+                continue;
+            }
+
+            switch (packet->id)
+            {
+            case DRAW:
+            case DRAW_INDEXED:
+            case DRAW_INDIRECT:
+            case DRAW_INDEXED_INDIRECT:
+                if (sortSubpass)
+                {
+                    if (stateChanged)
+                    {
+                        snapshots.push_back(takeSnapshot());
+                        stateChanged = false;
+                    }
+
+                    draws.push_back({ snapshots.size() - 1, draws.size(), packet });
+                    continue;
+                }
+                break;
+
+            default:
+                // Any other command keeps its position relative to the draws around it.
+                flushDraws();
+                break;
+            }
+
+            write(packet);
+
+            // Draws are only reordered within inline subpasses of render passes begun with orderIndependentDraws.
+            if (packet->id == BEGIN_RENDER_PASS)
+            {
+                sortSubpass = (nextRenderPass++)->orderIndependentDraws && reinterpret_cast<const BeginRenderPassPacket*>(packet)->contents == VK_SUBPASS_CONTENTS_INLINE;
+            }
+            else if (packet->id == NEXT_SUBPASS)
+            {
+                sortSubpass = (nextRenderPass - 1)->orderIndependentDraws && reinterpret_cast<const NextSubpassPacket*>(packet)->contents == VK_SUBPASS_CONTENTS_INLINE;
+            }
+            else if (packet->id == END_RENDER_PASS)
+            {
+                sortSubpass = false;
+                continue;
+            }
+            else
+            {
+                continue;
+            }
+
+            // Everything recorded before the subpass has already been written.
+            writtenState.clear();
+            for (auto& entry : state)
+                writtenState[entry.first] = entry.second.packet;
+        }
 
-    void StreamEncoder::Begin()
-    {
-        // Free any transient resources.
-        for (auto destroyCallback : m_transientResources)
-            destroyCallback();
+        endIndexedDraws();
 
-        // Reset the read and write positions in the memory stream.
-        m_stream.SeekP(0);
-        m_stream.SeekG(0);
+        if (pIndirectDraws)
+        {
+            device->FlushBuffer(m_indirectBuffer);
+            device->UnmapBuffer(m_indirectBuffer);
+        }
 
-        // Clear all internal state.
-        m_graphicsState.Reset();
-        m_resourceBindings.Reset();
-        m_pipelineBarriers.Clear();
-        m_descriptorSetBindings.clear();
-        m_renderPasses.clear();
-        m_pipelineBindings.clear();
-        m_transientResources.clear();
-        m_boundDescriptorSetLayouts.clear();
-        m_inRenderPass = false;
+        // Replace the timeline with the optimized one.
+        m_timeline.Swap(m_optimizedTimeline);
+        m_optimizedTimeline.Release();
     }
 
-    void StreamEncoder::End()
+    VkDrawIndexedIndirectCommand* StreamEncoder::MapIndirectBuffer(uint32_t drawCount)
     {
-        // Get the collection of all image acceses in the PipelineBarriers object, which explicitly defines each image's last layout.
-        auto& imageAccesses = m_pipelineBarriers.GetImageAccesses();
-        if (imageAccesses.size() > 0)
+        // The indirect buffer is kept across recordings and only grows when it cannot hold every indexed draw of the recording.
+        // It starts with room for a reasonable number of draws and doubles, so it is rarely recreated.
+        auto device = m_commandBuffer->GetPool()->GetDevice();
+        auto size = sizeof(VkDrawIndexedIndirectCommand) * std::max(drawCount, s_minIndirectDrawCount);
+        if (!m_indirectBuffer || m_indirectBuffer->GetCreateInfo().size < size)
         {
-            // Populate a new pipeline barrier structure with any required image layout transitions.
-            PipelineBarrier pipelineBarrier = {};
-            pipelineBarrier.streamPosition = m_stream.TellP();
-            for (auto itr : imageAccesses)
+            // An outgrown buffer is destroyed along with the recording's other transient resources rather than during End.
+            if (m_indirectBuffer)
             {
-                // Extract the image object from the key.
-                auto image = reinterpret_cast<Image*>(itr.first[0]);
-
-                // Every access to the image within the command buffer is transitioned back to the default layout independently of other accesses.
-                auto& accessList = itr.second;
-                for (auto& entry : accessList)
-                {
-                    if (entry.layout == image->GetDefaultImageLayout())
-                        continue;
+                size = std::max(size, static_cast<size_t>(m_indirectBuffer->GetCreateInfo().size * 2));
+                auto indirectBuffer = m_indirectBuffer;
+                m_transientResources.push_back([device, indirectBuffer]() -> void {
+                    device->DestroyBuffer(indirectBuffer);
+                });
 
-                    VkImageMemoryBarrier barrier = {};
-                    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                    barrier.dstAccessMask = barrier.srcAccessMask;
-                    barrier.oldLayout = entry.layout;
-                    barrier.newLayout = image->GetDefaultImageLayout();
-                    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier.image = image->GetHandle();
-                    barrier.subresourceRange.aspectMask = GetImageAspectFlags(image->GetCreateInfo().format);
-                    barrier.subresourceRange.baseMipLevel = entry.subresourceRange.baseMipLevel;
-                    barrier.subresourceRange.levelCount = entry.subresourceRange.levelCount;
-                    barrier.subresourceRange.baseArrayLayer = entry.subresourceRange.baseArrayLayer;
-                    barrier.subresourceRange.layerCount = entry.subresourceRange.layerCount;
-                    pipelineBarrier.imageBarriers.push_back(barrier);
-                    pipelineBarrier.srcStageMask |= entry.stageMask;
-                }
+                m_indirectBuffer = nullptr;
             }
 
-            // All final image transitions should block any proceeding commands until the top of the pipeline stage is reached.
-            pipelineBarrier.dstStageMask = pipelineBarrier.srcStageMask;
-
-            // If any image barriers were added, add pipeline barrier to stream encoder at current write position.
-            if (pipelineBarrier.imageBarriers.size() > 0)
-                m_pipelineBarriers.GetBarriers().push_back(pipelineBarrier);
+            // The device reads the draws on every submission, so the buffer is placed in memory written by the host and fast for the device to read.
+            VezBufferCreateInfo createInfo = {};
+            createInfo.size = size;
+            createInfo.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+            if (device->CreateBuffer(VEZ_MEMORY_CPU_TO_GPU, &createInfo, &m_indirectBuffer) != VK_SUCCESS)
+                return nullptr;
         }
 
-        // Remove last pipeline barrier if srcStageMask and dstStageMask were never set.
-        auto& barriers = m_pipelineBarriers.GetBarriers();
-        if (!barriers.empty())
+        void* pData = nullptr;
+        if (device->MapBuffer(m_indirectBuffer, 0, size, &pData) != VK_SUCCESS)
+            return nullptr;
+
+        return reinterpret_cast<VkDrawIndexedIndirectCommand*>(pData);
+    }
+
+    void StreamEncoder::ResolvePipelines(RenderPass* pRenderPass, uint32_t subpassIndex)
+    {
+        // Unresolved pipeline packets were written to the timeline in the same order as the placeholder subpass's bindings.
+        auto packet = m_unresolvedPipelinePackets.begin();
+        for (auto& entry : m_renderPasses.back().subpasses.back().pipelineBindings)
         {
-            if (barriers.back().srcStageMask == 0 && barriers.back().dstStageMask == 0)
-                barriers.pop_back();
+            if (packet == m_unresolvedPipelinePackets.end())
+                break;
+
+            auto state = entry.state;
+            state.SetSubpassIndex(subpassIndex);
+            (*packet++)->pipeline = entry.pipeline->GetHandle(pRenderPass, &state);
         }
     }
 
@@ -137,6 +1100,10 @@ namespace vez
 
     void StreamEncoder::CmdBeginRenderPass(const VezRenderPassBeginInfo* pBeginInfo)
     {
+        // Secondary command buffers always continue the render pass of the primary executing them.
+        if (m_isSecondary)
+            return;
+
         // Mark the beginning of the renderpass.
         m_inRenderPass = true;
 
@@ -151,12 +1118,15 @@ namespace vez
         renderPassDesc.pNext = pBeginInfo->pNext;
         renderPassDesc.streamPosition = streamPosition;
         renderPassDesc.framebuffer = reinterpret_cast<Framebuffer*>(pBeginInfo->framebuffer);
+        renderPassDesc.orderIndependentDraws = (pBeginInfo->orderIndependentDraws == VK_TRUE);
         renderPassDesc.attachments.resize(pBeginInfo->attachmentCount);
         renderPassDesc.clearValues.resize(pBeginInfo->attachmentCount);
         for (auto i = 0U; i < pBeginInfo->attachmentCount; ++i)
         {
             // Retrieve the imageView for the given attachment index.
             auto imageView = renderPassDesc.framebuffer->GetAttachment(i);
+            if (m_memoize)
+                m_recordedResources.push_back(reinterpret_cast<uint64_t>(imageView->GetHandle()));
 
             // Copy application supplied information into VkAttachmentReference object.
             auto& attachment = renderPassDesc.attachments[i];
@@ -167,11 +1137,19 @@ namespace vez
             attachment.storeOp = pBeginInfo->pAttachments[i].storeOp;
             attachment.stencilLoadOp = pBeginInfo->pAttachments[i].loadOp;
             attachment.stencilStoreOp = pBeginInfo->pAttachments[i].storeOp;
-            attachment.initialLayout = m_pipelineBarriers.GetImageLayout(imageView);
+            attachment.initialLayout = m_pipelineBarriers.GetImageLayout(streamPosition, imageView);
 
-            // For now, reset final layout to initial layout so as to keep command stream state well defined.
-            // Later this should be refactored so finalLayout is stored in the PipelineBarriers object.
-            attachment.finalLayout = attachment.initialLayout;
+            // Leave the attachment in the layout its image rests in between uses, which becomes its tracked layout once the render pass ends.
+            // Presentable images return to the present layout, sampled images to the layout shaders read them in and others stay attachments.
+            auto image = imageView->GetImage();
+            if (image->GetDefaultImageLayout() == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+                attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            else if (image->GetCreateInfo().usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+                attachment.finalLayout = image->GetShaderReadLayout();
+            else if (IsDepthStencilFormat(attachment.format))
+                attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+            else
+                attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
             // Copy application supplied information into VkClearValue object.
             auto& clearValue = renderPassDesc.clearValues[i];
@@ -189,35 +1167,24 @@ namespace vez
             }
         }
 
-        // Pipeline stage and access flags will be populated at the end of the subpass (either via CmdNextSubpass or CmdEndRenderPass).
+        // Subpass dependencies are derived from the attachments each subpass uses once the render pass ends.
         SubpassDesc firstSubpass = {};
         firstSubpass.streamPosition = streamPosition;
-        firstSubpass.dependency.dependencyFlags = 0;
-        firstSubpass.dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        firstSubpass.dependency.dstSubpass = 0;
         renderPassDesc.subpasses.push_back(firstSubpass);
         m_renderPasses.push_back(renderPassDesc);
     }
 
     void StreamEncoder::CmdNextSubpass()
     {
-        // End the previous subpass.
-        EndSubpass();
+        // Secondary command buffers always continue the render pass of the primary executing them.
+        if (m_isSecondary)
+            return;
 
         // Add a new subpass to the current render pass (if command stream is inside of one at the moment).
         if (m_inRenderPass)
         {
-            auto& prevSubpassDesc = m_renderPasses.back().subpasses.back();
-
             SubpassDesc nextSubpassDesc = {};
             nextSubpassDesc.streamPosition = m_stream.TellP();
-            nextSubpassDesc.dependency.dependencyFlags = 0;
-            nextSubpassDesc.dependency.srcSubpass = static_cast<uint32_t>(m_renderPasses.back().subpasses.size() - 1);
-            nextSubpassDesc.dependency.dstSubpass = nextSubpassDesc.dependency.srcSubpass + 1;
-            nextSubpassDesc.dependency.srcStageMask = prevSubpassDesc.dependency.dstStageMask;
-            nextSubpassDesc.dependency.srcAccessMask = prevSubpassDesc.dependency.dstAccessMask;
-            nextSubpassDesc.dependency.dstStageMask = 0;
-            nextSubpassDesc.dependency.dstAccessMask = 0;
             m_renderPasses.back().subpasses.push_back(nextSubpassDesc);
         }
 
@@ -225,13 +1192,19 @@ namespace vez
         m_graphicsState.SetSubpassIndex(m_graphicsState.GetSubpassIndex() + 1);
 
         // Encode the command to the memory stream.
-        m_stream << NEXT_SUBPASS;
+        auto packet = AllocatePacket<NextSubpassPacket>(NEXT_SUBPASS);
+        packet->contents = VK_SUBPASS_CONTENTS_INLINE;
+
+        // Keep a reference to the packet in case the subpass executes secondary command buffers.
+        if (m_inRenderPass)
+            m_renderPasses.back().subpasses.back().nextSubpassPacket = packet;
     }
 
     void StreamEncoder::CmdEndRenderPass()
     {
-        // End the last subpass.
-        EndSubpass();
+        // Secondary command buffers always continue the render pass of the primary executing them.
+        if (m_isSecondary)
+            return;
 
         // If CmdBeginRenderPass was not previously called before this, exit.
         if (!m_inRenderPass)
@@ -240,14 +1213,15 @@ namespace vez
         // Get the current render pass description object.
         auto& renderPassDesc = m_renderPasses.back();
 
+        // Derive the subpass dependencies from the attachments used and the pipeline barriers recorded within the render pass.
+        BuildSubpassDependencies(renderPassDesc, m_stream.TellP());
+
         // Request a compatible render pass from the RenderPassCache.
         auto device = m_commandBuffer->GetPool()->GetDevice();
         auto renderPassCache = device->GetRenderPassCache();
         auto result = renderPassCache->CreateRenderPass(&renderPassDesc, &renderPassDesc.renderPass);
-        if (result != VK_SUCCESS)
-        {
-            // TODO: Handle error.
-        }
+        if (result != VK_SUCCESS && m_recordingResult == VK_SUCCESS)
+            m_recordingResult = result;
 
         // Add render pass to transient resource list.
         m_transientResources.push_back([renderPassCache, renderPass = renderPassDesc.renderPass]() -> void {
@@ -265,65 +1239,15 @@ namespace vez
                 auto handle = entry.pipeline->GetHandle(renderPassDesc.renderPass, &entry.state);
                 m_pipelineBindings.push_back({ entry.streamPosition, handle, entry.pipeline->GetBindPoint(), entry.pipeline->GetPipelineLayout() });
             }
-        }
-
-        // Determine the start and end stream positions of the render pass.
-        auto startStreamPos = renderPassDesc.streamPosition;
-        auto endStreamPos = m_stream.TellP();
-
-        // See if any pipeline barriers were inserted into the command stream.
-        auto& barriers = m_pipelineBarriers.GetBarriers();
-        if (barriers.size() > 0)
-        {
-            // Find the first pipeline barrier after the start of the render pass.
-            auto it = barriers.begin();
-            while (it != barriers.end() && it->streamPosition < startStreamPos)
-                ++it;
-
-#if 0
-            // Erase all pipeline barriers that occur within the renderpass.
-            while (barriersItr != barriers.end() && barriersItr->streamPosition <= endStreamPos)
-                barriersItr = barriers.erase(barriersItr);
-#else
-            // Aggregate all pipeline barriers into a single monolithic one to be inserted at the beginning of the render pass.
-            if (it != barriers.end())
-            {
-                PipelineBarrier newBarrier = {};
-                newBarrier.streamPosition = renderPassDesc.streamPosition;
-
-                // Iterate over all pipeline barriers that occurred within render pass and combine them.
-                while (it != barriers.end() && it->streamPosition <= endStreamPos)
-                {
-                    newBarrier.srcStageMask |= it->srcStageMask;
-                    newBarrier.dstStageMask |= it->dstStageMask;
-                    newBarrier.bufferBarriers.insert(newBarrier.bufferBarriers.end(), it->bufferBarriers.begin(), it->bufferBarriers.end());
-                    newBarrier.imageBarriers.insert(newBarrier.imageBarriers.end(), it->imageBarriers.begin(), it->imageBarriers.end());
-                    it = barriers.erase(it);
-                }
-
-                barriers.insert(it, newBarrier);
-            }
-#endif
-        }
-
-        // For all attachments referenced in the render pass, add finalLayouts and accesses to PipelineBarriers.
-        auto framebuffer = reinterpret_cast<Framebuffer*>(renderPassDesc.framebuffer);
-        for (auto i = 0U; i < renderPassDesc.attachments.size(); ++i)
-        {
-            auto imageView = framebuffer->GetAttachment(i);
-            const auto& subresourceRange = imageView->GetSubresourceRange();
-            auto image = imageView->GetImage();
-            auto& attachment = renderPassDesc.attachments[i];
 
-            auto access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            auto stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            if (IsDepthStencilFormat(imageView->GetFormat()))
+            // Record the native commands of each executed secondary command buffer within the subpass, and execute the native
+            // command buffer recorded for it.  Failures are returned when the recording ends.
+            for (auto& entry : subpassDesc.secondaryCommandBuffers)
             {
-                auto access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-                auto stage = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                result = std::get<0>(entry)->ResolveSecondary(renderPassDesc.renderPass, i, std::get<1>(entry));
+                if (result != VK_SUCCESS && m_recordingResult == VK_SUCCESS)
+                    m_recordingResult = result;
             }
-
-            m_pipelineBarriers.ImageAccess(endStreamPos + 1ULL, image, &subresourceRange, attachment.finalLayout, access, stage);
         }
 
         // Mark that render pass has ended.
@@ -333,7 +1257,7 @@ namespace vez
         m_graphicsState.SetFramebuffer(nullptr);
 
         // Encode the command to the memory stream.
-        m_stream << END_RENDER_PASS;
+        AllocatePacket<EndRenderPassPacket>(END_RENDER_PASS);
     }
 
     void StreamEncoder::CmdBindPipeline(Pipeline* pPipeline)
@@ -350,10 +1274,12 @@ namespace vez
         if (pipeline)
         {
             // Encode the command, along with the pipeline's layout and shader stages push constant is used in, to the memory stream.
-            auto layout = pipeline->GetPipelineLayout();
-            auto shaderStages = pipeline->GetPushConstantsRangeStages(offset, size);
-            m_stream << PUSH_CONSTANTS << layout << shaderStages << offset << size;
-            m_stream.Write(pValues, static_cast<uint64_t>(size));
+            auto packet = AllocatePacket<PushConstantsPacket>(PUSH_CONSTANTS, size);
+            packet->layout = pipeline->GetPipelineLayout();
+            packet->stageFlags = pipeline->GetPushConstantsRangeStages(offset, size);
+            packet->offset = offset;
+            packet->size = size;
+            memcpy(GetCommandPacketData<uint8_t>(packet), pValues, size);
         }
     }
 
@@ -391,9 +1317,15 @@ namespace vez
         }
 
         // Encode the command to the memory stream.
-        m_stream << BIND_VERTEX_BUFFERS << firstBinding << bindingCount;
-        m_stream.Write(ppBuffers, sizeof(Buffer*) * bindingCount);
-        m_stream.Write(pOffsets, sizeof(VkDeviceSize) * bindingCount);
+        auto packet = AllocatePacket<BindVertexBuffersPacket>(BIND_VERTEX_BUFFERS, (sizeof(VkBuffer) + sizeof(VkDeviceSize)) * bindingCount);
+        packet->firstBinding = firstBinding;
+        packet->bindingCount = bindingCount;
+
+        auto buffers = GetCommandPacketData<VkBuffer>(packet);
+        for (auto i = 0U; i < bindingCount; ++i)
+            buffers[i] = ppBuffers[i]->GetHandle();
+
+        memcpy(GetCommandPacketData<VkDeviceSize>(packet, sizeof(VkBuffer) * bindingCount), pOffsets, sizeof(VkDeviceSize) * bindingCount);
     }
 
     void StreamEncoder::CmdBindIndexBuffer(Buffer* pBuffer, VkDeviceSize offset, VkIndexType indexType)
@@ -403,7 +1335,10 @@ namespace vez
         m_pipelineBarriers.BufferAccess(m_stream.TellP(), pBuffer, offset, size - offset, VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 
         // Encode the command to the memory stream.
-        m_stream << BIND_INDEX_BUFFER << pBuffer << offset << indexType;
+        auto packet = AllocatePacket<BindIndexBufferPacket>(BIND_INDEX_BUFFER);
+        packet->buffer = pBuffer->GetHandle();
+        packet->offset = offset;
+        packet->indexType = indexType;
     }
 
     void StreamEncoder::CmdSetVertexInputFormat(VertexInputFormat* pVertexInputFormat)
@@ -451,58 +1386,74 @@ namespace vez
     void StreamEncoder::CmdSetViewport(uint32_t firstViewport, uint32_t viewportCount, const VkViewport* pViewports)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_VIEWPORT << firstViewport << viewportCount;
-        m_stream.Write(pViewports, sizeof(VkViewport) * viewportCount);
+        auto packet = AllocatePacket<SetViewportPacket>(SET_VIEWPORT, sizeof(VkViewport) * viewportCount);
+        packet->firstViewport = firstViewport;
+        packet->viewportCount = viewportCount;
+        memcpy(GetCommandPacketData<VkViewport>(packet), pViewports, sizeof(VkViewport) * viewportCount);
     }
 
     void StreamEncoder::CmdSetScissor(uint32_t firstScissor, uint32_t scissorCount, const VkRect2D* pScissors)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_SCISSOR << firstScissor << scissorCount;
-        m_stream.Write(pScissors, sizeof(VkRect2D) * scissorCount);
+        auto packet = AllocatePacket<SetScissorPacket>(SET_SCISSOR, sizeof(VkRect2D) * scissorCount);
+        packet->firstScissor = firstScissor;
+        packet->scissorCount = scissorCount;
+        memcpy(GetCommandPacketData<VkRect2D>(packet), pScissors, sizeof(VkRect2D) * scissorCount);
     }
 
     void StreamEncoder::CmdSetLineWidth(float lineWidth)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_LINE_WIDTH << lineWidth;
+        auto packet = AllocatePacket<SetLineWidthPacket>(SET_LINE_WIDTH);
+        packet->lineWidth = lineWidth;
     }
 
     void StreamEncoder::CmdSetDepthBias(float depthBiasConstantFactor, float depthBiasClamp, float depthBiasSlopeFactor)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_DEPTH_BIAS << depthBiasConstantFactor << depthBiasClamp << depthBiasSlopeFactor;
+        auto packet = AllocatePacket<SetDepthBiasPacket>(SET_DEPTH_BIAS);
+        packet->depthBiasConstantFactor = depthBiasConstantFactor;
+        packet->depthBiasClamp = depthBiasClamp;
+        packet->depthBiasSlopeFactor = depthBiasSlopeFactor;
     }
 
     void StreamEncoder::CmdSetBlendConstants(const float blendConstants[4])
     {
         // Encode the command to the memory stream.
-        m_stream << SET_BLEND_CONSTANTS;
-        m_stream.Write(blendConstants, sizeof(float) * 4);
+        auto packet = AllocatePacket<SetBlendConstantsPacket>(SET_BLEND_CONSTANTS);
+        memcpy(packet->blendConstants, blendConstants, sizeof(float) * 4);
     }
 
     void StreamEncoder::CmdSetDepthBounds(float minDepthBounds, float maxDepthBounds)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_DEPTH_BOUNDS << minDepthBounds << maxDepthBounds;
+        auto packet = AllocatePacket<SetDepthBoundsPacket>(SET_DEPTH_BOUNDS);
+        packet->minDepthBounds = minDepthBounds;
+        packet->maxDepthBounds = maxDepthBounds;
     }
 
     void StreamEncoder::CmdSetStencilCompareMask(VkStencilFaceFlags faceMask, uint32_t compareMask)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_STENCIL_COMPARE_MASK << faceMask << compareMask;
+        auto packet = AllocatePacket<SetStencilCompareMaskPacket>(SET_STENCIL_COMPARE_MASK);
+        packet->faceMask = faceMask;
+        packet->compareMask = compareMask;
     }
 
     void StreamEncoder::CmdSetStencilWriteMask(VkStencilFaceFlags faceMask, uint32_t writeMask)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_STENCIL_WRITE_MASK << faceMask << writeMask;
+        auto packet = AllocatePacket<SetStencilWriteMaskPacket>(SET_STENCIL_WRITE_MASK);
+        packet->faceMask = faceMask;
+        packet->writeMask = writeMask;
     }
 
     void StreamEncoder::CmdSetStencilReference(VkStencilFaceFlags faceMask, uint32_t reference)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_STENCIL_REFERENCE << faceMask << reference;
+        auto packet = AllocatePacket<SetStencilReferencePacket>(SET_STENCIL_REFERENCE);
+        packet->faceMask = faceMask;
+        packet->reference = reference;
     }
 
     void StreamEncoder::CmdDraw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance)
@@ -514,7 +1465,11 @@ namespace vez
         BindDescriptorSet();
 
         // Encode the command to the memory stream.
-        m_stream << DRAW << vertexCount << instanceCount << firstVertex << firstInstance;
+        auto packet = AllocatePacket<DrawPacket>(DRAW);
+        packet->vertexCount = vertexCount;
+        packet->instanceCount = instanceCount;
+        packet->firstVertex = firstVertex;
+        packet->firstInstance = firstInstance;
     }
 
     void StreamEncoder::CmdDrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
@@ -526,7 +1481,12 @@ namespace vez
         BindDescriptorSet();
 
         // Encode the command to the memory stream.
-        m_stream << DRAW_INDEXED << indexCount << instanceCount << firstIndex << vertexOffset << firstInstance;
+        auto packet = AllocatePacket<DrawIndexedPacket>(DRAW_INDEXED);
+        packet->indexCount = indexCount;
+        packet->instanceCount = instanceCount;
+        packet->firstIndex = firstIndex;
+        packet->vertexOffset = vertexOffset;
+        packet->firstInstance = firstInstance;
     }
 
     void StreamEncoder::CmdDrawIndirect(Buffer* pBuffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
@@ -542,7 +1502,11 @@ namespace vez
         BindDescriptorSet();
 
         // Encode the command to the memory stream.
-        m_stream << DRAW_INDIRECT << pBuffer << offset << drawCount << stride;
+        auto packet = AllocatePacket<DrawIndirectPacket>(DRAW_INDIRECT);
+        packet->buffer = pBuffer->GetHandle();
+        packet->offset = offset;
+        packet->drawCount = drawCount;
+        packet->stride = stride;
     }
 
     void StreamEncoder::CmdDrawIndexedIndirect(Buffer* pBuffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
@@ -558,7 +1522,11 @@ namespace vez
         BindDescriptorSet();
 
         // Encode the command to the memory stream.
-        m_stream << DRAW_INDEXED_INDIRECT << pBuffer << offset << drawCount << stride;
+        auto packet = AllocatePacket<DrawIndexedIndirectPacket>(DRAW_INDEXED_INDIRECT);
+        packet->buffer = pBuffer->GetHandle();
+        packet->offset = offset;
+        packet->drawCount = drawCount;
+        packet->stride = stride;
     }
 
     void StreamEncoder::CmdDispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
@@ -570,7 +1538,10 @@ namespace vez
         BindDescriptorSet();
 
         // Encode the command to the memory stream.
-        m_stream << DISPATCH << groupCountX << groupCountY << groupCountZ;
+        auto packet = AllocatePacket<DispatchPacket>(DISPATCH);
+        packet->groupCountX = groupCountX;
+        packet->groupCountY = groupCountY;
+        packet->groupCountZ = groupCountZ;
     }
 
     void StreamEncoder::CmdDispatchIndirect(Buffer* pBuffer, VkDeviceSize offset)
@@ -586,7 +1557,9 @@ namespace vez
         BindDescriptorSet();
 
         // Encode the command to the memory stream.
-        m_stream << DISPATCH_INDIRECT << pBuffer << offset;
+        auto packet = AllocatePacket<DispatchIndirectPacket>(DISPATCH_INDIRECT);
+        packet->buffer = pBuffer->GetHandle();
+        packet->offset = offset;
     }
 
     void StreamEncoder::CmdCopyBuffer(Buffer* pSrcBuffer, Buffer* pDstBuffer, uint32_t regionCount, const VezBufferCopy* pRegions)
@@ -594,21 +1567,31 @@ namespace vez
         // Add buffer accesses to PipelineBarriers.
         for (auto i = 0U; i < regionCount; ++i)
         {
-            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pSrcBuffer, pRegions[i].srcOffset, pRegions[i].size, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, pRegions[i].dstOffset, pRegions[i].size, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pSrcBuffer, pRegions[i].srcOffset, pRegions[i].size, VK_ACCESS_TRANSFER_READ_BIT, PIPELINE_STAGE_COPY_BIT);
+            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, pRegions[i].dstOffset, pRegions[i].size, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_COPY_BIT);
         }
 
         // Encode the command to the memory stream.
-        m_stream << COPY_BUFFER << pSrcBuffer << pDstBuffer << regionCount;
-        m_stream.Write(pRegions, sizeof(VezBufferCopy) * regionCount);
+        auto packet = AllocatePacket<CopyBufferPacket>(COPY_BUFFER, sizeof(VkBufferCopy) * regionCount);
+        packet->srcBuffer = pSrcBuffer->GetHandle();
+        packet->dstBuffer = pDstBuffer->GetHandle();
+        packet->regionCount = regionCount;
+
+        auto regions = GetCommandPacketData<VkBufferCopy>(packet);
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            regions[i].srcOffset = pRegions[i].srcOffset;
+            regions[i].dstOffset = pRegions[i].dstOffset;
+            regions[i].size = pRegions[i].size;
+        }
     }
 
     void StreamEncoder::CmdCopyImage(Image* pSrcImage, Image* pDstImage, uint32_t regionCount, const VezImageCopy* pRegions)
     {
-        // If source and destination images are the same, layouts must be equal.
+        // If source and destination subresources of the same image overlap, layouts must be equal.
         VkImageLayout srcLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
         VkImageLayout dstLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        if (pSrcImage == pDstImage)
+        if (pSrcImage == pDstImage && RegionSubresourcesOverlap(regionCount, pRegions))
             srcLayout = dstLayout = VK_IMAGE_LAYOUT_GENERAL;
 
         // Add image accesses to PipelineBarriers.
@@ -620,29 +1603,50 @@ namespace vez
             subresourceRange.levelCount = 1;
             subresourceRange.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].srcSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, srcLayout, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, srcLayout, VK_ACCESS_TRANSFER_READ_BIT, PIPELINE_STAGE_COPY_BIT);
 
             // Destination image access.
             subresourceRange.baseMipLevel = pRegions[i].dstSubresource.mipLevel;
             subresourceRange.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].dstSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, dstLayout, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, dstLayout, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_COPY_BIT);
         }
 
         // Encode the command to the memory stream.
-        m_stream << COPY_IMAGE << pSrcImage << pDstImage << regionCount;
-        m_stream.Write(pRegions, sizeof(VezImageCopy) * regionCount);
-        m_stream << srcLayout << dstLayout;
+        auto packet = AllocatePacket<CopyImagePacket>(COPY_IMAGE, sizeof(VkImageCopy) * regionCount);
+        packet->srcImage = pSrcImage->GetHandle();
+        packet->dstImage = pDstImage->GetHandle();
+        packet->srcImageLayout = srcLayout;
+        packet->dstImageLayout = dstLayout;
+        packet->regionCount = regionCount;
+
+        auto regions = GetCommandPacketData<VkImageCopy>(packet);
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            VkImageCopy& region = regions[i];
+            memcpy(&region.srcOffset, &pRegions[i].srcOffset, sizeof(VkOffset3D));
+            memcpy(&region.dstOffset, &pRegions[i].dstOffset, sizeof(VkOffset3D));
+            memcpy(&region.extent, &pRegions[i].extent, sizeof(VkExtent3D));
+            region.srcSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
+            region.srcSubresource.mipLevel = pRegions[i].srcSubresource.mipLevel;
+            region.srcSubresource.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
+            region.srcSubresource.layerCount = pRegions[i].srcSubresource.layerCount;
+            region.dstSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
+            region.dstSubresource.mipLevel = pRegions[i].dstSubresource.mipLevel;
+            region.dstSubresource.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
+            region.dstSubresource.layerCount = pRegions[i].dstSubresource.layerCount;
+        }
     }
 
     void StreamEncoder::CmdBlitImage(Image* pSrcImage, Image* pDstImage, uint32_t regionCount, const VezImageBlit* pRegions, VkFilter filter)
     {
-        // If source and destination images are the same, layouts must be equal.
+        // If source and destination subresources of the same image overlap, layouts must be equal.
+        // Mipmap generation blits between distinct mip levels, which stay in the transfer layouts.
         VkImageLayout srcLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
         VkImageLayout dstLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        if (pSrcImage == pDstImage)
+        if (pSrcImage == pDstImage && RegionSubresourcesOverlap(regionCount, pRegions))
             srcLayout = dstLayout = VK_IMAGE_LAYOUT_GENERAL;
-        
+
         // Add image accesses to PipelineBarriers.
         for (auto i = 0U; i < regionCount; ++i)
         {
@@ -652,19 +1656,41 @@ namespace vez
             subresourceRange.levelCount = 1;
             subresourceRange.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].srcSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, srcLayout, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, srcLayout, VK_ACCESS_TRANSFER_READ_BIT, PIPELINE_STAGE_BLIT_BIT);
 
             // Destination image access.
             subresourceRange.baseMipLevel = pRegions[i].dstSubresource.mipLevel;
             subresourceRange.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].dstSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, dstLayout, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, dstLayout, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_BLIT_BIT);
         }
 
         // Encode the command to the memory stream.
-        m_stream << BLIT_IMAGE << pSrcImage << pDstImage << regionCount;
-        m_stream.Write(pRegions, sizeof(VezImageBlit) * regionCount);
-        m_stream << filter << srcLayout << dstLayout;
+        auto packet = AllocatePacket<BlitImagePacket>(BLIT_IMAGE, sizeof(VkImageBlit) * regionCount);
+        packet->srcImage = pSrcImage->GetHandle();
+        packet->dstImage = pDstImage->GetHandle();
+        packet->srcImageLayout = srcLayout;
+        packet->dstImageLayout = dstLayout;
+        packet->filter = filter;
+        packet->regionCount = regionCount;
+
+        auto regions = GetCommandPacketData<VkImageBlit>(packet);
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            VkImageBlit& region = regions[i];
+            memcpy(&region.srcOffsets[0], &pRegions[i].srcOffsets[0], sizeof(VkOffset3D));
+            memcpy(&region.srcOffsets[1], &pRegions[i].srcOffsets[1], sizeof(VkOffset3D));
+            memcpy(&region.dstOffsets[0], &pRegions[i].dstOffsets[0], sizeof(VkOffset3D));
+            memcpy(&region.dstOffsets[1], &pRegions[i].dstOffsets[1], sizeof(VkOffset3D));
+            region.srcSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
+            region.srcSubresource.mipLevel = pRegions[i].srcSubresource.mipLevel;
+            region.srcSubresource.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
+            region.srcSubresource.layerCount = pRegions[i].srcSubresource.layerCount;
+            region.dstSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
+            region.dstSubresource.mipLevel = pRegions[i].dstSubresource.mipLevel;
+            region.dstSubresource.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
+            region.dstSubresource.layerCount = pRegions[i].dstSubresource.layerCount;
+        }
     }
 
     void StreamEncoder::CmdCopyBufferToImage(Buffer* pSrcBuffer, Image* pDstImage, uint32_t regionCount, const VezBufferImageCopy* pRegions)
@@ -676,7 +1702,7 @@ namespace vez
             auto bufferRange = static_cast<VkDeviceSize>(pRegions[i].bufferImageHeight) * pRegions[i].bufferRowLength;
             if (bufferRange == 0)
                 bufferRange = reinterpret_cast<Buffer*>(pSrcBuffer)->GetCreateInfo().size - pRegions[i].bufferOffset;
-            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pSrcBuffer, pRegions[i].bufferOffset, bufferRange, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pSrcBuffer, pRegions[i].bufferOffset, bufferRange, VK_ACCESS_TRANSFER_READ_BIT, PIPELINE_STAGE_COPY_BIT);
 
             // Destination image access.
             VezImageSubresourceRange subresourceRange = {};
@@ -684,12 +1710,29 @@ namespace vez
             subresourceRange.levelCount = 1;
             subresourceRange.baseArrayLayer = pRegions[i].imageSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].imageSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_COPY_BIT);
         }
 
         // Encode the command to the memory stream.
-        m_stream << COPY_BUFFER_TO_IMAGE << pSrcBuffer << pDstImage << regionCount;
-        m_stream.Write(pRegions, sizeof(VezBufferImageCopy) * regionCount);
+        auto packet = AllocatePacket<CopyBufferToImagePacket>(COPY_BUFFER_TO_IMAGE, sizeof(VkBufferImageCopy) * regionCount);
+        packet->srcBuffer = pSrcBuffer->GetHandle();
+        packet->dstImage = pDstImage->GetHandle();
+        packet->regionCount = regionCount;
+
+        auto regions = GetCommandPacketData<VkBufferImageCopy>(packet);
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            VkBufferImageCopy& region = regions[i];
+            region.bufferOffset = pRegions[i].bufferOffset;
+            region.bufferRowLength = pRegions[i].bufferRowLength;
+            region.bufferImageHeight = pRegions[i].bufferImageHeight;
+            memcpy(&region.imageOffset, &pRegions[i].imageOffset, sizeof(VkOffset3D));
+            memcpy(&region.imageExtent, &pRegions[i].imageExtent, sizeof(VkExtent3D));
+            region.imageSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
+            region.imageSubresource.mipLevel = pRegions[i].imageSubresource.mipLevel;
+            region.imageSubresource.baseArrayLayer = pRegions[i].imageSubresource.baseArrayLayer;
+            region.imageSubresource.layerCount = pRegions[i].imageSubresource.layerCount;
+        }
     }
 
     void StreamEncoder::CmdCopyImageToBuffer(Image* pSrcImage, Buffer* pDstBuffer, uint32_t regionCount, const VezBufferImageCopy* pRegions)
@@ -703,68 +1746,139 @@ namespace vez
             subresourceRange.levelCount = 1;
             subresourceRange.baseArrayLayer = pRegions[i].imageSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].imageSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, PIPELINE_STAGE_COPY_BIT);
 
             // Destination buffer access.
             auto bufferRange = static_cast<VkDeviceSize>(pRegions[i].bufferImageHeight) * pRegions[i].bufferRowLength;
             if (bufferRange == 0)
                 bufferRange = reinterpret_cast<Buffer*>(pDstBuffer)->GetCreateInfo().size - pRegions[i].bufferOffset;
-            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, pRegions[i].bufferOffset, bufferRange, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, pRegions[i].bufferOffset, bufferRange, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_COPY_BIT);
         }
 
         // Encode the command to the memory stream.
-        m_stream << COPY_IMAGE_TO_BUFFER << pSrcImage << pDstBuffer << regionCount;
-        m_stream.Write(pRegions, sizeof(VezBufferImageCopy) * regionCount);
+        auto packet = AllocatePacket<CopyImageToBufferPacket>(COPY_IMAGE_TO_BUFFER, sizeof(VkBufferImageCopy) * regionCount);
+        packet->srcImage = pSrcImage->GetHandle();
+        packet->dstBuffer = pDstBuffer->GetHandle();
+        packet->regionCount = regionCount;
+
+        auto regions = GetCommandPacketData<VkBufferImageCopy>(packet);
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            VkBufferImageCopy& region = regions[i];
+            region.bufferOffset = pRegions[i].bufferOffset;
+            region.bufferRowLength = pRegions[i].bufferRowLength;
+            region.bufferImageHeight = pRegions[i].bufferImageHeight;
+            memcpy(&region.imageOffset, &pRegions[i].imageOffset, sizeof(VkOffset3D));
+            memcpy(&region.imageExtent, &pRegions[i].imageExtent, sizeof(VkExtent3D));
+            region.imageSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
+            region.imageSubresource.mipLevel = pRegions[i].imageSubresource.mipLevel;
+            region.imageSubresource.baseArrayLayer = pRegions[i].imageSubresource.baseArrayLayer;
+            region.imageSubresource.layerCount = pRegions[i].imageSubresource.layerCount;
+        }
     }
 
     void StreamEncoder::CmdUpdateBuffer(Buffer* pDstBuffer, VkDeviceSize dstOffset, VkDeviceSize dataSize, const void* pData)
     {
         // Add buffer access to PipelineBarriers.
-        m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, dstOffset, dataSize, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, dstOffset, dataSize, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_CLEAR_BIT);
 
         // Encode the command to the memory stream.
-        m_stream << UPDATE_BUFFER << pDstBuffer << dstOffset << dataSize;
-        m_stream.Write(pData, dataSize);
+        // Large updates are split across multiple packets so each one fits within a single memory stream block.
+        auto pBytes = reinterpret_cast<const uint8_t*>(pData);
+        for (VkDeviceSize chunkOffset = 0; chunkOffset < dataSize; chunkOffset += KILOBYTES(32))
+        {
+            auto chunkSize = std::min(dataSize - chunkOffset, static_cast<VkDeviceSize>(KILOBYTES(32)));
+            auto packet = AllocatePacket<UpdateBufferPacket>(UPDATE_BUFFER, chunkSize);
+            packet->dstBuffer = pDstBuffer->GetHandle();
+            packet->dstOffset = dstOffset + chunkOffset;
+            packet->dataSize = chunkSize;
+            memcpy(GetCommandPacketData<uint8_t>(packet), &pBytes[chunkOffset], chunkSize);
+        }
     }
 
     void StreamEncoder::CmdFillBuffer(Buffer* pDstBuffer, VkDeviceSize dstOffset, VkDeviceSize size, uint32_t data)
     {
         // Add buffer access to PipelineBarriers.
-        m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, dstOffset, size, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        m_pipelineBarriers.BufferAccess(m_stream.TellP(), pDstBuffer, dstOffset, size, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_CLEAR_BIT);
 
         // Encode the command to the memory stream.
-        m_stream << FILL_BUFFER << pDstBuffer << dstOffset << size << data;
+        auto packet = AllocatePacket<FillBufferPacket>(FILL_BUFFER);
+        packet->dstBuffer = pDstBuffer->GetHandle();
+        packet->dstOffset = dstOffset;
+        packet->size = size;
+        packet->data = data;
     }
 
     void StreamEncoder::CmdClearColorImage(Image* pImage, const VkClearColorValue* pColor, uint32_t rangeCount, const VezImageSubresourceRange* pRanges)
     {
         // Add image accesses to PipelineBarriers.
         for (auto i = 0U; i < rangeCount; ++i)
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pImage, &pRanges[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pImage, &pRanges[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_CLEAR_BIT);
 
         // Encode the command to the memory stream.
-        m_stream << CLEAR_COLOR_IMAGE << pImage << *pColor << rangeCount;
-        m_stream.Write(pRanges, sizeof(VezImageSubresourceRange) * rangeCount);
+        auto packet = AllocatePacket<ClearColorImagePacket>(CLEAR_COLOR_IMAGE, sizeof(VkImageSubresourceRange) * rangeCount);
+        packet->image = pImage->GetHandle();
+        packet->color = *pColor;
+        packet->rangeCount = rangeCount;
+
+        auto ranges = GetCommandPacketData<VkImageSubresourceRange>(packet);
+        for (auto i = 0U; i < rangeCount; ++i)
+        {
+            VkImageSubresourceRange& range = ranges[i];
+            range.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
+            range.baseMipLevel = pRanges[i].baseMipLevel;
+            range.levelCount = pRanges[i].levelCount;
+            range.baseArrayLayer = pRanges[i].baseArrayLayer;
+            range.layerCount = pRanges[i].layerCount;
+        }
     }
 
     void StreamEncoder::CmdClearDepthStencilImage(Image* pImage, const VkClearDepthStencilValue* pDepthStencil, uint32_t rangeCount, const VezImageSubresourceRange* pRanges)
     {
         // Add image accesses to PipelineBarriers.
         for (auto i = 0U; i < rangeCount; ++i)
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pImage, &pRanges[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pImage, &pRanges[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_CLEAR_BIT);
 
         // Encode the command to the memory stream.
-        m_stream << CLEAR_DEPTH_STENCIL_IMAGE << pImage << *pDepthStencil << rangeCount;
-        m_stream.Write(pRanges, sizeof(VezImageSubresourceRange) * rangeCount);
+        auto packet = AllocatePacket<ClearDepthStencilImagePacket>(CLEAR_DEPTH_STENCIL_IMAGE, sizeof(VkImageSubresourceRange) * rangeCount);
+        packet->image = pImage->GetHandle();
+        packet->depthStencil = *pDepthStencil;
+        packet->rangeCount = rangeCount;
+
+        auto ranges = GetCommandPacketData<VkImageSubresourceRange>(packet);
+        for (auto i = 0U; i < rangeCount; ++i)
+        {
+            VkImageSubresourceRange& range = ranges[i];
+            range.aspectMask = GetImageAspectFlags(pImage->GetCreateInfo().format);
+            range.baseMipLevel = pRanges[i].baseMipLevel;
+            range.levelCount = pRanges[i].levelCount;
+            range.baseArrayLayer = pRanges[i].baseArrayLayer;
+            range.layerCount = pRanges[i].layerCount;
+        }
     }
 
     void StreamEncoder::CmdClearAttachments(uint32_t attachmentCount, const VezClearAttachment* pAttachments, uint32_t rectCount, const VkClearRect* pRects)
     {
+        // Must be called within a render pass whose framebuffer is known, which excludes secondary command buffers.
+        if (!m_inRenderPass || !m_renderPasses.back().framebuffer)
+            return;
+
         // Encode the command to the memory stream.
-        m_stream << CLEAR_ATTACHMENTS << attachmentCount;
-        m_stream.Write(pAttachments, sizeof(VezClearAttachment) * attachmentCount);
-        m_stream << rectCount;
-        m_stream.Write(pRects, sizeof(VkClearRect) * rectCount);
+        auto packet = AllocatePacket<ClearAttachmentsPacket>(CLEAR_ATTACHMENTS, sizeof(VkClearAttachment) * attachmentCount + sizeof(VkClearRect) * rectCount);
+        packet->attachmentCount = attachmentCount;
+        packet->rectCount = rectCount;
+
+        auto framebuffer = m_renderPasses.back().framebuffer;
+        auto attachments = GetCommandPacketData<VkClearAttachment>(packet);
+        for (auto i = 0U; i < attachmentCount; ++i)
+        {
+            VkClearAttachment& attachment = attachments[i];
+            attachment.aspectMask = GetImageAspectFlags(framebuffer->GetAttachment(i)->GetImage()->GetCreateInfo().format);
+            attachment.colorAttachment = pAttachments[i].colorAttachment;
+            memcpy(&attachment.clearValue, &pAttachments[i].clearValue, sizeof(VkClearValue));
+        }
+
+        memcpy(GetCommandPacketData<VkClearRect>(packet, sizeof(VkClearAttachment) * attachmentCount), pRects, sizeof(VkClearRect) * rectCount);
     }
 
     void StreamEncoder::CmdResolveImage(Image* pSrcImage, Image* pDstImage, uint32_t regionCount, const VezImageResolve* pRegions)
@@ -778,30 +1892,118 @@ namespace vez
             subresourceRange.levelCount = 1;
             subresourceRange.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].srcSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pSrcImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, PIPELINE_STAGE_RESOLVE_BIT);
 
             // Destination image access.
             subresourceRange.baseMipLevel = pRegions[i].dstSubresource.mipLevel;
             subresourceRange.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
             subresourceRange.layerCount = pRegions[i].dstSubresource.layerCount;
-            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            m_pipelineBarriers.ImageAccess(m_stream.TellP(), pDstImage, &subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, PIPELINE_STAGE_RESOLVE_BIT);
         }
 
         // Encode the command to the memory stream.
-        m_stream << RESOLVE_IMAGE << pSrcImage << pDstImage << regionCount;
-        m_stream.Write(pRegions, sizeof(VezImageResolve) * regionCount);
+        auto packet = AllocatePacket<ResolveImagePacket>(RESOLVE_IMAGE, sizeof(VkImageResolve) * regionCount);
+        packet->srcImage = pSrcImage->GetHandle();
+        packet->dstImage = pDstImage->GetHandle();
+        packet->regionCount = regionCount;
+
+        auto regions = GetCommandPacketData<VkImageResolve>(packet);
+        for (auto i = 0U; i < regionCount; ++i)
+        {
+            VkImageResolve& region = regions[i];
+            memcpy(&region.srcOffset, &pRegions[i].srcOffset, sizeof(VkOffset3D));
+            memcpy(&region.dstOffset, &pRegions[i].dstOffset, sizeof(VkOffset3D));
+            memcpy(&region.extent, &pRegions[i].extent, sizeof(VkExtent3D));
+            region.srcSubresource.aspectMask = GetImageAspectFlags(pSrcImage->GetCreateInfo().format);
+            region.srcSubresource.mipLevel = pRegions[i].srcSubresource.mipLevel;
+            region.srcSubresource.baseArrayLayer = pRegions[i].srcSubresource.baseArrayLayer;
+            region.srcSubresource.layerCount = pRegions[i].srcSubresource.layerCount;
+            region.dstSubresource.aspectMask = GetImageAspectFlags(pDstImage->GetCreateInfo().format);
+            region.dstSubresource.mipLevel = pRegions[i].dstSubresource.mipLevel;
+            region.dstSubresource.baseArrayLayer = pRegions[i].dstSubresource.baseArrayLayer;
+            region.dstSubresource.layerCount = pRegions[i].dstSubresource.layerCount;
+        }
     }
 
     void StreamEncoder::CmdSetEvent(VkEvent event, VkPipelineStageFlags stageMask)
     {
         // Encode the command to the memory stream.
-        m_stream << SET_EVENT << event << stageMask;
+        auto packet = AllocatePacket<SetEventPacket>(SET_EVENT);
+        packet->event = event;
+        packet->stageMask = stageMask;
     }
 
     void StreamEncoder::CmdResetEvent(VkEvent event, VkPipelineStageFlags stageMask)
     {
         // Encode the command to the memory stream.
-        m_stream << RESET_EVENT << event << stageMask;
+        auto packet = AllocatePacket<ResetEventPacket>(RESET_EVENT);
+        packet->event = event;
+        packet->stageMask = stageMask;
+    }
+
+    void StreamEncoder::CmdExecuteCommands(uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers)
+    {
+        // Secondary command buffers may only be executed within a render pass of a primary command buffer.
+        if (!m_inRenderPass || m_isSecondary)
+            return;
+
+        // The current subpass's contents are switched to secondary command buffers.
+        auto streamPosition = m_stream.TellP();
+        auto& subpass = m_renderPasses.back().subpasses.back();
+        subpass.contents = VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+        if (subpass.nextSubpassPacket)
+            subpass.nextSubpassPacket->contents = VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+
+        std::vector<CommandBuffer*> secondaries;
+        for (auto i = 0U; i < commandBufferCount; ++i)
+        {
+            // Skip any command buffers that are not recorded secondary command buffers.
+            auto secondary = ppCommandBuffers[i];
+            auto& encoder = secondary->GetStreamEncoder();
+            if (secondary->GetLevel() != VK_COMMAND_BUFFER_LEVEL_SECONDARY || encoder.m_renderPasses.empty())
+                continue;
+
+            // Merge the secondary command buffer's resource accesses so the required barriers are hoisted before the render pass.
+            for (auto& itr : encoder.m_pipelineBarriers.GetBufferAccesses())
+            {
+                for (auto& entry : itr.second)
+                    m_pipelineBarriers.BufferAccess(streamPosition, itr.first, entry.offset, entry.range, entry.accessMask, entry.stageMask);
+            }
+
+            std::vector<PipelineBarriers::ImageAccessInfo> imageAccesses;
+            for (auto& itr : encoder.m_pipelineBarriers.GetImageAccesses())
+            {
+                itr.second.GetAccesses(imageAccesses);
+                for (auto& entry : imageAccesses)
+                    m_pipelineBarriers.ImageAccess(streamPosition, itr.first, &entry.subresourceRange, entry.layout, entry.accessMask, entry.stageMask);
+            }
+
+            // Merge the attachment locations written by the secondary command buffer's pipelines.
+            const auto& secondarySubpass = encoder.m_renderPasses.back().subpasses.back();
+            for (auto location : secondarySubpass.outputAttachments)
+                AddOutputAttachment(subpass, location);
+
+            subpass.depthStencilStageMask |= secondarySubpass.depthStencilStageMask;
+            subpass.depthStencilAccessMask |= secondarySubpass.depthStencilAccessMask;
+
+            secondaries.push_back(secondary);
+        }
+
+        if (secondaries.empty())
+            return;
+
+        m_executesSecondaryCommandBuffers = true;
+
+        // Encode the command to the memory stream.  Each secondary command buffer's native handle depends on the render pass and subpass it
+        // is resolved against, so it is filled in once the render pass ends.
+        auto packet = AllocatePacket<ExecuteCommandsPacket>(EXECUTE_COMMANDS, sizeof(VkCommandBuffer) * secondaries.size());
+        packet->commandBufferCount = static_cast<uint32_t>(secondaries.size());
+        auto pHandles = GetCommandPacketData<VkCommandBuffer>(packet);
+        for (auto i = 0U; i < secondaries.size(); ++i)
+        {
+            pHandles[i] = VK_NULL_HANDLE;
+            subpass.secondaryCommandBuffers.push_back(std::make_tuple(secondaries[i], &pHandles[i]));
+        }
     }
 
     void StreamEncoder::BindDescriptorSet()
@@ -858,18 +2060,17 @@ namespace vez
                     if (!descriptorSetLayout)
                         continue;
 
-                    // Allocate a new descriptor set. (TODO! Log or report error if allocation fails)
-                    auto descriptorSet = descriptorSetLayout->AllocateDescriptorSet();
-                    if (!descriptorSet)
-                        continue;
-
-                    // Set descriptor set layout as active for given set index.
-                    m_boundDescriptorSetLayouts[set] = descriptorSetLayout;
-
-                    // Update all of the set's bindings.
-                    std::vector<VkDescriptorBufferInfo> bufferInfos;
-                    std::vector<VkDescriptorImageInfo> imageInfos;
-                    std::vector<VkWriteDescriptorSet> descriptorWrites;
+                    // Pack the set's descriptors into records ordered for the layout's update template, reusing the encoder's storage, along with
+                    // their writes and a description of the set's exact contents and the resources they reference.
+                    auto& records = m_descriptorRecords;
+                    auto& descriptorWrites = m_descriptorWrites;
+                    auto& contents = m_descriptorSetContents;
+                    auto& resources = m_descriptorSetResources;
+                    records.resize(descriptorSetLayout->GetDescriptorCount());
+                    descriptorWrites.clear();
+                    contents.clear();
+                    resources.clear();
+                    contents.push_back(reinterpret_cast<uint64_t>(descriptorSetLayout));
                     for (auto bindingItr : setBindings.bindings)
                     {
                         // Get layout binding for given binding index.
@@ -897,11 +2098,14 @@ namespace vez
                             // Get the binding info.
                             auto arrayElement = arrayElementItr.first;
                             auto& bindingInfo = arrayElementItr.second;
+                            if (arrayElement >= layoutBinding->descriptorCount)
+                                continue;
+
+                            auto& record = records[descriptorSetLayout->GetRecordIndex(binding) + arrayElement];
 
                             // Fill in descriptor set write structure.
                             VkWriteDescriptorSet dsWrite = {};
                             dsWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                            dsWrite.dstSet = descriptorSet;
                             dsWrite.dstBinding = binding;
                             dsWrite.dstArrayElement = arrayElement;
                             dsWrite.descriptorType = layoutBinding->descriptorType;
@@ -910,19 +2114,16 @@ namespace vez
                             // Handle buffers.
                             if (bindingInfo.pBuffer)
                             {
-                                VkDescriptorBufferInfo bufferInfo = {};
-                                bufferInfo.buffer = bindingInfo.pBuffer->GetHandle();
-                                bufferInfo.offset = bindingInfo.offset;
-                                bufferInfo.range = bindingInfo.range;
-                                bufferInfos.push_back(bufferInfo);
-                                dsWrite.pBufferInfo = reinterpret_cast<const VkDescriptorBufferInfo*>(bufferInfos.size());
+                                record.bufferInfo = { bindingInfo.pBuffer->GetHandle(), bindingInfo.offset, bindingInfo.range };
+                                dsWrite.pBufferInfo = &record.bufferInfo;
                                 m_pipelineBarriers.BufferAccess(m_stream.TellP(), bindingInfo.pBuffer, bindingInfo.offset, bindingInfo.range, accessMask, stageMask);
                             }
                             // Handle buffer views.
                             else if (bindingInfo.pBufferView)
                             {
-                                dsWrite.pTexelBufferView = &bindingInfo.pBufferView->GetHandle();
-                                m_pipelineBarriers.BufferAccess(m_stream.TellP(), bindingInfo.pBuffer, bindingInfo.pBufferView->GetOffset(), bindingInfo.pBufferView->GetRange(), accessMask, stageMask);
+                                record.texelBufferView = bindingInfo.pBufferView->GetHandle();
+                                dsWrite.pTexelBufferView = &record.texelBufferView;
+                                m_pipelineBarriers.BufferAccess(m_stream.TellP(), bindingInfo.pBufferView->GetBuffer(), bindingInfo.pBufferView->GetOffset(), bindingInfo.pBufferView->GetRange(), accessMask, stageMask);
                             }
                             // Handle images and samplers.
                             else if (bindingInfo.pImageView || bindingInfo.sampler != VK_NULL_HANDLE)
@@ -937,17 +2138,18 @@ namespace vez
                                 if (bindingInfo.pImageView)
                                 {
                                     imageInfo.imageView = bindingInfo.pImageView->GetHandle();
-                                    imageInfo.imageLayout = m_pipelineBarriers.GetImageLayout(bindingInfo.pImageView);
-                                    
+
                                     switch (dsWrite.descriptorType)
                                     {
                                     case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
                                     case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
-                                        //imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                                        //m_pipelineBarriers.ImageAccess(m_stream.TellP(), bindingInfo.pImageView->GetImage(), &bindingInfo.pImageView->GetSubresourceRange(), imageInfo.imageLayout, accessMask, stageMask);
+                                        // Sampled images are transitioned to their read only layout, whose barriers within a render pass are inserted before it begins.
+                                        imageInfo.imageLayout = bindingInfo.pImageView->GetImage()->GetShaderReadLayout();
+                                        m_pipelineBarriers.ImageAccess(m_stream.TellP(), bindingInfo.pImageView->GetImage(), &bindingInfo.pImageView->GetSubresourceRange(), imageInfo.imageLayout, accessMask, stageMask);
                                         break;
 
                                     case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+                                        m_pipelineBarriers.GetImageLayout(m_stream.TellP(), bindingInfo.pImageView);
                                         imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
                                         break;
 
@@ -961,8 +2163,39 @@ namespace vez
                                     }
                                 }
 
-                                imageInfos.push_back(imageInfo);
-                                dsWrite.pImageInfo = reinterpret_cast<const VkDescriptorImageInfo*>(imageInfos.size());
+                                record.imageInfo = imageInfo;
+                                dsWrite.pImageInfo = &record.imageInfo;
+                            }
+                            else
+                            {
+                                continue;
+                            }
+
+                            // Describe the descriptor's contents.
+                            contents.push_back((static_cast<uint64_t>(binding) << 32) | arrayElement);
+                            contents.push_back(static_cast<uint64_t>(dsWrite.descriptorType));
+                            if (dsWrite.pBufferInfo)
+                            {
+                                contents.push_back(reinterpret_cast<uint64_t>(record.bufferInfo.buffer));
+                                contents.push_back(record.bufferInfo.offset);
+                                contents.push_back(record.bufferInfo.range);
+                                resources.push_back(reinterpret_cast<uint64_t>(record.bufferInfo.buffer));
+                            }
+                            else if (dsWrite.pImageInfo)
+                            {
+                                contents.push_back(reinterpret_cast<uint64_t>(record.imageInfo.sampler));
+                                contents.push_back(reinterpret_cast<uint64_t>(record.imageInfo.imageView));
+                                contents.push_back(static_cast<uint64_t>(record.imageInfo.imageLayout));
+                                if (record.imageInfo.sampler != VK_NULL_HANDLE)
+                                    resources.push_back(reinterpret_cast<uint64_t>(record.imageInfo.sampler));
+
+                                if (record.imageInfo.imageView != VK_NULL_HANDLE)
+                                    resources.push_back(reinterpret_cast<uint64_t>(record.imageInfo.imageView));
+                            }
+                            else
+                            {
+                                contents.push_back(reinterpret_cast<uint64_t>(record.texelBufferView));
+                                resources.push_back(reinterpret_cast<uint64_t>(record.texelBufferView));
                             }
 
                             // Add the descriptor set write to the list.
@@ -970,27 +2203,65 @@ namespace vez
                         }
                     }
 
-                    // Iterate back over descriptorWrites array and fix pointer addresses.
-                    for (auto& dswrite : descriptorWrites)
+                    if (m_memoize)
+                        m_recordedResources.insert(m_recordedResources.end(), resources.cbegin(), resources.cend());
+
+                    // Push descriptor layouts store their descriptors in the stream, to be pushed in place of binding a descriptor set.
+                    // They are zero initialized first so identical descriptors always encode to identical bytes.
+                    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+                    auto firstPushDescriptor = static_cast<uint32_t>(m_pushDescriptors.size());
+                    if (descriptorSetLayout->IsPushDescriptor())
+                    {
+                        for (auto& dsWrite : descriptorWrites)
+                        {
+                            PushDescriptor pushDescriptor;
+                            memset(&pushDescriptor, 0, sizeof(PushDescriptor));
+                            pushDescriptor.binding = dsWrite.dstBinding;
+                            pushDescriptor.arrayElement = dsWrite.dstArrayElement;
+                            pushDescriptor.descriptorType = dsWrite.descriptorType;
+                            if (dsWrite.pBufferInfo)
+                                pushDescriptor.record.bufferInfo = *dsWrite.pBufferInfo;
+                            else if (dsWrite.pImageInfo)
+                                pushDescriptor.record.imageInfo = *dsWrite.pImageInfo;
+                            else
+                                pushDescriptor.record.texelBufferView = *dsWrite.pTexelBufferView;
+
+                            m_pushDescriptors.push_back(pushDescriptor);
+                        }
+                    }
+                    // Transient descriptor sets are bump allocated from the command buffer's own pools, reset in bulk along with the recording.
+                    else if (m_transientDescriptorSets)
+                    {
+                        auto& descriptorPool = m_transientDescriptorPools[descriptorSetLayout];
+                        if (!descriptorPool)
+                            descriptorPool = new LinearDescriptorPool(descriptorSetLayout);
+
+                        descriptorSet = descriptorPool->AllocateDescriptorSet();
+                        if (!descriptorSet)
+                            continue;
+
+                        descriptorSetLayout->UpdateDescriptorSet(descriptorSet, records.data(), descriptorWrites);
+                    }
+                    else
                     {
-                        if (dswrite.pBufferInfo)
-                            dswrite.pBufferInfo = &bufferInfos[reinterpret_cast<uint64_t>(dswrite.pBufferInfo) - 1];
-                        else if (dswrite.pImageInfo)
-                            dswrite.pImageInfo = &imageInfos[reinterpret_cast<uint64_t>(dswrite.pImageInfo) - 1];
+                        // Get a descriptor set with these contents from the device's cache, which only writes newly allocated sets.
+                        // (TODO! Log or report error if allocation fails)
+                        auto descriptorSetCache = m_commandBuffer->GetPool()->GetDevice()->GetDescriptorSetCache();
+                        descriptorSet = descriptorSetCache->AcquireDescriptorSet(descriptorSetLayout, contents, resources, records.data(), descriptorWrites);
+                        if (!descriptorSet)
+                            continue;
+
+                        // Retain the descriptor set until the recording is reset.
+                        m_descriptorSets.push_back(descriptorSet);
                     }
 
-                    // Update descriptor set.
-                    auto device = m_commandBuffer->GetPool()->GetDevice()->GetHandle();
-                    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+                    // Set descriptor set layout as active for given set index.
+                    m_boundDescriptorSetLayouts[set] = descriptorSetLayout;
 
                     // Store descriptor set binding for current stream encoder position.
-                    DescriptorSetBinding dsb = { m_stream.TellP(), pipeline->GetBindPoint(), pipeline->GetPipelineLayout(), set, descriptorSet };
+                    auto pushDescriptorCount = static_cast<uint32_t>(m_pushDescriptors.size()) - firstPushDescriptor;
+                    DescriptorSetBinding dsb = { m_stream.TellP(), pipeline->GetBindPoint(), pipeline->GetPipelineLayout(), set, descriptorSet, firstPushDescriptor, pushDescriptorCount };
                     m_descriptorSetBindings.push_back(dsb);
-
-                    // Add descriptor set to transient resource list. 
-                    m_transientResources.push_back([descriptorSetLayout, descriptorSet]() -> void {
-                        descriptorSetLayout->FreeDescriptorSet(descriptorSet);
-                    });
                 }
             }
         }
@@ -1019,6 +2290,16 @@ namespace vez
                     auto& subpass = m_renderPasses.back().subpasses.back();
                     subpass.pipelineBindings.push_back({ m_stream.TellP(), pipeline, m_graphicsState });
 
+                    // Track the depth stencil attachment accesses made by the fragment tests enabled in the graphics state.
+                    const auto& depthStencilState = m_graphicsState.GetDepthStencilState();
+                    if (depthStencilState.depthTestEnable || depthStencilState.depthBoundsTestEnable || depthStencilState.stencilTestEnable)
+                    {
+                        subpass.depthStencilStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                        subpass.depthStencilAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+                        if ((depthStencilState.depthTestEnable && depthStencilState.depthWriteEnable) || WritesStencil(depthStencilState))
+                            subpass.depthStencilAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                    }
+
                     // Update subpass outputAttachments array based on which locations pipeline writes to.
                     // Outputs from fragment shader stage will exist in set 0.
                     auto set0Bindings = pipeline->GetBindings().find(0);
@@ -1028,39 +2309,19 @@ namespace vez
                         for (auto& resource : set0Bindings->second)
                         {
                             if (resource.stages == VK_SHADER_STAGE_FRAGMENT_BIT && resource.resourceType == VEZ_PIPELINE_RESOURCE_TYPE_OUTPUT)
-                            {
-                                // Add output location to subpass's outputAttachments array.
-                                subpass.outputAttachments.emplace(resource.location);
-
-                                // Set stage and access masks appropriately based on attachment format.
-                                // Check for existence of attachment index for the case of GLSL error or framebuffer with no attachments.
-                                auto framebuffer = reinterpret_cast<Framebuffer*>(m_renderPasses.back().framebuffer);
-                                if (resource.location < framebuffer->GetAttachmentCount())
-                                {
-                                    auto imageView = framebuffer->GetAttachment(resource.location);
-                                    if (IsDepthStencilFormat(imageView->GetFormat()))
-                                    {
-                                        subpass.dependency.dstStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-                                        subpass.dependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-                                    }
-                                    else
-                                    {
-                                        subpass.dependency.dstStageMask |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-                                        subpass.dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-                                    }
-                                }
-                            }
+                                AddOutputAttachment(subpass, resource.location);
                         }
                     }
 
                     // Iterate over all sets and bindings to find any input attachments.
+                    // Input attachments are not supported within secondary command buffers, which have no framebuffer.
                     auto sets = pipeline->GetBindings();
                     for (auto& itr : sets)
                     {
                         auto& bindings = itr.second;
                         for (auto& entry : bindings)
                         {
-                            if (entry.resourceType == VEZ_PIPELINE_RESOURCE_TYPE_INPUT_ATTACHMENT)
+                            if (entry.resourceType == VEZ_PIPELINE_RESOURCE_TYPE_INPUT_ATTACHMENT && m_renderPasses.back().framebuffer)
                             {
                                 // Add image access to resource bindings so the input attachment is bound to a descriptor set.
                                 auto framebuffer = reinterpret_cast<Framebuffer*>(m_renderPasses.back().framebuffer);
@@ -1083,37 +2344,220 @@ namespace vez
         }
     }
 
-    void StreamEncoder::EndSubpass()
+    void StreamEncoder::AddOutputAttachment(SubpassDesc& subpass, uint32_t location)
     {
-        // Get the current subpass dependency object.
-        auto& subpassDependency = m_renderPasses.back().subpasses.back().dependency;
+        // Add output location to subpass's outputAttachments array.
+        subpass.outputAttachments.emplace(location);
 
-        // Determine appropriate bits for pipeline stage and access masks.  Simply do a bitwise or with the last pipeline barrier.
-        // Pipeline barrier should then be removed from list since they will not be inserted during a subpass.
-        // If stage masks are 0 (meaning no dependencies were found during stream encoding, set them to default values).
-        if (!m_pipelineBarriers.GetBarriers().empty())
+        // Outputs to the depth stencil attachment are written by the fragment tests.
+        // Check for existence of attachment index for the case of GLSL error or framebuffer with no attachments.
+        auto framebuffer = reinterpret_cast<Framebuffer*>(m_renderPasses.back().framebuffer);
+        if (framebuffer && location < framebuffer->GetAttachmentCount() && IsDepthStencilFormat(framebuffer->GetAttachment(location)->GetFormat()))
         {
-            const auto& barrier = m_pipelineBarriers.GetBarriers().back();
-            subpassDependency.srcStageMask |= barrier.srcStageMask;
-            subpassDependency.dstStageMask |= barrier.dstStageMask;
+            subpass.depthStencilStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            subpass.depthStencilAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        }
+    }
+
+    void StreamEncoder::BuildSubpassDependencies(RenderPassDesc& renderPassDesc, uint64_t endStreamPos)
+    {
+        // Stages and accesses of a subpass's use of an attachment.
+        struct AttachmentUsage
+        {
+            VkPipelineStageFlags stageMask;
+            VkAccessFlags readMask;
+            VkAccessFlags writeMask;
+        };
+
+        // Dependencies between the same subpasses with the same flags are combined into one.
+        auto& dependencies = renderPassDesc.dependencies;
+        auto addDependency = [&](uint32_t srcSubpass, uint32_t dstSubpass, VkPipelineStageFlags srcStageMask, VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask, VkDependencyFlags dependencyFlags) {
+            for (auto& dependency : dependencies)
+            {
+                if (dependency.srcSubpass == srcSubpass && dependency.dstSubpass == dstSubpass && dependency.dependencyFlags == dependencyFlags)
+                {
+                    dependency.srcStageMask |= srcStageMask;
+                    dependency.dstStageMask |= dstStageMask;
+                    dependency.srcAccessMask |= srcAccessMask;
+                    dependency.dstAccessMask |= dstAccessMask;
+                    return;
+                }
+            }
+
+            dependencies.push_back({ srcSubpass, dstSubpass, srcStageMask, dstStageMask, srcAccessMask, dstAccessMask, dependencyFlags });
+        };
+
+        // Returns the subpass containing the command at a stream position within the render pass.
+        auto& subpasses = renderPassDesc.subpasses;
+        auto findSubpass = [&](uint64_t streamPos) {
+            auto subpass = 0U;
+            while (subpass + 1 < subpasses.size() && subpasses[subpass + 1].streamPosition < streamPos)
+                ++subpass;
+
+            return subpass;
+        };
+
+        auto subpassCount = static_cast<uint32_t>(subpasses.size());
+        auto framebuffer = reinterpret_cast<Framebuffer*>(renderPassDesc.framebuffer);
+        for (auto i = 0U; i < renderPassDesc.attachments.size(); ++i)
+        {
+            auto imageView = framebuffer->GetAttachment(i);
+            auto& attachment = renderPassDesc.attachments[i];
+            bool isDepthStencil = IsDepthStencilFormat(attachment.format);
+
+            // Determine how each subpass uses the attachment.  The depth stencil attachment is referenced by every subpass.
+            std::vector<AttachmentUsage> usages(subpassCount, AttachmentUsage{});
+            auto firstSubpass = subpassCount;
+            auto lastSubpass = 0U;
+            for (auto k = 0U; k < subpassCount; ++k)
+            {
+                auto& usage = usages[k];
+                if (isDepthStencil)
+                {
+                    usage.stageMask = subpasses[k].depthStencilStageMask;
+                    usage.readMask = subpasses[k].depthStencilAccessMask & VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+                    usage.writeMask = subpasses[k].depthStencilAccessMask & VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                }
+                else if (subpasses[k].outputAttachments.find(i) != subpasses[k].outputAttachments.end())
+                {
+                    usage.stageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+                    usage.readMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+                    usage.writeMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+                }
+
+                if (subpasses[k].inputAttachments.find(i) != subpasses[k].inputAttachments.end())
+                {
+                    usage.stageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+                    usage.readMask |= VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+                }
+
+                if (usage.stageMask != 0 || isDepthStencil)
+                {
+                    firstSubpass = std::min(firstSubpass, k);
+                    lastSubpass = k;
+                }
+            }
 
-            for (auto& entry : barrier.bufferBarriers)
+            // Skip attachments no subpass references.
+            if (firstSubpass == subpassCount)
+                continue;
+
+            // Subpasses that neither write the depth stencil attachment nor clear it reference it in the read-only layout.
+            // When no subpass writes it, the attachment is only read by the render pass.
+            bool readOnly = isDepthStencil;
+            if (isDepthStencil)
+            {
+                for (auto k = 0U; k < subpassCount; ++k)
+                {
+                    bool writes = (usages[k].writeMask != 0 || (k == firstSubpass && attachment.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD));
+                    subpasses[k].depthStencilLayout = writes ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+                    readOnly = readOnly && !writes;
+                }
+            }
+
+            // Each subpass waits on the last subpass writing the attachment before it, and when writing, on the subpasses reading it since.
+            // Attachments are only accessed at the same framebuffer location, so these dependencies are by region.
+            for (auto dst = firstSubpass + 1; dst <= lastSubpass; ++dst)
             {
-                subpassDependency.srcAccessMask |= entry.srcAccessMask;
-                subpassDependency.dstAccessMask |= entry.dstAccessMask;
+                if (usages[dst].stageMask == 0)
+                    continue;
+
+                for (auto src = dst; src-- > firstSubpass;)
+                {
+                    if (usages[src].stageMask == 0)
+                        continue;
+
+                    if (usages[src].writeMask != 0 || usages[dst].writeMask != 0)
+                        addDependency(src, dst, usages[src].stageMask, usages[src].writeMask, usages[dst].stageMask, usages[dst].readMask | usages[dst].writeMask, VK_DEPENDENCY_BY_REGION_BIT);
+
+                    if (usages[src].writeMask != 0)
+                        break;
+                }
             }
 
-            for (auto& entry : barrier.imageBarriers)
+            // Load operations take place in the first subpass referencing the attachment and store operations in the last one.
+            VkPipelineStageFlags loadStoreStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            VkAccessFlags loadAccessMask = (attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            VkAccessFlags storeAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            if (isDepthStencil)
             {
-                subpassDependency.srcAccessMask |= entry.srcAccessMask;
-                subpassDependency.dstAccessMask |= entry.dstAccessMask;
+                loadStoreStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                loadAccessMask = (attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                storeAccessMask = readOnly ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
             }
+
+            // Record the attachment's final access and find the accesses preceding the render pass it must wait on.
+            // The render pass starts from the layout the attachment is left in, which may have changed since it began when accesses within
+            // the render pass required a layout transition before it.
+            VkAccessFlags srcAccessMask = 0;
+            VkPipelineStageFlags srcStageMask = 0;
+            m_pipelineBarriers.AttachmentAccess(endStreamPos + 1ULL, imageView->GetImage(), &imageView->GetSubresourceRange(), attachment.finalLayout, storeAccessMask, loadStoreStageMask, &srcAccessMask, &srcStageMask, &attachment.initialLayout);
+            if (srcStageMask == 0)
+                srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+            // The first subpass referencing the attachment waits on the preceding accesses only in the stages using the attachment.
+            auto& firstUsage = usages[firstSubpass];
+            addDependency(VK_SUBPASS_EXTERNAL, firstSubpass, srcStageMask, srcAccessMask, firstUsage.stageMask | loadStoreStageMask, firstUsage.readMask | firstUsage.writeMask | loadAccessMask, 0);
+
+            // Later commands wait on the attachment's final access in the store operation's stages, which the final layout transition must precede.
+            // A read-only attachment has no writes for them to wait on.
+            auto& lastUsage = usages[lastSubpass];
+            addDependency(lastSubpass, VK_SUBPASS_EXTERNAL, lastUsage.stageMask | loadStoreStageMask, lastUsage.writeMask | (readOnly ? 0 : storeAccessMask), loadStoreStageMask, 0, 0);
         }
 
-        if (subpassDependency.srcStageMask == 0)
-            subpassDependency.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        // Pipeline barriers recorded within the render pass protect resources other than attachments.  The ones waiting on accesses in earlier
+        // subpasses become dependencies between those subpasses, along with an external dependency for any accesses preceding the render pass.
+        // The rest are combined into a single pipeline barrier inserted before the render pass, as are any requiring layout transitions.
+        auto startStreamPos = renderPassDesc.streamPosition;
+        auto& barriers = m_pipelineBarriers.GetBarriers();
+        auto it = barriers.begin();
+        while (it != barriers.end() && it->streamPosition < startStreamPos)
+            ++it;
+
+        PipelineBarrier renderPassBarrier = { startStreamPos, 0, 0, {}, {} };
+        while (it != barriers.end() && it->streamPosition <= endStreamPos)
+        {
+            auto dstSubpass = findSubpass(it->streamPosition);
+            auto srcSubpass = (it->signalStreamPosition > startStreamPos) ? findSubpass(it->signalStreamPosition - 1ULL) : dstSubpass;
+            bool layoutTransition = std::any_of(it->imageBarriers.begin(), it->imageBarriers.end(), [](const VkImageMemoryBarrier& imageBarrier) {
+                return imageBarrier.oldLayout != imageBarrier.newLayout;
+            });
+
+            if (srcSubpass < dstSubpass && !layoutTransition)
+            {
+                VkAccessFlags srcAccessMask = 0, dstAccessMask = 0;
+                for (auto& entry : it->bufferBarriers)
+                {
+                    srcAccessMask |= entry.srcAccessMask;
+                    dstAccessMask |= entry.dstAccessMask;
+                }
+
+                for (auto& entry : it->imageBarriers)
+                {
+                    srcAccessMask |= entry.srcAccessMask;
+                    dstAccessMask |= entry.dstAccessMask;
+                }
 
-        if (subpassDependency.dstStageMask == 0)
-            subpassDependency.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    }    
-}
\ No newline at end of file
+                auto srcStageMask = GetLegacyStageMask(it->srcStageMask);
+                auto dstStageMask = GetLegacyStageMask(it->dstStageMask);
+                addDependency(srcSubpass, dstSubpass, srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, 0);
+                addDependency(VK_SUBPASS_EXTERNAL, dstSubpass, srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, 0);
+            }
+            else
+            {
+                renderPassBarrier.srcStageMask |= it->srcStageMask;
+                renderPassBarrier.dstStageMask |= it->dstStageMask;
+                renderPassBarrier.signalStreamPosition = std::max(renderPassBarrier.signalStreamPosition, it->signalStreamPosition);
+                renderPassBarrier.bufferBarriers.insert(renderPassBarrier.bufferBarriers.end(), it->bufferBarriers.begin(), it->bufferBarriers.end());
+                renderPassBarrier.imageBarriers.insert(renderPassBarrier.imageBarriers.end(), it->imageBarriers.begin(), it->imageBarriers.end());
+                renderPassBarrier.bufferBarrierStages.insert(renderPassBarrier.bufferBarrierStages.end(), it->bufferBarrierStages.begin(), it->bufferBarrierStages.end());
+                renderPassBarrier.imageBarrierStages.insert(renderPassBarrier.imageBarrierStages.end(), it->imageBarrierStages.begin(), it->imageBarrierStages.end());
+            }
+
+            it = barriers.erase(it);
+        }
+
+        if (renderPassBarrier.srcStageMask != 0)
+            barriers.insert(it, renderPassBarrier);
+    }
+}
@@ -27,73 +27,29 @@
 #include <set>
 #include <functional>
 #include <map>
+#include <tuple>
 #include "Utility/MemoryStream.h"
+#include "Utility/SpinLock.h"
 #include "VEZ.h"
 #include "GraphicsState.h"
 #include "ResourceBindings.h"
 #include "PipelineBarriers.h"
+#include "DescriptorSetLayout.h"
+#include "DescriptorSetCache.h"
+#include "CommandPackets.h"
 
 namespace vez
 {
     // Forward declarations.
     class DescriptorSetLayout;
+    class LinearDescriptorPool;
     class CommandBuffer;
     class RenderPass;
     class BufferView;
+    class MemoryBlockPool;
+    class Queue;
 
-    // List of all VulkanEZ commands which are encoded during command buffer recording.
-    typedef enum CommandID
-    {
-        BEGIN_RENDER_PASS,
-        NEXT_SUBPASS,
-        END_RENDER_PASS,
-        BIND_PIPELINE,
-        PUSH_CONSTANTS,
-        BIND_BUFFER,
-        BIND_BUFFER_VIEW,
-        BIND_IMAGE_VIEW,
-        BIND_SAMPLER,
-        BIND_VERTEX_BUFFERS,
-        BIND_INDEX_BUFFER,
-        SET_VERTEX_INPUT_FORMAT,
-        SET_VIEWPORT_STATE,
-        SET_INPUT_ASSEMBLY_STATE,
-        SET_RASTERIZATION_STATE,
-        SET_MULTISAMPLE_STATE,
-        SET_DEPTH_STENCIL_STATE,
-        SET_COLOR_BLEND_STATE,
-        SET_VIEWPORT,
-        SET_SCISSOR,
-        SET_LINE_WIDTH,
-        SET_DEPTH_BIAS,
-        SET_BLEND_CONSTANTS,
-        SET_DEPTH_BOUNDS,
-        SET_STENCIL_COMPARE_MASK,
-        SET_STENCIL_WRITE_MASK,
-        SET_STENCIL_REFERENCE,
-        DRAW,
-        DRAW_INDEXED,
-        DRAW_INDIRECT,
-        DRAW_INDEXED_INDIRECT,
-        DISPATCH,
-        DISPATCH_INDIRECT,
-        COPY_BUFFER,
-        COPY_IMAGE,
-        BLIT_IMAGE,
-        COPY_BUFFER_TO_IMAGE,
-        COPY_IMAGE_TO_BUFFER,
-        UPDATE_BUFFER,
-        FILL_BUFFER,
-        CLEAR_COLOR_IMAGE,
-        CLEAR_DEPTH_STENCIL_IMAGE,
-        CLEAR_ATTACHMENTS,
-        RESOLVE_IMAGE,
-        SET_EVENT,
-        RESET_EVENT,
-        COMMAND_ID_COUNT,
-    } CommandID;
-
-    // Type declaration for transient resource destruction lambdas (render passes, descriptor sets).
+    // Type declaration for transient resource destruction lambdas (render passes).
     typedef std::vector<std::function<void()>> TransientResources;
 
     // Descriptor set binding structure to be inserted into the command stream during decoding.
@@ -104,6 +60,8 @@ namespace vez
         VkPipelineLayout pipelineLayout;
         uint32_t setIndex;
         VkDescriptorSet descriptorSet;
+        uint32_t firstPushDescriptor;
+        uint32_t pushDescriptorCount;
     };
 
     // Pipeline bindings that occurred within a subpass.
@@ -120,8 +78,13 @@ namespace vez
         uint64_t streamPosition;
         std::set<uint32_t> inputAttachments;
         std::set<uint32_t> outputAttachments;
+        VkPipelineStageFlags depthStencilStageMask;
+        VkAccessFlags depthStencilAccessMask;
+        VkImageLayout depthStencilLayout;
         std::list<SubpassPipelineBinding> pipelineBindings;
-        VkSubpassDependency dependency;
+        VkSubpassContents contents;
+        NextSubpassPacket* nextSubpassPacket;
+        std::vector<std::tuple<CommandBuffer*, VkCommandBuffer*>> secondaryCommandBuffers;
     };
 
     // RenderPass binding to be inserted into the command stream during decoding.
@@ -133,7 +96,9 @@ namespace vez
         std::vector<VkAttachmentDescription> attachments;
         std::vector<VkClearValue> clearValues;
         std::vector<SubpassDesc> subpasses;
+        std::vector<VkSubpassDependency> dependencies;
         RenderPass* renderPass;
+        bool orderIndependentDraws;
     };
 
     // Pipeline bindings to be inserted into the command stream during decoding.
@@ -145,30 +110,81 @@ namespace vez
         VkPipelineLayout pipelineLayout;
     };
 
+    // Number of commands removed or merged by the optimization pass of the last recording.
+    struct StreamOptimizationStatistics
+    {
+        uint32_t redundantStateCount;
+        uint32_t unusedStateCount;
+        uint32_t noOpCommandCount;
+        uint32_t coalescedCopyCount;
+        uint32_t coalescedCopyRegionCount;
+        uint32_t mergedDrawCount;
+        uint32_t sortedDrawCount;
+        uint32_t splitBarrierCount;
+        uint32_t mergedBarrierCount;
+    };
+
     // Command buffer stream encoder class for serializing incoming calls to an in memory binary stream.
     // The StreamEncoder class is responsible for automatic pipeline barrier insertion determination and descriptor set
     // creation from resource bindings.
+    // When recording ends, the pipeline barriers, render pass begins, pipeline bindings and descriptor set bindings are spliced
+    // into the recorded commands as packets, producing a single timeline stream that StreamDecoder replays in one linear pass.
+    // Redundant or unused state, no-op commands and consecutive buffer copies and indexed draws are removed or merged along the way,
+    // and draws within render passes begun with orderIndependentDraws are reordered to minimize state changes.
     class StreamEncoder
     {
     public:
-        StreamEncoder(CommandBuffer* comandBuffer, uint64_t memoryStreamBlockSize);
+        StreamEncoder(CommandBuffer* comandBuffer, MemoryBlockPool* pStreamBlockPool);
         
         ~StreamEncoder();
 
-        MemoryStream& GetStream() { return m_stream; }
+        MemoryStream& GetTimeline() { return m_timeline; }
+
+        // When enabled, the previous recording's descriptor sets and timeline are retained until the next recording ends so
+        // identical descriptor sets are reused and an unchanged timeline can be detected.
+        // A timeline is never unchanged once a buffer, image, view or sampler the previous recording referenced is destroyed, or
+        // when barriers were split, since each recording waits on events of its own.
+        void SetMemoization(bool enabled);
+
+        // Marks the previous recording as changed if it referenced the destroyed resource handle.
+        void InvalidateResource(uint64_t handle);
+
+        // When enabled, consecutive indexed draws with no state changes between them are merged into a single multi-draw
+        // indirect command reading its arguments from a host visible buffer owned by the stream encoder.
+        void SetDrawMerging(bool enabled) { m_mergeDraws = enabled; }
 
-        const std::list<PipelineBarrier>& GetPipelineBarriers() { return m_pipelineBarriers.GetBarriers(); }
+        // When enabled, pipeline barriers outside of render passes with enough independent work recorded between the accesses they wait on
+        // and themselves are split into an event set after those accesses and waited on in place of the barrier.
+        void SetSplitBarriers(bool enabled) { m_splitBarriers = enabled; }
 
-        const std::vector<RenderPassDesc>& GetRenderPassBindings() const { return m_renderPasses; }
+        // When enabled, descriptor sets are allocated from the stream encoder's own linear descriptor pools, which are reset when the
+        // recording is, instead of being shared with other command buffers through the device's descriptor set cache.
+        void SetTransientDescriptorSets(bool enabled) { m_transientDescriptorSets = enabled; }
 
-        const std::vector<DescriptorSetBinding>& GetDescriptorSetBindings() const { return m_descriptorSetBindings; }
+        // Returns whether the last recording produced exactly the same timeline as the one before it.
+        bool IsTimelineUnchanged() const { return m_timelineUnchanged; }
 
-        const std::vector<PipelineBinding>& GetPipelineBindings() const { return m_pipelineBindings; }
+        const StreamOptimizationStatistics& GetOptimizationStatistics() const { return m_optimizationStatistics; }
+
+        // Returns whether the recording executes any secondary command buffers.
+        bool ExecutesSecondaryCommandBuffers() const { return m_executesSecondaryCommandBuffers; }
+
+        // Returns the first error encountered while recording, such as an executed secondary command buffer that failed to resolve.
+        VkResult GetRecordingResult() const { return m_recordingResult; }
+
+        // Patches a secondary recording's graphics pipeline bindings with pipelines compatible with the given render pass and subpass.
+        void ResolvePipelines(RenderPass* pRenderPass, uint32_t subpassIndex);
+
+        void Reset();
 
         void Begin();
 
         void End();
 
+        // Appends the transitions from the images' resident layouts to those the recording assumed, in submission order to the queue.
+        // Ownership of exclusively owned resources last used by a queue of another family is transferred with release barriers for that queue.
+        void ResolveResidentState(Queue* pQueue, ResidentStateUpdates& updates, PipelineBarrier& barrier, std::unordered_map<Queue*, PipelineBarrier>& releaseBarriers);
+
         void TransitionImageLayout(Image* pImage, const VezImageSubresourceRange* range, VkImageLayout layout, VkAccessFlags accessMask, VkPipelineStageFlags stageMask);
 
         void CmdBeginRenderPass(const VezRenderPassBeginInfo* pBeginInfo);
@@ -217,22 +233,69 @@ namespace vez
         void CmdResolveImage(Image* pSrcImage, Image* pDstImage, uint32_t regionCount, const VezImageResolve* pRegions);
         void CmdSetEvent(VkEvent event, VkPipelineStageFlags stageMask);
         void CmdResetEvent(VkEvent event, VkPipelineStageFlags stageMask);
+        void CmdExecuteCommands(uint32_t commandBufferCount, CommandBuffer** ppCommandBuffers);
 
     private:
+        template <typename T>
+        T* AllocatePacket(CommandID id, uint64_t dataSize = 0)
+        {
+            return WriteCommandPacket<T>(m_stream, id, dataSize);
+        }
+
+        void OptimizeStream();
+        void BuildTimeline();
+        void OptimizeTimeline();
+        void SplitPipelineBarriers();
+        VkDrawIndexedIndirectCommand* MapIndirectBuffer(uint32_t drawCount);
+        void ReleasePreviousRecording();
+        bool CompareTimelines();
         void BindDescriptorSet();
         void BindPipeline();
-        void EndSubpass();
+        void AddOutputAttachment(SubpassDesc& subpass, uint32_t location);
+        void BuildSubpassDependencies(RenderPassDesc& renderPassDesc, uint64_t endStreamPos);
 
         CommandBuffer* m_commandBuffer;
         MemoryStream m_stream;
+        MemoryStream m_timeline;
+        MemoryStream m_optimizedTimeline;
         GraphicsState m_graphicsState;
         ResourceBindings m_resourceBindings;
         PipelineBarriers m_pipelineBarriers;
         std::vector<RenderPassDesc> m_renderPasses;
         std::vector<DescriptorSetBinding> m_descriptorSetBindings;
+        std::vector<PushDescriptor> m_pushDescriptors;
         std::vector<PipelineBinding> m_pipelineBindings;
         TransientResources m_transientResources;
+        std::vector<VkDescriptorSet> m_descriptorSets;
+        std::vector<DescriptorRecord> m_descriptorRecords;
+        std::vector<VkWriteDescriptorSet> m_descriptorWrites;
+        DescriptorSetContents m_descriptorSetContents;
+        std::vector<uint64_t> m_descriptorSetResources;
+        std::unordered_map<DescriptorSetLayout*, LinearDescriptorPool*> m_transientDescriptorPools;
+        bool m_transientDescriptorSets = false;
         std::unordered_map<uint32_t, DescriptorSetLayout*> m_boundDescriptorSetLayouts;
         bool m_inRenderPass = false;
+        bool m_isSecondary = false;
+        bool m_executesSecondaryCommandBuffers = false;
+        VkResult m_recordingResult = VK_SUCCESS;
+        std::vector<BindPipelinePacket*> m_unresolvedPipelinePackets;
+        std::vector<bool> m_removedPackets;
+        std::vector<VkBufferCopy> m_copyRegions;
+        uint32_t m_indexedDrawCount = 0;
+        bool m_mergeDraws = false;
+        bool m_splitBarriers = false;
+        Buffer* m_indirectBuffer = nullptr;
+        StreamOptimizationStatistics m_optimizationStatistics = {};
+
+        bool m_memoize = false;
+        bool m_timelineUnchanged = false;
+        MemoryStream m_previousTimeline;
+        TransientResources m_previousTransientResources;
+        std::vector<VkDescriptorSet> m_previousDescriptorSets;
+        std::unordered_map<DescriptorSetLayout*, LinearDescriptorPool*> m_previousTransientDescriptorPools;
+        std::vector<uint64_t> m_recordedResources;
+        std::vector<uint64_t> m_previousResources;
+        bool m_previousResourceDestroyed = false;
+        SpinLock m_previousResourcesLock;
     };    
 }
\ No newline at end of file
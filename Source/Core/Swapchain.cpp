@@ -283,11 +283,8 @@ namespace vez
             imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
             imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
             imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-            auto image = Image::CreateFromHandle(m_device, &imageCreateInfo, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, handle, nullptr);
+            auto image = Image::CreateFromHandle(m_device, &imageCreateInfo, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_UNDEFINED, handle, nullptr);
             m_images.push_back(image);
-
-            // Transition image to default layout.
-            m_device->TransitionImageLayout(m_images.back(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
         }
 
         // Return success.
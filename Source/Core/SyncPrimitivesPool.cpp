@@ -39,6 +39,10 @@ namespace vez
         // Destroy all created semaphores.
         for (auto semaphore : m_allSemaphores)
             vkDestroySemaphore(m_device->GetHandle(), semaphore, nullptr);
+
+        // Destroy all created events.
+        for (auto event : m_allEvents)
+            vkDestroyEvent(m_device->GetHandle(), event, nullptr);
     }
 
     VkResult SyncPrimitivesPool::AcquireFence(VkFence* pFence)
@@ -136,4 +140,44 @@ namespace vez
         m_semaphoreLock.Unlock();
         return result;
     }
+
+    VkResult SyncPrimitivesPool::AcquireEvent(VkEvent* pEvent)
+    {
+        VkResult result = VK_SUCCESS;
+
+        // See if there's a free event available.
+        m_eventLock.Lock();
+        if (m_availableEvents.size() > 0)
+        {
+            *pEvent = m_availableEvents.front();
+            m_availableEvents.pop();
+        }
+        // Else create a new one.
+        else
+        {
+            VkEventCreateInfo createInfo = {};
+            createInfo.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+            result = vkCreateEvent(m_device->GetHandle(), &createInfo, nullptr, pEvent);
+            if (result == VK_SUCCESS)
+                m_allEvents.emplace(*pEvent);
+        }
+        m_eventLock.Unlock();
+
+        return result;
+    }
+
+    void SyncPrimitivesPool::ReleaseEvents(uint32_t eventCount, const VkEvent* pEvents)
+    {
+        // Events are returned unsignaled so they can be waited on by the next command buffer acquiring them.
+        m_eventLock.Lock();
+        for (auto i = 0U; i < eventCount; ++i)
+        {
+            if (m_allEvents.find(pEvents[i]) != m_allEvents.end())
+            {
+                vkResetEvent(m_device->GetHandle(), pEvents[i]);
+                m_availableEvents.push(pEvents[i]);
+            }
+        }
+        m_eventLock.Unlock();
+    }
 }
\ No newline at end of file
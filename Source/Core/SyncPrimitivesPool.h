@@ -45,12 +45,17 @@ namespace vez
         void ReleaseSemaphores(uint32_t semaphoreCount, const VkSemaphore* pSemaphores);
         bool Exists(VkSemaphore semaphore);
 
+        VkResult AcquireEvent(VkEvent* pEvent);
+        void ReleaseEvents(uint32_t eventCount, const VkEvent* pEvents);
+
     private:
         Device* m_device = nullptr;
         std::set<VkFence> m_allFences;
         std::set<VkSemaphore> m_allSemaphores;
+        std::set<VkEvent> m_allEvents;
         std::queue<VkFence> m_availableFences;
         std::queue<VkSemaphore> m_availableSemaphores;
-        SpinLock m_fenceLock, m_semaphoreLock;
+        std::queue<VkEvent> m_availableEvents;
+        SpinLock m_fenceLock, m_semaphoreLock, m_eventLock;
     };    
 }
\ No newline at end of file
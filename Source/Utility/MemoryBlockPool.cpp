@@ -0,0 +1,154 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include <algorithm>
+#include "MemoryBlockPool.h"
+
+namespace vez
+{
+    static uint64_t NextPowerOfTwo(uint64_t value)
+    {
+        uint64_t result = 1;
+        while (result < value)
+            result <<= 1ULL;
+        return result;
+    }
+
+    MemoryBlockPool::MemoryBlockPool(uint64_t minBlockSize, uint64_t maxBlockSize)
+        : m_minBlockSize(NextPowerOfTwo(minBlockSize))
+        , m_maxBlockSize(std::max(NextPowerOfTwo(maxBlockSize), NextPowerOfTwo(minBlockSize)))
+        , m_blockSize(m_minBlockSize)
+    {
+
+    }
+
+    MemoryBlockPool::~MemoryBlockPool()
+    {
+        // Any blocks still held by streams are owned by them until they are released, only free blocks are destroyed here.
+        for (auto block : m_freeBlocks)
+            delete[] block;
+    }
+
+    uint64_t MemoryBlockPool::GetBlockSize()
+    {
+        m_spinLock.Lock();
+        auto blockSize = m_blockSize;
+        m_spinLock.Unlock();
+        return blockSize;
+    }
+
+    uint8_t* MemoryBlockPool::AcquireBlock(uint64_t blockSize)
+    {
+        uint8_t* block = nullptr;
+
+        m_spinLock.Lock();
+
+        // Reuse a free block if one of the requested size is available.
+        if (blockSize == m_blockSize && !m_freeBlocks.empty())
+        {
+            block = m_freeBlocks.back();
+            m_freeBlocks.pop_back();
+            --m_statistics.freeBlockCount;
+        }
+        else
+        {
+            // Blocks are only ever allocated from the heap when the pool has been drained.
+            block = new uint8_t[blockSize];
+            ++m_statistics.allocatedBlockCount;
+            ++m_statistics.heapAllocationCount;
+            m_statistics.allocatedBytes += blockSize;
+            m_statistics.highWaterAllocatedBytes = std::max(m_statistics.highWaterAllocatedBytes, m_statistics.allocatedBytes);
+        }
+
+        // Update in use high-water mark.
+        m_statistics.inUseBytes += blockSize;
+        m_statistics.highWaterInUseBytes = std::max(m_statistics.highWaterInUseBytes, m_statistics.inUseBytes);
+
+        m_spinLock.Unlock();
+
+        return block;
+    }
+
+    void MemoryBlockPool::ReleaseBlock(uint8_t* pBlock, uint64_t blockSize)
+    {
+        m_spinLock.Lock();
+
+        m_statistics.inUseBytes -= blockSize;
+
+        // Blocks of a stale size are returned to the heap, all others are kept for reuse.
+        if (blockSize == m_blockSize)
+        {
+            m_freeBlocks.push_back(pBlock);
+            ++m_statistics.freeBlockCount;
+        }
+        else
+        {
+            delete[] pBlock;
+            --m_statistics.allocatedBlockCount;
+            m_statistics.allocatedBytes -= blockSize;
+        }
+
+        m_spinLock.Unlock();
+    }
+
+    void MemoryBlockPool::ReportStreamSize(uint64_t streamSize)
+    {
+        m_spinLock.Lock();
+
+        // Track the largest stream ever reported.
+        m_statistics.largestStreamSize = std::max(m_statistics.largestStreamSize, streamSize);
+
+        // The peak decays by 1/16th on every report so a single large stream does not pin large blocks indefinitely.
+        m_streamSizePeak = std::max(streamSize, m_streamSizePeak - (m_streamSizePeak >> 4ULL));
+
+        // Grow the block size immediately but only shrink once the peak has fallen well below it to avoid oscillation.
+        auto blockSize = std::min(std::max(NextPowerOfTwo(m_streamSizePeak), m_minBlockSize), m_maxBlockSize);
+        if (blockSize > m_blockSize || blockSize <= (m_blockSize >> 2ULL))
+        {
+            FreeUnusedBlocks();
+            m_blockSize = blockSize;
+        }
+
+        m_spinLock.Unlock();
+    }
+
+    void MemoryBlockPool::GetStatistics(MemoryBlockPoolStatistics* pStatistics)
+    {
+        m_spinLock.Lock();
+        *pStatistics = m_statistics;
+        pStatistics->blockSize = m_blockSize;
+        m_spinLock.Unlock();
+    }
+
+    void MemoryBlockPool::FreeUnusedBlocks()
+    {
+        // Free blocks of the outgoing block size will never be reused so return them to the heap.
+        for (auto block : m_freeBlocks)
+        {
+            delete[] block;
+            m_statistics.allocatedBytes -= m_blockSize;
+        }
+
+        m_statistics.allocatedBlockCount -= m_freeBlocks.size();
+        m_statistics.freeBlockCount = 0;
+        m_freeBlocks.clear();
+    }
+}
@@ -0,0 +1,77 @@
+//
+// Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Macros.h"
+#include "SpinLock.h"
+
+namespace vez
+{
+    // Snapshot of a MemoryBlockPool's current usage and high-water marks.
+    struct MemoryBlockPoolStatistics
+    {
+        uint64_t blockSize;
+        uint64_t allocatedBlockCount;
+        uint64_t freeBlockCount;
+        uint64_t allocatedBytes;
+        uint64_t inUseBytes;
+        uint64_t highWaterAllocatedBytes;
+        uint64_t highWaterInUseBytes;
+        uint64_t largestStreamSize;
+        uint64_t heapAllocationCount;
+    };
+
+    // Thread-safe pool of fixed size memory blocks shared by all MemoryStream instances of a device.
+    // Blocks are acquired while a stream is being written to and returned when the stream is released.
+    // The pool's block size adapts to the decaying peak of reported stream sizes so that typical streams fit within a single block.
+    // Free blocks are only retained for the current block size so steady state recording never touches the heap.
+    class MemoryBlockPool
+    {
+    public:
+        MemoryBlockPool(uint64_t minBlockSize = KILOBYTES(64), uint64_t maxBlockSize = MEGABYTES(8));
+
+        ~MemoryBlockPool();
+
+        uint64_t GetBlockSize();
+
+        uint8_t* AcquireBlock(uint64_t blockSize);
+
+        void ReleaseBlock(uint8_t* pBlock, uint64_t blockSize);
+
+        void ReportStreamSize(uint64_t streamSize);
+
+        void GetStatistics(MemoryBlockPoolStatistics* pStatistics);
+
+    private:
+        void FreeUnusedBlocks();
+
+        SpinLock m_spinLock;
+        uint64_t m_minBlockSize;
+        uint64_t m_maxBlockSize;
+        uint64_t m_blockSize;
+        uint64_t m_streamSizePeak = 0;
+        std::vector<uint8_t*> m_freeBlocks;
+        MemoryBlockPoolStatistics m_statistics = {};
+    };
+}
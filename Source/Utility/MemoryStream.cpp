@@ -20,8 +20,8 @@
 // THE SOFTWARE.
 //
 #include <cstring>
-#include <cstdlib>
-#include <cmath>
+#include <algorithm>
+#include "MemoryBlockPool.h"
 #include "MemoryStream.h"
 
 namespace vez
@@ -32,24 +32,41 @@ namespace vez
         AllocateNewBlock(4);
     }
 
+    MemoryStream::MemoryStream(MemoryBlockPool* pBlockPool)
+        : m_blockPool(pBlockPool)
+        , m_blockSize(pBlockPool->GetBlockSize())
+    {
+        // Blocks are not taken from the pool until the stream is first written to.
+    }
+
+    MemoryStream::~MemoryStream()
+    {
+        Release();
+    }
+
     void MemoryStream::Read(void* pData, uint64_t size)
     {
         if (size == 0)
             return;
 
-        if (m_blocks.size() == 0)
+        if (m_readBlock >= m_blocks.size())
             return;
 
-        if (m_readBlock->readAddr + size > m_readBlock->writeAddr)
+        if (m_blocks[m_readBlock].readAddr + size > m_blocks[m_readBlock].writeAddr)
         {
-            if (++m_readBlock == m_blocks.end())
+            // Blocks past the write block only hold data from a previous pass over the stream.
+            if (m_readBlock >= m_writeBlock)
+            {
+                m_readBlock = m_blocks.size();
                 return;
-            else
-                m_readBlock->readAddr = 0;
+            }
+
+            m_blocks[++m_readBlock].readAddr = 0;
         }
 
-        memcpy(pData, &m_readBlock->allocation[m_readBlock->readAddr], size);
-        m_readBlock->readAddr += size;
+        auto& block = m_blocks[m_readBlock];
+        memcpy(pData, &block.allocation[block.readAddr], size);
+        block.readAddr += size;
     }
 
     void MemoryStream::Write(const void* pData, uint64_t size)
@@ -59,97 +76,84 @@ namespace vez
 
         AllocateNewBlock(size);
 
-        if (m_writeBlock->writeAddr + size > m_writeBlock->allocation.size())
-        {
-            ++m_writeBlock;
-            m_writeBlock->writeAddr = 0;
-        }
-
-        memcpy(&m_writeBlock->allocation[m_writeBlock->writeAddr], pData, size);
-        m_writeBlock->writeAddr += size;
+        auto& block = m_blocks[m_writeBlock];
+        memcpy(&block.allocation[block.writeAddr], pData, size);
+        block.writeAddr += size;
     }
 
     bool MemoryStream::EndOfStream()
     {
-        return (m_blocks.size() == 0 || m_readBlock == m_blocks.end());
+        return (m_readBlock >= m_blocks.size());
     }
 
     void MemoryStream::Reset()
     {
-        for (auto block : m_blocks)
+        // Rewind every block while keeping their allocations.
+        for (auto& block : m_blocks)
         {
             block.readAddr = 0;
             block.writeAddr = 0;
         }
 
-        m_readBlock = m_blocks.begin();
-        m_writeBlock = m_blocks.begin();
+        m_readBlock = 0;
+        m_writeBlock = 0;
+    }
+
+    void MemoryStream::Release()
+    {
+        // Let the pool adapt its block size to the amount of data written, then return all blocks.
+        if (m_blockPool && !m_blocks.empty())
+            m_blockPool->ReportStreamSize(TellP());
+
+        for (auto& block : m_blocks)
+            ReleaseBlock(block);
+
+        // Clearing the vector retains its capacity so subsequent writes do not reallocate it.
+        m_blocks.clear();
+        m_readBlock = 0;
+        m_writeBlock = 0;
+    }
+
+    void MemoryStream::Swap(MemoryStream& other)
+    {
+        std::swap(m_blockPool, other.m_blockPool);
+        std::swap(m_blockSize, other.m_blockSize);
+        std::swap(m_blocks, other.m_blocks);
+        std::swap(m_readBlock, other.m_readBlock);
+        std::swap(m_writeBlock, other.m_writeBlock);
     }
 
     void MemoryStream::SeekG(uint64_t pos)
     {
-        auto blockIndex = static_cast<uint32_t>(floor(pos / m_blockSize));
-        blockIndex = std::min(blockIndex, static_cast<uint32_t>(m_blocks.size() - 1));
-        m_readBlock = m_blocks.begin();
-        std::advance(m_readBlock, blockIndex);
-        m_readBlock->readAddr = pos % m_blockSize;
+        if (m_blocks.empty())
+            return;
+
+        m_readBlock = FindBlock(pos);
+        m_blocks[m_readBlock].readAddr = std::min(pos - m_blocks[m_readBlock].offset, m_blocks[m_readBlock].size);
     }
 
     void MemoryStream::SeekG(int64_t offset, SeekDir dir)
     {
-        if (m_blocks.size() == 0)
+        if (m_blocks.empty())
             return;
 
         switch (dir)
         {
         case BEG:
         {
-            SeekG(static_cast<uint64_t>(offset));
+            SeekG(static_cast<uint64_t>(std::max<int64_t>(offset, 0)));
             break;
         }
 
         case CUR:
         {
-            if (offset > 0)
-            {
-                while (std::abs(offset) >= static_cast<int64_t>(m_blockSize) && m_readBlock != m_blocks.end())
-                {
-                    offset -= m_blockSize;
-                    ++m_readBlock;
-                }
-
-                if (m_readBlock == m_blocks.end())
-                {
-                    --m_readBlock;
-                    m_readBlock->readAddr = m_blockSize;
-                }
-                else
-                {
-                    m_readBlock->readAddr = offset;
-                }
-            }
-            else if (offset < 0)
-            {
-                while (std::abs(offset) >= static_cast<int64_t>(m_blockSize) && m_readBlock != m_blocks.begin())
-                {
-                    offset -= m_blockSize;
-                    --m_readBlock;
-                }
-
-                if (offset >= static_cast<int64_t>(m_blockSize))
-                {
-                    m_readBlock->readAddr = 0;
-                }
-                else
-                {
-                    m_readBlock->readAddr = offset;
-                }
-            }
+            SeekG(static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(TellG()) + offset, 0)));
             break;
         }
 
         case END:
         {
+            SeekG(static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(TellP()) + offset, 0)));
             break;
         }
         }
@@ -157,87 +161,49 @@ namespace vez
 
     uint64_t MemoryStream::TellG()
     {
-        if (m_blocks.size() == 0)
+        if (m_blocks.empty())
             return 0;
 
-        if (m_readBlock == m_blocks.end())
-            return m_blocks.size() * m_blockSize;
+        if (m_readBlock >= m_blocks.size())
+            return m_blocks[m_writeBlock].offset + m_blocks[m_writeBlock].size;
 
-        return m_readBlock->readAddr + std::distance(m_blocks.begin(), m_readBlock) * m_blockSize;
+        return m_blocks[m_readBlock].offset + m_blocks[m_readBlock].readAddr;
     }
 
     uint64_t MemoryStream::TellP()
     {
-        if (m_blocks.size() == 0)
+        if (m_blocks.empty())
             return 0;
 
-        return m_writeBlock->writeAddr + std::distance(m_blocks.begin(), m_writeBlock) * m_blockSize;
+        return m_blocks[m_writeBlock].offset + m_blocks[m_writeBlock].writeAddr;
     }
 
     void MemoryStream::SeekP(uint64_t pos)
     {
-        auto blockIndex = static_cast<uint32_t>(floor(pos / m_blockSize));
-        blockIndex = std::min(blockIndex, static_cast<uint32_t>(m_blocks.size() - 1));
-        m_writeBlock = m_blocks.begin();
-        std::advance(m_writeBlock, blockIndex);
-        m_writeBlock->writeAddr = pos % m_blockSize;
+        if (m_blocks.empty())
+            return;
+
+        m_writeBlock = FindBlock(pos);
+        m_blocks[m_writeBlock].writeAddr = std::min(pos - m_blocks[m_writeBlock].offset, m_blocks[m_writeBlock].size);
     }
 
     void MemoryStream::SeekP(int64_t offset, SeekDir dir)
     {
-        if (m_blocks.size() == 0)
+        if (m_blocks.empty())
             return;
 
         switch (dir)
         {
         case BEG:
         {
-            SeekP(static_cast<uint64_t>(offset));
+            SeekP(static_cast<uint64_t>(std::max<int64_t>(offset, 0)));
             break;
         }
 
         case CUR:
-        {
-            if (offset > 0)
-            {
-                while (std::abs(offset) >= static_cast<int64_t>(m_blockSize) && m_writeBlock != m_blocks.end())
-                {
-                    offset -= m_blockSize;
-                    ++m_writeBlock;
-                }
-
-                if (m_writeBlock == m_blocks.end())
-                {
-                    --m_writeBlock;
-                    m_writeBlock->writeAddr = m_blockSize;
-                }
-                else
-                {
-                    m_writeBlock->writeAddr = offset;
-                }
-            }
-            else if (offset < 0)
-            {
-                while (std::abs(offset) >= static_cast<int64_t>(m_blockSize) && m_writeBlock != m_blocks.begin())
-                {
-                    offset += m_blockSize;
-                    --m_writeBlock;
-                }
-
-                if (offset >= static_cast<int64_t>(m_blockSize))
-                {
-                    m_writeBlock->writeAddr = 0;
-                }
-                else
-                {
-                    m_writeBlock->writeAddr -= offset;
-                }
-            }
-            break;
-        }
-
         case END:
         {
+            SeekP(static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(TellP()) + offset, 0)));
             break;
         }
         }
@@ -245,14 +211,63 @@ namespace vez
 
     void MemoryStream::AllocateNewBlock(uint64_t size)
     {
-        if (m_blocks.size() == 0 || m_writeBlock->allocation.size() - m_writeBlock->writeAddr < size)
+        // First write since the stream was created or released.
+        if (m_blocks.empty())
         {
-            m_blocks.push_back({ std::vector<uint8_t>(m_blockSize), 0, 0 });
-            m_writeBlock = m_blocks.end();
-            --m_writeBlock;
+            if (m_blockPool)
+                m_blockSize = m_blockPool->GetBlockSize();
+
+            m_blocks.push_back(AcquireBlock(size, 0));
+            m_readBlock = 0;
+            m_writeBlock = 0;
+            return;
+        }
 
-            if (m_blocks.size() == 1)
-                m_readBlock = m_blocks.begin();
+        // Current write block still has room.
+        auto& writeBlock = m_blocks[m_writeBlock];
+        if (writeBlock.size - writeBlock.writeAddr >= size)
+            return;
+
+        // Move onto the next block, reusing one from a previous pass over the stream if it is large enough.
+        auto offset = writeBlock.offset + writeBlock.size;
+        if (++m_writeBlock == m_blocks.size())
+        {
+            m_blocks.push_back(AcquireBlock(size, offset));
         }
+        else if (m_blocks[m_writeBlock].size < size)
+        {
+            ReleaseBlock(m_blocks[m_writeBlock]);
+            m_blocks[m_writeBlock] = AcquireBlock(size, offset);
+        }
+
+        m_blocks[m_writeBlock].offset = offset;
+        m_blocks[m_writeBlock].readAddr = 0;
+        m_blocks[m_writeBlock].writeAddr = 0;
+    }
+
+    MemoryStream::MemoryBlock MemoryStream::AcquireBlock(uint64_t size, uint64_t offset)
+    {
+        // Writes larger than the block size get a dedicated block, which the pool returns to the heap once released.
+        auto blockSize = std::max(size, m_blockSize);
+        auto allocation = m_blockPool ? m_blockPool->AcquireBlock(blockSize) : new uint8_t[blockSize];
+        return { allocation, blockSize, offset, 0, 0 };
+    }
+
+    void MemoryStream::ReleaseBlock(const MemoryBlock& block)
+    {
+        if (m_blockPool)
+            m_blockPool->ReleaseBlock(block.allocation, block.size);
+        else
+            delete[] block.allocation;
+    }
+
+    size_t MemoryStream::FindBlock(uint64_t pos) const
+    {
+        // Streams only span a few blocks, so they are searched backwards from the write block.
+        auto blockIndex = m_writeBlock;
+        while (blockIndex > 0 && m_blocks[blockIndex].offset > pos)
+            --blockIndex;
+
+        return blockIndex;
     }
-}
\ No newline at end of file
+}
@@ -20,13 +20,13 @@
 // THE SOFTWARE.
 //
 #pragma once
-#include <algorithm>
-#include <iterator>
-#include <list>
+#include <stdint.h>
 #include <vector>
 
 namespace vez
 {
+    class MemoryBlockPool;
+
     class MemoryStream
     {
     public:
@@ -39,6 +39,10 @@ namespace vez
 
         MemoryStream(uint64_t blockSize);
 
+        MemoryStream(MemoryBlockPool* pBlockPool);
+
+        ~MemoryStream();
+
         template <typename T>
         MemoryStream& operator >> (T& value)
         {
@@ -56,22 +60,43 @@ namespace vez
         template <typename T>
         T* ReadPtr(uint64_t count = 1)
         {
-            if (m_blocks.size() == 0)
+            if (m_readBlock >= m_blocks.size())
                 return nullptr;
 
-            if (m_readBlock->readAddr + sizeof(T) * count > m_readBlock->writeAddr)
+            if (m_blocks[m_readBlock].readAddr + sizeof(T) * count > m_blocks[m_readBlock].writeAddr)
             {
-                if (++m_readBlock == m_blocks.end())
+                // Blocks past the write block only hold data from a previous pass over the stream.
+                if (m_readBlock >= m_writeBlock)
+                {
+                    m_readBlock = m_blocks.size();
                     return nullptr;
-                else
-                    m_readBlock->readAddr = 0;
+                }
+
+                m_blocks[++m_readBlock].readAddr = 0;
             }
 
-            auto ptr = reinterpret_cast<T*>(&m_readBlock->allocation[m_readBlock->readAddr]);
-            m_readBlock->readAddr += sizeof(T) * count;
+            auto& block = m_blocks[m_readBlock];
+            auto ptr = reinterpret_cast<T*>(&block.allocation[block.readAddr]);
+            block.readAddr += sizeof(T) * count;
+            return ptr;
+        }
+
+        // Reserves contiguous space for count elements at the write position so they can be filled in place.
+        // Writes larger than the block size get a dedicated block of their own size.
+        template <typename T>
+        T* WritePtr(uint64_t count = 1)
+        {
+            AllocateNewBlock(sizeof(T) * count);
+
+            auto& block = m_blocks[m_writeBlock];
+            auto ptr = reinterpret_cast<T*>(&block.allocation[block.writeAddr]);
+            block.writeAddr += sizeof(T) * count;
             return ptr;
         }
 
+        // Returns the size of the stream's blocks, the largest write that never needs a dedicated block.
+        uint64_t GetBlockSize() const { return m_blockSize; }
+
         void Read(void* pData, uint64_t size);
 
         void Write(const void* pData, uint64_t size);
@@ -80,6 +105,10 @@ namespace vez
 
         void Reset();
 
+        void Release();
+
+        void Swap(MemoryStream& other);
+
         void SeekG(uint64_t pos);
 
         void SeekG(int64_t offset, SeekDir dir);
@@ -93,18 +122,29 @@ namespace vez
         void SeekP(int64_t offset, SeekDir dir);
 
     private:
+        // Blocks hold at least the stream's block size.  The offset is the stream position of the block's first byte.
         struct MemoryBlock
         {
-            std::vector<uint8_t> allocation;
+            uint8_t* allocation;
+            uint64_t size;
+            uint64_t offset;
             uint64_t readAddr;
             uint64_t writeAddr;
         };
 
         void AllocateNewBlock(uint64_t size);
 
+        MemoryBlock AcquireBlock(uint64_t size, uint64_t offset);
+
+        void ReleaseBlock(const MemoryBlock& block);
+
+        // Returns the index of the block containing the given stream position.
+        size_t FindBlock(uint64_t pos) const;
+
+        MemoryBlockPool* m_blockPool = nullptr;
         uint64_t m_blockSize;
-        std::list<MemoryBlock> m_blocks;
-        std::list<MemoryBlock>::iterator m_readBlock;
-        std::list<MemoryBlock>::iterator m_writeBlock;
+        std::vector<MemoryBlock> m_blocks;
+        size_t m_readBlock = 0;
+        size_t m_writeBlock = 0;
     };
-}
\ No newline at end of file
+}
@@ -124,6 +124,9 @@ namespace vez
         // Cancels all pending tasks and waits for threads to complete current tasks.
         void Abort();
 
+        // Returns the number of worker threads.
+        uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
     private:
         std::stack<std::thread> m_threads;
         ThreadSafeQueue<std::packaged_task<void()>> m_tasks;
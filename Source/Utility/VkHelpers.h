@@ -30,6 +30,43 @@ namespace vez
 {
     typedef std::vector<uint32_t> DescriptorSetLayoutHash;
 
+    // Host-side record of a single descriptor.  A descriptor set's records are packed in binding order, one per array element of each binding,
+    // matching the layout's descriptor update template.
+    union DescriptorRecord
+    {
+        VkDescriptorImageInfo imageInfo;
+        VkDescriptorBufferInfo bufferInfo;
+        VkBufferView texelBufferView;
+    };
+
+    // Push descriptor layouts hold no more descriptors than every VK_KHR_push_descriptor implementation can push.
+    static const uint32_t MAX_PUSH_DESCRIPTORS = 32;
+
+    // Pipeline stage masks tracked for automated pipeline barriers.  The lower 32 bits hold the legacy stage bits, while the copy, resolve,
+    // blit and clear stages above them match VK_KHR_synchronization2's extended stage bits and fold back into the transfer stage otherwise.
+    typedef uint64_t PipelineStageFlags;
+
+    static const PipelineStageFlags PIPELINE_STAGE_COPY_BIT = 0x100000000ULL;
+    static const PipelineStageFlags PIPELINE_STAGE_RESOLVE_BIT = 0x200000000ULL;
+    static const PipelineStageFlags PIPELINE_STAGE_BLIT_BIT = 0x400000000ULL;
+    static const PipelineStageFlags PIPELINE_STAGE_CLEAR_BIT = 0x800000000ULL;
+
+    // Source and destination stages of a single buffer or image memory barrier.
+    struct MemoryBarrierStages
+    {
+        PipelineStageFlags srcStageMask;
+        PipelineStageFlags dstStageMask;
+    };
+
+    inline VkPipelineStageFlags GetLegacyStageMask(PipelineStageFlags stageMask)
+    {
+        auto legacyStageMask = static_cast<VkPipelineStageFlags>(stageMask & 0xFFFFFFFFULL);
+        if (stageMask & (PIPELINE_STAGE_COPY_BIT | PIPELINE_STAGE_RESOLVE_BIT | PIPELINE_STAGE_BLIT_BIT | PIPELINE_STAGE_CLEAR_BIT))
+            legacyStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+        return legacyStageMask;
+    }
+
     inline bool IsDepthStencilFormat(VkFormat format)
     {
         switch (format)
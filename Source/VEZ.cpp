@@ -615,7 +615,11 @@ void VKAPI_CALL vezDestroySampler(VkDevice device, VkSampler sampler)
     // Lookup object handle.
     auto deviceImpl = vez::ObjectLookup::GetObjectImpl(device);
     if (deviceImpl)
+    {
+        // Cached descriptor sets and memoized recordings must not outlive the sampler.
+        deviceImpl->InvalidateResource(reinterpret_cast<uint64_t>(sampler));
         vkDestroySampler(deviceImpl->GetHandle(), sampler, nullptr);
+    }
 }
 
 VkResult VKAPI_CALL vezCreateBuffer(VkDevice device, VezMemoryFlags memFlags, const VezBufferCreateInfo* pCreateInfo, VkBuffer* pBuffer)
@@ -879,7 +883,7 @@ VkResult VKAPI_CALL vezAllocateCommandBuffers(VkDevice device, const VezCommandB
 
     // Allocate the command buffers.
     std::vector<vez::CommandBuffer*> commandBuffers(pAllocateInfo->commandBufferCount);
-    auto result = deviceImpl->AllocateCommandBuffers(queueImpl, pAllocateInfo->pNext, pAllocateInfo->commandBufferCount, commandBuffers.data());
+    auto result = deviceImpl->AllocateCommandBuffers(queueImpl, pAllocateInfo->pNext, pAllocateInfo->level, pAllocateInfo->commandBufferCount, commandBuffers.data());
     if (result != VK_SUCCESS)
         return result;
 
@@ -1323,4 +1327,19 @@ void VKAPI_CALL vezCmdSetEvent(VkEvent event, VkPipelineStageFlags stageMask)
 void VKAPI_CALL vezCmdResetEvent(VkEvent event, VkPipelineStageFlags stageMask)
 {
     s_pActiveCommandBuffer->CmdResetEvent(event, stageMask);
+}
+
+void VKAPI_CALL vezCmdExecuteCommands(uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers)
+{
+    // Lookup CommandBuffer object handles.
+    std::vector<vez::CommandBuffer*> commandBuffers;
+    for (auto i = 0U; i < commandBufferCount; ++i)
+    {
+        auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(pCommandBuffers[i]);
+        if (cmdBufferImpl)
+            commandBuffers.push_back(cmdBufferImpl);
+    }
+
+    // Execute the secondary command buffers.
+    s_pActiveCommandBuffer->CmdExecuteCommands(static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
 }
\ No newline at end of file
@@ -154,6 +154,7 @@ typedef struct VezCommandBufferAllocateInfo
     const void* pNext;
     VkQueue queue;
     uint32_t commandBufferCount;
+    VkCommandBufferLevel level;
 } VezCommandBufferAllocateInfo;
 
 typedef struct VezShaderModuleCreateInfo
@@ -414,6 +415,7 @@ typedef struct VezRenderPassBeginInfo
     VezFramebuffer framebuffer;
     uint32_t attachmentCount;
     const VezAttachmentInfo* pAttachments;
+    VkBool32 orderIndependentDraws;
 } VezRenderPassBeginInfo;
 
 typedef struct VezBufferCopy
@@ -622,6 +624,7 @@ VKAPI_ATTR void VKAPI_CALL vezCmdClearAttachments(uint32_t attachmentCount, cons
 VKAPI_ATTR void VKAPI_CALL vezCmdResolveImage(VkImage srcImage, VkImage dstImage, uint32_t regionCount, const VezImageResolve* pRegions);
 VKAPI_ATTR void VKAPI_CALL vezCmdSetEvent(VkEvent event, VkPipelineStageFlags stageMask);
 VKAPI_ATTR void VKAPI_CALL vezCmdResetEvent(VkEvent event, VkPipelineStageFlags stageMask);
+VKAPI_ATTR void VKAPI_CALL vezCmdExecuteCommands(uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers);
 
 #ifdef __cplusplus
 }
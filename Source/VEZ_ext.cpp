@@ -22,6 +22,7 @@
 #include <vector>
 #include "VEZ_ext.h"
 #include "Utility/ObjectLookup.h"
+#include "Utility/MemoryBlockPool.h"
 #include "Core/Device.h"
 #include "Core/CommandBuffer.h"
 #include "Core/Image.h"
@@ -38,7 +39,9 @@ VkResult VKAPI_CALL vezImportVkImage(VkDevice device, VkImage image, VkFormat fo
     createInfo.format = format;
     createInfo.samples = samples;
     createInfo.extent = extent;    
-    auto imageImpl = vez::Image::CreateFromHandle(deviceImpl, &createInfo, imageLayout, image, VK_NULL_HANDLE);
+    createInfo.mipLevels = 1;
+    createInfo.arrayLayers = 1;
+    auto imageImpl = vez::Image::CreateFromHandle(deviceImpl, &createInfo, imageLayout, imageLayout, image, VK_NULL_HANDLE);
 
     // Add to ObjectLookup.
     vez::ObjectLookup::AddObjectImpl(image, imageImpl);
@@ -71,8 +74,153 @@ VkResult VKAPI_CALL vezGetImageLayout(VkDevice device, VkImage image, VkImageLay
     if (!imageImpl)
         return VK_INCOMPLETE;
 
-    // Get default image layout.
-    *pImageLayout = imageImpl->GetDefaultImageLayout();
+    // Only the layout of the image's first subresource is reported.
+    *pImageLayout = imageImpl->GetResidentLayout(0, 0);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezGetImageSubresourceLayout(VkDevice device, VkImage image, uint32_t mipLevel, uint32_t arrayLayer, VkImageLayout* pImageLayout)
+{
+    // Lookup device object handle.
+    auto deviceImpl = vez::ObjectLookup::GetObjectImpl(device);
+    if (!deviceImpl)
+        return VK_INCOMPLETE;
+
+    // Lookup image object handle.
+    auto imageImpl = vez::ObjectLookup::GetObjectImpl(image);
+    if (!imageImpl)
+        return VK_INCOMPLETE;
+
+    // Validate the subresource.
+    if (mipLevel >= imageImpl->GetCreateInfo().mipLevels || arrayLayer >= imageImpl->GetCreateInfo().arrayLayers)
+        return VK_INCOMPLETE;
+
+    // Get the layout the subresource is left in by the submitted command buffers.
+    *pImageLayout = imageImpl->GetResidentLayout(mipLevel, arrayLayer);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezGetStreamBlockPoolStatistics(VkDevice device, VezStreamBlockPoolStatistics* pStatistics)
+{
+    // Lookup device object handle.
+    auto deviceImpl = vez::ObjectLookup::GetObjectImpl(device);
+    if (!deviceImpl)
+        return VK_INCOMPLETE;
+
+    // Get current usage and high-water marks of the device's command stream block pool.
+    vez::MemoryBlockPoolStatistics statistics = {};
+    deviceImpl->GetStreamBlockPool()->GetStatistics(&statistics);
+    pStatistics->blockSize = statistics.blockSize;
+    pStatistics->allocatedBlockCount = statistics.allocatedBlockCount;
+    pStatistics->freeBlockCount = statistics.freeBlockCount;
+    pStatistics->allocatedBytes = statistics.allocatedBytes;
+    pStatistics->inUseBytes = statistics.inUseBytes;
+    pStatistics->highWaterAllocatedBytes = statistics.highWaterAllocatedBytes;
+    pStatistics->highWaterInUseBytes = statistics.highWaterInUseBytes;
+    pStatistics->largestStreamSize = statistics.largestStreamSize;
+    pStatistics->heapAllocationCount = statistics.heapAllocationCount;
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezCommandBufferSetAsyncDecode(VkCommandBuffer commandBuffer, VkBool32 enabled)
+{
+    // Lookup command buffer object handle.
+    auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(commandBuffer);
+    if (!cmdBufferImpl)
+        return VK_INCOMPLETE;
+
+    // Subsequent calls to vezEndCommandBuffer queue the command stream's decode onto the instance's thread pool.
+    cmdBufferImpl->SetAsyncDecode(enabled == VK_TRUE);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezCommandBufferSetMemoization(VkCommandBuffer commandBuffer, VkBool32 enabled)
+{
+    // Lookup command buffer object handle.
+    auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(commandBuffer);
+    if (!cmdBufferImpl)
+        return VK_INCOMPLETE;
+
+    // Subsequent recordings reuse identical descriptor sets from the previous recording, and skip decoding entirely when the
+    // resulting command stream matches the one previously decoded into the native command buffer.
+    // Destroying a resource the previous recording referenced, or splitting barriers, makes the next recording decode again.
+    cmdBufferImpl->SetMemoization(enabled == VK_TRUE);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezCommandBufferSetDrawMerging(VkCommandBuffer commandBuffer, VkBool32 enabled)
+{
+    // Lookup command buffer object handle.
+    auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(commandBuffer);
+    if (!cmdBufferImpl)
+        return VK_INCOMPLETE;
+
+    // Subsequent recordings merge consecutive indexed draws sharing the same state into a single indirect draw when the
+    // device supports multiDrawIndirect.
+    cmdBufferImpl->SetDrawMerging(enabled == VK_TRUE);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezCommandBufferSetSplitBarriers(VkCommandBuffer commandBuffer, VkBool32 enabled)
+{
+    // Lookup command buffer object handle.
+    auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(commandBuffer);
+    if (!cmdBufferImpl)
+        return VK_INCOMPLETE;
+
+    // Subsequent recordings replace pipeline barriers outside of render passes with events set right after the accesses they wait on
+    // when enough independent work is recorded in between.
+    cmdBufferImpl->SetSplitBarriers(enabled == VK_TRUE);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezCommandBufferSetTransientDescriptorSets(VkCommandBuffer commandBuffer, VkBool32 enabled)
+{
+    // Lookup command buffer object handle.
+    auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(commandBuffer);
+    if (!cmdBufferImpl)
+        return VK_INCOMPLETE;
+
+    // Subsequent recordings bump allocate their descriptor sets from linear descriptor pools owned by the command buffer, reset in bulk
+    // when it is recorded again, rather than sharing them with other command buffers through the device's descriptor set cache.
+    cmdBufferImpl->SetTransientDescriptorSets(enabled == VK_TRUE);
+
+    // Return success.
+    return VK_SUCCESS;
+}
+
+VkResult VKAPI_CALL vezGetCommandBufferOptimizationStatistics(VkCommandBuffer commandBuffer, VezCommandBufferOptimizationStatistics* pStatistics)
+{
+    // Lookup command buffer object handle.
+    auto cmdBufferImpl = vez::ObjectLookup::GetObjectImpl(commandBuffer);
+    if (!cmdBufferImpl)
+        return VK_INCOMPLETE;
+
+    // Get the number of commands removed or merged when the command buffer's last recording ended.
+    const auto& statistics = cmdBufferImpl->GetStreamEncoder().GetOptimizationStatistics();
+    pStatistics->redundantStateCount = statistics.redundantStateCount;
+    pStatistics->unusedStateCount = statistics.unusedStateCount;
+    pStatistics->noOpCommandCount = statistics.noOpCommandCount;
+    pStatistics->coalescedCopyCount = statistics.coalescedCopyCount;
+    pStatistics->coalescedCopyRegionCount = statistics.coalescedCopyRegionCount;
+    pStatistics->mergedDrawCount = statistics.mergedDrawCount;
+    pStatistics->sortedDrawCount = statistics.sortedDrawCount;
+    pStatistics->splitBarrierCount = statistics.splitBarrierCount;
+    pStatistics->mergedBarrierCount = statistics.mergedBarrierCount;
 
     // Return success.
     return VK_SUCCESS;
@@ -28,12 +28,54 @@
 extern "C" {
 #endif
 
+typedef struct VezStreamBlockPoolStatistics
+{
+    uint64_t blockSize;
+    uint64_t allocatedBlockCount;
+    uint64_t freeBlockCount;
+    uint64_t allocatedBytes;
+    uint64_t inUseBytes;
+    uint64_t highWaterAllocatedBytes;
+    uint64_t highWaterInUseBytes;
+    uint64_t largestStreamSize;
+    uint64_t heapAllocationCount;
+} VezStreamBlockPoolStatistics;
+
+typedef struct VezCommandBufferOptimizationStatistics
+{
+    uint32_t redundantStateCount;
+    uint32_t unusedStateCount;
+    uint32_t noOpCommandCount;
+    uint32_t coalescedCopyCount;
+    uint32_t coalescedCopyRegionCount;
+    uint32_t mergedDrawCount;
+    uint32_t sortedDrawCount;
+    uint32_t splitBarrierCount;
+    uint32_t mergedBarrierCount;
+} VezCommandBufferOptimizationStatistics;
+
 VKAPI_ATTR VkResult VKAPI_CALL vezImportVkImage(VkDevice device, VkImage image, VkFormat format, VkExtent3D extent, VkSampleCountFlagBits samples, VkImageLayout imageLayout);
 
 VKAPI_ATTR VkResult VKAPI_CALL vezRemoveImportedVkImage(VkDevice device, VkImage image);
 
 VKAPI_ATTR VkResult VKAPI_CALL vezGetImageLayout(VkDevice device, VkImage image, VkImageLayout* pImageLayout);
 
+VKAPI_ATTR VkResult VKAPI_CALL vezGetImageSubresourceLayout(VkDevice device, VkImage image, uint32_t mipLevel, uint32_t arrayLayer, VkImageLayout* pImageLayout);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezGetStreamBlockPoolStatistics(VkDevice device, VezStreamBlockPoolStatistics* pStatistics);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezCommandBufferSetAsyncDecode(VkCommandBuffer commandBuffer, VkBool32 enabled);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezCommandBufferSetMemoization(VkCommandBuffer commandBuffer, VkBool32 enabled);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezCommandBufferSetDrawMerging(VkCommandBuffer commandBuffer, VkBool32 enabled);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezCommandBufferSetSplitBarriers(VkCommandBuffer commandBuffer, VkBool32 enabled);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezCommandBufferSetTransientDescriptorSets(VkCommandBuffer commandBuffer, VkBool32 enabled);
+
+VKAPI_ATTR VkResult VKAPI_CALL vezGetCommandBufferOptimizationStatistics(VkCommandBuffer commandBuffer, VezCommandBufferOptimizationStatistics* pStatistics);
+
 
 #ifdef __cplusplus
 }